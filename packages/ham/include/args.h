@@ -9,6 +9,7 @@
 #include <cmath>
 
 #include <text.h>
+#include "querytable.h"
 #include "tclap/CmdLine.h"
 using namespace TCLAP;
 using namespace std;
@@ -18,7 +19,9 @@ namespace ham {
 // NOTE some input is passed on the command line (global configuration), while some is passed in a csv file (stuff that depends on each (pair of) sequence(s)).
 class Args {
 public:
-  Args(int argc, const char * argv[]);
+  Args(int argc, const char * argv[], bool throw_parse_errors=false);  // if <throw_parse_errors> is set, command line errors throw an ArgException (rather than printing usage and exiting)
+  size_t ReadQueries(size_t max_queries) { return queries_.ReadQueries(max_queries); }  // replace <queries_> with the next <max_queries> rows of the input file (all of them if zero), and return how many we read
+  bool stream_queries() { return query_batch_size() > 0 && !partition() && !cache_naive_seqs(); }  // if set, we don't read any queries in the constructor, and run_algorithm() calls ReadQueries() for each batch
   // void Check();  // make sure everything's the same length (i.e. the input file had all the expected columns)
 
   string hmmdir() { return hmmdir_arg_.getValue(); }
@@ -33,9 +36,16 @@ public:
   float hamming_fraction_bound_hi() { return hamming_fraction_bound_hi_arg_.getValue(); }
   float logprob_ratio_threshold() { return logprob_ratio_threshold_arg_.getValue(); }
   float max_logprob_drop() { return max_logprob_drop_arg_.getValue(); }
+  float prune_margin() { return prune_margin_arg_.getValue(); }
   string algorithm() { return algorithm_arg_.getValue(); }
   string ambig_base() { return ambig_base_arg_.getValue(); }
   string seed_unique_id() { return seed_unique_id_arg_.getValue(); }
+  string checkpoint_file() { return checkpoint_file_arg_.getValue(); }
+  string resume_from() { return resume_from_arg_.getValue(); }
+  string existing_partition() { return existing_partition_arg_.getValue(); }
+  unsigned checkpoint_interval() { return checkpoint_interval_arg_.getValue(); }
+  string chain_kernel() { return chain_kernel_arg_.getValue(); }
+  string binary_hmms() { return binary_hmms_arg_.getValue(); }
   int debug() { return debug_arg_.getValue(); }
   int naive_hamming_cluster() { return naive_hamming_cluster_arg_.getValue(); }
   int biggest_naive_seq_cluster_to_calculate() { return biggest_naive_seq_cluster_to_calculate_arg_.getValue(); }
@@ -45,33 +55,41 @@ public:
   unsigned min_largest_cluster_size() { return min_largest_cluster_size_arg_.getValue(); }
   unsigned max_cluster_size() { return max_cluster_size_arg_.getValue(); }
   unsigned random_seed() { return random_seed_arg_.getValue(); }
+  unsigned n_threads() { return n_threads_arg_.getValue(); }
+  unsigned query_batch_size() { return query_batch_size_arg_.getValue(); }
   bool no_chunk_cache() { return no_chunk_cache_arg_.getValue(); }
+  bool no_suffix_trellis() { return no_suffix_trellis_arg_.getValue(); }
+  bool composite_vdj() { return composite_vdj_arg_.getValue(); }
+  bool prune_viterbi() { return prune_viterbi_arg_.getValue(); }
   bool partition() { return partition_arg_.getValue(); }
   bool dont_rescale_emissions() { return dont_rescale_emissions_arg_.getValue(); }
   bool cache_naive_seqs() { return cache_naive_seqs_arg_.getValue(); }
   bool cache_naive_hfracs() { return cache_naive_hfracs_arg_.getValue(); }
   bool only_cache_new_vals() { return only_cache_new_vals_arg_.getValue(); }
+  bool binary_cache() { return binary_cache_arg_.getValue(); }
+  bool binary_output() { return binary_output_arg_.getValue(); }
+  float cache_memory_budget() { return cache_memory_budget_arg_.getValue(); }
+  float serve_memory_limit() { return serve_memory_limit_arg_.getValue(); }
+  bool naive_seq_index() { return naive_seq_index_arg_.getValue(); }
+  unsigned naive_seq_index_check_every() { return naive_seq_index_check_every_arg_.getValue(); }
   bool write_logprob_for_each_partition() { return write_logprob_for_each_partition_arg_.getValue(); }
+  bool scaled_forward() { return scaled_forward_arg_.getValue(); }
+  bool check_scaled_forward() { return check_scaled_forward_arg_.getValue(); }
+  bool serve() { return serve_arg_.getValue(); }
  
   // command line arguments
-  vector<string> algo_strings_;
+  vector<string> algo_strings_, chain_kernel_strings_, binary_hmm_strings_;
   vector<int> debug_ints_;
-  ValuesConstraint<string> algo_vals_;
+  ValuesConstraint<string> algo_vals_, chain_kernel_vals_, binary_hmm_vals_;
   ValuesConstraint<int> debug_vals_;
-  ValueArg<string> hmmdir_arg_, datadir_arg_, infile_arg_, outfile_arg_, annotationfile_arg_, input_cachefname_arg_, output_cachefname_arg_, locus_arg_, algorithm_arg_, ambig_base_arg_, seed_unique_id_arg_;
-  ValueArg<float> hamming_fraction_bound_lo_arg_, hamming_fraction_bound_hi_arg_, logprob_ratio_threshold_arg_, max_logprob_drop_arg_;
+  ValueArg<string> hmmdir_arg_, datadir_arg_, infile_arg_, outfile_arg_, annotationfile_arg_, input_cachefname_arg_, output_cachefname_arg_, locus_arg_, algorithm_arg_, ambig_base_arg_, seed_unique_id_arg_, chain_kernel_arg_, binary_hmms_arg_, checkpoint_file_arg_, resume_from_arg_, existing_partition_arg_;
+  ValueArg<float> hamming_fraction_bound_lo_arg_, hamming_fraction_bound_hi_arg_, logprob_ratio_threshold_arg_, max_logprob_drop_arg_, prune_margin_arg_, cache_memory_budget_arg_, serve_memory_limit_arg_;
   ValueArg<int> debug_arg_, naive_hamming_cluster_arg_, biggest_naive_seq_cluster_to_calculate_arg_, biggest_logprob_cluster_to_calculate_arg_, n_partitions_to_write_arg_;
-  ValueArg<unsigned> n_final_clusters_arg_, min_largest_cluster_size_arg_, max_cluster_size_arg_, random_seed_arg_;
-  SwitchArg no_chunk_cache_arg_, partition_arg_, dont_rescale_emissions_arg_, cache_naive_seqs_arg_, cache_naive_hfracs_arg_, only_cache_new_vals_arg_, write_logprob_for_each_partition_arg_;
+  ValueArg<unsigned> n_final_clusters_arg_, min_largest_cluster_size_arg_, max_cluster_size_arg_, random_seed_arg_, n_threads_arg_, query_batch_size_arg_, naive_seq_index_check_every_arg_, checkpoint_interval_arg_;
+  SwitchArg no_chunk_cache_arg_, no_suffix_trellis_arg_, composite_vdj_arg_, prune_viterbi_arg_, partition_arg_, dont_rescale_emissions_arg_, cache_naive_seqs_arg_, cache_naive_hfracs_arg_, only_cache_new_vals_arg_, binary_output_arg_, binary_cache_arg_, naive_seq_index_arg_, write_logprob_for_each_partition_arg_, scaled_forward_arg_, check_scaled_forward_arg_, serve_arg_;
 
   // arguments read from csv input file
-  map<string, vector<string> > strings_;
-  map<string, vector<int> > integers_;
-  map<string, vector<double> > floats_;
-  map<string, vector<vector<string> > > str_lists_;
-  map<string, vector<vector<int> > > int_lists_;
-  map<string, vector<vector<double> > > float_lists_;
-  set<string> str_headers_, int_headers_, float_headers_, str_list_headers_, int_list_headers_, float_list_headers_;
+  QueryTable queries_;
 };
 }
 #endif
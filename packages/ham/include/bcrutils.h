@@ -10,9 +10,11 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <atomic>
 
 #include "model.h"
 #include "text.h"
+#include "outputfile.h"
 
 using namespace std;
 namespace ham {
@@ -132,27 +134,36 @@ public:
 // ----------------------------------------------------------------------------------------
 class HMMHolder {
 public:
-  HMMHolder(string hmm_dir, GermLines &gl, Track *track): hmm_dir_(hmm_dir), gl_(gl), track_(track) {}
+  // <binary_mode> is what to do with the binary (.hamb) version of each gene's yaml file (see modelfile.h): "use" it if it's there and up to date, and
+  // otherwise parse the yaml; "write" it (from the yaml) if it isn't there or is out of date; or "ignore" it and always parse the yaml
+  HMMHolder(string hmm_dir, GermLines &gl, Track *track, string binary_mode="use"): hmm_dir_(hmm_dir), gl_(gl), n_trims_(0), track_(track), binary_mode_(binary_mode) {}
   ~HMMHolder();
   Model *Get(string gene);
   Track *track() { return track_; }
-  // Rescale, within each hmm, the emission probabilities to reflect <overall_mute_freq> instead of the mute freq which was recorded in the hmm file.
-  // If <overall_mute_freq> is -INFINITY, we re-rescale them to what they were originally
-  void RescaleOverallMuteFreqs(map<string, set<string> > &only_genes, double overall_mute_freq);  // WOE BETIDE THEE WHO FORGETETH TO RE-RESET THESE
-  void UnRescaleOverallMuteFreqs(map<string, set<string> > &only_genes);
+  // Set <overlays> to the emission probabilities for each hmm in <only_genes>, rescaled to reflect <overall_mute_freq> instead of the mute freq which was
+  // recorded in the hmm file. The hmms themselves aren't modified, so they can be shared between threads.
+  void RescaledEmissions(map<string, set<string> > &only_genes, double overall_mute_freq, map<string, EmissionOverlay> &overlays);
   void CacheAll();  // read all available hmms into memory
+  size_t ApproxBytes();  // rough memory usage of the hmms we've read
+  size_t Trim(size_t max_bytes);  // drop the hmms we used longest ago until we're using no more than <max_bytes> (returns the number dropped). NOTE invalidates Model pointers from Get(), so only call it between jobs
+  size_t n_hmms() { return hmms_.size(); }
   string NameString(map<string, set<string> > *only_genes=nullptr, int max_to_print=-1);  // if more than <max_to_print> for any region, only print the number of genes for each region
 private:
+  Model *ReadModel(string yamlfname);
   string hmm_dir_;
   GermLines &gl_;
   map<string, Model*> hmms_; // map of gene name to hmm pointer
+  vector<string> read_order_;  // genes in <hmms_>, in the order we read them (until Trim() sorts it by <last_used_>)
+  map<string, atomic<unsigned> > last_used_;  // value of <n_trims_> when we last used each gene in <hmms_> (atomic, since Get() gets called from several threads at once)
+  unsigned n_trims_;  // number of calls to Trim(), i.e. jobs so far in --serve mode
   Track *track_;  // each of the models has a track... but they should all be the same, so just toss one here for easy access
+  string binary_mode_;
 };
 
 // ----------------------------------------------------------------------------------------
 class Result {
 public:
-  Result(KBounds kbounds, string locus) : total_score_(-INFINITY), no_path_(false), locus_(locus), better_kbounds_(kbounds), boundary_error_(false), could_not_expand_(false), finalized_(false) {}
+  Result(KBounds kbounds, string locus) : total_score_(-INFINITY), no_path_(false), n_pruned_ksets_(0), n_pruned_genes_(0), locus_(locus), better_kbounds_(kbounds), boundary_error_(false), could_not_expand_(false), finalized_(false) {}
   void PushBackRecoEvent(RecoEvent event) { events_.push_back(event); }
   void Finalize(GermLines &gl, map<string, double> &unsorted_per_gene_support, KSet best_kset, KBounds kbounds);
   RecoEvent &best_event() { assert(finalized_); return best_event_; }
@@ -162,6 +173,7 @@ public:
   double total_score() { return total_score_; }
   double total_score_;
   bool no_path_;
+  int n_pruned_ksets_, n_pruned_genes_;  // with --prune-viterbi, the number of k sets we skipped entirely, and of genes we skipped in the rest
 
 private:
   void check_boundaries(KSet best, KBounds kbounds);  // and if you find errors, put expanded bounds in better_[kmin,kmax]_
@@ -185,6 +197,24 @@ void StreamViterbiOutput(ofstream &ofs, RecoEvent &event, vector<Sequence*> &pse
 void StreamForwardOutput(ofstream &ofs, vector<Sequence> &seqs, double total_score, string errors);
 void StreamForwardOutput(ofstream &ofs, vector<Sequence*> &pseqs, double total_score, string errors);
 
+// ----------------------------------------------------------------------------------------
+// writes the viterbi or forward output for each query to <fname>, either as csv (with the Stream*() fcns above) or, if <binary> is set, in the
+// binary format in outputfile.h
+class AnnotationWriter {
+public:
+  AnnotationWriter(string fname, string algorithm, bool binary);
+  ~AnnotationWriter();
+  void Viterbi(RecoEvent &event, vector<Sequence> &seqs, string errors);
+  void Viterbi(RecoEvent &event, vector<Sequence*> &pseqs, string errors);
+  void Forward(vector<Sequence> &seqs, double total_score, string errors);
+  void Error(vector<Sequence> &seqs, string errors);
+  void Close();
+private:
+  string algorithm_;
+  ofstream ofs_;
+  OutputFileWriter *writer_;  // nullptr if we're writing csv
+};
+
 string SeqStr(vector<Sequence*> &pseqs, string delimiter = " ");
 string SeqStr(vector<Sequence> &seqs, string delimiter = " ");
 string SeqNameStr(vector<Sequence*> &pseqs, string delimiter = " ");
@@ -0,0 +1,138 @@
+#ifndef HAM_CACHEFILE_H
+#define HAM_CACHEFILE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <stdint.h>
+#include <math.h>
+#include <stdexcept>
+#include <cassert>
+
+#include "text.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// One line of the glomerator's cache file: the log prob, naive seq, naive hfrac and errors for a set of sequences (only some of which may be set).
+class CacheEntry {
+public:
+  CacheEntry() : has_logprob_(false), logprob_(-INFINITY), has_naive_hfrac_(false), naive_hfrac_(-INFINITY) {}
+  void Update(const CacheEntry &other);  // replace whichever values are set in <other> (like a later line for the same key in a csv cache file)
+
+  string name_;  // colon-separated unique ids
+  bool has_logprob_;
+  double logprob_;
+  string naive_seq_;  // empty if we don't have it
+  bool has_naive_hfrac_;
+  double naive_hfrac_;
+  string errors_;
+};
+
+// ----------------------------------------------------------------------------------------
+// The binary cache format, for when the csv version gets too big to copy and reparse for every process. Layout (in native byte order):
+//   - CacheFileHeader
+//   - one record for each entry: a CacheRecordHeader, then the name, naive seq, and error characters, padded to a multiple of eight bytes
+//   - the index: the offset of each record, sorted by name, so we can look things up with a binary search
+// The file is only ever read through a read-only mmap (see MappedCacheFile), and it's replaced by writing a new one and renaming it over the old one,
+// so any number of processes can read it at once. New entries go in a journal file next to it (see CacheJournal) until they're compacted
+// into the main file (CompactCacheFile()). The journal is just a CacheJournalHeader followed by records with no index.
+const char CACHE_FILE_MAGIC[8] = {'H', 'A', 'M', 'C', 'A', 'C', 'H', 'E'};
+const char CACHE_JOURNAL_MAGIC[8] = {'H', 'A', 'M', 'C', 'J', 'R', 'N', 'L'};
+const uint32_t CACHE_FILE_VERSION = 1;
+
+struct CacheFileHeader {
+  char magic_[8];
+  uint32_t version_;
+  uint32_t unused_;
+  uint64_t n_entries_;
+  uint64_t index_offset_;
+};
+
+struct CacheJournalHeader {
+  char magic_[8];
+  uint32_t version_;
+  uint32_t unused_;
+};
+
+struct CacheRecordHeader {
+  uint32_t name_length_, naive_seq_length_, errors_length_;
+  uint32_t flags_;  // bit 0: has log prob, bit 1: has naive hfrac
+  double logprob_, naive_hfrac_;
+};
+
+// ----------------------------------------------------------------------------------------
+// read-only memory map of a binary cache file
+class MappedCacheFile {
+public:
+  MappedCacheFile(string fname);
+  ~MappedCacheFile();
+  size_t n_entries() { return n_entries_; }
+  CacheEntry entry(size_t ientry);  // <ientry>th entry in name order
+  bool Find(string name, CacheEntry &entry);  // set <entry> and return true if <name> is in the file
+
+private:
+  MappedCacheFile(const MappedCacheFile&);  // (no copying the map)
+  MappedCacheFile &operator=(const MappedCacheFile&);
+  const CacheRecordHeader *record(size_t ientry);
+  string fname_;
+  const char *data_;
+  size_t length_, n_entries_;
+  const uint64_t *index_;
+};
+
+// ----------------------------------------------------------------------------------------
+// appends records to the journal for a binary cache file (creating it if it isn't there). Each Append() is one write() to a file opened with
+// O_APPEND, so several processes can append to the same journal.
+class CacheJournal {
+public:
+  CacheJournal(string cachefname);
+  ~CacheJournal();
+  void Append(const vector<CacheEntry> &entries);
+
+private:
+  CacheJournal(const CacheJournal&);
+  CacheJournal &operator=(const CacheJournal&);
+  string fname_;
+  int fd_;
+};
+
+// ----------------------------------------------------------------------------------------
+// parsed input cache files that --serve keeps between jobs, so jobs that read the same one don't each have to reparse it. A file gets reparsed if
+// it (or its journal) has changed since we read it, i.e. if its inode, size, or modification time are different.
+class CacheFileStore {
+public:
+  const vector<CacheEntry> &Entries(string fname);  // every entry in <fname> (and its journal), in the same order as ReadCacheEntries()
+  size_t ApproxBytes();
+  size_t Trim(size_t max_bytes);  // drop the files we used longest ago until we're under <max_bytes>, and return how many we dropped
+  size_t n_files() { return files_.size(); }
+
+private:
+  class StoredFile {
+  public:
+    string stamp_;  // see FileStamp()
+    size_t bytes_;
+    vector<CacheEntry> entries_;
+  };
+  string FileStamp(string fname);
+  map<string, StoredFile> files_;
+  vector<string> use_order_;  // least recently used first
+};
+
+string CacheJournalName(string cachefname);
+bool IsBinaryCacheFile(string fname);
+void ReadCsvCacheFile(string fname, function<void(CacheEntry&)> fcn);  // call <fcn> for each line (in file order, so later lines should override earlier ones)
+void ReadCacheJournal(string cachefname, function<void(CacheEntry&)> fcn);  // same, for each record in <cachefname>'s journal (nothing if there isn't one)
+void ReadCacheEntries(string fname, function<void(CacheEntry&)> fcn);  // either format, plus the journal if it's binary
+void WriteCsvCacheFile(string fname, const vector<CacheEntry> &entries);  // NOTE doesn't sort <entries>
+void WriteBinaryCacheFile(string fname, vector<CacheEntry> entries);  // writes to a temporary file and renames it, so readers never see a partial file
+vector<CacheEntry> MergedCacheEntries(string fname);  // every entry from <fname> (and its journal), with duplicate keys combined (see CacheEntry::Update())
+void CompactCacheFile(string fname);  // fold a binary cache file's journal into the main file, and remove the journal
+}
+#endif
@@ -0,0 +1,41 @@
+#ifndef HAM_CHAINKERNELS_H
+#define HAM_CHAINKERNELS_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <stdexcept>
+
+#include "compiledmodel.h"
+#include "trellispool.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Viterbi and forward kernels for one column of the chain-shaped states [chain_begin(), chain_end()) of a compiled model (see CompiledModel::DetectChain()).
+// Each has an avx2 version (four states per register) that gets used if the cpu supports it, and a scalar version that does exactly the same floating
+// point operations in the same order, so that the two give bit-identical results. The viterbi kernels also do the same operations as the general code in
+// Trellis::MiddleViterbiVals() (although since that's compiled with -Ofast the compiler is free to reorder them there, so they can differ in the last bit).
+// The forward kernels sum each state's incoming paths with one log-sum-exp (using ChainExp() and ChainLog()) rather than with a sequence of
+// AddInLogSpace() calls, so they differ from the general code by rounding.
+//
+// <chain_begin> and <chain_end> are, on input, the range of chain states that are non-zero in <previous>, and on output the same thing for <current>.
+// States outside the chain aren't touched.
+
+void SetChainKernelMode(string mode);  // "auto" (avx2 if available, otherwise scalar), "scalar", or "none" (use the general code)
+bool ChainKernelsOn();
+string ChainKernelName();  // which one we're actually using
+
+// sets <best_end_logprob> and <best_end_state> to the first chain state with the largest value of <current> plus the end transition (-INFINITY and -1 if there aren't any)
+void ChainViterbiColumn(CompiledModel *cm, const double *previous, double *current, TracebackTable *traceback_table, size_t position, vector<const double*> &emission_rows, vector<double> &emission_counts,
+                        size_t &chain_begin, size_t &chain_end, double &best_end_logprob, int &best_end_state);
+// returns the log of the sum over chain states of exp(<current> plus the end transition)
+double ChainForwardColumn(CompiledModel *cm, const double *previous, double *current, vector<const double*> &emission_rows, vector<double> &emission_counts,
+                          size_t &chain_begin, size_t &chain_end);
+
+double ChainExp(double x);  // exp(x) for x <= 0 (underflows to zero below about -708)
+double ChainLog(double x);  // log(x) for positive, normal x
+
+}
+#endif
@@ -0,0 +1,72 @@
+#ifndef HAM_CHECKPOINT_H
+#define HAM_CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <fstream>
+#include <type_traits>
+#include <stdint.h>
+#include <stdexcept>
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Binary checkpoint files for an in-progress partition run (see Glomerator::WriteCheckpoint()). The file is just a header followed by whatever the
+// glomerator writes, in native byte order, so it's only meant to be read back by the same binary on the same machine type. Containers are written
+// as their size followed by their elements.
+const char CHECKPOINT_MAGIC[8] = {'H', 'A', 'M', 'C', 'K', 'P', 'N', 'T'};
+const uint32_t CHECKPOINT_VERSION = 2;
+
+// ----------------------------------------------------------------------------------------
+// writes to a temporary file, which Close() renames to <fname>, so there's always either the previous complete checkpoint or the new one
+class CheckpointWriter {
+public:
+  CheckpointWriter(string fname);
+  ~CheckpointWriter();
+  void Close();
+
+  template<typename T> typename enable_if<is_arithmetic<T>::value>::type Write(const T &val) { ofs_.write((const char*)&val, sizeof(T)); }
+  void Write(const string &str) { Write((uint64_t)str.size()); ofs_.write(str.data(), str.size()); }
+  template<typename T1, typename T2> void Write(const pair<T1, T2> &pr) { Write(pr.first); Write(pr.second); }
+  template<typename T> void Write(const vector<T> &vec) { Write((uint64_t)vec.size()); for(auto &val : vec) Write(val); }
+  template<typename T, typename C> void Write(const set<T, C> &st) { Write((uint64_t)st.size()); for(auto &val : st) Write(val); }
+  template<typename T> void Write(const unordered_set<T> &st) { Write((uint64_t)st.size()); for(auto &val : st) Write(val); }
+  template<typename K, typename V> void Write(const map<K, V> &mp) { Write((uint64_t)mp.size()); for(auto &kv : mp) { Write(kv.first); Write(kv.second); } }
+  template<typename K, typename V> void Write(const unordered_map<K, V> &mp) { Write((uint64_t)mp.size()); for(auto &kv : mp) { Write(kv.first); Write(kv.second); } }
+
+private:
+  CheckpointWriter(const CheckpointWriter&);
+  CheckpointWriter &operator=(const CheckpointWriter&);
+  string fname_, tmpfname_;
+  ofstream ofs_;
+};
+
+// ----------------------------------------------------------------------------------------
+// NOTE reading into a set or map clears it first, but keeps its comparator (so Partitions stay attached to their registry)
+class CheckpointReader {
+public:
+  CheckpointReader(string fname);
+  void Check();  // throw if we've run off the end of the file
+  void Close();  // make sure we've gotten to the end of what the writer wrote
+
+  template<typename T> typename enable_if<is_arithmetic<T>::value>::type Read(T &val) { ifs_.read((char*)&val, sizeof(T)); Check(); }
+  void Read(string &str) { str.resize(ReadSize()); if(str.size() > 0) ifs_.read(&str[0], str.size()); Check(); }
+  template<typename T1, typename T2> void Read(pair<T1, T2> &pr) { Read(pr.first); Read(pr.second); }
+  template<typename T> void Read(vector<T> &vec) { vec.resize(ReadSize()); for(auto &val : vec) Read(val); }
+  template<typename T, typename C> void Read(set<T, C> &st) { st.clear(); for(size_t n=ReadSize(); n>0; --n) { T val; Read(val); st.insert(val); } }
+  template<typename T> void Read(unordered_set<T> &st) { st.clear(); size_t n(ReadSize()); st.reserve(n); for( ; n>0; --n) { T val; Read(val); st.insert(val); } }
+  template<typename K, typename V> void Read(map<K, V> &mp) { mp.clear(); for(size_t n=ReadSize(); n>0; --n) { K key; Read(key); Read(mp[key]); } }
+  template<typename K, typename V> void Read(unordered_map<K, V> &mp) { mp.clear(); size_t n(ReadSize()); mp.reserve(n); for( ; n>0; --n) { K key; Read(key); Read(mp[key]); } }
+  size_t ReadSize() { uint64_t size; Read(size); return size; }
+
+private:
+  string fname_;
+  ifstream ifs_;
+};
+}
+#endif
@@ -2,37 +2,62 @@
 #define HAM_CLUSTERPATH_H
 
 #include <set>
-#include <deque>
+#include <vector>
+#include <functional>
 #include <string>
 #include <cmath>
 #include <iostream>
 #include <stdexcept>
 
 #include "text.h"
+#include "clusterregistry.h"
+#include "checkpoint.h"
 
 using namespace std;
 namespace ham {
 
-typedef set<string> Partition;
+typedef set<ClusterId, ClusterNameLess> Partition;  // NOTE construct with ClusterNameLess(&registry) (or copy from another Partition)
 
 // ----------------------------------------------------------------------------------------
-class ClusterPath {  // sequence of gradually coalescing partitions, with associated info
+// one merge step: <parent_a_> and <parent_b_> were merged to make <merged_>
+struct MergeEvent {
+  MergeEvent(ClusterId parent_a, ClusterId parent_b, ClusterId merged) : parent_a_(parent_a), parent_b_(parent_b), merged_(merged) {}
+  ClusterId parent_a_, parent_b_, merged_;
+};
+
+// ----------------------------------------------------------------------------------------
+// Sequence of gradually coalescing partitions, with associated info. Rather than a copy of every partition, we keep the initial partition and a
+// log of the merges, plus the current partition (which we update in place), so each merge step is O(log n) rather than O(n). Earlier partitions
+// get reconstructed when we need them (see GetPartition() and ForEachPartition()). Partitions are indexed from zero (the initial partition) to
+// n_partitions() - 1 (the current one).
+class ClusterPath {
 public:
   ClusterPath() {}
   ClusterPath(Partition initial_partition, double initial_logprob=-INFINITY);
-  void AddPartition(Partition partition, double logprob, size_t n_max_partitions=-1);  // , double max_drop);
+  void AddMerge(ClusterId parent_a, ClusterId parent_b, ClusterId merged, double logprob);
   // int PotentialNumberOfParents(Partition &partition, bool debug=false);  // number of partitions from which we could have arrived at this partition (i.e. number of ways to split it)
-  Partition &CurrentPartition() { return partitions_.back(); }  // return current (most recent) partition
+  Partition &CurrentPartition() { return current_partition_; }  // return current (most recent) partition
   double CurrentLogProb() { return logprobs_.back(); }  // return logprob of current (most recent partition)
-  deque<Partition> &partitions() { return partitions_; }
+  size_t n_partitions() { return logprobs_.size(); }
+  Partition GetPartition(size_t ipart);  // reconstruct the <ipart>th partition
+  void ForEachPartition(size_t istart, function<void(size_t, Partition&)> fcn);  // call <fcn> for each partition from <istart> to the current one (reconstructing only the first one)
+  set<ClusterId> ClustersSince(size_t istart);  // every cluster that's in any of the partitions from <istart> on
+  vector<MergeEvent> &merges() { return merges_; }
   size_t i_best() { return i_best_; }
   void set_logprob(size_t il, double logprob);
-  deque<double> &logprobs() { return logprobs_; }
+  double logprob(size_t il) { return logprobs_.at(il); }
+  void WriteCheckpoint(CheckpointWriter &ckpt);
+  void ReadCheckpoint(CheckpointReader &ckpt);  // NOTE the path has to have already been constructed with a Partition attached to the right registry
   bool finished_;
   int initial_path_index_;  // index (in the batch of last glomeration steps) of the path which gave rise to this path [if you have to ask, you really don't want to know]
 private:
-  deque<Partition> partitions_;
-  deque<double> logprobs_;
+  void ApplyMerge(Partition &partition, const MergeEvent &merge);
+  void UndoMerge(Partition &partition, const MergeEvent &merge);
+
+  Partition initial_partition_;
+  Partition current_partition_;
+  vector<MergeEvent> merges_;  // <merges_[i]> takes partition i to partition i + 1
+  vector<double> logprobs_;
 
   double max_log_prob_of_partition_;
   // Partition best_partition_;
@@ -0,0 +1,75 @@
+#ifndef HAM_CLUSTERREGISTRY_H
+#define HAM_CLUSTERREGISTRY_H
+
+#include <string>
+#include <vector>
+#include <limits>
+#include <unordered_map>
+#include <stdexcept>
+
+#include "text.h"
+#include "checkpoint.h"
+
+using namespace std;
+namespace ham {
+
+typedef unsigned ClusterId;  // index of a cluster in the ClusterRegistry
+const ClusterId NO_CLUSTER = numeric_limits<ClusterId>::max();
+
+// ----------------------------------------------------------------------------------------
+// hash for the uid index vectors that define clusters
+struct UidVectorHash {
+  size_t operator()(const vector<unsigned> &uids) const {
+    size_t hval(uids.size());
+    for(auto iuid : uids)
+      hval ^= iuid + 0x9e3779b9 + (hval << 6) + (hval >> 2);
+    return hval;
+  }
+};
+
+// ----------------------------------------------------------------------------------------
+// Interns each cluster (i.e. each list of unique ids) as an integer id, so the glomerator can key its caches on ints rather than on colon-joined
+// uid strings, which get to be tens of kilobytes for big clusters. The uids within a cluster are kept in the same order they'd have in the name
+// string, so the name that we write to file (see Name()) is the same as it always was.
+class ClusterRegistry {
+public:
+  ClusterRegistry() {}
+  ClusterId Intern(string namestr, string delimiter=":");  // id for a <delimiter>-separated list of uids (registering the cluster, and any uids we haven't seen, if necessary)
+  ClusterId Intern(const vector<unsigned> &uids);
+  ClusterId Join(ClusterId id_a, ClusterId id_b);  // cluster with the members of both, with the one whose name sorts first at the front
+  ClusterId FindJoin(ClusterId id_a, ClusterId id_b);  // result of a previous Join() of these two, or NO_CLUSTER if we haven't joined them
+  bool NameLess(ClusterId id_a, ClusterId id_b);  // same order as comparing the two name strings, but without building them
+  bool Contains(ClusterId id, string uid);
+  unsigned UidIndex(string uid);  // NOTE adds it if we haven't seen it
+  string Name(ClusterId id, string delimiter=":");  // NOTE builds the whole string, so only use this for i/o (and debug printing)
+  const vector<unsigned> &uids(ClusterId id) { return uids_[id]; }
+  size_t size(ClusterId id) { return uids_[id].size(); }
+  const string &uid_str(unsigned iuid) { return uid_strs_[iuid]; }
+  size_t n_clusters() { return uids_.size(); }
+  size_t n_uids() { return uid_strs_.size(); }
+  void WriteCheckpoint(CheckpointWriter &ckpt);
+  void ReadCheckpoint(CheckpointReader &ckpt);  // NOTE throws unless every uid and cluster we already have is the same in the checkpoint (i.e. the checkpoint is from a run on the same input)
+
+private:
+  vector<string> uid_strs_;  // uid string for each uid index
+  unordered_map<string, unsigned> uid_indices_;
+  vector<vector<unsigned> > uids_;  // uid indices for each cluster id
+  unordered_map<vector<unsigned>, ClusterId, UidVectorHash> ids_;
+  unordered_map<unsigned long long, ClusterId> joins_;  // result of Join() for each (unordered) pair of ids that we've already joined
+};
+
+// ----------------------------------------------------------------------------------------
+// orders cluster ids by their name strings, so a Partition iterates in the same order as when it was a set of strings
+class ClusterNameLess {
+public:
+  ClusterNameLess(ClusterRegistry *registry=nullptr) : registry_(registry) {}
+  bool operator()(ClusterId id_a, ClusterId id_b) const {
+    if(registry_ == nullptr)
+      throw runtime_error("ClusterNameLess used without a registry");
+    return registry_->NameLess(id_a, id_b);
+  }
+private:
+  ClusterRegistry *registry_;
+};
+}
+#endif
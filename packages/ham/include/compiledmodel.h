@@ -0,0 +1,127 @@
+#ifndef HAM_COMPILEDMODEL_H
+#define HAM_COMPILEDMODEL_H
+
+#include <vector>
+#include <bitset>
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "state.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// minimal stl allocator that puts the start of each buffer on a cache line boundary
+template <typename T, size_t ALIGNMENT = 64>
+class AlignedAllocator {
+public:
+  typedef T value_type;
+  template <typename U> struct rebind { typedef AlignedAllocator<U, ALIGNMENT> other; };
+  AlignedAllocator() {}
+  template <typename U> AlignedAllocator(const AlignedAllocator<U, ALIGNMENT> &) {}
+
+  T *allocate(size_t n) {
+    void *ptr(nullptr);
+    if(posix_memalign(&ptr, ALIGNMENT, n * sizeof(T)) != 0)
+      throw bad_alloc();
+    return static_cast<T*>(ptr);
+  }
+  void deallocate(T *ptr, size_t) { free(ptr); }
+};
+template <typename T, typename U, size_t A> bool operator==(const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &) { return true; }
+template <typename T, typename U, size_t A> bool operator!=(const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &) { return false; }
+
+template <typename T> using aligned_vector = vector<T, AlignedAllocator<T> >;
+
+// Emission log probs in the same layout as CompiledModel's own table, to be used in its place (see Model::RescaledEmissions()). This way several
+// DPHandlers or threads can run the same model with different emissions (e.g. rescaled to different mutation frequencies) without modifying it.
+typedef aligned_vector<double> EmissionOverlay;
+
+// ----------------------------------------------------------------------------------------
+// Flat-array copy of the information the dp inner loops need from a finalized model, so they don't have to chase State and Transition pointers for every cell.
+// Incoming edges are stored in compressed sparse row format, i.e. the edges into state <ist> are [from_begin(ist), from_end(ist)) in <from_indices_> and <from_log_probs_>
+// (in increasing order of source index, the same order as State::from_state_indices()). Outgoing edges are stored the same way in the to_*() arrays (in
+// increasing order of destination index), for Trellis::SuffixViterbi() and SuffixForward(), which run right to left.
+class CompiledModel {
+public:
+  CompiledModel() : n_states_(0), n_symbols_(0), narrow_traceback_ok_(false), chain_begin_(0), chain_end_(0) {}
+  void Compile(vector<State*> &states, State *initial, Track *track);  // pack everything (called once, from Model::Finalize())
+  void CompileEmissions(vector<State*> &states);  // re-pack only the emissions (e.g. after we've rescaled the mute freqs)
+  void CompileRescaledEmissions(vector<State*> &states, double factor, EmissionOverlay &overlay);  // pack the emissions from State::RescaledEmissionLogprobs(<factor>) into <overlay> (we don't change)
+
+  inline size_t n_states() { return n_states_; }
+  inline uint32_t from_begin(size_t ist) { return from_offsets_[ist]; }
+  inline uint32_t from_end(size_t ist) { return from_offsets_[ist + 1]; }
+  inline const uint16_t *from_indices() { return from_indices_.data(); }
+  inline const double *from_log_probs() { return from_log_probs_.data(); }
+  inline uint32_t to_begin(size_t ist) { return to_offsets_[ist]; }
+  inline uint32_t to_end(size_t ist) { return to_offsets_[ist + 1]; }
+  inline const uint16_t *to_indices() { return to_indices_.data(); }
+  inline const double *to_log_probs() { return to_log_probs_.data(); }
+  inline double init_log_prob(size_t ist) { return init_log_probs_[ist]; }  // -INFINITY if there's no transition from init to <ist>
+  inline double end_log_prob(size_t ist) { return end_log_probs_[ist]; }  // -INFINITY if there's no transition from <ist> to end
+  inline bitset<STATE_MAX> *to_states(size_t ist) { return &to_states_[ist]; }
+  // same as the previous three, but in probability (rather than log probability) space, for Trellis::ScaledForward()
+  inline const double *from_probs() { return from_probs_.data(); }
+  inline double init_prob(size_t ist) { return init_probs_[ist]; }
+  inline const double *end_probs() { return end_probs_.data(); }
+  // emission log probs for symbol <ch> in each state, i.e. emission_row(ch)[ist] is the same as states[ist]->EmissionLogprob(ch)
+  inline const double *emission_row(uint8_t ch) { return &emission_log_probs_[(ch == ambiguous_index_ ? n_symbols_ - 1 : ch) * n_states_]; }
+  inline const double *emission_row_by_column(size_t icol, const EmissionOverlay *overlay = nullptr) { return &(overlay ? *overlay : emission_log_probs_)[icol * n_states_]; }  // same, but indexed by column in the Sequences profile (and from <overlay> if it's set)
+  inline size_t emission_table_size() { return emission_log_probs_.size(); }
+  size_t ApproxBytes();  // rough size of the packed arrays
+  inline size_t n_symbols() { return n_symbols_; }
+  inline bool narrow_traceback_ok() { return narrow_traceback_ok_; }  // can traceback pointers be stored as 8-bit offsets (see TracebackTable)?
+
+  // chain-shaped section of the model (see DetectChain()), for the kernels in chainkernels.cc
+  inline bool has_chain() { return chain_end_ > chain_begin_; }
+  inline size_t chain_begin() { return chain_begin_; }
+  inline size_t chain_end() { return chain_end_; }
+  inline size_t n_chain_heads() { return chain_heads_.size(); }
+  inline size_t chain_head(size_t ih) { return chain_heads_[ih]; }
+  inline size_t chain_head_begin(size_t ih) { return chain_head_ranges_[2*ih]; }  // first chain state to which the <ih>th head has an edge...
+  inline size_t chain_head_end(size_t ih) { return chain_head_ranges_[2*ih + 1]; }  // ...and one past the last one
+  inline const double *chain_head_log_probs(size_t ih) { return &chain_head_log_probs_[ih * (chain_end_ - chain_begin_)]; }  // transition log probs from the <ih>th head to each chain state (-INFINITY if there's no edge)
+  inline const double *chain_log_probs() { return chain_log_probs_.data(); }  // transition log probs from the previous chain state (-INFINITY for the first one)
+  inline const double *end_log_probs() { return end_log_probs_.data(); }
+  inline vector<uint16_t> *chain_extra_out_states() { return &chain_extra_out_states_; }  // chain states with transitions to anywhere other than the next chain state
+
+  static const size_t min_chain_length_ = 8;
+  static const size_t max_chain_heads_ = 16;
+
+private:
+  void DetectChain();
+  void FillEmissions(vector<State*> &states, double factor, aligned_vector<double> &emission_log_probs);
+  bool ChainLinkOk(size_t istart, size_t ist);
+
+
+  size_t n_states_;
+  size_t n_symbols_;  // alphabet size plus one (the last row is for the ambiguous character)
+  uint8_t ambiguous_index_;
+  bool narrow_traceback_ok_;  // true if every edge connects states that are within 127 of each other in index
+
+  aligned_vector<uint32_t> from_offsets_;  // length n_states_ + 1
+  aligned_vector<uint16_t> from_indices_;  // one entry per edge
+  aligned_vector<double> from_log_probs_;  // one entry per edge
+  aligned_vector<uint32_t> to_offsets_;  // same as the previous three, but for outgoing edges
+  aligned_vector<uint16_t> to_indices_;
+  aligned_vector<double> to_log_probs_;
+  aligned_vector<double> init_log_probs_;
+  aligned_vector<double> end_log_probs_;
+  aligned_vector<double> from_probs_, init_probs_, end_probs_;  // exp() of the previous three
+  aligned_vector<double> emission_log_probs_;  // n_symbols_ rows of length n_states_
+  vector<bitset<STATE_MAX> > to_states_;
+
+  size_t chain_begin_, chain_end_;
+  vector<uint16_t> chain_heads_;
+  vector<size_t> chain_head_ranges_;
+  aligned_vector<double> chain_head_log_probs_;  // one row of length chain_end_ - chain_begin_ for each head
+  aligned_vector<double> chain_log_probs_;
+  vector<uint16_t> chain_extra_out_states_;
+};
+
+}
+#endif
@@ -13,6 +13,7 @@
 #include "mathutils.h"
 #include "bcrutils.h"
 #include "args.h"
+#include "threadpool.h"
 
 using namespace std;
 namespace ham {
@@ -20,11 +21,12 @@ namespace ham {
 // ----------------------------------------------------------------------------------------
 class DPHandler {
 public:
-  DPHandler(string algorithm, Args *args, GermLines &gl, HMMHolder &hmms);
+  DPHandler(string algorithm, Args *args, GermLines &gl, HMMHolder &hmms, size_t n_threads = 1);  // <n_threads> is the number of genes to run at once in each k set
   ~DPHandler();
   void Clear();
   Result Run(vector<Sequence*> pseqvector, KBounds kbounds, vector<string> only_gene_list = {}, double overall_mute_freq = -INFINITY, bool clear_cache = true);  // run all over the kspace specified by bounds in kmin and kmax
   Result Run(vector<Sequence> seqvector, KBounds kbounds, vector<string> only_gene_list = {}, double overall_mute_freq = -INFINITY, bool clear_cache = true);
+  Result Run(Sequences seqs, KBounds kbounds, vector<string> only_gene_list = {}, double overall_mute_freq = -INFINITY, bool clear_cache = true);  // <seqs> can be profile-only for forward
   Result Run(Sequence seq, KBounds kbounds, vector<string> only_gene_list = {}, double overall_mute_freq = -INFINITY, bool clear_cache = true);
   void HandleFishyAnnotations(Result &multi_seq_result, vector<Sequence*> pqry_seqs, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq);
   void HandleFishyAnnotations(Result &multi_seq_result, vector<Sequence> qry_seqs, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq);
@@ -33,10 +35,21 @@ public:
   void PrintCachedTrellisSize();
 
 private:
-  void RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, map<string, string> > *best_genes);
+  void RunKSet(Sequences &seqs, KBounds &kbounds, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, map<string, string> > *best_genes, double prune_threshold = -INFINITY, int *n_pruned_genes = nullptr);
+  void StoreKSetResults(KSet kset, map<string, set<string> > &only_genes, map<string, double> &regional_best_scores, map<string, double> &regional_total_scores, map<string, double> &per_gene_support_this_kset, map<KSet, double> *best_scores, map<KSet, double> *total_scores);
+  void FillCompositeScores(Sequences &seqs, KBounds &kbounds, map<string, set<string> > &only_genes);
+  void FillCompositeScores(Sequences &seqs, KBounds &kbounds, string gene);
+  Trellis *CompositeTrellis(Sequences &seqs, KSet kset, string gene);
+  double CompositeTrellisScore(Trellis *trell, size_t length);
+  void CompositeKSet(KBounds &kbounds, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, map<string, string> > *best_genes);
+  void CacheEmissionBounds(Sequences &seqs, map<string, set<string> > &only_genes);
+  double GeneBound(KSet kset, string region, string gene);
+  double KSetBound(KSet kset, map<string, set<string> > &only_genes, map<string, double> *regional_bounds = nullptr);
+  double OptimisticScore(KSet kset, string region, string gene, map<string, double> &optimistic_scores);
   KSet FindPartialCacheMatch(string region, string gene, KSet kset);
   void InitCache(string gene);
-  void FillTrellis(KSet kset, Sequences query_seqs, vector<string> query_strs, string gene, string &origin);
+  void FillTrellis(KSet kset, Sequences query_seqs, vector<string> query_strs, string gene, string &origin, Sequences *suffix_seqs = nullptr, vector<string> *suffix_strs = nullptr, double min_score = -INFINITY);
+  void CheckScaledForward(Trellis *trell, Sequences &query_seqs, string gene);
   RecoEvent FillRecoEvent(Sequences &seqs, KSet kset, map<string, string> &best_genes, double score);
   vector<string> GetQueryStrs(Sequences &seqs, KSet kset, string region);
 
@@ -52,14 +65,19 @@ private:
   Args *args_;
   GermLines &gl_;
   HMMHolder &hmms_;
+  ThreadPool thread_pool_;
 
   // NOTE BEWARE DRAGONS AND ALL THAT SHIT!
   // if you add something new here you *must* clear it in Clear(), because we reuse the dphandler for different sequences UPDATE kind of don't do that any more
   // NOTE also that the vector<string> key can take up a ton of memory for multi-hmms with large k UPDATE dammit, no, I don't think that's where the memory was going
+  TrellisPool pool_;  // recycles dp buffers between trellises NOTE has to be declared before <scratch_cachefo_>, so the trellises can give their buffers back to it when they're destroyed
   map<string, map<vector<string>, Trellis> > scratch_cachefo_;  // collection of the trellises that  we've calculated from scratch, so we can reuse them. eg: scratch_cachefo_["IGHV1-18*01"]["ACGGGTCG"] for single hmms, or scratch_cachefo_["IGHV1-18*01"][("ACGGGTCG","ATGGTTAG")] for pair hmms
   map<string, map<KSet, TracebackPath> > paths_;
   map<string, map<KSet, double> > scores_;
   map<string, double> per_gene_support_;  // log prob of the best (full) annotation for each gene
+  map<string, vector<double> > composite_scores_;  // for --composite-vdj, each gene's log prob at every boundary in the current Run() (see FillCompositeScores())
+  map<string, EmissionOverlay> emission_overlays_;  // emissions rescaled to the current sequences' mutation frequency, for each gene in the current Run() (empty if we're not rescaling)
+  map<string, vector<double> > emission_bounds_;  // for --prune-viterbi, running sum over the sequence of each gene's best emission log prob (see CacheEmissionBounds())
 };
 }
 #endif
@@ -9,6 +9,7 @@
 
 #include "yaml-cpp/yaml.h"
 #include "lexicaltable.h"
+#include "modelfile.h"
 
 using namespace std;
 
@@ -18,6 +19,8 @@ class Emission {
 public:
   Emission();
   void Parse(YAML::Node config, Track *track);
+  void ParseBinary(ModelFileReader &reader, Track *track);
+  void WriteBinary(ModelFileWriter &writer);
   void ReplaceLogProbs(vector<double> new_log_probs) { scores_.ReplaceLogProbs(new_log_probs); }
   void UnReplaceLogProbs() { scores_.UnReplaceLogProbs(); }
   ~Emission();
@@ -8,12 +8,20 @@
 #include <ctime>
 #include <algorithm>
 #include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <queue>
 #include <pthread.h>
 
 #include "args.h"
 #include "dphandler.h"
 #include "clusterpath.h"
 #include "text.h"
+#include "packedseq.h"
+#include "threadpool.h"
+#include "cachefile.h"
+#include "outputfile.h"
+#include "naiveseqindex.h"
 
 using namespace std;
 namespace ham {
@@ -23,39 +31,90 @@ typedef pair<vector<string>, vector<string> > ClusterPair;
 // ----------------------------------------------------------------------------------------
 class Query {
 public:
-  Query() {}
-  Query(string name, vector<Sequence*> seqs, bool seed_missing, vector<string> only_genes, KBounds kbounds, float mute_freq, size_t cdr3_length, string p1="", string p2="") :
-    name_(name),
+  Query() : id_(NO_CLUSTER), parents_(NO_CLUSTER, NO_CLUSTER) {}
+  Query(ClusterId id, vector<Sequence*> seqs, bool seed_missing, vector<string> only_genes, KBounds kbounds, float mute_freq, size_t cdr3_length, ClusterId p1=NO_CLUSTER, ClusterId p2=NO_CLUSTER) :
+    id_(id),
     seqs_(seqs),
     seed_missing_(seed_missing),
     only_genes_(only_genes),
     kbounds_(kbounds),
     mute_freq_(mute_freq),
-    cdr3_length_(cdr3_length)
+    cdr3_length_(cdr3_length),
+    parents_(NO_CLUSTER, NO_CLUSTER)
   {
     // if(cdr3_length > 300)
     //   throw runtime_error("cdr3 length too big " + to_string(cdr3_length_) + " for " + name + "\n");
-    if(p1 != "" and p2 != "")
-      parents_ = pair<string, string>(p1, p2);
+    if(p1 != NO_CLUSTER and p2 != NO_CLUSTER)
+      parents_ = pair<ClusterId, ClusterId>(p1, p2);
     for(auto *pseq : seqs)
       if(pseq == nullptr)
-	throw runtime_error("null sequence pointer passed to Query constructor for " + name);
+	throw runtime_error("null sequence pointer passed to Query constructor for cluster " + to_string(id));
   }
 
-  string name_;
+  ClusterId id_;  // see ClusterRegistry
   vector<Sequence*> seqs_;
   bool seed_missing_;
   vector<string> only_genes_;
   KBounds kbounds_;
   float mute_freq_;
   size_t cdr3_length_;
-  pair<string, string> parents_;  // queries that were joined to make this
+  pair<ClusterId, ClusterId> parents_;  // queries that were joined to make this
+};
+
+// ----------------------------------------------------------------------------------------
+// A pair of clusters in the current partition that we might merge, with the naive hfrac or lratio on which we'd choose it. The two clusters are in
+// the order in which the loop over pairs in the partition first gets to them (see Glomerator::LoopPair()), so we can break ties the same way it did.
+class MergeCandidate {
+public:
+  MergeCandidate(double value, pair<ClusterId, ClusterId> keys) : value_(value), keys_(keys) {}
+  double value_;
+  pair<ClusterId, ClusterId> keys_;
+};
+
+// ----------------------------------------------------------------------------------------
+// true if the loop over pairs in the partition gets to <keys_a> before <keys_b>
+class PairLoopLess {
+public:
+  PairLoopLess(ClusterRegistry *registry=nullptr) : name_less_(registry) {}
+  bool operator()(const pair<ClusterId, ClusterId> &keys_a, const pair<ClusterId, ClusterId> &keys_b) const {
+    if(keys_a.first != keys_b.first)
+      return name_less_(keys_a.first, keys_b.first);
+    return name_less_(keys_a.second, keys_b.second);
+  }
+private:
+  ClusterNameLess name_less_;
+};
+
+// ----------------------------------------------------------------------------------------
+// priority queue ordering for merge candidates: the top is the one with the smallest (or, if <maximize>, largest) value, with ties going to the one that comes first in the pair loop
+class MergeCandidateOrder {
+public:
+  MergeCandidateOrder(ClusterRegistry *registry=nullptr, bool maximize=false) : loop_less_(registry), maximize_(maximize) {}
+  bool operator()(const MergeCandidate &cand_a, const MergeCandidate &cand_b) const {  // true if <cand_a> comes *after* <cand_b>
+    if(cand_a.value_ != cand_b.value_)
+      return maximize_ ? cand_a.value_ < cand_b.value_ : cand_a.value_ > cand_b.value_;
+    return loop_less_(cand_b.keys_, cand_a.keys_);
+  }
+private:
+  PairLoopLess loop_less_;
+  bool maximize_;
+};
+
+typedef priority_queue<MergeCandidate, vector<MergeCandidate>, MergeCandidateOrder> MergeCandidateQueue;
+
+// ----------------------------------------------------------------------------------------
+// hits, misses, and evictions for one of the glomerator's caches (see Glomerator::EvictCacheEntries())
+class CacheStats {
+public:
+  CacheStats() : hits_(0), misses_(0), evictions_(0) {}
+  void Count(bool hit) { if(hit) ++hits_; else ++misses_; }
+  long hits_, misses_, evictions_;
 };
 
 // ----------------------------------------------------------------------------------------
 class Glomerator {
 public:
-  Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args *args, Track *track);
+  Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args *args, Track *track, CacheFileStore *cache_store=nullptr);
   ~Glomerator();
   void Cluster();
   double LogProbOfPartition(Partition &clusters, bool debug=false);
@@ -72,46 +131,70 @@ public:
   // Also sets arguments <initial_path_index> and <logweight> to correspond to the returned partition.
   // Partition GetAnInitialPartition(int &initial_path_index, double &logweight);
 
+  size_t FirstPartitionToWrite(ClusterPath &cp);
   void WritePartitions(ClusterPath &cp);
   void WriteAnnotations(ClusterPath &cp);
 private:
   void ReadCacheFile();
-  void WriteCacheLine(ofstream &ofs, string query);
+  void ReadExistingPartition();
+  CacheEntry GetCacheEntry(ClusterId query);
+  bool AppendToCacheJournal() { return args_->binary_cache() && args_->output_cachefname() == args_->input_cachefname() && IsBinaryCacheFile(args_->input_cachefname()); }  // if we're writing to the same binary file we read from, we only need to append the new values to its journal
+  bool OnlyCacheNewVals();
+  bool CacheKeyToWrite(ClusterId key, bool only_new_vals);
+  string evicted_cachefname() { return args_->output_cachefname() + ".evicted"; }  // entries that EvictCacheEntries() throws away go in this file's journal, so they still end up in the output cache file
   void WriteCacheFile();
+  void WriteCheckpoint(ClusterPath &cp, bool mid_step=false);
+  void ReadCheckpoint(ClusterPath &cp);
+  void WriteQuery(CheckpointWriter &ckpt, Query &query);
+  Query ReadQuery(CheckpointReader &ckpt);
+  void WriteCandidates(CheckpointWriter &ckpt, MergeCandidateQueue candidates);
+  void ReadCandidates(CheckpointReader &ckpt, MergeCandidateQueue &candidates);
 
   void PrintPartition(Partition &clusters, string extrastr);
   string CacheSizeString();
+  size_t CacheBytes(string cachename);
+  size_t CacheBytes();  // total over all the caches in EvictCacheEntries()
+  string CacheMemoryString(bool verbose=false);
   string FinalString(bool newline=false);
   string GetStatusStr(time_t current_time);
   void WriteStatus();  // write some progress info to file
 
-  string ParentalString(pair<string, string> *parents);
-  int CountMembers(string namestr);
+  string ParentalString(pair<ClusterId, ClusterId> *parents);
+  int CountMembers(ClusterId id) { return (int)registry_.size(id); }
   unsigned LargestClusterSize(Partition &partition);
   string ClusterSizeString(Partition *partition);
-  string JoinNames(string name1, string name2, string delimiter=":");
   string JoinNameStrings(vector<Sequence*> &strlist, string delimiter=":");
   string JoinSeqStrings(vector<Sequence*> &strlist, string delimiter=":");
-  string PrintStr(string queries);
-  bool SeedMissing(string queries);
-
-  double CalculateHfrac(string &seq_a, string &seq_b);
-  double NaiveHfrac(string key_a, string key_b);
-
-  string ChooseSubsetOfNames(string queries, int n_max);
-  string GetNaiveSeqNameToCalculate(string actual_queries);  // convert between the actual queries/key we're interested in and the one we're going to calculate
-  string GetLogProbNameToCalculate(string queries, int n_max);
-  pair<string, string> GetLogProbPairOfNamesToCalculate(string actual_queries, pair<string, string> actual_parents);  // convert between the actual queries/key we're interested in and the one we're going to calculate
-  bool FirstParentMuchBigger(string queries, string queries_other, int nmax);
-  string FindNaiveSeqNameReplace(pair<string, string> *parents);
-  string &GetNaiveSeq(string key, pair<string, string> *parents=nullptr);
+  string PrintStr(ClusterId queries);
+  bool SeedMissing(ClusterId queries);
+  bool Existing(ClusterId key) { return existing_clusters_.count(key) > 0; }
+
+  double CalculateHfrac(ClusterId key_a, ClusterId key_b);
+  PackedSeq &GetPackedNaiveSeq(ClusterId key);
+  double NaiveHfrac(ClusterId key_a, ClusterId key_b);
+
+  ClusterId ChooseSubsetOfNames(ClusterId queries, int n_max);
+  ClusterId GetNaiveSeqNameToCalculate(ClusterId actual_queries);  // convert between the actual queries/key we're interested in and the one we're going to calculate
+  ClusterId GetLogProbNameToCalculate(ClusterId queries, int n_max);
+  pair<ClusterId, ClusterId> GetLogProbPairOfNamesToCalculate(ClusterId actual_queries, pair<ClusterId, ClusterId> actual_parents);  // convert between the actual queries/key we're interested in and the one we're going to calculate
+  bool FirstParentMuchBigger(ClusterId queries, ClusterId queries_other, int nmax);
+  ClusterId FindNaiveSeqNameReplace(pair<ClusterId, ClusterId> *parents);
+  string &GetNaiveSeq(ClusterId key, pair<ClusterId, ClusterId> *parents=nullptr);
   // double NormFactor(string name);
-  double GetLogProb(string queries);
-  double GetLogProbRatio(string key_a, string key_b);
-  string CalculateNaiveSeq(string key, RecoEvent *event=nullptr);
-  double CalculateLogProb(string queries);
+  double GetLogProb(ClusterId queries);
+  double GetLogProbRatio(ClusterId key_a, ClusterId key_b);
+  string CalculateNaiveSeq(ClusterId key, RecoEvent *event=nullptr);
+  SeqProfile GetProfile(ClusterId key);
+  double CalculateLogProb(ClusterId queries);
+  string &SetNaiveSeq(ClusterId queries, const string &naive_seq);
+  void TouchCacheEntry(ClusterId key) { if(args_->cache_memory_budget() > 0.) last_used_[key] = n_merge_steps_; }
+  bool CacheEntryDead(ClusterId key, vector<ClusterId> &live_cluster_of_uid, unordered_set<ClusterId> &protected_keys);
+  bool HasLiveEvictableEntries(ClusterId key);
+  void EvictCacheEntry(ClusterId key, bool dead, bool only_new_vals, vector<CacheEntry> &evicted_entries);
+  void EvictCacheEntries(ClusterPath *path);
+  void PrecalculateLogProbs(Partition &partition);
 
-  bool check_cache(string queries) {
+  bool check_cache(ClusterId queries) {
     if(cachefo_.find(queries) != cachefo_.end())
       return true;
     else if(tmp_cachefo_.find(queries) != tmp_cachefo_.end())
@@ -120,18 +203,28 @@ private:
       throw false;
   }
 
-  Query &cachefo(string queries);
+  Query &cachefo(ClusterId queries);
 
   bool SameLength(vector<Sequence*> &seqs, bool debug=false);
-  void AddFailedQuery(string queries, string error_str);
+  void AddFailedQuery(ClusterId queries, string error_str);
   void UpdateLogProbTranslationsForAsymetrics(Query &qmerge);
-  vector<Sequence*> GetSeqs(string query);
-  void MoveSubsetsFromTmpCache(string query);
-  void CopyToPermanentCache(string translated_query, string superquery);
-  Query &GetMergedQuery(string name_a, string name_b);
+  vector<Sequence*> GetSeqs(ClusterId query);
+  void MoveSubsetsFromTmpCache(ClusterId query);
+  void CopyToPermanentCache(ClusterId translated_query, ClusterId superquery);
+  Query &GetMergedQuery(ClusterId name_a, ClusterId name_b);
 
   bool LikelihoodRatioTooSmall(double lratio, int candidate_cluster_size);
   Partition GetSeededClusters(Partition &partition);
+  pair<ClusterId, ClusterId> LoopPair(ClusterId key_a, ClusterId key_b);
+  void ForEachLoopPair(Partition &partition, function<void(pair<ClusterId, ClusterId>)> fcn);
+  void AddNewHfracCandidates(Partition &partition, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures);
+  vector<pair<ClusterId, ClusterId> > AddIndexedHfracCandidates(Partition &partition, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures);
+  void CheckNaiveSeqIndex(Partition &partition, vector<pair<ClusterId, ClusterId> > &indexed_pairs, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures);
+  void AddHfracCandidate(pair<ClusterId, ClusterId> keys, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures);
+  void AddLRatioCandidate(pair<ClusterId, ClusterId> keys, Partition &partition, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures);
+  void AddLoopFailures(pair<ClusterId, ClusterId> keys, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures);
+  bool CandidateStale(const MergeCandidate &cand, Partition &partition, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures);
+  const MergeCandidate *BestCandidate(MergeCandidateQueue &candidates, Partition &partition, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures);
   pair<double, Query> FindHfracMerge(ClusterPath *path);
   pair<double, Query> FindLRatioMerge(ClusterPath *path);
   pair<double, Query> *ChooseRandomMerge(vector<pair<double, Query> > &potential_merges);
@@ -140,32 +233,63 @@ private:
   Args *args_;
   GermLines &gl_;
   HMMHolder &hmms_;
+  CacheFileStore *cache_store_;  // if set (with --serve), we get the input cache file's entries from here instead of reading the file
+  ThreadPool thread_pool_;  // for running several forward calculations at once (see PrecalculateLogProbs())
   ofstream ofs_;
 
+  ClusterRegistry registry_;  // every cluster we've seen (clusters everywhere else are just ids in here, and we only build their colon-joined names for i/o) NOTE has to be declared before the partitions, since they use it for ordering
+
   Partition initial_partition_;
+  unordered_set<ClusterId> existing_clusters_;  // for --existing-partition: clusters from the previous run's best partition, which we don't merge with each other
 
-  map<string, string> naive_seq_name_translations_;
-  map<string, pair<string, string> > logprob_name_translations_;
-  map<string, string> logprob_asymetric_translations_;
-  map<string, string> name_subsets_;
+  unordered_map<ClusterId, ClusterId> naive_seq_name_translations_;
+  unordered_map<ClusterId, pair<ClusterId, ClusterId> > logprob_name_translations_;
+  unordered_map<ClusterId, ClusterId> logprob_asymetric_translations_;
+  unordered_map<ClusterId, ClusterId> name_subsets_;
 
-  map<string, Sequence> single_seqs_;  // only place that we keep the actual sequences (rather than pointers/references)
-  map<string, Query> single_seq_cachefo_;  // keep some (approximate) single-sequence info to help us build missing cache entries
-  map<string, Query> cachefo_;  // cache info for clusters we've actually merged
-  map<string, Query> tmp_cachefo_;  // cache info for clusters we're only considering merging
+  map<unsigned, Sequence> single_seqs_;  // only place that we keep the actual sequences (rather than pointers/references) (keyed by uid index in <registry_>)
+  map<unsigned, Query> single_seq_cachefo_;  // keep some (approximate) single-sequence info to help us build missing cache entries (keyed by uid index in <registry_>)
+  unordered_map<ClusterId, Query> cachefo_;  // cache info for clusters we've actually merged
+  unordered_map<ClusterId, Query> tmp_cachefo_;  // cache info for clusters we're only considering merging
 
   // These all include cached info from previous runs
-  map<string, double> log_probs_;  
-  map<string, double> naive_hfracs_;  // NOTE since this uses the joint key, it assumes there's only *one* way to get to a given cluster (this is similar to, but not quite the same as, the situation for log probs and naive seqs)
-  map<string, double> lratios_;
-  map<string, string> naive_seqs_;
-  map<string, string> errors_;
+  unordered_map<ClusterId, double> log_probs_;
+  unordered_map<ClusterId, pair<double, bool> > precalculated_log_probs_;  // forward results (log prob and whether there was no path) that PrecalculateLogProbs() ran ahead of time, waiting for CalculateLogProb() to ask for them
+  unordered_map<ClusterId, double> naive_hfracs_;  // NOTE since this uses the joint key, it assumes there's only *one* way to get to a given cluster (this is similar to, but not quite the same as, the situation for log probs and naive seqs)
+  unordered_map<ClusterId, double> lratios_;
+  unordered_map<ClusterId, string> naive_seqs_;
+  unordered_map<ClusterId, PackedSeq> packed_naive_seqs_;  // packed versions of (some of) the entries in <naive_seqs_> (see CalculateHfrac())
+  unordered_map<ClusterId, string> errors_;
+  unordered_map<ClusterId, SeqProfile> profiles_;  // count profiles of the current multi-sequence clusters, so the forward calculation for a merge just adds its parents' (see GetProfile()) NOTE not checkpointed, since we can always recount them
+
+  unordered_set<ClusterId> failed_queries_;
+
+  unordered_set<ClusterId> initial_log_probs_, initial_naive_hfracs_, initial_naive_seqs_;  // keep track of the ones we read from the initial cache file so we can write only the new ones to the output cache file
+
+  // memory accounting for the caches above, and for --cache-memory-budget (see EvictCacheEntries())
+  CacheStats log_prob_stats_, naive_hfrac_stats_, lratio_stats_, naive_seq_stats_, name_subset_stats_;
+  CacheStats profile_stats_;  // hits are profiles we found in <profiles_>, misses ones we had to count from the sequences
+  size_t naive_seq_bytes_, packed_naive_seq_bytes_, profile_bytes_;  // characters in <naive_seqs_>, words in <packed_naive_seqs_>, and bytes of counts in <profiles_> (the rest of the caches have fixed-size entries)
+  unsigned n_merge_steps_;
+  unordered_map<ClusterId, unsigned> last_used_;  // merge step in which we last looked up or added each key in the caches (only filled if we've got a budget)
+  unordered_set<ClusterId> merged_away_;  // clusters that have been merged out of existence, whose cache entries we haven't yet evicted
 
-  set<string> failed_queries_;
+  // merge candidates that persist between merge steps, so each step only has to look at pairs involving the newly-merged cluster (see FindHfracMerge())
+  bool found_initial_pairs_;  // have we been through all pairs in the initial partition?
+  bool found_initial_lratios_;  // have we calculated the lratios for the pairs from the initial partition?
+  vector<ClusterId> new_clusters_;  // clusters that we've merged since we last looked for new pairs
+  vector<pair<ClusterId, ClusterId> > lratio_pairs_to_calculate_;  // pairs within the hfrac upper bound whose lratio we haven't yet looked at
+  MergeCandidateQueue hfrac_candidates_;  // pairs below the hfrac lower bound
+  MergeCandidateQueue lratio_candidates_;
+  MergeCandidateQueue small_lratio_candidates_;  // pairs whose lratio LikelihoodRatioTooSmall() doesn't like, which we only consider with <force_merge_>
 
-  set<string> initial_log_probs_, initial_naive_hfracs_, initial_naive_seqs_;  // keep track of the ones we read from the initial cache file so we can write only the new ones to the output cache file
+  // for --naive-seq-index (see AddIndexedHfracCandidates())
+  NaiveSeqIndex naive_seq_index_;  // naive seqs of the current clusters
+  bool naive_seq_index_failed_;  // set if CheckNaiveSeqIndex() finds a pair the index missed, after which we go back to looking at every pair
+  size_t n_indexed_pairs_;  // number of pairs the index proposed
 
   int n_fwd_calculated_, n_vtb_calculated_, n_hfrac_calculated_, n_hfrac_merges_, n_lratio_merges_;
+  int n_pruned_ksets_, n_pruned_genes_;  // summed over the viterbi calculations (see Result)
 
   double asym_factor_;
 
@@ -173,6 +297,9 @@ private:
 
   Partition *current_partition_;  // (a.t.m. only used for writing to status file)
   time_t last_status_write_time_;  // last time that we wrote our progress to a file
+  time_t last_checkpoint_time_;  // last time we wrote --checkpoint-file (or started, or resumed)
+  bool resumed_mid_step_;  // did we resume from a checkpoint written partway through a merge step (right after the initial pass through the pairs), in which case the next Merge() picks up where it left off
+  map<ClusterId, pair<ClusterId, ClusterId> > hfrac_loop_failures_, lratio_loop_failures_;  // failures during the current merge step's passes through the pairs (see CandidateStale())
   FILE *progress_file_;
 };
 
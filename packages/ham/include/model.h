@@ -3,6 +3,7 @@
 
 #include <fstream>
 #include "state.h"
+#include "compiledmodel.h"
 #include "yaml-cpp/yaml.h"
 
 using namespace std;
@@ -13,11 +14,15 @@ public:
   Model();
   ~Model();
   void Parse(string);
+  void ParseBinary(ModelFileReader &reader);  // read a .hamb file (see modelfile.h)
+  void WriteBinary(string fname, uint64_t yaml_hash);  // NOTE call this before rescaling anything
   void AddState(State*);
   void RescaleOverallMuteFreq(double overall_mute_freq);  // Rescale emissions to reflect <overall_mute_freq>, unless <overall_mute_freq> is -INFINITY, in which case we *re*-rescale them to what they were originally
   void UnRescaleOverallMuteFreq();  // Undo the above
+  void RescaledEmissions(double overall_mute_freq, EmissionOverlay &overlay);  // set <overlay> to the compiled emissions we'd have after RescaleOverallMuteFreq(<overall_mute_freq>), without changing anything
   void Finalize();
   void AddMaybeFasterFromStateStuff();
+  size_t ApproxBytes();  // rough memory usage of the states and the compiled model
 
   string &name() { return name_; }
   Track *track() { return track_; }
@@ -26,6 +31,7 @@ public:
   State *state(size_t ist) { assert(ist < states_.size()); return states_[ist]; }
   bitset<STATE_MAX> *initial_to_states() { return initial_->to_states(); }  // get vector of states to which the initial state may transition
   State *init_state() { return initial_; }
+  CompiledModel *compiled() { assert(finalized_); return &compiled_; }  // flat-array version of the states for the dp inner loops
   double overall_prob() { return overall_prob_; }
   double original_overall_mute_freq() { return original_overall_mute_freq_; }
 
@@ -46,6 +52,7 @@ private:
   map<string, State*> states_by_name_; //Ptr to state stored by State name;
   State *initial_;
   State *ending_;
+  CompiledModel compiled_;  // NOTE has to be updated whenever the states' emissions change
   bool finalized_;
 };
 
@@ -0,0 +1,70 @@
+#ifndef HAM_MODELFILE_H
+#define HAM_MODELFILE_H
+
+#include <string>
+#include <stdint.h>
+#include <stdexcept>
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Binary (.hamb) version of an hmm yaml file, so we don't have to build a yaml node tree for every gene in every process. It's just the values that
+// Model::Parse() pulls out of the yaml (in the same order), written by Model::WriteBinary() and read back through a read-only mmap by
+// Model::ParseBinary(). Layout (in native byte order, so only meant for the machine type that wrote it):
+//   - ModelFileHeader, whose <yaml_hash_> is the ModelFileHash() of the yaml file it was made from, so we can tell when it's stale
+//   - the model: strings are a uint32 length and then the characters, counts are uint32, and probabilities are doubles (already logged where the
+//     model stores logs, so we get exactly the same values as from the yaml)
+//   - another copy of the magic number, so we can tell it wasn't truncated
+const char MODEL_FILE_MAGIC[8] = {'H', 'A', 'M', 'M', 'O', 'D', 'E', 'L'};
+const uint32_t MODEL_FILE_VERSION = 1;
+
+struct ModelFileHeader {
+  char magic_[8];
+  uint32_t version_;
+  uint32_t unused_;
+  uint64_t yaml_hash_;
+};
+
+uint64_t ModelFileHash(string yamlfname);  // fnv-1a of the file's bytes
+string BinaryModelName(string yamlfname);  // <yamlfname> with .yaml replaced by .hamb
+
+// ----------------------------------------------------------------------------------------
+// builds the file in memory, and Close() writes it to a temporary file that it renames to <fname> (so several processes can write the same file)
+class ModelFileWriter {
+public:
+  ModelFileWriter(string fname, uint64_t yaml_hash);
+  void Close();
+  void Write(uint32_t val) { buffer_.append((const char*)&val, sizeof(val)); }
+  void Write(double val) { buffer_.append((const char*)&val, sizeof(val)); }
+  void Write(const string &str) { Write((uint32_t)str.size()); buffer_ += str; }
+
+private:
+  string fname_;
+  string buffer_;
+};
+
+// ----------------------------------------------------------------------------------------
+// read-only memory map of a binary model file, which we read through from start to finish
+class ModelFileReader {
+public:
+  ModelFileReader(string fname);
+  ~ModelFileReader();
+  uint64_t yaml_hash() { return ((const ModelFileHeader*)data_)->yaml_hash_; }
+  void Close();  // make sure we've gotten to the trailing magic number
+
+  uint32_t ReadCount() { uint32_t val; ReadBytes(&val, sizeof(val)); return val; }
+  double ReadDouble() { double val; ReadBytes(&val, sizeof(val)); return val; }
+  string ReadString() { size_t len(ReadCount()); Check(len); string str(data_ + ipos_, len); ipos_ += len; return str; }
+
+private:
+  ModelFileReader(const ModelFileReader&);  // (no copying the map)
+  ModelFileReader &operator=(const ModelFileReader&);
+  void Check(size_t n_bytes);  // throw if there aren't <n_bytes> left
+  void ReadBytes(void *dest, size_t n_bytes);
+  string fname_;
+  const char *data_;
+  size_t length_, ipos_;
+};
+}
+#endif
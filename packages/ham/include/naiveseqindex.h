@@ -0,0 +1,53 @@
+#ifndef HAM_NAIVESEQINDEX_H
+#define HAM_NAIVESEQINDEX_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <stdint.h>
+#include <math.h>
+#include <stdexcept>
+
+#include "clusterregistry.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Index of clusters' naive sequences that proposes only the pairs that could be within a hamming fraction of <max_hfrac>, so the glomerator
+// doesn't have to look at every pair. Sequences are grouped by cdr3 length and sequence length, and each sequence of length L is cut into
+// D + 1 + 2 * <max_ambiguous_bands> bands, where D = floor(<max_hfrac> * L). Bands with ambiguous characters (e.g. the N padding at either end) aren't
+// used, so for any pair at least D + 1 bands are usable in both sequences: if they differ at no more than D positions, at least one of those bands has
+// to be identical (pigeonhole), so two clusters that don't share a band can't be under the bound. I.e. there's no false negatives, just false
+// positives (which the glomerator throws out when it calculates the actual hfrac).
+// Sequences with more than <max_ambiguous_bands> ambiguous bands, and groups whose bands would be shorter than <min_band_length> (in which case we'd
+// propose nearly every pair anyway), are "wildcards" that get paired with everything in their group.
+class NaiveSeqIndex {
+public:
+  NaiveSeqIndex(double max_hfrac, string ambiguous_char, size_t max_ambiguous_bands=2, size_t min_band_length=8);
+  void Add(ClusterId key, int cdr3_length, const string &naive_seq);
+  void Remove(ClusterId key);  // (does nothing if it isn't there)
+  bool Contains(ClusterId key) { return members_.count(key) > 0; }
+  vector<ClusterId> Neighbors(ClusterId key);  // everything that shares a band with <key> (in no particular order)
+  vector<pair<ClusterId, ClusterId> > AllPairs();  // every pair of clusters that share a band (each with the lower id first, in no particular order)
+  size_t n_members() { return members_.size(); }
+  vector<ClusterId> members();  // (sorted)
+
+private:
+  struct Member {
+    uint64_t group_;
+    vector<uint64_t> bands_;  // hash of each band (empty for wildcards)
+  };
+  void RemoveFromList(vector<ClusterId> &keys, ClusterId key);
+
+  double max_hfrac_;
+  string ambiguous_char_;
+  size_t max_ambiguous_bands_, min_band_length_;
+  unordered_map<ClusterId, Member> members_;
+  unordered_map<uint64_t, vector<ClusterId> > buckets_;  // clusters with each band hash (which includes the group, and which band it is)
+  unordered_map<uint64_t, vector<ClusterId> > groups_;  // every cluster in each group (cdr3 length and sequence length)
+  unordered_map<uint64_t, vector<ClusterId> > wildcards_;  // clusters in each group that we couldn't cut into bands
+};
+}
+#endif
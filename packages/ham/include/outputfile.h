@@ -0,0 +1,153 @@
+#ifndef HAM_OUTPUTFILE_H
+#define HAM_OUTPUTFILE_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iomanip>
+#include <stdint.h>
+#include <stdexcept>
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Binary, columnar version of bcrham's csv output files (with --binary-output), for when writing and reparsing the csv takes longer than the hmm
+// calculations. Layout (in native byte order, like the other binary files):
+//   - OutputFileHeader, which says which kind of file it is (viterbi or forward annotations, or partitions)
+//   - any number of record batches, each of which is a uint64 byte length (not including itself), a uint32 row count, the batch's dictionary (a
+//     string column of everything in its id columns), and then the kind's columns (see OutputSchema) grouped by type, in this order:
+//       int columns:       row count int32s
+//       double columns:    row count doubles
+//       string columns:    row count uint32 lengths, then all the characters
+//       id columns:        row count uint32 indices into the dictionary
+//       int list columns:  row count uint32 lengths, then all the int32s
+//       id list columns:   row count uint32 lengths, then all the uint32 indices
+//   - another copy of the magic number, so we can tell it wasn't truncated
+// The rows, and the values in them, are the same as in the csv (so hamout can convert one to the other), except that genes and unique ids are ids,
+// deletions and log probs aren't strings, and partitions are lists of unique ids and cluster sizes instead of colon- and semicolon-joined strings.
+const char OUTPUT_FILE_MAGIC[8] = {'H', 'A', 'M', 'O', 'U', 'T', 'P', 'T'};
+const uint32_t OUTPUT_FILE_VERSION = 1;
+
+struct OutputFileHeader {
+  char magic_[8];
+  uint32_t version_;
+  uint32_t kind_;  // index in OutputKinds()
+};
+
+vector<string> OutputKinds();  // {"viterbi", "forward", "partition"}
+bool IsBinaryOutputFile(string fname);  // does <fname> start with the magic number?
+
+// ----------------------------------------------------------------------------------------
+// names of each kind's columns, by type
+class OutputSchema {
+public:
+  OutputSchema(string kind);
+  vector<string> ints_, doubles_, strings_, ids_, int_lists_, id_lists_;
+};
+
+// ----------------------------------------------------------------------------------------
+// one row's values, in the same order as the column names in its OutputSchema
+class OutputRow {
+public:
+  OutputRow(OutputSchema &schema);
+  vector<int> ints_;
+  vector<double> doubles_;
+  vector<string> strings_, ids_;
+  vector<vector<int> > int_lists_;
+  vector<vector<string> > id_lists_;
+};
+
+// ----------------------------------------------------------------------------------------
+// a batch of rows, stored column by column (this is what gets written to, and read from, the file)
+class OutputBatch {
+public:
+  OutputBatch(OutputSchema &schema);
+  void Clear();
+  void Add(const OutputRow &row);
+  size_t n_rows() { return n_rows_; }
+  string Serialize();  // contents of the batch in the file, not including the byte length
+  void Deserialize(const char *data, size_t length);
+
+  int Int(size_t icol, size_t irow) { return ints_[icol][irow]; }
+  double Double(size_t icol, size_t irow) { return doubles_[icol][irow]; }
+  string String(size_t icol, size_t irow) { return strings_[icol].Get(irow); }
+  string Id(size_t icol, size_t irow) { return dictionary_.Get(ids_[icol][irow]); }
+  vector<int> IntList(size_t icol, size_t irow);
+  vector<string> IdList(size_t icol, size_t irow);
+
+private:
+  class StringColumn {
+  public:
+    StringColumn() : starts_{0} {}
+    void Add(const string &str) { chars_ += str; starts_.push_back(chars_.size()); }
+    string Get(size_t irow) { return chars_.substr(starts_[irow], starts_[irow + 1] - starts_[irow]); }
+    size_t size() { return starts_.size() - 1; }
+    string chars_;
+    vector<size_t> starts_;  // row i is chars_[starts_[i]] up to chars_[starts_[i + 1]]
+  };
+  template <typename T> class ListColumn {
+  public:
+    ListColumn() : starts_{0} {}
+    vector<T> values_;
+    vector<size_t> starts_;
+  };
+  uint32_t IdIndex(const string &str);
+
+  size_t n_rows_;
+  StringColumn dictionary_;
+  map<string, uint32_t> dictionary_indices_;
+  vector<vector<int32_t> > ints_;
+  vector<vector<double> > doubles_;
+  vector<StringColumn> strings_;
+  vector<vector<uint32_t> > ids_;
+  vector<ListColumn<int32_t> > int_lists_;
+  vector<ListColumn<uint32_t> > id_lists_;
+};
+
+// ----------------------------------------------------------------------------------------
+// rows are collected into batches of <rows_per_batch>, and each batch is written in one go
+class OutputFileWriter {
+public:
+  OutputFileWriter(string fname, string kind, size_t rows_per_batch=1024);
+  ~OutputFileWriter();
+  OutputSchema &schema() { return schema_; }
+  void Add(const OutputRow &row);
+  void Close();  // write the last batch and the trailing magic number
+
+private:
+  void WriteBatch();
+  string fname_;
+  OutputSchema schema_;
+  size_t rows_per_batch_;
+  ofstream ofs_;
+  OutputBatch batch_;
+};
+
+// ----------------------------------------------------------------------------------------
+// read-only memory map of an output file, which we read through one batch at a time
+class OutputFileReader {
+public:
+  OutputFileReader(string fname);
+  ~OutputFileReader();
+  string kind() { return kind_; }
+  OutputSchema &schema() { return schema_; }
+  bool NextBatch(OutputBatch &batch);  // read the next batch into <batch>, or return false if we're at the end
+
+private:
+  OutputFileReader(const OutputFileReader&);  // (no copying the map)
+  OutputFileReader &operator=(const OutputFileReader&);
+  string fname_;
+  const char *data_;
+  size_t length_, ipos_;
+  string kind_;
+  OutputSchema schema_;
+};
+
+// ----------------------------------------------------------------------------------------
+string PartitionString(OutputBatch &batch, size_t irow);  // the partition in row <irow> of a partition batch, in the csv's format
+void ConvertOutputFileToCsv(string infname, string outfname);  // write the csv that bcrham would have written without --binary-output
+
+}
+#endif
@@ -0,0 +1,33 @@
+#ifndef HAM_PACKEDSEQ_H
+#define HAM_PACKEDSEQ_H
+
+#include <vector>
+#include <string>
+#include <stdint.h>
+#include <stdexcept>
+
+#include "track.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// A sequence stored as bit planes (plane <ip> has bit <ip> of each position's symbol index, 64 positions per word), along with a mask of its unambiguous
+// positions, so we can get hamming distances with xor and popcount instead of going base by base. For nucleotides this is two bits per base.
+class PackedSeq {
+public:
+  PackedSeq() : length_(0), n_words_(0), n_planes_(0) {}
+  PackedSeq(const string &seq, Track *track);  // NOTE assumes each symbol in <track> is one character
+  size_t size() { return length_; }
+
+  size_t length_, n_words_, n_planes_;
+  vector<uint64_t> planes_;  // <n_planes_> * <n_words_> words, one plane after another
+  vector<uint64_t> unambiguous_;  // bit is on for positions that aren't the ambiguous character (and off past the end of the sequence)
+};
+
+// Returns the number of positions at which <seq_a> and <seq_b> differ, skipping positions that are ambiguous in either, and sets <n_unambiguous> to the
+// number of positions that aren't ambiguous in either. Uses avx2 if the cpu has it (which gives exactly the same answer, since it's just counting bits).
+size_t PackedHammingDistance(PackedSeq &seq_a, PackedSeq &seq_b, size_t &n_unambiguous);
+string PackedHammingKernelName();
+}
+#endif
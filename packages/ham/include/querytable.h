@@ -0,0 +1,73 @@
+#ifndef HAM_QUERYTABLE_H
+#define HAM_QUERYTABLE_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stdexcept>
+
+#include "threadpool.h"
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Typed, column-oriented version of the per-query input file (a header line, then one whitespace-separated row per query, with names, seqs, and
+// only_genes as colon-separated lists). The file is memory mapped, and the list columns are kept as offsets into the map, so we only make strings
+// when somebody asks for them. Rows are read in batches with ReadQueries(), and big batches are parsed in parallel (each thread takes a range of
+// lines, and the pieces are stuck back together in order).
+class QueryTable {
+public:
+  QueryTable();
+  ~QueryTable();
+  void Open(string fname, size_t n_threads=1);  // map <fname> and read its header (doesn't read any rows)
+  size_t ReadQueries(size_t max_queries);  // replace the current rows with the next <max_queries> rows in the file (all of them if zero), and return how many we read
+  size_t n_queries() { return rows_.k_v_min_.size(); }
+
+  int k_v_min(size_t iqry) { return rows_.k_v_min_[iqry]; }
+  int k_v_max(size_t iqry) { return rows_.k_v_max_[iqry]; }
+  int k_d_min(size_t iqry) { return rows_.k_d_min_[iqry]; }
+  int k_d_max(size_t iqry) { return rows_.k_d_max_[iqry]; }
+  int cdr3_length(size_t iqry) { return rows_.cdr3_length_[iqry]; }
+  double mut_freq(size_t iqry) { return rows_.mut_freq_[iqry]; }
+  vector<string> names(size_t iqry) { return List(rows_.names_, iqry); }
+  vector<string> seqs(size_t iqry) { return List(rows_.seqs_, iqry); }
+  vector<string> only_genes(size_t iqry) { return List(rows_.only_genes_, iqry); }
+
+private:
+  QueryTable(const QueryTable&);  // (no copying the map)
+  QueryTable &operator=(const QueryTable&);
+
+  enum Column { NAMES, SEQS, ONLY_GENES, K_V_MIN, K_V_MAX, K_D_MIN, K_D_MAX, MUT_FREQ, CDR3_LENGTH, N_COLUMNS };
+  struct Span {
+    size_t offset_, length_;  // position in the map
+  };
+  struct ListColumn {
+    ListColumn() : starts_{0} {}
+    vector<Span> items_;
+    vector<size_t> starts_;  // items for query i are items_[starts_[i]] up to items_[starts_[i + 1]]
+  };
+  struct Rows {  // one batch of rows (or one thread's piece of it)
+    void Clear();
+    void Append(const Rows &other);
+    vector<int> k_v_min_, k_v_max_, k_d_min_, k_d_max_, cdr3_length_;
+    vector<double> mut_freq_;
+    ListColumn names_, seqs_, only_genes_;
+  };
+
+  vector<string> List(const ListColumn &column, size_t iqry);
+  size_t LineEnd(size_t ipos);  // position of the newline that ends the line starting at <ipos> (or the end of the file)
+  void ParseLines(size_t istart, size_t istop, Rows &rows);  // parse the complete lines in [<istart>, <istop>) onto the end of <rows>
+  double ParseNumber(Span token, size_t iline_start);
+
+  string fname_;
+  const char *data_;
+  size_t length_;
+  size_t ipos_;  // start of the next unread line
+  size_t n_threads_;
+  vector<Column> columns_;  // column in the file --> which one it is
+  Rows rows_;
+};
+
+}
+#endif
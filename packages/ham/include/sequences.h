@@ -39,10 +39,31 @@ private:
   vector<uint8_t> seqq_; // digitized Sequence
 };
 
+// ----------------------------------------------------------------------------------------
+// per-position symbol counts over a set of equal-length sequences (columns are the track's symbol indices, followed by one for the ambiguous
+// character). Since the trellis's emissions only depend on these counts, the profile of a merged cluster is just the sum of its parents' profiles.
+class SeqProfile {
+public:
+  SeqProfile() : length_(0), width_(0), n_seqs_(0) {}
+  SeqProfile(SeqProfile &rhs, size_t pos, size_t len);  // rows from <pos> to <pos> + <len>
+  void Add(Sequence &seq);
+  void Add(SeqProfile &rhs);  // add <rhs>'s counts to ours
+  size_t length() const { return length_; }
+  size_t width() const { return width_; }
+  size_t n_seqs() const { return n_seqs_; }
+  size_t bytes() const { return sizeof(uint32_t) * counts_.size(); }
+  const uint32_t *row(size_t pos) const { return &counts_[pos * width_]; }
+  string key() const { return string((const char*)counts_.data(), bytes()); }  // raw counts, so that prefixes (and suffixes) of the key are keys of the profile's prefixes (and suffixes)
+private:
+  size_t length_, width_, n_seqs_;
+  vector<uint32_t> counts_;  // <length_> rows of <width_> counts, i.e. emission log probs are the dot product of each row with the state's log probs
+};
+
 // ----------------------------------------------------------------------------------------
 class Sequences {
 public:
-  Sequences() : sequence_length_(0) {}
+  Sequences() {}
+  Sequences(SeqProfile profile, string names);  // just the profile, without the individual sequences (enough for the forward algorithm) (<names> is colon-separated)
   // Sequences(const Sequences &rhs);
   Sequences(Sequences &rhs, size_t pos, size_t len);  // copy <seqs> from <pos> to <pos> + <len>
   // Sequences(vector<Sequence> &seqs);
@@ -53,12 +74,20 @@ public:
   // Sequence GetAtConst(size_t index) { return seqs_.at(index); }  // 
   Sequence *get_ptr(size_t index) { return &seqs_.at(index); }
   size_t n_seqs() const { return seqs_.size(); }
-  size_t GetSequenceLength() { return sequence_length_;}
+  bool profile_only() const { return seqs_.size() == 0 && profile_.n_seqs() > 0; }
+  size_t GetSequenceLength() { return profile_.length(); }
+  SeqProfile &full_profile() { return profile_; }
+  size_t profile_width() { return profile_.width(); }
+  const uint32_t *profile(size_t pos) { return profile_.row(pos); }
   Sequences Union(Sequences &otherseqs);  // return union set of self and <otherseqs>
   // Sequences GetSubSequences(size_t pos, size_t len);
 
   void Print();
   string name_str(string delimiter = " ") {
+    if(profile_only()) {
+      vector<string> names(SplitString(names_));
+      return JoinStrings(names, delimiter);
+    }
     string name_str;
     for(size_t iseq = 0; iseq < n_seqs(); ++iseq) {
       if(iseq > 0) name_str += delimiter;
@@ -76,7 +105,8 @@ public:
   }
 private:
   vector<Sequence> seqs_;
-  size_t sequence_length_; // length of the sequences (required to be the same for all)
+  SeqProfile profile_;  // also tells us the length of the sequences (required to be the same for all)
+  string names_;  // for profile-only instances, the colon-separated names of the sequences that went into the profile
 };
 
 }
@@ -21,8 +21,11 @@ class State {
 public:
   State();
   void Parse(YAML::Node node, vector<string> state_names, Track *track);
+  void ParseBinary(ModelFileReader &reader, Track *track);
+  void WriteBinary(ModelFileWriter &writer);  // NOTE writes the current emissions, so don't call it after rescaling them
   void RescaleOverallMuteFreq(double factor);  // Rescale emissions by the ratio <factor>
   void UnRescaleOverallMuteFreq();  // undo the above
+  vector<double> RescaledEmissionLogprobs(double factor);  // the emission log probs that RescaleOverallMuteFreq(<factor>) would set, but without setting them
   ~State();
 
   inline string name() { return name_; }
@@ -34,6 +37,7 @@ public:
   inline vector<size_t> *from_state_indices() { return &from_state_indices_; }
   inline Transition *transition(size_t iter) { return (*transitions_)[iter]; }
   inline Transition *trans_to_end() { return trans_to_end_; }
+  inline string ambiguous_char() { return ambiguous_char_; }
 
   double EmissionLogprob(uint8_t ch);
   double EmissionLogprob(Sequences *seqs, size_t pos);
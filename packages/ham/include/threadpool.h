@@ -0,0 +1,43 @@
+#ifndef HAM_THREADPOOL_H
+#define HAM_THREADPOOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <exception>
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Fixed set of worker threads for running the iterations of a loop in parallel. The workers (and the calling thread) each take the next unclaimed
+// iteration from a shared counter whenever they finish one, so threads that get quick iterations just end up doing more of them. The threads stick
+// around between calls, since we call ParallelFor() for every k set.
+class ThreadPool {
+public:
+  ThreadPool(size_t n_threads);  // NOTE <n_threads> includes the calling thread, i.e. we start <n_threads> - 1 workers
+  ~ThreadPool();
+  void ParallelFor(size_t n_tasks, function<void(size_t)> task);  // run task(0) through task(<n_tasks> - 1), and return once they've all finished (rethrowing the first exception, if there was one)
+  size_t n_threads() { return workers_.size() + 1; }
+
+private:
+  void WorkerLoop();
+  void RunTasks();
+
+  vector<thread> workers_;
+  mutex mutex_;
+  condition_variable start_cv_, done_cv_;
+  function<void(size_t)> task_;
+  size_t n_tasks_;
+  atomic<size_t> next_task_;
+  size_t n_busy_;  // number of workers that haven't finished the current call
+  size_t generation_;  // incremented for each call, so the workers can tell when there's new work
+  bool stop_;
+  exception_ptr error_;
+};
+
+}
+#endif
@@ -8,17 +8,18 @@
 #include "sequences.h"
 #include "model.h"
 #include "tracebackpath.h"
+#include "chainkernels.h"
+#include "trellispool.h"
 
 using namespace std;
 namespace ham {
 
-typedef vector<vector<int16_t> > int_2D;
-
 // ----------------------------------------------------------------------------------------
 class Trellis {
 public:
-  Trellis(Model *hmm, Sequence seq, Trellis *cached_trellis = nullptr);
-  Trellis(Model *hmm, Sequences seqs, Trellis *cached_trellis = nullptr);
+  Trellis(Model *hmm, Sequence seq, Trellis *cached_trellis = nullptr, TrellisPool *pool = nullptr, const EmissionOverlay *emission_overlay = nullptr);
+  // if <pool> is set, we get our buffers from it and give them back when we're destroyed, and if <emission_overlay> is set we use its emissions instead of the model's
+  Trellis(Model *hmm, Sequences seqs, Trellis *cached_trellis = nullptr, TrellisPool *pool = nullptr, const EmissionOverlay *emission_overlay = nullptr);
   void Init();
   Trellis();
   ~Trellis();
@@ -34,18 +35,39 @@ public:
   double ending_forward_log_prob(size_t length) { return forward_log_probs_pointer_->at(length - 1); } // NOTE do *not* use <forward_log_probs_>
   size_t viterbi_pointer(size_t length) { return viterbi_indices_pointer_->at(length - 1); } // i.e. the zeroth entry of viterbi_indices_ corresponds to stopping with sequence of length 1 NOTE do *not* use <viterbi_indices_>  
 
-  int_2D *traceback_table_pointer() const { return traceback_table_pointer_; }
+  TracebackTable *traceback_table_pointer() const { return traceback_table_pointer_; }
   vector<double> *viterbi_log_probs_pointer() { return viterbi_log_probs_pointer_; }
   vector<double> *forward_log_probs_pointer() { return forward_log_probs_pointer_; }
   vector<int> *viterbi_indices_pointer() { return viterbi_indices_pointer_; }
 
-  void SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states);
+  void SetEmissionRows(size_t position);
+  inline double EmissionLogprob(size_t ist) {  // same as State::EmissionLogprob(Sequences*, pos), but as a dot product of the counts and rows set by the last SetEmissionRows() call
+    double logprob(0.);
+    for(size_t ir = 0; ir < emission_rows_.size(); ++ir)
+      logprob += emission_counts_[ir] * emission_rows_[ir][ist];
+    return logprob;
+  }
+  void SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, double fill_val = -INFINITY);
   void MiddleViterbiVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position);
   void MiddleForwardVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position);
+  void MiddleViterbiRange(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position, size_t ibegin, size_t iend);
+  void MiddleForwardRange(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position, size_t ibegin, size_t iend);
+  void SetChainRange(vector<double> *scoring_current);
+  double ScaledEmissions(bitset<STATE_MAX> &states);
+  double NormalizeColumn(vector<double> *scoring_current);
+  void FallBackToForward();
+  void AcquireColumns();
+  void ReleaseColumns();
+  void AddChainNextStates(vector<double> *scoring_current, bitset<STATE_MAX> &next_states);
   void CacheViterbiVals(size_t position, double dpval, size_t i_st_current);
   void CacheForwardVals(size_t position, double dpval, size_t i_st_current);
   void Viterbi();
   void Forward();
+  void ScaledForward();  // same as Forward(), but in probability space with per-column rescaling, so there's no exp() or log() per edge
+  bool scaled_forward_fell_back() { return scaled_forward_fell_back_; }  // did the last ScaledForward() call have to switch to Forward()?
+  void SuffixViterbi();  // same as Viterbi() and Forward(), but fill in the values for every *suffix* of the sequence, rather than every prefix...
+  void SuffixForward();
+  bool suffix() { return suffix_; }  // ...i.e. ending_viterbi_log_prob(n) is the best path that emits the *last* <n> positions (and chunk trellises take the end of the sequence)
   void Traceback(TracebackPath &path);
 
   string SizeString();
@@ -55,14 +77,19 @@ public:
 private:
   Model *hmm_;
   Sequences seqs_;
-  int_2D *traceback_table_pointer_;  // if we have a cached trellis, this points to the cached trellis's table
-  int_2D traceback_table_;  // if we have a cached trellis, this isn't initialized
+  TrellisPool *pool_;  // if set, where we get our buffers from (and return them to)
+  const EmissionOverlay *emission_overlay_;  // if set, emission log probs to use instead of the model's
+  TracebackTable *traceback_table_pointer_;  // if we have a cached trellis, this points to the cached trellis's table
+  TracebackTable traceback_table_;  // if we have a cached trellis, this isn't initialized
 
   Trellis *cached_trellis_;  // pointer to another trellis that already has its dp table(s) filled in, the idea being this trellis only needs a subset of that table, so we don't need to calculate anything new for this one
 
   int16_t ending_viterbi_pointer_;
   double  ending_viterbi_log_prob_;
   double  ending_forward_log_prob_;
+  bool scaled_forward_fell_back_;
+  bool suffix_;  // were the tables filled by SuffixViterbi() or SuffixForward()?
+  bool near_underflow_;  // during ScaledForward(), have any cells or emissions gotten close to the smallest double?
 
   // chunk caching stuff
   vector<double> *viterbi_log_probs_pointer_;  // see notes for traceback_table_
@@ -70,10 +97,14 @@ private:
   vector<int> *viterbi_indices_pointer_;  // see notes for traceback_table_
   vector<double> viterbi_log_probs_;  // log prob of best path up to and including each position NOTE includes log prob of transition to end
   vector<double> forward_log_probs_;  // total log prob of all paths up to and including each position NOTE includes log prob of transition to end
-  vector<int> viterbi_indices_;  // pointer to the state at which the best log prob occurred
+  vector<int> viterbi_indices_;  // pointer to the state at which the best log prob occurred (for suffix trellises, the state in which the best path starts)
 
   vector<double> *swap_ptr_;
-  vector<double> scoring_current_, scoring_previous_;
+  vector<double> scoring_current_, scoring_previous_;  // only allocated while Viterbi() or Forward() is running
+  vector<const double*> emission_rows_;  // for each symbol that occurs at the current position, the compiled model's emission log probs...
+  vector<double> emission_counts_;  // ...and the number of sequences with that symbol
+  vector<double> scaled_emissions_;  // for ScaledForward(): emission probs in the current column, divided by the largest one
+  size_t chain_lo_, chain_hi_;  // range of the model's chain states that are non-zero in the most recent column (see chainkernels.h)
 };
 
 }
@@ -0,0 +1,80 @@
+#ifndef HAM_TRELLISPOOL_H
+#define HAM_TRELLISPOOL_H
+
+#include <vector>
+#include <mutex>
+#include <stdint.h>
+
+using namespace std;
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// Free lists of dp buffers, so trellises can reuse the storage left behind by ones that have been destroyed (e.g. from the previous gene or query) rather
+// than going back to the heap every time. Buffers are handed back and forth by swapping vectors, so ownership is always clear: a trellis owns whatever it
+// has acquired until it releases it again. Each DPHandler has its own, which is shared (under a lock) by the threads that fill its trellises.
+class TrellisPool {
+public:
+  TrellisPool(size_t max_free = 256) : max_free_(max_free), n_acquired_(0), n_reused_(0) {}
+  void Acquire(vector<double> &buf);  // swap a free buffer (if there is one) into <buf> NOTE contents are unspecified, so resize/assign it before using it
+  void Acquire(vector<int16_t> &buf);
+  void Acquire(vector<int8_t> &buf);
+  void Release(vector<double> &buf);  // give <buf>'s storage back to the pool (leaves <buf> empty)
+  void Release(vector<int16_t> &buf);
+  void Release(vector<int8_t> &buf);
+  void Clear();  // free everything we're holding onto
+
+  size_t n_acquired() { return n_acquired_; }
+  size_t n_reused() { return n_reused_; }  // how many of the <n_acquired_> got a recycled buffer
+  double free_bytes();
+
+private:
+  template <typename T> void Acquire(vector<T> &buf, vector<vector<T> > &free_bufs);
+  template <typename T> void Release(vector<T> &buf, vector<vector<T> > &free_bufs);
+
+  mutex mutex_;
+  size_t max_free_;  // don't keep more than this many free buffers of each type
+  size_t n_acquired_, n_reused_;
+  vector<vector<double> > free_doubles_;
+  vector<vector<int16_t> > free_int16s_;
+  vector<vector<int8_t> > free_int8s_;
+};
+
+// ----------------------------------------------------------------------------------------
+// Traceback pointers for every (position, state) cell in one contiguous buffer. For models in which every edge connects states that are within 127 of each
+// other in index (which is true of the germline hmms, since they're mostly chains) we store the pointers as 8-bit offsets from the current state rather
+// than as 16-bit state indices, to halve the memory.
+class TracebackTable {
+public:
+  TracebackTable() : length_(0), n_states_(0), narrow_(false) {}
+  void Init(size_t length, size_t n_states, bool narrow, TrellisPool *pool);  // size for <length> positions and clear all pointers (getting the buffer from <pool> if it isn't null)
+  void Release(TrellisPool *pool);  // give our buffer back to <pool> (or just free it, if <pool> is null)
+
+  inline int16_t get(size_t position, size_t ist) {  // -1 if there's no pointer
+    if(narrow_) {
+      int8_t offset(narrow_buf_[position * n_states_ + ist]);
+      return offset == no_pointer_ ? -1 : (int16_t)ist - offset;
+    }
+    return wide_buf_[position * n_states_ + ist];
+  }
+  inline void set(size_t position, size_t ist, int16_t from) {
+    if(narrow_)
+      narrow_buf_[position * n_states_ + ist] = (int16_t)ist - from;
+    else
+      wide_buf_[position * n_states_ + ist] = from;
+  }
+
+  bool narrow() { return narrow_; }
+  size_t length() { return length_; }
+  double bytes() { return narrow_ ? narrow_buf_.capacity() * sizeof(int8_t) : wide_buf_.capacity() * sizeof(int16_t); }
+
+  static const int8_t no_pointer_ = -128;
+
+private:
+  size_t length_, n_states_;
+  bool narrow_;
+  vector<int16_t> wide_buf_;  // state index of the previous state (-1 for none) for each cell, row-major by position
+  vector<int8_t> narrow_buf_;  // same, but current state index minus previous state index (<no_pointer_> for none)
+};
+
+}
+#endif
@@ -3,26 +3,38 @@
 namespace ham {
 
 // ----------------------------------------------------------------------------------------
-Args::Args(int argc, const char * argv[]):
+Args::Args(int argc, const char * argv[], bool throw_parse_errors):
   algo_strings_ {"viterbi", "forward"},
+  chain_kernel_strings_ {"auto", "scalar", "none"},
+  binary_hmm_strings_ {"use", "write", "ignore"},
   debug_ints_ {0, 1, 2},
   algo_vals_(algo_strings_),
+  chain_kernel_vals_(chain_kernel_strings_),
+  binary_hmm_vals_(binary_hmm_strings_),
   debug_vals_(debug_ints_),
   hmmdir_arg_("", "hmmdir", "directory in which to look for hmm model files", true, "", "string"),
   datadir_arg_("", "datadir", "directory in which to look for non-sample-specific data (eg human germline seqs)", true, "", "string"),
-  infile_arg_("", "infile", "input (whitespace-separated) file", true, "", "string"),
-  outfile_arg_("", "outfile", "output csv file", true, "", "string"),
+  infile_arg_("", "infile", "input (whitespace-separated) file (required unless --serve is set)", false, "", "string"),
+  outfile_arg_("", "outfile", "output csv file (required unless --serve is set)", false, "", "string"),
   annotationfile_arg_("", "annotationfile", "if specified, write annotations for each cluster to here", false, "", "string"),
-  input_cachefname_arg_("", "input-cachefname", "input cached log prob/naive seq csv file", false, "", "string"),
-  output_cachefname_arg_("", "output-cachefname", "output cached log prob/naive seq csv file", false, "", "string"),
+  input_cachefname_arg_("", "input-cachefname", "input cached log prob/naive seq file (csv or binary)", false, "", "string"),
+  output_cachefname_arg_("", "output-cachefname", "output cached log prob/naive seq file (csv unless --binary-cache is set)", false, "", "string"),
   locus_arg_("", "locus", "ig{h,k,l} or tr{a,b,g,d}", true, "", "string"),
-  algorithm_arg_("", "algorithm", "algorithm to run", true, "", &algo_vals_),
+  algorithm_arg_("", "algorithm", "algorithm to run (required unless --serve is set)", false, "", &algo_vals_),
   ambig_base_arg_("", "ambig-base", "ambiguous base", false, "", "string"),
   seed_unique_id_arg_("", "seed-unique-id", "seed unique id", false, "", "string"),
+  chain_kernel_arg_("", "chain-kernel", "dp kernels for chain-shaped hmm states: auto (avx2 if the cpu has it), scalar, or none (general code only)", false, "auto", &chain_kernel_vals_),
+  binary_hmms_arg_("", "binary-hmms", "what to do with the binary (.hamb) version of each hmm yaml file in --hmmdir: use it if it's up to date with the yaml (or if there's no yaml), write it (from the yaml) if it isn't there, is out of date, or can't be read, or ignore it. If it can't be read (e.g. it's truncated, or from a different version), we parse the yaml instead", false, "use", &binary_hmm_vals_),
+  checkpoint_file_arg_("", "checkpoint-file", "when partitioning, periodically (see --checkpoint-interval), and as soon as we finish the initial passes through all the pairs, write the state of the run to this file, so it can be continued with --resume-from if it gets killed. It's replaced atomically, and removed once the partitions are written", false, "", "string"),
+  resume_from_arg_("", "resume-from", "continue the partition run whose state is in this --checkpoint-file (the other arguments, in particular --infile and --input-cachefname, have to be the same as for the original run)", false, "", "string"),
+  existing_partition_arg_("", "existing-partition", "partition output file (--outfile) from a previous run on some of the sequences in --infile. We start from its best partition (with any sequences that aren't in it as singletons), and only consider merges that involve at least one cluster with a new sequence. Use the previous run's --output-cachefname as --input-cachefname so the existing clusters' naive seqs and log probs don't get recalculated. Implies --only-cache-new-vals", false, "", "string"),
   hamming_fraction_bound_lo_arg_("", "hamming-fraction-bound-lo", "if hamming fraction for a pair is smaller than this, merge them without calculating lratio", false, 0.0, "float"),
   hamming_fraction_bound_hi_arg_("", "hamming-fraction-bound-hi", "if hamming fraction for a pair is larger than this, skip without calculating lratio", false, 1.0, "float"),
   logprob_ratio_threshold_arg_("", "logprob-ratio-threshold", "", false, -INFINITY, "float"),
   max_logprob_drop_arg_("", "max-logprob-drop", "stop glomerating when the total logprob has dropped by this much", false, -1.0, "float"),
+  prune_margin_arg_("", "prune-margin", "with --prune-viterbi, only skip things whose upper bound is at least this far below the best score so far (has to be non-negative)", false, 0.0, "float"),
+  cache_memory_budget_arg_("", "cache-memory-budget", "when partitioning, if the log prob, naive seq, naive hfrac, lratio, and subset caches use more than this many megabytes, evict entries (first everything for clusters that have been merged out of existence, then the least recently used naive hfracs and lratios, which we can recalculate exactly) until they're back under it, so the results don't depend on the budget. Evicted entries are kept in a journal next to --output-cachefname so they still end up in the output cache file. Zero (the default) for no limit", false, 0.0, "float"),
+  serve_memory_limit_arg_("", "serve-memory-limit", "with --serve, if the hmms and input cache files we're keeping use more than this many megabytes after a job, drop the cache files, and then the hmms, that we used longest ago until they're back under it (zero, the default, for no limit)", false, 0.0, "float"),
   debug_arg_("", "debug", "debug level", false, 0, &debug_vals_),
   naive_hamming_cluster_arg_("", "naive-hamming-cluster", "cluster sequences using naive hamming distance", false, 0, "int"),
   biggest_naive_seq_cluster_to_calculate_arg_("", "biggest-naive-seq-cluster-to-calculate", "", false, 99999, "int"),
@@ -32,22 +44,30 @@ Args::Args(int argc, const char * argv[]):
   min_largest_cluster_size_arg_("", "min-largest-cluster-size", "instead of stopping at the most likely partition, stop when your largest cluster is this big", false, 0, "unsigned"),
   max_cluster_size_arg_("", "max-cluster-size", "if any cluster gets bigger than this, stop clustering", false, 0, "unsigned"),
   random_seed_arg_("", "random-seed", "", false, time(NULL), "unsigned"),
+  n_threads_arg_("", "n-threads", "number of threads with which to run the genes in each k set (and, when partitioning, the number of forward calculations to run at once in each lratio merge step, or when annotating with --query-batch-size, the number of queries to run at once)", false, 1, "unsigned"),
+  query_batch_size_arg_("", "query-batch-size", "when annotating (i.e. not partitioning or caching naive seqs), read this many queries at a time from --infile, run them (in parallel, with --n-threads), and write their output, rather than reading the whole file at once. Output is in input order either way. Zero (the default) to read the whole file", false, 0, "unsigned"),
+  naive_seq_index_check_every_arg_("", "naive-seq-index-check-every", "with --naive-seq-index, every this many merge steps (starting with the first), also look at every pair, and go back to doing that for the rest of the run if the index missed any pair under --hamming-fraction-bound-hi (zero for never)", false, 0, "unsigned"),
+  checkpoint_interval_arg_("", "checkpoint-interval", "with --checkpoint-file, write a checkpoint after the first merge step that finishes at least this many seconds after the last one (zero for after every merge step)", false, 600, "unsigned"),
   no_chunk_cache_arg_("", "no-chunk-cache", "don't perform chunk caching?", false),
+  no_suffix_trellis_arg_("", "no-suffix-trellis", "chunk cache j from the start of the query (i.e. once for each k_v + k_d) rather than from the end of the sequence (once per gene)", false),
+  composite_vdj_arg_("", "composite-vdj", "fill each gene's dp tables once and combine them over every k set, rather than running each k set separately (only the best k set gets a traceback)", false),
+  prune_viterbi_arg_("", "prune-viterbi", "in viterbi mode, skip genes and k sets whose upper bound (from their best emission at each position) is more than --prune-margin below the best score so far. The best annotation doesn't change, but per-gene support doesn't include the skipped genes", false),
   partition_arg_("", "partition", "", false),
   dont_rescale_emissions_arg_("", "dont-rescale-emissions", "", false),
   cache_naive_seqs_arg_("", "cache-naive-seqs", "cache all naive sequences", false),
   cache_naive_hfracs_arg_("", "cache-naive-hfracs", "cache naive hamming fraction between sequence sets (in addition to log probs and naive seqs)", false),
   only_cache_new_vals_arg_("", "only-cache-new-vals", "only write sequence sets with newly-calculated values to cache file", false),
+  binary_output_arg_("", "binary-output", "write --outfile (and --annotationfile) in the binary, columnar format in outputfile.h rather than as csv (use hamout to convert them to csv)", false),
+  binary_cache_arg_("", "binary-cache", "write the output cache file in the binary, memory-mappable format (see cachefile.h). If it's the same file as a binary input cache file, the new values are appended to its journal instead of rewriting the whole thing (use hamcache to compact it)", false),
+  naive_seq_index_arg_("", "naive-seq-index", "when partitioning, only calculate naive hfracs for pairs of clusters whose naive sequences share an identical band (see naiveseqindex.h), rather than for every pair with the same cdr3 length. Since any pair under --hamming-fraction-bound-hi has to share a band, this gives the same merges", false),
   write_logprob_for_each_partition_arg_("", "write-logprob-for-each-partition", "By default, we don't know the total logprob of each partition (since many merges are by naive hfrac). This argument tells us that this is the last time through (with one process) and we want to know the total probability of each partition.", false),
-  str_headers_ {},
-  int_headers_ {"k_v_min", "k_v_max", "k_d_min", "k_d_max", "cdr3_length"},
-  float_headers_ {"mut_freq"},
-  str_list_headers_ {"names", "seqs", "only_genes"},  // passed as colon-separated lists of strings
-  int_list_headers_ {},  // passed as colon-separated lists of ints
-  float_list_headers_ {}  // passed as colon-separated lists of floats
+  scaled_forward_arg_("", "scaled-forward", "run the forward algorithm in probability space with per-column rescaling, rather than in log space", false),
+  check_scaled_forward_arg_("", "check-scaled-forward", "run both the scaled and log space forward algorithms for each trellis, and throw an exception if they disagree", false),
+  serve_arg_("", "serve", "read the germlines and hmms (from --datadir and --hmmdir, for --locus) once, then run jobs read from stdin (keeping the hmms, and each --input-cachefname until it changes on disk, in memory between jobs), one per line, until eof or a line that says 'quit'. Each line is a job id followed by the rest of the (whitespace-separated) bcrham arguments for that job, i.e. everything except --hmmdir, --datadir, --locus, --ambig-base, and --binary-hmms, which come from the worker. After each job we write the line 'bcrham-serve <id> ok <seconds>' or 'bcrham-serve <id> error <message>' to stdout", false)
 {
   try {
     CmdLine cmd("bcrham -- the fantabulous HMM compiler goes to B-Cellville", ' ', "");
+    cmd.setExceptionHandling(!throw_parse_errors);
     cmd.add(hmmdir_arg_);
     cmd.add(datadir_arg_);
     cmd.add(infile_arg_);
@@ -60,9 +80,18 @@ Args::Args(int argc, const char * argv[]):
     cmd.add(hamming_fraction_bound_hi_arg_);
     cmd.add(logprob_ratio_threshold_arg_);
     cmd.add(max_logprob_drop_arg_);
+    cmd.add(prune_margin_arg_);
+    cmd.add(cache_memory_budget_arg_);
+    cmd.add(serve_memory_limit_arg_);
     cmd.add(algorithm_arg_);
     cmd.add(ambig_base_arg_);
     cmd.add(seed_unique_id_arg_);
+    cmd.add(checkpoint_file_arg_);
+    cmd.add(resume_from_arg_);
+    cmd.add(existing_partition_arg_);
+    cmd.add(checkpoint_interval_arg_);
+    cmd.add(chain_kernel_arg_);
+    cmd.add(binary_hmms_arg_);
     cmd.add(debug_arg_);
     cmd.add(naive_hamming_cluster_arg_);
     cmd.add(biggest_naive_seq_cluster_to_calculate_arg_);
@@ -72,77 +101,53 @@ Args::Args(int argc, const char * argv[]):
     cmd.add(min_largest_cluster_size_arg_);
     cmd.add(max_cluster_size_arg_);
     cmd.add(random_seed_arg_);
+    cmd.add(n_threads_arg_);
+    cmd.add(query_batch_size_arg_);
+    cmd.add(naive_seq_index_check_every_arg_);
     cmd.add(no_chunk_cache_arg_);
+    cmd.add(no_suffix_trellis_arg_);
+    cmd.add(composite_vdj_arg_);
+    cmd.add(prune_viterbi_arg_);
     cmd.add(cache_naive_seqs_arg_);
     cmd.add(cache_naive_hfracs_arg_);
     cmd.add(only_cache_new_vals_arg_);
+    cmd.add(binary_cache_arg_);
+    cmd.add(binary_output_arg_);
+    cmd.add(naive_seq_index_arg_);
     cmd.add(write_logprob_for_each_partition_arg_);
+    cmd.add(scaled_forward_arg_);
+    cmd.add(check_scaled_forward_arg_);
+    cmd.add(serve_arg_);
     cmd.add(partition_arg_);
     cmd.add(dont_rescale_emissions_arg_);
 
     cmd.parse(argc, argv);
 
   } catch(ArgException &e) {
-    cerr << "ERROR: " << e.error() << " for argument " << e.argId() << endl;
+    if(!throw_parse_errors)  // (otherwise the caller reports it)
+      cerr << "ERROR: " << e.error() << " (" << e.argId() << ")" << endl;
     throw;
   }
 
-  for(auto & head : str_headers_)
-    strings_[head] = vector<string>();
-  for(auto & head : int_headers_)
-    integers_[head] = vector<int>();
-  for(auto & head : float_headers_)
-    floats_[head] = vector<double>();
-
   vector<string> loci{"igh", "igk", "igl", "tra", "trb", "trg", "trd"};  // this is ugly... but oh, well
   if(find(loci.begin(), loci.end(), locus()) == loci.end())
     throw runtime_error("--locus argument '" + locus() + "' not among ig{h,k,l} or tr{a,b,g,d}");
+  if(n_threads() == 0)
+    throw runtime_error("--n-threads has to be at least 1");
+  if(prune_margin() < 0.)
+    throw runtime_error("--prune-margin has to be non-negative");
+  if(cache_memory_budget() < 0.)
+    throw runtime_error("--cache-memory-budget has to be non-negative");
+  if(serve_memory_limit() < 0.)
+    throw runtime_error("--serve-memory-limit has to be non-negative");
+  if(serve())  // jobs come in later, each with its own Args
+    return;
+  if(infile() == "" || outfile() == "" || algorithm() == "")
+    throw runtime_error("--infile, --outfile, and --algorithm are required (unless --serve is set)");
 
-  ifstream ifs(infile());
-  if(!ifs.is_open())
-    throw runtime_error("args.cc: bcrham input file '" + infile() + "' d.n.e.\n");
-  string line;
-  // get header line
-  getline(ifs, line);
-  stringstream ss(line);
-  vector<string> headers;  // keep track of the file's column order
-  while(!ss.eof()) {
-    string head;
-    ss >> head;
-    if(head != "")   // make sure not to add a blank header at the end of the file
-      headers.push_back(head);
-  }
-  while(getline(ifs, line)) {
-    if(line.size() < 10)  // 10 is kinda arbitrary, but we just want to skip blank lines
-      continue;
-    stringstream ss(line);
-    string tmpstr;
-    int tmpint;
-    double tmpfloat;
-    for(auto & head : headers) {
-      if(str_headers_.count(head)) {
-        ss >> tmpstr;
-        strings_[head].push_back(tmpstr);
-      } else if(str_list_headers_.count(head)) {
-        ss >> tmpstr;
-        str_lists_[head].push_back(SplitString(tmpstr, ":"));
-      } else if(int_list_headers_.count(head)) {
-        ss >> tmpstr;
-        int_lists_[head].push_back(Intify(SplitString(tmpstr, ":")));
-      } else if(float_list_headers_.count(head)) {
-        ss >> tmpstr;
-	float_lists_[head].push_back(Floatify(SplitString(tmpstr, ":")));
-      } else if(int_headers_.count(head)) {
-        ss >> tmpint;
-        integers_[head].push_back(tmpint);
-      } else if(float_headers_.count(head)) {
-        ss >> tmpfloat;
-        floats_[head].push_back(tmpfloat);
-      } else {
-        throw runtime_error("args.cc: found unexpected header " + head + "' in input file " + infile());
-      }
-    }
-  }
+  queries_.Open(infile(), n_threads());
+  if(!stream_queries())
+    queries_.ReadQueries(0);
 
   // Check();
 }
@@ -8,6 +8,7 @@
 #include <ctime>
 #include <fstream>
 #include <cfenv>
+#include <sstream>
 
 #include "dphandler.h"
 #include "bcrutils.h"
@@ -22,95 +23,202 @@ using namespace std;
 
 // ----------------------------------------------------------------------------------------
 vector<vector<Sequence> > GetSeqs(Args &args, Track *trk);
-void run_algorithm(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args &args);
+void run_job(HMMHolder &hmms, GermLines &gl, Track *track, Args &args, CacheFileStore *cache_store=nullptr);
+void run_algorithm(HMMHolder &hmms, GermLines &gl, Track *track, Args &args);
+void serve(HMMHolder &hmms, GermLines &gl, Track *track, Args &worker_args);
 
 // ----------------------------------------------------------------------------------------
 int main(int argc, const char * argv[]) {
   clock_t run_start(clock());
   Args args(argc, argv);
-  srand(args.random_seed());
 
   // init some infrastructure
   vector<string> characters {"A", "C", "G", "T"};
   Track track("NUKES", characters, args.ambig_base());
   GermLines gl(args.datadir(), args.locus());
-  HMMHolder hmms(args.hmmdir(), gl, &track);
-  vector<vector<Sequence> > qry_seq_list(GetSeqs(args, &track));
+  HMMHolder hmms(args.hmmdir(), gl, &track, args.binary_hmms());
+
+  if(args.serve())
+    serve(hmms, gl, &track, args);
+  else
+    run_job(hmms, gl, &track, args);
+
+  printf("        time: bcrham %.1f\n", ((clock() - run_start) / (double)CLOCKS_PER_SEC));
+  return 0;
+}
+
+// ----------------------------------------------------------------------------------------
+void run_job(HMMHolder &hmms, GermLines &gl, Track *track, Args &args, CacheFileStore *cache_store) {
+  srand(args.random_seed());
+  SetChainKernelMode(args.chain_kernel());
+  if(args.debug()) cout << "  chain kernels: " << ChainKernelName() << endl;
+  if(args.debug() && args.partition()) cout << "  hamming kernel: " << PackedHammingKernelName() << endl;
 
   if(args.cache_naive_seqs()) {
-    Glomerator glom(hmms, gl, qry_seq_list, &args, &track);
+    vector<vector<Sequence> > qry_seq_list(GetSeqs(args, track));
+    Glomerator glom(hmms, gl, qry_seq_list, &args, track, cache_store);
     glom.CacheNaiveSeqs();
   } else if(args.partition()) {  // NOTE this is kind of hackey -- there's some code duplication between Glomerator and the loop below... but only a little, and they're doing fairly different things, so screw it for the time being
-    Glomerator glom(hmms, gl, qry_seq_list, &args, &track);
+    vector<vector<Sequence> > qry_seq_list(GetSeqs(args, track));
+    Glomerator glom(hmms, gl, qry_seq_list, &args, track, cache_store);
     glom.Cluster();
   } else {
-    run_algorithm(hmms, gl, qry_seq_list, args);
+    run_algorithm(hmms, gl, track, args);
   }
+}
 
-  printf("        time: bcrham %.1f\n", ((clock() - run_start) / (double)CLOCKS_PER_SEC));
-  return 0;
+// ----------------------------------------------------------------------------------------
+// run jobs from stdin (see the --serve help string) with the germlines and hmms we've already read, so we don't have to read them again for every
+// job. The hmms, and the input cache files that jobs read, stay in memory between jobs (up to --serve-memory-limit). Errors in a job are reported
+// on its status line, and we go on to the next one.
+// NOTE no quoting in job lines, so paths can't have spaces
+void serve(HMMHolder &hmms, GermLines &gl, Track *track, Args &worker_args) {
+  vector<string> worker_strs {"bcrham", "--hmmdir", worker_args.hmmdir(), "--datadir", worker_args.datadir(), "--locus", worker_args.locus(), "--binary-hmms", worker_args.binary_hmms()};
+  if(worker_args.ambig_base() != "") {
+    worker_strs.push_back("--ambig-base");
+    worker_strs.push_back(worker_args.ambig_base());
+  }
+  CacheFileStore cache_store;
+  cout << "bcrham-serve ready" << endl;
+
+  string line;
+  while(getline(cin, line)) {
+    vector<string> job_strs(worker_strs);
+    stringstream ss(line);
+    string job_id, tmpstr;
+    ss >> job_id;
+    if(job_id == "")  // blank line
+      continue;
+    if(job_id == "quit")
+      break;
+    while(ss >> tmpstr)
+      job_strs.push_back(tmpstr);
+
+    clock_t job_start(clock());
+    string error;
+    try {
+      vector<const char*> job_argv;
+      for(auto &str : job_strs)
+        job_argv.push_back(str.c_str());
+      Args job_args(job_argv.size(), job_argv.data(), true);
+      if(job_args.serve())
+        throw runtime_error("jobs can't set --serve");
+      run_job(hmms, gl, track, job_args, &cache_store);
+    } catch(ArgException &e) {
+      error = e.error() + " (" + e.argId() + ")";
+    } catch(exception &e) {
+      error = e.what();
+    } catch(ExitException &e) {  // e.g. --help
+      error = "job tried to exit with status " + to_string(e.getExitStatus());
+    }
+
+    if(worker_args.serve_memory_limit() > 0.) {  // cache files first, since they're usually quicker to reread than hmms are to reparse
+      size_t max_bytes(1e6 * worker_args.serve_memory_limit()), hmm_bytes(hmms.ApproxBytes());
+      size_t n_files_dropped(cache_store.Trim(hmm_bytes < max_bytes ? max_bytes - hmm_bytes : 0));
+      size_t n_hmms_dropped(hmms.Trim(max_bytes - cache_store.ApproxBytes()));
+      if(n_files_dropped > 0 || n_hmms_dropped > 0)
+        printf("        dropped %zu cache files and %zu hmms to get under --serve-memory-limit (%zu and %zu left)\n", n_files_dropped, n_hmms_dropped, cache_store.n_files(), hmms.n_hmms());
+    }
+
+    fflush(stdout);  // make sure everything from the job comes out before the status line
+    replace(error.begin(), error.end(), '\n', ' ');
+    if(error == "")
+      printf("bcrham-serve %s ok %.1f\n", job_id.c_str(), ((clock() - job_start) / (double)CLOCKS_PER_SEC));
+    else
+      printf("bcrham-serve %s error %s\n", job_id.c_str(), error.c_str());
+    fflush(stdout);
+  }
 }
 
 // ----------------------------------------------------------------------------------------
 // read input sequences from file and return as vector of sequences
 vector<vector<Sequence> > GetSeqs(Args &args, Track *trk) {
   vector<vector<Sequence> > all_seqs;
-  assert(args.str_lists_["names"].size() == args.str_lists_["seqs"].size());
-  for(size_t iqry = 0; iqry < args.str_lists_["names"].size(); ++iqry) { // loop over queries, where each query can be composed of one, two, or k sequences
+  for(size_t iqry = 0; iqry < args.queries_.n_queries(); ++iqry) { // loop over queries, where each query can be composed of one, two, or k sequences
+    vector<string> names(args.queries_.names(iqry)), seqstrs(args.queries_.seqs(iqry));
+    if(names.size() != seqstrs.size())
+      throw runtime_error("different numbers of names and seqs for query " + to_string(iqry) + " in " + args.infile());
     vector<Sequence> seqs;
-    assert(args.str_lists_["names"][iqry].size() == args.str_lists_["seqs"][iqry].size());
-    for(size_t iseq = 0; iseq < args.str_lists_["names"][iqry].size(); ++iseq) { // loop over each sequence in that query
-      Sequence sq(trk, args.str_lists_["names"][iqry][iseq], args.str_lists_["seqs"][iqry][iseq]);
-      seqs.push_back(sq);
-    }
+    for(size_t iseq = 0; iseq < names.size(); ++iseq) // loop over each sequence in that query
+      seqs.push_back(Sequence(trk, names[iseq], seqstrs[iseq]));
     all_seqs.push_back(seqs);
   }
-  assert(all_seqs.size() == args.str_lists_["names"].size());
   return all_seqs;
 }
 
 // ----------------------------------------------------------------------------------------
-void run_algorithm(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args &args) {
-
-  // write csv output headers
-  ofstream ofs;
-  ofs.open(args.outfile());
-  if(!ofs.is_open())
-    throw runtime_error("ERROR --outfile (" + args.outfile() + ") d.n.e.\n");
-  StreamHeader(ofs, args.algorithm());
-
-  int n_vtb_calculated(0), n_fwd_calculated(0);
-
-  for(size_t iqry = 0; iqry < qry_seq_list.size(); iqry++) {
-    if(args.debug() > 1) cout << "  ---------" << endl;
-    KSet kmin(args.integers_["k_v_min"][iqry], args.integers_["k_d_min"][iqry]);
-    KSet kmax(args.integers_["k_v_max"][iqry], args.integers_["k_d_max"][iqry]);
-    KBounds kbounds(kmin, kmax);
-    vector<Sequence> qry_seqs(qry_seq_list[iqry]);
-
-    DPHandler dph(args.algorithm(), &args, gl, hmms);
-    Result result = dph.Run(qry_seqs, kbounds, args.str_lists_["only_genes"][iqry], args.floats_["mut_freq"][iqry]);
-    // if(FishyMultiSeqAnnotation(qry_seqs.size(), result.best_event()))
-    //   dph.HandleFishyAnnotations(result, qry_seqs, kbounds, args.str_lists_["only_genes"][iqry], args.floats_["mut_freq"][iqry]);
-
-    if(args.debug() > 1) cout << "       ----" << endl;
-
-    if(result.no_path_)
-      StreamErrorput(ofs, args.algorithm(), qry_seqs, "no_path");
-    else if(args.algorithm() == "viterbi")
-      StreamViterbiOutput(ofs, result.best_event(), qry_seqs, "");
-    else if(args.algorithm() == "forward")
-      StreamForwardOutput(ofs, qry_seqs, result.total_score(), "");
-    else
-      assert(0);
+// With --query-batch-size, we read the queries a batch at a time (so memory doesn't depend on the size of the input file), run each batch's queries
+// in parallel (one thread each, as in Glomerator::PrecalculateLogProbs()), and then write them in input order. Otherwise (or with --debug, since the
+// dphandler debug printing would get all mixed up) we run them one at a time, with --n-threads genes at once in each k set.
+void run_algorithm(HMMHolder &hmms, GermLines &gl, Track *track, Args &args) {
+
+  AnnotationWriter writer(args.outfile(), args.algorithm(), args.binary_output());
+
+  int n_vtb_calculated(0), n_fwd_calculated(0), n_pruned_ksets(0), n_pruned_genes(0);
+  bool parallel_queries(args.stream_queries() && args.n_threads() > 1 && !args.debug());
+  ThreadPool thread_pool(parallel_queries ? args.n_threads() : 1);
+
+  while(!args.stream_queries() || args.ReadQueries(args.query_batch_size()) > 0) {
+    vector<vector<Sequence> > qry_seq_list(GetSeqs(args, track));
+    QueryTable &queries(args.queries_);
+    vector<vector<string> > only_genes;
+    vector<KBounds> kbounds_list;
+    vector<Result> results;
+    for(size_t iqry = 0; iqry < qry_seq_list.size(); iqry++) {
+      KSet kmin(queries.k_v_min(iqry), queries.k_d_min(iqry));
+      KSet kmax(queries.k_v_max(iqry), queries.k_d_max(iqry));
+      only_genes.push_back(queries.only_genes(iqry));
+      kbounds_list.push_back(KBounds(kmin, kmax));
+      results.push_back(Result(kbounds_list.back(), args.locus()));
+    }
+
+    auto run_query = [&](size_t iqry) {
+      if(args.debug() > 1) cout << "  ---------" << endl;
+      DPHandler dph(args.algorithm(), &args, gl, hmms, parallel_queries ? 1 : args.n_threads());
+      results[iqry] = dph.Run(qry_seq_list[iqry], kbounds_list[iqry], only_genes[iqry], queries.mut_freq(iqry));
+      // if(FishyMultiSeqAnnotation(qry_seqs.size(), result.best_event()))
+      //   dph.HandleFishyAnnotations(result, qry_seqs, kbounds, only_genes[iqry], queries.mut_freq(iqry));
+      if(args.debug() > 1) cout << "       ----" << endl;
+    };
+    if(parallel_queries) {
+      for(size_t iqry = 0; iqry < qry_seq_list.size(); iqry++) {
+        for(auto &gene : only_genes[iqry])
+          hmms.Get(gene);  // make sure it's read from disk before we go multi-threaded
+      }
+      thread_pool.ParallelFor(qry_seq_list.size(), run_query);
+    } else {
+      for(size_t iqry = 0; iqry < qry_seq_list.size(); iqry++)
+        run_query(iqry);
+    }
+
+    for(size_t iqry = 0; iqry < qry_seq_list.size(); iqry++) {
+      Result &result(results[iqry]);
+      vector<Sequence> &qry_seqs(qry_seq_list[iqry]);
+      n_pruned_ksets += result.n_pruned_ksets_;
+      n_pruned_genes += result.n_pruned_genes_;
+
+      if(result.no_path_)
+        writer.Error(qry_seqs, "no_path");
+      else if(args.algorithm() == "viterbi")
+        writer.Viterbi(result.best_event(), qry_seqs, "");
+      else if(args.algorithm() == "forward")
+        writer.Forward(qry_seqs, result.total_score(), "");
+      else
+        assert(0);
+
+      if(args.algorithm() == "viterbi")
+        ++n_vtb_calculated;
+      else if(args.algorithm() == "forward")
+        ++n_fwd_calculated;
+    }
 
-    if(args.algorithm() == "viterbi")
-      ++n_vtb_calculated;
-    else if(args.algorithm() == "forward")
-      ++n_fwd_calculated;
+    if(!args.stream_queries())
+      break;
   }
   printf("        calcd:   vtb %-4d  fwd %-4d\n", n_vtb_calculated, n_fwd_calculated);
-  ofs.close();
+  if(args.prune_viterbi())
+    printf("        pruned:  k sets %-6d  genes %-6d\n", n_pruned_ksets, n_pruned_genes);
+  writer.Close();
 }
 
 
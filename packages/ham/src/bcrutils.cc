@@ -306,10 +306,14 @@ void HMMHolder::CacheAll() {
   for(auto & region : gl_.regions_) {
     for(auto & gene : gl_.names_[region]) {
       string infname(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
-      if(ifstream(infname)) {
+      if(ifstream(infname) || (binary_mode_ != "ignore" && ifstream(BinaryModelName(infname)))) {
         cout << "    read " << infname << endl;
-        hmms_[gene] = new Model;
-        hmms_[gene]->Parse(infname);
+        if(hmms_.count(gene) == 0)
+          read_order_.push_back(gene);
+        else
+          delete hmms_[gene];
+        hmms_[gene] = ReadModel(infname);
+        last_used_[gene] = n_trims_;
       }
     }
   }
@@ -317,34 +321,85 @@ void HMMHolder::CacheAll() {
 
 // ----------------------------------------------------------------------------------------
 Model *HMMHolder::Get(string gene) {
-  if(hmms_.find(gene) == hmms_.end()) {   // if we don't already have it, read it from disk
-    hmms_[gene] = new Model;
-    string infname(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
-    // if (true) cout << "    read " << infname << endl;
-    hmms_[gene]->Parse(infname);
+  // NOTE only reads from <hmms_> if we already have <gene>, so it's safe to call from several threads at once as long as nobody's reading a new one
+  map<string, Model*>::iterator it(hmms_.find(gene));
+  if(it != hmms_.end()) {
+    last_used_.find(gene)->second.store(n_trims_, memory_order_relaxed);
+    return it->second;
   }
+  // if we don't already have it, read it from disk
+  string infname(hmm_dir_ + "/" + gl_.SanitizeName(gene) + ".yaml");
+  // if (true) cout << "    read " << infname << endl;
+  hmms_[gene] = ReadModel(infname);
+  read_order_.push_back(gene);
+  last_used_[gene] = n_trims_;
   return hmms_[gene];
 }
 
 // ----------------------------------------------------------------------------------------
-void HMMHolder::RescaleOverallMuteFreqs(map<string, set<string> > &only_genes, double overall_mute_freq) {
-  // WOE BETIDE THEE WHO FORGETETH TO RE-RESET THESE
-  // Seriously! If you don't re-rescale 'em when you're done with the sequences to which <overall_mute_freq> correspond, the mute freqs in the hmms will be *wrong*
+size_t HMMHolder::ApproxBytes() {
+  size_t bytes(0);
+  for(auto &kv : hmms_)
+    bytes += kv.second->ApproxBytes();
+  return bytes;
+}
 
-  // then actually do the rescaling for each necessary gene
-  for(auto &region : gl_.regions_) {
-    for(auto &gene : only_genes[region]) {
-      Get(gene)->RescaleOverallMuteFreq(overall_mute_freq);
+// ----------------------------------------------------------------------------------------
+size_t HMMHolder::Trim(size_t max_bytes) {
+  stable_sort(read_order_.begin(), read_order_.end(), [&](const string &gene_a, const string &gene_b) { return last_used_[gene_a] < last_used_[gene_b]; });  // (ties stay in the order we read them)
+  size_t bytes(ApproxBytes()), n_dropped(0);
+  while(bytes > max_bytes && n_dropped < read_order_.size()) {
+    string gene(read_order_[n_dropped++]);
+    bytes -= hmms_[gene]->ApproxBytes();
+    delete hmms_[gene];
+    hmms_.erase(gene);
+    last_used_.erase(gene);
+  }
+  read_order_.erase(read_order_.begin(), read_order_.begin() + n_dropped);
+  ++n_trims_;  // so anything the next job uses counts as more recent than everything so far
+  return n_dropped;
+}
+
+// ----------------------------------------------------------------------------------------
+Model *HMMHolder::ReadModel(string yamlfname) {
+  // read the binary version of <yamlfname> if we can (if there's no yaml file, we use the binary one without checking it), otherwise parse the yaml
+  Model *hmm(new Model);
+  string binfname(BinaryModelName(yamlfname));
+  bool have_yaml(ifstream(yamlfname).good());
+  uint64_t yaml_hash(0);
+  if(binary_mode_ != "ignore") {
+    if(have_yaml)
+      yaml_hash = ModelFileHash(yamlfname);
+    if(ifstream(binfname)) {
+      try {
+        ModelFileReader reader(binfname);
+        if(!have_yaml || reader.yaml_hash() == yaml_hash) {
+          hmm->ParseBinary(reader);
+          return hmm;
+        }
+      } catch(runtime_error &err) {  // truncated, or written by a different version: if we've got the yaml, we can just parse that instead (and rewrite the binary one, if we're writing)
+        if(!have_yaml) {
+          delete hmm;
+          throw;
+        }
+        cerr << "  WARNING couldn't read binary hmm file " << binfname << " (" << err.what() << "), so parsing " << yamlfname << " instead" << endl;
+        delete hmm;
+        hmm = new Model;
+      }
     }
   }
+  hmm->Parse(yamlfname);
+  if(binary_mode_ == "write")
+    hmm->WriteBinary(binfname, yaml_hash);
+  return hmm;
 }
 
 // ----------------------------------------------------------------------------------------
-void HMMHolder::UnRescaleOverallMuteFreqs(map<string, set<string> > &only_genes) {
+void HMMHolder::RescaledEmissions(map<string, set<string> > &only_genes, double overall_mute_freq, map<string, EmissionOverlay> &overlays) {
+  overlays.clear();
   for(auto &region : gl_.regions_) {
-    for(auto &gene : only_genes[region]) {
-      Get(gene)->UnRescaleOverallMuteFreq();
-    }
+    for(auto &gene : only_genes[region])
+      Get(gene)->RescaledEmissions(overall_mute_freq, overlays[gene]);
   }
 }
 
@@ -432,13 +487,13 @@ void StreamErrorput(ofstream &ofs, string algorithm, vector<Sequence> &seqs, str
       << ","
       << ","
       << "," << errors
-      << endl;
+      << "\n";
   } else {
     ofs
       << SeqNameStr(seqs, ":")
       << ","
       << "," << errors
-      << endl;
+      << "\n";
   }
 
 }
@@ -484,7 +539,7 @@ void StreamViterbiOutput(ofstream &ofs, RecoEvent &event, vector<Sequence> &seqs
     << "," << PerGeneSupportString(event.per_gene_support_["d"])
     << "," << PerGeneSupportString(event.per_gene_support_["j"])
     << "," << errors
-    << endl;
+    << "\n";
 }
 
 // ----------------------------------------------------------------------------------------
@@ -499,7 +554,80 @@ void StreamForwardOutput(ofstream &ofs, vector<Sequence> &seqs, double total_sco
     << SeqNameStr(seqs, ":")
     << "," << total_score
     << "," << errors
-    << endl;
+    << "\n";
+}
+
+// ----------------------------------------------------------------------------------------
+AnnotationWriter::AnnotationWriter(string fname, string algorithm, bool binary) : algorithm_(algorithm), writer_(nullptr) {
+  if(binary) {
+    writer_ = new OutputFileWriter(fname, algorithm);
+  } else {
+    ofs_.open(fname);
+    if(!ofs_.is_open())
+      throw runtime_error("ERROR --outfile (" + fname + ") d.n.e.\n");
+    StreamHeader(ofs_, algorithm);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+AnnotationWriter::~AnnotationWriter() {
+  delete writer_;
+}
+
+// ----------------------------------------------------------------------------------------
+void AnnotationWriter::Viterbi(RecoEvent &event, vector<Sequence*> &pseqs, string errors) {
+  vector<Sequence> seqs(GetSeqVector(pseqs));
+  Viterbi(event, seqs, errors);
+}
+
+// ----------------------------------------------------------------------------------------
+void AnnotationWriter::Viterbi(RecoEvent &event, vector<Sequence> &seqs, string errors) {
+  if(writer_ == nullptr) {
+    StreamViterbiOutput(ofs_, event, seqs, errors);
+    return;
+  }
+  OutputRow row(writer_->schema());  // NOTE has to match the column order in OutputSchema
+  row.ints_ = {1, (int)event.deletions_["v_5p"], (int)event.deletions_["v_3p"], (int)event.deletions_["d_5p"], (int)event.deletions_["d_3p"], (int)event.deletions_["j_5p"], (int)event.deletions_["j_3p"]};
+  row.doubles_ = {event.score_};
+  row.strings_ = {SeqNameStr(seqs, ":"), event.insertions_["fv"], event.insertions_["vd"], event.insertions_["dj"], event.insertions_["jf"], SeqStr(seqs, ":"),
+		  PerGeneSupportString(event.per_gene_support_["v"]), PerGeneSupportString(event.per_gene_support_["d"]), PerGeneSupportString(event.per_gene_support_["j"]), errors};
+  row.ids_ = {event.genes_["v"], event.genes_["d"], event.genes_["j"]};
+  writer_->Add(row);
+}
+
+// ----------------------------------------------------------------------------------------
+void AnnotationWriter::Forward(vector<Sequence> &seqs, double total_score, string errors) {
+  if(writer_ == nullptr) {
+    StreamForwardOutput(ofs_, seqs, total_score, errors);
+    return;
+  }
+  OutputRow row(writer_->schema());
+  row.ints_ = {1};
+  row.doubles_ = {total_score};
+  row.strings_ = {SeqNameStr(seqs, ":"), errors};
+  writer_->Add(row);
+}
+
+// ----------------------------------------------------------------------------------------
+void AnnotationWriter::Error(vector<Sequence> &seqs, string errors) {
+  if(writer_ == nullptr) {
+    StreamErrorput(ofs_, algorithm_, seqs, errors);
+    return;
+  }
+  OutputRow row(writer_->schema());  // (everything but the unique ids, seqs, and errors stay empty)
+  row.strings_[0] = SeqNameStr(seqs, ":");
+  if(algorithm_ == "viterbi")
+    row.strings_[5] = SeqStr(seqs, ":");
+  row.strings_.back() = errors;
+  writer_->Add(row);
+}
+
+// ----------------------------------------------------------------------------------------
+void AnnotationWriter::Close() {
+  if(writer_ == nullptr)
+    ofs_.close();
+  else
+    writer_->Close();
 }
 
 // ----------------------------------------------------------------------------------------
@@ -0,0 +1,434 @@
+#include "cachefile.h"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+void CacheEntry::Update(const CacheEntry &other) {
+  if(other.has_logprob_) {
+    has_logprob_ = true;
+    logprob_ = other.logprob_;
+  }
+  if(other.naive_seq_.size() > 0)
+    naive_seq_ = other.naive_seq_;
+  if(other.has_naive_hfrac_) {
+    has_naive_hfrac_ = true;
+    naive_hfrac_ = other.naive_hfrac_;
+  }
+  if(other.errors_.size() > 0)
+    errors_ = other.errors_;
+}
+
+// ----------------------------------------------------------------------------------------
+static size_t PaddedRecordSize(const CacheEntry &entry) {
+  size_t size(sizeof(CacheRecordHeader) + entry.name_.size() + entry.naive_seq_.size() + entry.errors_.size());
+  return (size + 7) / 8 * 8;
+}
+
+// ----------------------------------------------------------------------------------------
+static void AppendRecord(const CacheEntry &entry, string &buffer) {
+  CacheRecordHeader header;
+  memset(&header, 0, sizeof(header));
+  header.name_length_ = entry.name_.size();
+  header.naive_seq_length_ = entry.naive_seq_.size();
+  header.errors_length_ = entry.errors_.size();
+  header.flags_ = (entry.has_logprob_ ? 1 : 0) | (entry.has_naive_hfrac_ ? 2 : 0);
+  header.logprob_ = entry.logprob_;
+  header.naive_hfrac_ = entry.naive_hfrac_;
+  size_t start(buffer.size());
+  buffer.append((const char*)&header, sizeof(header));
+  buffer += entry.name_;
+  buffer += entry.naive_seq_;
+  buffer += entry.errors_;
+  buffer.resize(start + PaddedRecordSize(entry), '\0');
+}
+
+// ----------------------------------------------------------------------------------------
+// returns the size of the record at <data> (or zero if there isn't a whole one in the <length> bytes that are left)
+static size_t ParseRecord(const char *data, size_t length, CacheEntry &entry) {
+  if(length < sizeof(CacheRecordHeader))
+    return 0;
+  const CacheRecordHeader *header((const CacheRecordHeader*)data);
+  size_t size(sizeof(CacheRecordHeader) + (size_t)header->name_length_ + header->naive_seq_length_ + header->errors_length_);
+  size = (size + 7) / 8 * 8;
+  if(size > length)
+    return 0;
+  const char *chars(data + sizeof(CacheRecordHeader));
+  entry.name_.assign(chars, header->name_length_);
+  entry.naive_seq_.assign(chars + header->name_length_, header->naive_seq_length_);
+  entry.errors_.assign(chars + header->name_length_ + header->naive_seq_length_, header->errors_length_);
+  entry.has_logprob_ = header->flags_ & 1;
+  entry.logprob_ = header->logprob_;
+  entry.has_naive_hfrac_ = header->flags_ & 2;
+  entry.naive_hfrac_ = header->naive_hfrac_;
+  return size;
+}
+
+// ----------------------------------------------------------------------------------------
+MappedCacheFile::MappedCacheFile(string fname) :
+  fname_(fname),
+  data_(nullptr),
+  length_(0),
+  n_entries_(0),
+  index_(nullptr)
+{
+  int fd(open(fname.c_str(), O_RDONLY));
+  if(fd < 0)
+    throw runtime_error("couldn't open binary cache file " + fname + " (" + strerror(errno) + ")");
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    close(fd);
+    throw runtime_error("couldn't stat binary cache file " + fname);
+  }
+  length_ = st.st_size;
+  if(length_ < sizeof(CacheFileHeader)) {
+    close(fd);
+    throw runtime_error("binary cache file " + fname + " is too short to have a header");
+  }
+  void *map(mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0));
+  close(fd);  // (the map stays valid)
+  if(map == MAP_FAILED)
+    throw runtime_error("couldn't mmap binary cache file " + fname + " (" + strerror(errno) + ")");
+  data_ = (const char*)map;
+
+  const CacheFileHeader *header((const CacheFileHeader*)data_);
+  if(memcmp(header->magic_, CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC)) != 0 || header->version_ != CACHE_FILE_VERSION) {
+    munmap((void*)data_, length_);
+    throw runtime_error("binary cache file " + fname + " has the wrong magic number or version");
+  }
+  n_entries_ = header->n_entries_;
+  if(header->index_offset_ % 8 != 0 || header->index_offset_ + n_entries_ * sizeof(uint64_t) != length_) {
+    munmap((void*)data_, length_);
+    throw runtime_error("index in binary cache file " + fname + " doesn't match the file length (truncated?)");
+  }
+  index_ = (const uint64_t*)(data_ + header->index_offset_);
+}
+
+// ----------------------------------------------------------------------------------------
+MappedCacheFile::~MappedCacheFile() {
+  if(data_ != nullptr)
+    munmap((void*)data_, length_);
+}
+
+// ----------------------------------------------------------------------------------------
+const CacheRecordHeader *MappedCacheFile::record(size_t ientry) {
+  if(ientry >= n_entries_)
+    throw runtime_error("entry " + to_string(ientry) + " out of range in binary cache file " + fname_);
+  uint64_t offset(index_[ientry]);  // make sure a corrupt index can't send us outside the map
+  if(offset < sizeof(CacheFileHeader) || offset % 8 != 0 || offset > length_ - sizeof(CacheRecordHeader))
+    throw runtime_error("bad offset " + to_string(offset) + " for entry " + to_string(ientry) + " in binary cache file " + fname_);
+  return (const CacheRecordHeader*)(data_ + offset);
+}
+
+// ----------------------------------------------------------------------------------------
+CacheEntry MappedCacheFile::entry(size_t ientry) {
+  CacheEntry entry;
+  const char *start((const char*)record(ientry));
+  if(ParseRecord(start, data_ + length_ - start, entry) == 0)
+    throw runtime_error("record " + to_string(ientry) + " runs off the end of binary cache file " + fname_);
+  return entry;
+}
+
+// ----------------------------------------------------------------------------------------
+bool MappedCacheFile::Find(string name, CacheEntry &entry) {
+  size_t lo(0), hi(n_entries_);  // binary search over the index, comparing the names in place
+  while(lo < hi) {
+    size_t mid((lo + hi) / 2);
+    const CacheRecordHeader *header(record(mid));
+    if(header->name_length_ > length_ - ((const char*)header - data_) - sizeof(CacheRecordHeader))
+      throw runtime_error("name for entry " + to_string(mid) + " runs off the end of binary cache file " + fname_);
+    int cmp = name.compare(0, string::npos, (const char*)header + sizeof(CacheRecordHeader), header->name_length_);
+    if(cmp == 0) {
+      entry = this->entry(mid);
+      return true;
+    }
+    if(cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------------------------
+CacheJournal::CacheJournal(string cachefname) :
+  fname_(CacheJournalName(cachefname)),
+  fd_(-1)
+{
+  if(access(fname_.c_str(), F_OK) != 0) {  // new journal: write the header to a temporary file and link it into place, so that if several processes get here at once, only one of them creates it, and nobody can append before the header's there
+    string tmpfname(fname_ + ".tmp." + to_string(getpid()));
+    CacheJournalHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic_, CACHE_JOURNAL_MAGIC, sizeof(CACHE_JOURNAL_MAGIC));
+    header.version_ = CACHE_FILE_VERSION;
+    ofstream ofs(tmpfname, ios::binary);
+    ofs.write((const char*)&header, sizeof(header));
+    ofs.close();
+    if(!ofs)
+      throw runtime_error("couldn't write header to cache journal " + tmpfname);
+    if(link(tmpfname.c_str(), fname_.c_str()) != 0 && errno != EEXIST)
+      throw runtime_error("couldn't create cache journal " + fname_ + " (" + strerror(errno) + ")");
+    remove(tmpfname.c_str());
+  }
+  fd_ = open(fname_.c_str(), O_WRONLY | O_APPEND);
+  if(fd_ < 0)
+    throw runtime_error("couldn't open cache journal " + fname_ + " (" + strerror(errno) + ")");
+}
+
+// ----------------------------------------------------------------------------------------
+CacheJournal::~CacheJournal() {
+  close(fd_);
+}
+
+// ----------------------------------------------------------------------------------------
+void CacheJournal::Append(const vector<CacheEntry> &entries) {
+  string buffer;
+  for(auto &entry : entries)
+    AppendRecord(entry, buffer);
+  if(buffer.size() == 0)
+    return;
+  ssize_t n_written(write(fd_, buffer.data(), buffer.size()));  // one write, so appends from different processes don't interleave
+  if(n_written != (ssize_t)buffer.size())
+    throw runtime_error("couldn't append " + to_string(entries.size()) + " entries to cache journal " + fname_ + " (" + strerror(errno) + ")");
+}
+
+// ----------------------------------------------------------------------------------------
+const vector<CacheEntry> &CacheFileStore::Entries(string fname) {
+  string stamp(FileStamp(fname));
+  auto it = files_.find(fname);
+  if(it == files_.end() || it->second.stamp_ != stamp) {
+    StoredFile &stored(files_[fname]);
+    stored.stamp_ = stamp;
+    stored.entries_.clear();
+    stored.bytes_ = 0;
+    ReadCacheEntries(fname, [&](CacheEntry &entry) {
+	stored.bytes_ += sizeof(CacheEntry) + entry.name_.size() + entry.naive_seq_.size() + entry.errors_.size();
+	stored.entries_.push_back(entry);
+      });
+    it = files_.find(fname);
+  }
+  use_order_.erase(remove(use_order_.begin(), use_order_.end(), fname), use_order_.end());
+  use_order_.push_back(fname);
+  return it->second.entries_;
+}
+
+// ----------------------------------------------------------------------------------------
+size_t CacheFileStore::ApproxBytes() {
+  size_t bytes(0);
+  for(auto &kv : files_)
+    bytes += kv.second.bytes_;
+  return bytes;
+}
+
+// ----------------------------------------------------------------------------------------
+size_t CacheFileStore::Trim(size_t max_bytes) {
+  size_t bytes(ApproxBytes()), n_dropped(0);
+  while(bytes > max_bytes && n_dropped < use_order_.size()) {
+    string fname(use_order_[n_dropped++]);
+    bytes -= files_[fname].bytes_;
+    files_.erase(fname);
+  }
+  use_order_.erase(use_order_.begin(), use_order_.begin() + n_dropped);
+  return n_dropped;
+}
+
+// ----------------------------------------------------------------------------------------
+string CacheFileStore::FileStamp(string fname) {
+  string stamp;
+  for(auto &fn : {fname, CacheJournalName(fname)}) {
+    struct stat st;
+    if(stat(fn.c_str(), &st) != 0) {
+      stamp += "none ";
+      continue;
+    }
+    stamp += to_string(st.st_ino) + " " + to_string(st.st_size) + " " + to_string(st.st_mtim.tv_sec) + "." + to_string(st.st_mtim.tv_nsec) + " ";
+  }
+  return stamp;
+}
+
+// ----------------------------------------------------------------------------------------
+string CacheJournalName(string cachefname) {
+  return cachefname + ".journal";
+}
+
+// ----------------------------------------------------------------------------------------
+bool IsBinaryCacheFile(string fname) {
+  ifstream ifs(fname, ios::binary);
+  char magic[sizeof(CACHE_FILE_MAGIC)];
+  if(!ifs.read(magic, sizeof(magic)))
+    return false;
+  return memcmp(magic, CACHE_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+// ----------------------------------------------------------------------------------------
+void ReadCsvCacheFile(string fname, function<void(CacheEntry&)> fcn) {
+  ifstream ifs(fname);
+  if(!ifs.is_open())
+    throw runtime_error("input cache file " + fname + " dne\n");
+
+  string line;
+  // check the header is right (no cached info)
+  if(!getline(ifs, line))
+    return;  // return for zero length file
+  line.erase(remove(line.begin(), line.end(), '\r'), line.end());
+  vector<string> headstrs(SplitString(line, ","));
+  assert(headstrs[0].find("unique_ids") == 0);
+  assert(headstrs[1].find("logprob") == 0);
+  assert(headstrs[2].find("naive_seq") == 0);
+  assert(headstrs[3].find("naive_hfrac") == 0);
+  assert(headstrs[4].find("errors") == 0);
+
+  while(getline(ifs, line)) {
+    line.erase(remove(line.begin(), line.end(), '\r'), line.end());
+    vector<string> column_list = SplitString(line, ",");
+    assert(column_list.size() == 5);
+    CacheEntry entry;
+    entry.name_ = column_list[0];
+    if(column_list[1].size() > 0) {
+      entry.has_logprob_ = true;
+      entry.logprob_ = stod(column_list[1]);
+    }
+    entry.naive_seq_ = column_list[2];
+    if(column_list[3].size() > 0) {
+      entry.has_naive_hfrac_ = true;
+      entry.naive_hfrac_ = stod(column_list[3]);
+    }
+    entry.errors_ = column_list[4];
+    fcn(entry);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void ReadCacheJournal(string cachefname, function<void(CacheEntry&)> fcn) {
+  ifstream ifs(CacheJournalName(cachefname), ios::binary);
+  if(!ifs.is_open())
+    return;
+  string contents((istreambuf_iterator<char>(ifs)), istreambuf_iterator<char>());
+  if(contents.size() == 0)
+    return;
+  if(contents.size() < sizeof(CacheJournalHeader) || memcmp(contents.data(), CACHE_JOURNAL_MAGIC, sizeof(CACHE_JOURNAL_MAGIC)) != 0)
+    throw runtime_error("cache journal " + CacheJournalName(cachefname) + " has the wrong magic number");
+  size_t ipos(sizeof(CacheJournalHeader));
+  while(ipos < contents.size()) {
+    CacheEntry entry;
+    size_t size(ParseRecord(contents.data() + ipos, contents.size() - ipos, entry));
+    if(size == 0) {  // partial record at the end, i.e. a process died in the middle of appending
+      cerr << "  WARNING ignoring truncated record at the end of cache journal " << CacheJournalName(cachefname) << endl;
+      break;
+    }
+    fcn(entry);
+    ipos += size;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void ReadCacheEntries(string fname, function<void(CacheEntry&)> fcn) {
+  if(IsBinaryCacheFile(fname)) {
+    MappedCacheFile cachefile(fname);
+    for(size_t ientry=0; ientry<cachefile.n_entries(); ++ientry) {
+      CacheEntry entry(cachefile.entry(ientry));
+      fcn(entry);
+    }
+    ReadCacheJournal(fname, fcn);
+  } else {
+    ReadCsvCacheFile(fname, fcn);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void WriteCsvCacheFile(string fname, const vector<CacheEntry> &entries) {
+  ofstream ofs(fname);
+  if(!ofs.is_open())
+    throw runtime_error("couldn't open output cache file " + fname + "\n");
+  ofs << "unique_ids,logprob,naive_seq,naive_hfrac,errors" << endl;
+  ofs << setprecision(20);
+  for(auto &entry : entries) {
+    ofs << entry.name_ << ",";
+    if(entry.has_logprob_)
+      ofs << entry.logprob_;
+    ofs << "," << entry.naive_seq_ << ",";
+    if(entry.has_naive_hfrac_)
+      ofs << entry.naive_hfrac_;
+    ofs << "," << entry.errors_ << endl;
+  }
+  ofs.close();
+}
+
+// ----------------------------------------------------------------------------------------
+void WriteBinaryCacheFile(string fname, vector<CacheEntry> entries) {
+  sort(entries.begin(), entries.end(), [](const CacheEntry &a, const CacheEntry &b) { return a.name_ < b.name_; });
+  for(size_t ie=1; ie<entries.size(); ++ie)
+    if(entries[ie].name_ == entries[ie-1].name_)
+      throw runtime_error("duplicate key " + entries[ie].name_ + " in WriteBinaryCacheFile() (should've been merged)");
+
+  string tmpfname(fname + ".tmp." + to_string(getpid()));
+  ofstream ofs(tmpfname, ios::binary);
+  if(!ofs.is_open())
+    throw runtime_error("couldn't open output cache file " + tmpfname + "\n");
+
+  CacheFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic_, CACHE_FILE_MAGIC, sizeof(CACHE_FILE_MAGIC));
+  header.version_ = CACHE_FILE_VERSION;
+  header.n_entries_ = entries.size();
+  vector<uint64_t> index;
+  uint64_t offset(sizeof(CacheFileHeader));
+  for(auto &entry : entries) {
+    index.push_back(offset);
+    offset += PaddedRecordSize(entry);
+  }
+  header.index_offset_ = offset;
+  ofs.write((const char*)&header, sizeof(header));
+
+  string buffer;
+  for(auto &entry : entries) {
+    AppendRecord(entry, buffer);
+    if(buffer.size() > (1 << 20)) {  // don't keep the whole thing in memory
+      ofs.write(buffer.data(), buffer.size());
+      buffer.clear();
+    }
+  }
+  ofs.write(buffer.data(), buffer.size());
+  ofs.write((const char*)index.data(), index.size() * sizeof(uint64_t));
+  ofs.close();
+  if(!ofs)
+    throw runtime_error("failed writing binary cache file " + tmpfname);
+  int fd(open(tmpfname.c_str(), O_RDONLY));  // make sure it's on disk before it replaces the old one, so a crash can't leave us with an empty or partial file
+  if(fd < 0 || fsync(fd) != 0)
+    throw runtime_error("couldn't sync binary cache file " + tmpfname + " (" + strerror(errno) + ")");
+  close(fd);
+  if(rename(tmpfname.c_str(), fname.c_str()) != 0)
+    throw runtime_error("couldn't rename " + tmpfname + " to " + fname + " (" + strerror(errno) + ")");
+}
+
+// ----------------------------------------------------------------------------------------
+vector<CacheEntry> MergedCacheEntries(string fname) {
+  vector<CacheEntry> entries;
+  map<string, size_t> ientries;
+  ReadCacheEntries(fname, [&](CacheEntry &entry) {
+      auto it = ientries.find(entry.name_);
+      if(it == ientries.end()) {
+	ientries[entry.name_] = entries.size();
+	entries.push_back(entry);
+      } else {
+	entries[it->second].Update(entry);
+      }
+    });
+  return entries;
+}
+
+// ----------------------------------------------------------------------------------------
+void CompactCacheFile(string fname) {
+  if(!IsBinaryCacheFile(fname))
+    throw runtime_error("can only compact binary cache files, but " + fname + " isn't one");
+  WriteBinaryCacheFile(fname, MergedCacheEntries(fname));
+  remove(CacheJournalName(fname).c_str());  // NOTE anything appended between reading the journal and removing it is lost, so don't compact while anybody's writing
+}
+
+}
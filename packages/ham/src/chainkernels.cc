@@ -0,0 +1,515 @@
+#include "chainkernels.h"
+
+#include <cstring>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAM_CHAIN_AVX2
+#endif
+
+// NOTE the avx2 and scalar versions in here have to do exactly the same floating point operations in exactly the same order,
+// so don't let the compiler reassociate or contract anything in this file (-Ofast would otherwise allow both)
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize ("no-fast-math", "fp-contract=off")
+#elif defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+// cephes-style exp() and log() coefficients (the rational approximations from cephes exp.c and log.c)
+static const double exp_min = -708.3964185322641;  // below this, exp() is subnormal, and we just call it zero
+static const double exp_log2e = 1.4426950408889634073599;
+static const double exp_c1 = 6.93145751953125e-1;  // ln(2) split in two pieces for the argument reduction
+static const double exp_c2 = 1.42860682030941723212e-6;
+static const double exp_p[3] = {1.26177193074810590878e-4, 3.02994407707441961300e-2, 9.99999999999999999910e-1};
+static const double exp_q[4] = {3.00198505138664455042e-6, 2.52448340349684104192e-3, 2.27265548208155028766e-1, 2.00000000000000000009e0};
+static const double exp_magic = 4503599627370496.0 + 1023.0;  // 2^52 plus the exponent bias: adding an integer to this puts (integer + bias) in the low mantissa bits
+
+static const double log_sqrth = 0.70710678118654752440;
+static const double log_c1 = 0.693359375;  // ln(2) split in two pieces
+static const double log_c2 = -2.121944400546905827679e-4;
+static const double log_p[6] = {1.01875663804580931796e-4, 4.97494994976747001425e-1, 4.70579119878881725854e0, 1.44989225341610930846e1, 1.79368678507819816313e1, 7.70838733755885391666e0};
+static const double log_q[5] = {1.12873587189167450590e1, 4.52279145837532221105e1, 8.29875266912776603211e1, 7.11544750618563894466e1, 2.31251620126765340583e1};  // leading coefficient is one
+static const double log_two52 = 4503599627370496.0;
+
+static const int kernel_none = 0, kernel_scalar = 1, kernel_avx2 = 2;
+
+// ----------------------------------------------------------------------------------------
+static bool Avx2Available() {
+#ifdef HAM_CHAIN_AVX2
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+// ----------------------------------------------------------------------------------------
+static int ResolveChainKernelMode(string mode) {
+  if(mode == "auto")
+    return Avx2Available() ? kernel_avx2 : kernel_scalar;
+  else if(mode == "scalar")
+    return kernel_scalar;
+  else if(mode == "none")
+    return kernel_none;
+  else
+    throw runtime_error("unknown chain kernel mode '" + mode + "'");
+}
+
+static int chain_kernel_impl(ResolveChainKernelMode("auto"));
+
+// ----------------------------------------------------------------------------------------
+void SetChainKernelMode(string mode) {
+  chain_kernel_impl = ResolveChainKernelMode(mode);
+}
+
+// ----------------------------------------------------------------------------------------
+bool ChainKernelsOn() {
+  return chain_kernel_impl != kernel_none;
+}
+
+// ----------------------------------------------------------------------------------------
+string ChainKernelName() {
+  if(chain_kernel_impl == kernel_avx2)
+    return "avx2";
+  else if(chain_kernel_impl == kernel_scalar)
+    return "scalar";
+  else
+    return "none";
+}
+
+// ----------------------------------------------------------------------------------------
+double ChainExp(double x) {
+  if(!(x >= exp_min))  // also catches -INFINITY
+    return 0.;
+  double n = floor(x * exp_log2e + 0.5);
+  double r = x - n * exp_c1;
+  r = r - n * exp_c2;
+  double rr = r * r;
+  double px = r * ((exp_p[0] * rr + exp_p[1]) * rr + exp_p[2]);
+  double qx = ((exp_q[0] * rr + exp_q[1]) * rr + exp_q[2]) * rr + exp_q[3];
+  r = px / (qx - px);
+  r = 1. + 2. * r;
+
+  double biased = n + exp_magic;  // and then shift the low bits up into the exponent to get 2^n
+  uint64_t bits;
+  memcpy(&bits, &biased, sizeof(bits));
+  bits <<= 52;
+  double pow2n;
+  memcpy(&pow2n, &bits, sizeof(pow2n));
+  return r * pow2n;
+}
+
+// ----------------------------------------------------------------------------------------
+double ChainLog(double x) {
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  uint64_t ebits(((bits >> 52) & 0x7ffULL) | 0x4330000000000000ULL);  // exponent field as the low bits of 2^52, so we can convert it exactly
+  double e;
+  memcpy(&e, &ebits, sizeof(e));
+  e = e - log_two52;
+  e = e - 1022.;
+  bits = (bits & 0x800fffffffffffffULL) | 0x3fe0000000000000ULL;  // mantissa, in [0.5, 1)
+  double m;
+  memcpy(&m, &bits, sizeof(m));
+
+  if(m < log_sqrth) {
+    e = e - 1.;
+    m = (m + m) - 1.;
+  } else {
+    m = m - 1.;
+  }
+  double z = m * m;
+  double p = ((((log_p[0] * m + log_p[1]) * m + log_p[2]) * m + log_p[3]) * m + log_p[4]) * m + log_p[5];
+  double q = ((((m + log_q[0]) * m + log_q[1]) * m + log_q[2]) * m + log_q[3]) * m + log_q[4];
+  double y = m * (z * p / q);
+  y = y + e * log_c2;
+  y = y - 0.5 * z;
+  z = m + y;
+  z = z + e * log_c1;
+  return z;
+}
+
+// ----------------------------------------------------------------------------------------
+// set <live_heads> to the heads that are non-zero in <previous>, and update [<chain_begin>, <chain_end>) to the range of chain states that could be non-zero in the current column
+static void ColumnRange(CompiledModel *cm, const double *previous, size_t &chain_begin, size_t &chain_end, size_t *live_heads, size_t &n_live) {
+  size_t ibegin(cm->chain_end()), iend(cm->chain_begin());
+  if(chain_end > chain_begin) {  // each non-zero chain state feeds the next one
+    ibegin = chain_begin + 1;
+    iend = min(chain_end + 1, cm->chain_end());
+  }
+  n_live = 0;
+  for(size_t ih = 0; ih < cm->n_chain_heads(); ++ih) {
+    if(previous[cm->chain_head(ih)] == -INFINITY)
+      continue;
+    live_heads[n_live++] = ih;
+    ibegin = min(ibegin, cm->chain_head_begin(ih));
+    iend = max(iend, cm->chain_head_end(ih));
+  }
+  chain_begin = ibegin;
+  chain_end = max(ibegin, iend);
+}
+
+// ----------------------------------------------------------------------------------------
+static inline double ChainEmission(size_t ist, const double * const *rows, const double *counts, size_t n_rows) {
+  double emission(0.);
+  for(size_t ir = 0; ir < n_rows; ++ir)
+    emission = emission + counts[ir] * rows[ir][ist];
+  return emission;
+}
+
+// ----------------------------------------------------------------------------------------
+static inline void ViterbiStateScalar(CompiledModel *cm, size_t ist, const double *previous, double *current, TracebackTable *traceback_table, size_t position, const double * const *rows, const double *counts, size_t n_rows,
+                                      const size_t *live_heads, size_t n_live) {
+  size_t ich(ist - cm->chain_begin());
+  double emission(ChainEmission(ist, rows, counts, n_rows));
+  double best(-INFINITY);
+  int ptr(-1);
+  for(size_t il = 0; il < n_live; ++il) {
+    if(ist < cm->chain_head_begin(live_heads[il]) || ist >= cm->chain_head_end(live_heads[il]))  // no edge (so it'd be -INFINITY anyway)
+      continue;
+    size_t ihead(cm->chain_head(live_heads[il]));
+    double dpval = (previous[ihead] + emission) + cm->chain_head_log_probs(live_heads[il])[ich];
+    if(dpval > best) {
+      best = dpval;
+      ptr = ihead;
+    }
+  }
+  double dpval = (previous[ist - 1] + emission) + cm->chain_log_probs()[ich];
+  if(dpval > best) {
+    best = dpval;
+    ptr = ist - 1;
+  }
+  current[ist] = best;
+  if(ptr >= 0)
+    traceback_table->set(position, ist, ptr);
+}
+
+// ----------------------------------------------------------------------------------------
+static inline void ForwardStateScalar(CompiledModel *cm, size_t ist, const double *previous, double *current, const double * const *rows, const double *counts, size_t n_rows,
+                                      const size_t *live_heads, size_t n_live) {
+  size_t ich(ist - cm->chain_begin());
+  double emission(ChainEmission(ist, rows, counts, n_rows));
+  double dpvals[CompiledModel::max_chain_heads_ + 1];
+  size_t n_dpvals(0);
+  double maxval(-INFINITY);
+  for(size_t il = 0; il < n_live; ++il) {
+    if(ist < cm->chain_head_begin(live_heads[il]) || ist >= cm->chain_head_end(live_heads[il]))  // would add exactly zero to the sum below
+      continue;
+    dpvals[n_dpvals] = (previous[cm->chain_head(live_heads[il])] + emission) + cm->chain_head_log_probs(live_heads[il])[ich];
+    maxval = dpvals[n_dpvals] > maxval ? dpvals[n_dpvals] : maxval;
+    ++n_dpvals;
+  }
+  dpvals[n_dpvals] = (previous[ist - 1] + emission) + cm->chain_log_probs()[ich];
+  maxval = dpvals[n_dpvals] > maxval ? dpvals[n_dpvals] : maxval;
+  ++n_dpvals;
+  if(n_dpvals == 1 || maxval == -INFINITY) {  // NOTE for one term, maxval + ChainLog(ChainExp(0.)) is exactly maxval
+    current[ist] = maxval;
+    return;
+  }
+  double sum(0.);
+  for(size_t id = 0; id < n_dpvals; ++id)
+    sum = sum + ChainExp(dpvals[id] - maxval);
+  current[ist] = maxval + ChainLog(sum);
+}
+
+// ----------------------------------------------------------------------------------------
+static inline void UpdateViterbiEnd(CompiledModel *cm, size_t ist, double *current, size_t &out_begin, size_t &out_end, double &best_end_logprob, int &best_end_state) {
+  if(current[ist] == -INFINITY)
+    return;
+  if(out_end == out_begin)
+    out_begin = ist;
+  out_end = ist + 1;
+  double logprob = current[ist] + cm->end_log_probs()[ist];
+  if(logprob > best_end_logprob) {
+    best_end_logprob = logprob;
+    best_end_state = ist;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+static inline void UpdateForwardRange(size_t ist, double *current, size_t &out_begin, size_t &out_end) {
+  if(current[ist] == -INFINITY)
+    return;
+  if(out_end == out_begin)
+    out_begin = ist;
+  out_end = ist + 1;
+}
+
+// ----------------------------------------------------------------------------------------
+static double ForwardEndTotalScalar(CompiledModel *cm, double *current, size_t ibegin, size_t iend) {
+  // log sum over [ibegin, iend) of exp(current + end transition), summing in four interleaved pieces to match the avx2 version
+  const double *end_log_probs(cm->end_log_probs());
+  double maxval(-INFINITY);
+  for(size_t ist = ibegin; ist < iend; ++ist) {
+    double val = current[ist] + end_log_probs[ist];
+    maxval = val > maxval ? val : maxval;
+  }
+  if(maxval == -INFINITY)
+    return -INFINITY;
+  double sums[4] = {0., 0., 0., 0.};
+  for(size_t ist = ibegin; ist < iend; ++ist)
+    sums[(ist - ibegin) % 4] = sums[(ist - ibegin) % 4] + ChainExp((current[ist] + end_log_probs[ist]) - maxval);
+  return maxval + ChainLog((sums[0] + sums[1]) + (sums[2] + sums[3]));
+}
+
+// ----------------------------------------------------------------------------------------
+static void ChainViterbiColumnScalar(CompiledModel *cm, const double *previous, double *current, TracebackTable *traceback_table, size_t position, vector<const double*> &emission_rows, vector<double> &emission_counts,
+                                     size_t &chain_begin, size_t &chain_end, double &best_end_logprob, int &best_end_state) {
+  size_t live_heads[CompiledModel::max_chain_heads_], n_live(0);
+  ColumnRange(cm, previous, chain_begin, chain_end, live_heads, n_live);
+  size_t out_begin(chain_begin), out_end(chain_begin);
+  best_end_logprob = -INFINITY;
+  best_end_state = -1;
+  for(size_t ist = chain_begin; ist < chain_end; ++ist) {
+    ViterbiStateScalar(cm, ist, previous, current, traceback_table, position, emission_rows.data(), emission_counts.data(), emission_rows.size(), live_heads, n_live);
+    UpdateViterbiEnd(cm, ist, current, out_begin, out_end, best_end_logprob, best_end_state);
+  }
+  chain_begin = out_begin;
+  chain_end = out_end;
+}
+
+// ----------------------------------------------------------------------------------------
+static double ChainForwardColumnScalar(CompiledModel *cm, const double *previous, double *current, vector<const double*> &emission_rows, vector<double> &emission_counts,
+                                       size_t &chain_begin, size_t &chain_end) {
+  size_t live_heads[CompiledModel::max_chain_heads_], n_live(0);
+  ColumnRange(cm, previous, chain_begin, chain_end, live_heads, n_live);
+  size_t out_begin(chain_begin), out_end(chain_begin);
+  for(size_t ist = chain_begin; ist < chain_end; ++ist) {
+    ForwardStateScalar(cm, ist, previous, current, emission_rows.data(), emission_counts.data(), emission_rows.size(), live_heads, n_live);
+    UpdateForwardRange(ist, current, out_begin, out_end);
+  }
+  double total(ForwardEndTotalScalar(cm, current, chain_begin, chain_end));
+  chain_begin = out_begin;
+  chain_end = out_end;
+  return total;
+}
+
+#ifdef HAM_CHAIN_AVX2
+// NOTE the avx2 functions mustn't call any of the (non-vex) scalar functions above while the upper halves of the ymm registers are in use, since on some
+// cpus the transition penalty is much larger than the work we save. So the last (partial) block in each column is done with masked loads and stores.
+
+// ----------------------------------------------------------------------------------------
+__attribute__((target("avx2"))) static inline __m256d ExpAvx2(__m256d x) {
+  __m256d underflow = _mm256_cmp_pd(x, _mm256_set1_pd(exp_min), _CMP_NGE_UQ);
+  x = _mm256_blendv_pd(x, _mm256_setzero_pd(), underflow);  // keep the lanes that we're going to zero out from making inf/nan intermediate values
+  __m256d n = _mm256_floor_pd(_mm256_add_pd(_mm256_mul_pd(x, _mm256_set1_pd(exp_log2e)), _mm256_set1_pd(0.5)));
+  __m256d r = _mm256_sub_pd(x, _mm256_mul_pd(n, _mm256_set1_pd(exp_c1)));
+  r = _mm256_sub_pd(r, _mm256_mul_pd(n, _mm256_set1_pd(exp_c2)));
+  __m256d rr = _mm256_mul_pd(r, r);
+  __m256d px = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(exp_p[0]), rr), _mm256_set1_pd(exp_p[1]));
+  px = _mm256_add_pd(_mm256_mul_pd(px, rr), _mm256_set1_pd(exp_p[2]));
+  px = _mm256_mul_pd(r, px);
+  __m256d qx = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(exp_q[0]), rr), _mm256_set1_pd(exp_q[1]));
+  qx = _mm256_add_pd(_mm256_mul_pd(qx, rr), _mm256_set1_pd(exp_q[2]));
+  qx = _mm256_add_pd(_mm256_mul_pd(qx, rr), _mm256_set1_pd(exp_q[3]));
+  r = _mm256_div_pd(px, _mm256_sub_pd(qx, px));
+  r = _mm256_add_pd(_mm256_set1_pd(1.), _mm256_mul_pd(_mm256_set1_pd(2.), r));
+
+  __m256d biased = _mm256_add_pd(n, _mm256_set1_pd(exp_magic));
+  __m256d pow2n = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_castpd_si256(biased), 52));
+  return _mm256_blendv_pd(_mm256_mul_pd(r, pow2n), _mm256_setzero_pd(), underflow);
+}
+
+// ----------------------------------------------------------------------------------------
+__attribute__((target("avx2"))) static inline __m256d LogAvx2(__m256d x) {
+  __m256i bits = _mm256_castpd_si256(x);
+  __m256i ebits = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi64(bits, 52), _mm256_set1_epi64x(0x7ff)), _mm256_set1_epi64x(0x4330000000000000LL));
+  __m256d e = _mm256_sub_pd(_mm256_castsi256_pd(ebits), _mm256_set1_pd(log_two52));
+  e = _mm256_sub_pd(e, _mm256_set1_pd(1022.));
+  bits = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(0x800fffffffffffffLL)), _mm256_set1_epi64x(0x3fe0000000000000LL));
+  __m256d m = _mm256_castsi256_pd(bits);
+
+  __m256d small = _mm256_cmp_pd(m, _mm256_set1_pd(log_sqrth), _CMP_LT_OQ);
+  e = _mm256_blendv_pd(e, _mm256_sub_pd(e, _mm256_set1_pd(1.)), small);
+  m = _mm256_blendv_pd(_mm256_sub_pd(m, _mm256_set1_pd(1.)), _mm256_sub_pd(_mm256_add_pd(m, m), _mm256_set1_pd(1.)), small);
+
+  __m256d z = _mm256_mul_pd(m, m);
+  __m256d p = _mm256_add_pd(_mm256_mul_pd(_mm256_set1_pd(log_p[0]), m), _mm256_set1_pd(log_p[1]));
+  for(size_t ic = 2; ic < 6; ++ic)
+    p = _mm256_add_pd(_mm256_mul_pd(p, m), _mm256_set1_pd(log_p[ic]));
+  __m256d q = _mm256_add_pd(m, _mm256_set1_pd(log_q[0]));
+  for(size_t ic = 1; ic < 5; ++ic)
+    q = _mm256_add_pd(_mm256_mul_pd(q, m), _mm256_set1_pd(log_q[ic]));
+  __m256d y = _mm256_mul_pd(m, _mm256_div_pd(_mm256_mul_pd(z, p), q));
+  y = _mm256_add_pd(y, _mm256_mul_pd(e, _mm256_set1_pd(log_c2)));
+  y = _mm256_sub_pd(y, _mm256_mul_pd(_mm256_set1_pd(0.5), z));
+  z = _mm256_add_pd(m, y);
+  z = _mm256_add_pd(z, _mm256_mul_pd(e, _mm256_set1_pd(log_c1)));
+  return z;
+}
+
+// ----------------------------------------------------------------------------------------
+__attribute__((target("avx2"))) static inline __m256i LaneMask(size_t n_lanes) {  // first <n_lanes> lanes on
+  return _mm256_cmpgt_epi64(_mm256_set1_epi64x(n_lanes), _mm256_set_epi64x(3, 2, 1, 0));
+}
+
+// ----------------------------------------------------------------------------------------
+__attribute__((target("avx2"))) static inline __m256d MaskLoad(const double *ptr, __m256i mask, __m256d off_val) {  // lanes that are off get <off_val>
+  return _mm256_blendv_pd(off_val, _mm256_maskload_pd(ptr, mask), _mm256_castsi256_pd(mask));
+}
+
+// ----------------------------------------------------------------------------------------
+__attribute__((target("avx2"))) static inline __m256d EmissionAvx2(size_t ist, __m256i mask, const double * const *rows, const double *counts, size_t n_rows) {
+  __m256d emission = _mm256_setzero_pd();
+  for(size_t ir = 0; ir < n_rows; ++ir)
+    emission = _mm256_add_pd(emission, _mm256_mul_pd(_mm256_set1_pd(counts[ir]), _mm256_maskload_pd(rows[ir] + ist, mask)));
+  return emission;
+}
+
+// ----------------------------------------------------------------------------------------
+__attribute__((target("avx2"))) static inline bool HeadOverlaps(CompiledModel *cm, size_t ih, size_t ist) {  // does the <ih>th head have any edges to [ist, ist + 4)?
+  return ist < cm->chain_head_end(ih) && ist + 4 > cm->chain_head_begin(ih);
+}
+
+// ----------------------------------------------------------------------------------------
+__attribute__((target("avx2"))) static void ChainViterbiColumnAvx2(CompiledModel *cm, const double *previous, double *current, TracebackTable *traceback_table, size_t position, vector<const double*> &emission_rows, vector<double> &emission_counts,
+                                                                   size_t &chain_begin, size_t &chain_end, double &best_end_logprob, int &best_end_state) {
+  size_t live_heads[CompiledModel::max_chain_heads_], n_live(0);
+  ColumnRange(cm, previous, chain_begin, chain_end, live_heads, n_live);
+  size_t out_begin(chain_begin), out_end(chain_begin);
+  best_end_logprob = -INFINITY;
+  best_end_state = -1;
+  const double * const *rows(emission_rows.data());
+  const double *counts(emission_counts.data());
+  size_t n_rows(emission_rows.size());
+  const double *chain_log_probs(cm->chain_log_probs());
+  size_t c0(cm->chain_begin());
+  __m256d minus_inf = _mm256_set1_pd(-INFINITY);
+
+  for(size_t ist = chain_begin; ist < chain_end; ist += 4) {
+    size_t n_lanes(min((size_t)4, chain_end - ist));
+    __m256i mask = LaneMask(n_lanes);
+    __m256d emission = EmissionAvx2(ist, mask, rows, counts, n_rows);
+    __m256d best = minus_inf;
+    __m256d ptr = _mm256_set1_pd(-1.);
+    for(size_t il = 0; il < n_live; ++il) {
+      if(!HeadOverlaps(cm, live_heads[il], ist))
+        continue;
+      size_t ihead(cm->chain_head(live_heads[il]));
+      __m256d dpval = _mm256_add_pd(_mm256_add_pd(_mm256_set1_pd(previous[ihead]), emission), MaskLoad(cm->chain_head_log_probs(live_heads[il]) + ist - c0, mask, minus_inf));
+      __m256d better = _mm256_cmp_pd(dpval, best, _CMP_GT_OQ);
+      best = _mm256_blendv_pd(best, dpval, better);
+      ptr = _mm256_blendv_pd(ptr, _mm256_set1_pd(ihead), better);
+    }
+    __m256d dpval = _mm256_add_pd(_mm256_add_pd(MaskLoad(previous + ist - 1, mask, minus_inf), emission), MaskLoad(chain_log_probs + ist - c0, mask, minus_inf));
+    __m256d better = _mm256_cmp_pd(dpval, best, _CMP_GT_OQ);
+    best = _mm256_blendv_pd(best, dpval, better);
+    ptr = _mm256_blendv_pd(ptr, _mm256_set_pd(ist + 2., ist + 1., ist, ist - 1.), better);
+    _mm256_maskstore_pd(current + ist, mask, best);
+
+    double ptrs[4];
+    _mm256_storeu_pd(ptrs, ptr);
+    for(size_t il = 0; il < n_lanes; ++il) {
+      if(ptrs[il] >= 0.)
+        traceback_table->set(position, ist + il, (int16_t)ptrs[il]);
+      UpdateViterbiEnd(cm, ist + il, current, out_begin, out_end, best_end_logprob, best_end_state);
+    }
+  }
+  chain_begin = out_begin;
+  chain_end = out_end;
+}
+
+// ----------------------------------------------------------------------------------------
+__attribute__((target("avx2"))) static double ForwardEndTotalAvx2(CompiledModel *cm, double *current, size_t ibegin, size_t iend) {
+  const double *end_log_probs(cm->end_log_probs());
+  __m256d minus_inf = _mm256_set1_pd(-INFINITY);
+  __m256d maxvals = minus_inf;
+  for(size_t ist = ibegin; ist < iend; ist += 4) {
+    __m256i mask = LaneMask(min((size_t)4, iend - ist));
+    maxvals = _mm256_max_pd(_mm256_add_pd(MaskLoad(current + ist, mask, minus_inf), MaskLoad(end_log_probs + ist, mask, minus_inf)), maxvals);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, maxvals);
+  double maxval(-INFINITY);
+  for(size_t il = 0; il < 4; ++il)
+    maxval = lanes[il] > maxval ? lanes[il] : maxval;
+  if(maxval == -INFINITY)
+    return -INFINITY;
+
+  __m256d sums = _mm256_setzero_pd();  // NOTE lanes that are off add exactly zero, which doesn't change the sums
+  __m256d vmax = _mm256_set1_pd(maxval);
+  for(size_t ist = ibegin; ist < iend; ist += 4) {
+    __m256i mask = LaneMask(min((size_t)4, iend - ist));
+    sums = _mm256_add_pd(sums, ExpAvx2(_mm256_sub_pd(_mm256_add_pd(MaskLoad(current + ist, mask, minus_inf), MaskLoad(end_log_probs + ist, mask, minus_inf)), vmax)));
+  }
+  _mm256_storeu_pd(lanes, sums);
+  _mm256_storeu_pd(lanes, LogAvx2(_mm256_set1_pd((lanes[0] + lanes[1]) + (lanes[2] + lanes[3]))));
+  return maxval + lanes[0];
+}
+
+// ----------------------------------------------------------------------------------------
+__attribute__((target("avx2"))) static double ChainForwardColumnAvx2(CompiledModel *cm, const double *previous, double *current, vector<const double*> &emission_rows, vector<double> &emission_counts,
+                                                                     size_t &chain_begin, size_t &chain_end) {
+  size_t live_heads[CompiledModel::max_chain_heads_], n_live(0);
+  ColumnRange(cm, previous, chain_begin, chain_end, live_heads, n_live);
+  size_t out_begin(chain_begin), out_end(chain_begin);
+  const double * const *rows(emission_rows.data());
+  const double *counts(emission_counts.data());
+  size_t n_rows(emission_rows.size());
+  const double *chain_log_probs(cm->chain_log_probs());
+  size_t c0(cm->chain_begin());
+  __m256d minus_inf = _mm256_set1_pd(-INFINITY);
+
+  __m256d dpvals[CompiledModel::max_chain_heads_ + 1];
+  for(size_t ist = chain_begin; ist < chain_end; ist += 4) {
+    size_t n_lanes(min((size_t)4, chain_end - ist));
+    __m256i mask = LaneMask(n_lanes);
+    __m256d emission = EmissionAvx2(ist, mask, rows, counts, n_rows);
+    size_t n_dpvals(0);
+    __m256d maxval = minus_inf;
+    for(size_t il = 0; il < n_live; ++il) {  // NOTE lanes to which a head has no edge get -INFINITY, which adds exactly zero, i.e. the same as the scalar version skipping them
+      if(!HeadOverlaps(cm, live_heads[il], ist))
+        continue;
+      dpvals[n_dpvals] = _mm256_add_pd(_mm256_add_pd(_mm256_set1_pd(previous[cm->chain_head(live_heads[il])]), emission), MaskLoad(cm->chain_head_log_probs(live_heads[il]) + ist - c0, mask, minus_inf));
+      maxval = _mm256_max_pd(dpvals[n_dpvals], maxval);
+      ++n_dpvals;
+    }
+    dpvals[n_dpvals] = _mm256_add_pd(_mm256_add_pd(MaskLoad(previous + ist - 1, mask, minus_inf), emission), MaskLoad(chain_log_probs + ist - c0, mask, minus_inf));
+    maxval = _mm256_max_pd(dpvals[n_dpvals], maxval);
+    ++n_dpvals;
+    if(n_dpvals == 1) {
+      _mm256_maskstore_pd(current + ist, mask, maxval);
+    } else {
+      __m256d sum = _mm256_setzero_pd();
+      for(size_t id = 0; id < n_dpvals; ++id)
+        sum = _mm256_add_pd(sum, ExpAvx2(_mm256_sub_pd(dpvals[id], maxval)));
+      __m256d dead = _mm256_cmp_pd(maxval, minus_inf, _CMP_EQ_OQ);
+      _mm256_maskstore_pd(current + ist, mask, _mm256_blendv_pd(_mm256_add_pd(maxval, LogAvx2(sum)), minus_inf, dead));
+    }
+    for(size_t il = 0; il < n_lanes; ++il)
+      UpdateForwardRange(ist + il, current, out_begin, out_end);
+  }
+  double total(ForwardEndTotalAvx2(cm, current, chain_begin, chain_end));
+  chain_begin = out_begin;
+  chain_end = out_end;
+  return total;
+}
+#endif
+
+// ----------------------------------------------------------------------------------------
+void ChainViterbiColumn(CompiledModel *cm, const double *previous, double *current, TracebackTable *traceback_table, size_t position, vector<const double*> &emission_rows, vector<double> &emission_counts,
+                        size_t &chain_begin, size_t &chain_end, double &best_end_logprob, int &best_end_state) {
+#ifdef HAM_CHAIN_AVX2
+  if(chain_kernel_impl == kernel_avx2) {
+    ChainViterbiColumnAvx2(cm, previous, current, traceback_table, position, emission_rows, emission_counts, chain_begin, chain_end, best_end_logprob, best_end_state);
+    return;
+  }
+#endif
+  ChainViterbiColumnScalar(cm, previous, current, traceback_table, position, emission_rows, emission_counts, chain_begin, chain_end, best_end_logprob, best_end_state);
+}
+
+// ----------------------------------------------------------------------------------------
+double ChainForwardColumn(CompiledModel *cm, const double *previous, double *current, vector<const double*> &emission_rows, vector<double> &emission_counts,
+                          size_t &chain_begin, size_t &chain_end) {
+#ifdef HAM_CHAIN_AVX2
+  if(chain_kernel_impl == kernel_avx2)
+    return ChainForwardColumnAvx2(cm, previous, current, emission_rows, emission_counts, chain_begin, chain_end);
+#endif
+  return ChainForwardColumnScalar(cm, previous, current, emission_rows, emission_counts, chain_begin, chain_end);
+}
+
+}
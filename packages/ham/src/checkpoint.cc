@@ -0,0 +1,72 @@
+#include "checkpoint.h"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+CheckpointWriter::CheckpointWriter(string fname) :
+  fname_(fname),
+  tmpfname_(fname + ".tmp." + to_string(getpid()))
+{
+  ofs_.open(tmpfname_, ios::binary);
+  if(!ofs_.is_open())
+    throw runtime_error("couldn't open checkpoint file " + tmpfname_ + "\n");
+  ofs_.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+  Write(CHECKPOINT_VERSION);
+}
+
+// ----------------------------------------------------------------------------------------
+CheckpointWriter::~CheckpointWriter() {
+  if(ofs_.is_open()) {  // didn't get to Close(), so leave the previous checkpoint alone
+    ofs_.close();
+    remove(tmpfname_.c_str());
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void CheckpointWriter::Close() {
+  ofs_.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));  // trailing copy, so Reader can tell it got to the end
+  ofs_.close();
+  if(!ofs_)
+    throw runtime_error("failed writing checkpoint file " + tmpfname_);
+  if(rename(tmpfname_.c_str(), fname_.c_str()) != 0)
+    throw runtime_error("couldn't rename " + tmpfname_ + " to " + fname_ + " (" + strerror(errno) + ")");
+}
+
+// ----------------------------------------------------------------------------------------
+CheckpointReader::CheckpointReader(string fname) :
+  fname_(fname),
+  ifs_(fname, ios::binary)
+{
+  if(!ifs_.is_open())
+    throw runtime_error("checkpoint file " + fname + " dne\n");
+  char magic[sizeof(CHECKPOINT_MAGIC)];
+  ifs_.read(magic, sizeof(magic));
+  Check();
+  if(memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)
+    throw runtime_error(fname + " isn't a checkpoint file");
+  uint32_t version;
+  Read(version);
+  if(version != CHECKPOINT_VERSION)
+    throw runtime_error("checkpoint file " + fname + " has version " + to_string(version) + ", but we can only read version " + to_string(CHECKPOINT_VERSION));
+}
+
+// ----------------------------------------------------------------------------------------
+void CheckpointReader::Close() {
+  char magic[sizeof(CHECKPOINT_MAGIC)];
+  ifs_.read(magic, sizeof(magic));
+  Check();
+  if(memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)
+    throw runtime_error("checkpoint file " + fname_ + " doesn't end where we expected (written by a different version of bcrham?)");
+  ifs_.close();
+}
+
+// ----------------------------------------------------------------------------------------
+void CheckpointReader::Check() {
+  if(!ifs_)
+    throw runtime_error("ran off the end of checkpoint file " + fname_);
+}
+}
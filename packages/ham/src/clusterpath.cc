@@ -4,9 +4,11 @@ namespace ham {
 ClusterPath::ClusterPath(Partition initial_partition, double initial_logprob):
   finished_(false),
   initial_path_index_(0),  // NOTE changing default from -1 to 0... which I think is ok, but it may screw something up
-  max_log_prob_of_partition_(-INFINITY)
+  initial_partition_(initial_partition),
+  current_partition_(initial_partition),
+  max_log_prob_of_partition_(-INFINITY),
+  i_best_(0)
 {
-  partitions_.push_back(initial_partition);
   logprobs_.push_back(initial_logprob);
 }
 
@@ -24,17 +26,11 @@ void ClusterPath::set_logprob(size_t il, double logprob) {
 }
 
 // ----------------------------------------------------------------------------------------
-void ClusterPath::AddPartition(Partition partition, double logprob, size_t n_max_partitions)  { // , double max_drop) {
-  partitions_.push_back(partition);
+void ClusterPath::AddMerge(ClusterId parent_a, ClusterId parent_b, ClusterId merged, double logprob) {
+  merges_.push_back(MergeEvent(parent_a, parent_b, merged));
+  ApplyMerge(current_partition_, merges_.back());
   logprobs_.push_back(logprob);
 
-  // int pot_parents = PotentialNumberOfParents(partition);
-  // double combifactor(1.);
-  // if(pot_parents > 0)  // if all partitions consist of one sequence, the above formula gives zero, but we want one
-  //   combifactor = double(1.) / pot_parents;
-  // logweights_.push_back(logweights_.back() + log(combifactor));
-
-
   // NOTE see also set_logprob()
   if(max_log_prob_of_partition_ == -INFINITY or logprob > max_log_prob_of_partition_) {  // partitions usually get added with -INFINITY, in which case <max_log_prob_of_partition_> will stay -INFINITY, so <i_best_> will be the last one
     max_log_prob_of_partition_ = logprob;
@@ -46,12 +42,100 @@ void ClusterPath::AddPartition(Partition partition, double logprob, size_t n_max
   //   cout << "        stopping after drop " << max_log_prob_of_partition_ << " --> " << logprob << endl;
   //   finished_ = true;  // NOTE this will not play well with multiple maxima, but I'm pretty sure we shouldn't be getting those
   // }
+}
 
-  if(n_max_partitions > 0 && partitions_.size() > n_max_partitions) {  // NOTE we don't check here that we're not removing the best partition
-    partitions_.pop_front();
-    logprobs_.pop_front();
+// ----------------------------------------------------------------------------------------
+void ClusterPath::ApplyMerge(Partition &partition, const MergeEvent &merge) {
+  if(!partition.erase(merge.parent_a_) || !partition.erase(merge.parent_b_))
+    throw runtime_error("merge parent not in partition in ClusterPath::ApplyMerge()");
+  partition.insert(merge.merged_);
+}
+
+// ----------------------------------------------------------------------------------------
+void ClusterPath::UndoMerge(Partition &partition, const MergeEvent &merge) {
+  if(!partition.erase(merge.merged_))
+    throw runtime_error("merged cluster not in partition in ClusterPath::UndoMerge()");
+  partition.insert(merge.parent_a_);
+  partition.insert(merge.parent_b_);
+}
+
+// ----------------------------------------------------------------------------------------
+// start from whichever end is closer
+Partition ClusterPath::GetPartition(size_t ipart) {
+  if(ipart >= n_partitions())
+    throw runtime_error("partition index " + to_string(ipart) + " too large in ClusterPath::GetPartition() (have " + to_string(n_partitions()) + ")");
+  if(ipart < merges_.size() - ipart) {
+    Partition partition(initial_partition_);
+    for(size_t im=0; im<ipart; ++im)
+      ApplyMerge(partition, merges_[im]);
+    return partition;
+  } else {
+    Partition partition(current_partition_);
+    for(size_t im=merges_.size(); im>ipart; --im)
+      UndoMerge(partition, merges_[im - 1]);
+    return partition;
   }
+}
 
+// ----------------------------------------------------------------------------------------
+void ClusterPath::ForEachPartition(size_t istart, function<void(size_t, Partition&)> fcn) {
+  if(istart >= n_partitions())
+    return;
+  Partition partition(GetPartition(istart));
+  fcn(istart, partition);
+  for(size_t ipart=istart+1; ipart<n_partitions(); ++ipart) {
+    ApplyMerge(partition, merges_[ipart - 1]);
+    fcn(ipart, partition);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// partition <i> consists of the current clusters, except that the merges from <i> on haven't happened yet
+set<ClusterId> ClusterPath::ClustersSince(size_t istart) {
+  set<ClusterId> clusters(current_partition_.begin(), current_partition_.end());
+  for(size_t im=istart; im<merges_.size(); ++im) {
+    clusters.insert(merges_[im].parent_a_);
+    clusters.insert(merges_[im].parent_b_);
+  }
+  return clusters;
+}
+
+// ----------------------------------------------------------------------------------------
+void ClusterPath::WriteCheckpoint(CheckpointWriter &ckpt) {
+  ckpt.Write(initial_partition_);
+  ckpt.Write(current_partition_);
+  ckpt.Write((uint64_t)merges_.size());
+  for(auto &merge : merges_) {
+    ckpt.Write(merge.parent_a_);
+    ckpt.Write(merge.parent_b_);
+    ckpt.Write(merge.merged_);
+  }
+  ckpt.Write(logprobs_);
+  ckpt.Write(max_log_prob_of_partition_);
+  ckpt.Write((uint64_t)i_best_);
+  ckpt.Write(finished_);
+  ckpt.Write(initial_path_index_);
+}
+
+// ----------------------------------------------------------------------------------------
+void ClusterPath::ReadCheckpoint(CheckpointReader &ckpt) {
+  ckpt.Read(initial_partition_);
+  ckpt.Read(current_partition_);
+  merges_.clear();
+  for(size_t n=ckpt.ReadSize(); n>0; --n) {
+    ClusterId parent_a, parent_b, merged;
+    ckpt.Read(parent_a);
+    ckpt.Read(parent_b);
+    ckpt.Read(merged);
+    merges_.push_back(MergeEvent(parent_a, parent_b, merged));
+  }
+  ckpt.Read(logprobs_);
+  ckpt.Read(max_log_prob_of_partition_);
+  i_best_ = ckpt.ReadSize();
+  ckpt.Read(finished_);
+  ckpt.Read(initial_path_index_);
+  if(logprobs_.size() != merges_.size() + 1)
+    throw runtime_error("inconsistent merge log in ClusterPath::ReadCheckpoint()");
 }
 
 // // ----------------------------------------------------------------------------------------
@@ -0,0 +1,125 @@
+#include "clusterregistry.h"
+namespace ham {
+// ----------------------------------------------------------------------------------------
+unsigned ClusterRegistry::UidIndex(string uid) {
+  auto it = uid_indices_.find(uid);
+  if(it != uid_indices_.end())
+    return it->second;
+  uid_strs_.push_back(uid);
+  uid_indices_[uid] = uid_strs_.size() - 1;
+  return uid_strs_.size() - 1;
+}
+
+// ----------------------------------------------------------------------------------------
+ClusterId ClusterRegistry::Intern(string namestr, string delimiter) {
+  vector<unsigned> uids;
+  for(auto &uid : SplitString(namestr, delimiter))
+    uids.push_back(UidIndex(uid));
+  return Intern(uids);
+}
+
+// ----------------------------------------------------------------------------------------
+ClusterId ClusterRegistry::Intern(const vector<unsigned> &uids) {
+  auto it = ids_.find(uids);
+  if(it != ids_.end())
+    return it->second;
+  uids_.push_back(uids);
+  ids_[uids] = uids_.size() - 1;
+  return uids_.size() - 1;
+}
+
+// ----------------------------------------------------------------------------------------
+ClusterId ClusterRegistry::Join(ClusterId id_a, ClusterId id_b) {
+  unsigned long long pairkey = (id_a < id_b) ? ((unsigned long long)id_a << 32 | id_b) : ((unsigned long long)id_b << 32 | id_a);
+  auto it = joins_.find(pairkey);
+  if(it != joins_.end())
+    return it->second;
+
+  if(NameLess(id_b, id_a))  // NOTE like the old string join, this doesn't sort *within* the two clusters
+    swap(id_a, id_b);
+  vector<unsigned> uids(uids_[id_a]);
+  uids.insert(uids.end(), uids_[id_b].begin(), uids_[id_b].end());
+  ClusterId joint_id = Intern(uids);
+  joins_[pairkey] = joint_id;
+  return joint_id;
+}
+
+// ----------------------------------------------------------------------------------------
+ClusterId ClusterRegistry::FindJoin(ClusterId id_a, ClusterId id_b) {
+  unsigned long long pairkey = (id_a < id_b) ? ((unsigned long long)id_a << 32 | id_b) : ((unsigned long long)id_b << 32 | id_a);
+  auto it = joins_.find(pairkey);
+  return it == joins_.end() ? NO_CLUSTER : it->second;
+}
+
+// ----------------------------------------------------------------------------------------
+bool ClusterRegistry::NameLess(ClusterId id_a, ClusterId id_b) {
+  if(id_a == id_b)
+    return false;
+  const vector<unsigned> &uids_a(uids_[id_a]), &uids_b(uids_[id_b]);
+  size_t n_common(min(uids_a.size(), uids_b.size()));
+  for(size_t iu=0; iu<n_common; ++iu) {
+    if(uids_a[iu] == uids_b[iu])
+      continue;
+    // uids can't contain the delimiter, so the first differing uid decides the order of the full strings
+    const string &str_a(uid_strs_[uids_a[iu]]), &str_b(uid_strs_[uids_b[iu]]);
+    size_t n_chars(min(str_a.size(), str_b.size()));
+    int cmp = str_a.compare(0, n_chars, str_b, 0, n_chars);
+    if(cmp != 0)
+      return cmp < 0;
+    // if one uid is a prefix of the other, compare the next character in each full name string, which for the shorter one is either the delimiter or the end of the string
+    int next_a = str_a.size() > n_chars ? (unsigned char)str_a[n_chars] : (iu + 1 < uids_a.size() ? ':' : -1);
+    int next_b = str_b.size() > n_chars ? (unsigned char)str_b[n_chars] : (iu + 1 < uids_b.size() ? ':' : -1);
+    return next_a < next_b;
+  }
+  return uids_a.size() < uids_b.size();  // if one is a prefix of the other, the shorter one comes first
+}
+
+// ----------------------------------------------------------------------------------------
+bool ClusterRegistry::Contains(ClusterId id, string uid) {
+  auto it = uid_indices_.find(uid);
+  if(it == uid_indices_.end())
+    return false;
+  for(auto iuid : uids_[id])
+    if(iuid == it->second)
+      return true;
+  return false;
+}
+
+// ----------------------------------------------------------------------------------------
+string ClusterRegistry::Name(ClusterId id, string delimiter) {
+  string namestr;
+  for(size_t iu=0; iu<uids_[id].size(); ++iu) {
+    if(iu > 0)
+      namestr += delimiter;
+    namestr += uid_strs_[uids_[id][iu]];
+  }
+  return namestr;
+}
+// ----------------------------------------------------------------------------------------
+void ClusterRegistry::WriteCheckpoint(CheckpointWriter &ckpt) {
+  ckpt.Write(uid_strs_);
+  ckpt.Write(uids_);
+  ckpt.Write(joins_);
+}
+
+// ----------------------------------------------------------------------------------------
+void ClusterRegistry::ReadCheckpoint(CheckpointReader &ckpt) {
+  vector<string> uid_strs;
+  vector<vector<unsigned> > uids;
+  ckpt.Read(uid_strs);
+  ckpt.Read(uids);
+  if(uid_strs.size() < uid_strs_.size() || !equal(uid_strs_.begin(), uid_strs_.end(), uid_strs.begin()) ||
+     uids.size() < uids_.size() || !equal(uids_.begin(), uids_.end(), uids.begin()))
+    throw runtime_error("checkpoint doesn't match the current input (it has to be resumed with the same --infile and --input-cachefname)");
+  uid_strs_.swap(uid_strs);
+  uids_.swap(uids);
+  ckpt.Read(joins_);
+
+  uid_indices_.clear();
+  for(size_t iuid=0; iuid<uid_strs_.size(); ++iuid)
+    uid_indices_[uid_strs_[iuid]] = iuid;
+  ids_.clear();
+  for(size_t id=0; id<uids_.size(); ++id)
+    ids_[uids_[id]] = id;
+}
+}
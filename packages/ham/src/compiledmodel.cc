@@ -0,0 +1,187 @@
+#include "compiledmodel.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+size_t CompiledModel::ApproxBytes() {
+  size_t n_doubles(from_log_probs_.size() + to_log_probs_.size() + init_log_probs_.size() + end_log_probs_.size() + from_probs_.size() + init_probs_.size() + end_probs_.size() + emission_log_probs_.size() + chain_head_log_probs_.size() + chain_log_probs_.size());
+  size_t bytes(sizeof(CompiledModel) + n_doubles * sizeof(double));
+  bytes += (from_offsets_.size() + to_offsets_.size()) * sizeof(uint32_t) + (from_indices_.size() + to_indices_.size() + chain_heads_.size() + chain_extra_out_states_.size()) * sizeof(uint16_t);
+  bytes += to_states_.size() * sizeof(bitset<STATE_MAX>) + chain_head_ranges_.size() * sizeof(size_t);
+  return bytes;
+}
+
+// ----------------------------------------------------------------------------------------
+void CompiledModel::Compile(vector<State*> &states, State *initial, Track *track) {
+  n_states_ = states.size();
+  n_symbols_ = track->alphabet_size() + 1;
+  ambiguous_index_ = track->ambiguous_index();
+
+  from_offsets_.assign(n_states_ + 1, 0);
+  from_indices_.clear();
+  from_log_probs_.clear();
+  init_log_probs_.assign(n_states_, -INFINITY);
+  end_log_probs_.assign(n_states_, -INFINITY);
+  to_states_.assign(n_states_, bitset<STATE_MAX>());
+  narrow_traceback_ok_ = true;
+  for(size_t ist = 0; ist < n_states_; ++ist) {
+    from_offsets_[ist] = from_indices_.size();
+    for(auto &ifrom : *states[ist]->from_state_indices()) {
+      if(abs((int)ist - (int)ifrom) > 127)
+        narrow_traceback_ok_ = false;
+      from_indices_.push_back(ifrom);
+      from_log_probs_.push_back(states[ifrom]->transition_logprob(ist));
+    }
+    if((*initial->to_states())[ist])
+      init_log_probs_[ist] = initial->transition_logprob(ist);
+    end_log_probs_[ist] = states[ist]->end_transition_logprob();
+    to_states_[ist] = *states[ist]->to_states();
+  }
+  from_offsets_[n_states_] = from_indices_.size();
+
+  // transpose into the outgoing edge arrays (going through the destination states in order means each state's outgoing edges end up sorted by destination)
+  to_offsets_.assign(n_states_ + 1, 0);
+  for(size_t iedge = 0; iedge < from_indices_.size(); ++iedge)
+    ++to_offsets_[from_indices_[iedge] + 1];
+  for(size_t ist = 0; ist < n_states_; ++ist)
+    to_offsets_[ist + 1] += to_offsets_[ist];
+  to_indices_.resize(from_indices_.size());
+  to_log_probs_.resize(from_log_probs_.size());
+  vector<uint32_t> next_slot(to_offsets_.begin(), to_offsets_.end() - 1);
+  for(size_t ist = 0; ist < n_states_; ++ist) {
+    for(size_t iedge = from_offsets_[ist]; iedge < from_offsets_[ist + 1]; ++iedge) {
+      uint32_t islot(next_slot[from_indices_[iedge]]++);
+      to_indices_[islot] = ist;
+      to_log_probs_[islot] = from_log_probs_[iedge];
+    }
+  }
+
+  from_probs_.resize(from_log_probs_.size());
+  for(size_t iedge = 0; iedge < from_log_probs_.size(); ++iedge)
+    from_probs_[iedge] = exp(from_log_probs_[iedge]);
+  init_probs_.resize(n_states_);
+  end_probs_.resize(n_states_);
+  for(size_t ist = 0; ist < n_states_; ++ist) {
+    init_probs_[ist] = exp(init_log_probs_[ist]);
+    end_probs_[ist] = exp(end_log_probs_[ist]);
+  }
+
+  DetectChain();
+  CompileEmissions(states);
+}
+
+// ----------------------------------------------------------------------------------------
+void CompiledModel::CompileEmissions(vector<State*> &states) {
+  FillEmissions(states, 0., emission_log_probs_);
+}
+
+// ----------------------------------------------------------------------------------------
+void CompiledModel::CompileRescaledEmissions(vector<State*> &states, double factor, EmissionOverlay &overlay) {
+  FillEmissions(states, factor, overlay);
+}
+
+// ----------------------------------------------------------------------------------------
+void CompiledModel::FillEmissions(vector<State*> &states, double factor, aligned_vector<double> &emission_log_probs) {
+  // pack each state's current emissions into <emission_log_probs> or, if <factor> is non-zero, the ones they'd have if we rescaled them by <factor>
+  assert(states.size() == n_states_);
+  emission_log_probs.assign(n_symbols_ * n_states_, -INFINITY);
+  for(size_t ist = 0; ist < n_states_; ++ist) {
+    if(factor != 0.) {
+      vector<double> log_probs(states[ist]->RescaledEmissionLogprobs(factor));
+      assert(log_probs.size() == n_symbols_ - 1);
+      for(size_t isym = 0; isym < n_symbols_ - 1; ++isym)
+        emission_log_probs[isym * n_states_ + ist] = log_probs[isym];
+    } else {
+      for(size_t isym = 0; isym < n_symbols_ - 1; ++isym)
+        emission_log_probs[isym * n_states_ + ist] = states[ist]->EmissionLogprob(isym);
+    }
+    if(states[ist]->ambiguous_char() != "")  // otherwise leave it at -INFINITY (the State would read off the end of its table) NOTE rescaling doesn't change this
+      emission_log_probs[(n_symbols_ - 1) * n_states_ + ist] = states[ist]->EmissionLogprob(ambiguous_index_);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void CompiledModel::DetectChain() {
+  // Look for the longest run of states [chain_begin_, chain_end_) in which each state's incoming edges are from the state right before it in the run, or from "head"
+  // states with index smaller than chain_begin_. The germline states in the hmms that hmmwriter.py writes look like this (with the left insert states as heads).
+  chain_begin_ = chain_end_ = 0;
+  size_t istart(1);  // the kernels read the previous column at chain_begin_ - 1, so we need at least one state before the chain
+  while(istart < n_states_) {
+    size_t iend(istart);
+    while(iend < n_states_ && ChainLinkOk(istart, iend))
+      ++iend;
+    if(iend - istart > chain_end_ - chain_begin_) {
+      chain_begin_ = istart;
+      chain_end_ = iend;
+    }
+    istart = max(iend, istart + 1);
+  }
+
+  chain_heads_.clear();
+  chain_head_ranges_.clear();
+  chain_head_log_probs_.clear();
+  chain_log_probs_.clear();
+  chain_extra_out_states_.clear();
+  if(chain_end_ - chain_begin_ < min_chain_length_) {  // not worth it
+    chain_begin_ = chain_end_ = 0;
+    return;
+  }
+
+  size_t n_chain(chain_end_ - chain_begin_);
+  for(size_t ist = chain_begin_; ist < chain_end_; ++ist) {  // heads have to be in increasing index order, so the kernels try the edges in the same order as the general code
+    for(size_t iedge = from_offsets_[ist]; iedge < from_offsets_[ist + 1]; ++iedge) {
+      if(from_indices_[iedge] < chain_begin_ && find(chain_heads_.begin(), chain_heads_.end(), from_indices_[iedge]) == chain_heads_.end())
+        chain_heads_.push_back(from_indices_[iedge]);
+    }
+  }
+  sort(chain_heads_.begin(), chain_heads_.end());
+  if(chain_heads_.size() > max_chain_heads_) {
+    chain_heads_.clear();
+    chain_begin_ = chain_end_ = 0;
+    return;
+  }
+
+  chain_head_ranges_.assign(2 * chain_heads_.size(), 0);
+  for(size_t ih = 0; ih < chain_heads_.size(); ++ih) {
+    chain_head_ranges_[2*ih] = chain_end_;
+    chain_head_ranges_[2*ih + 1] = chain_begin_;
+  }
+  chain_head_log_probs_.assign(chain_heads_.size() * n_chain, -INFINITY);
+  chain_log_probs_.assign(n_chain, -INFINITY);
+  for(size_t ist = chain_begin_; ist < chain_end_; ++ist) {
+    for(size_t iedge = from_offsets_[ist]; iedge < from_offsets_[ist + 1]; ++iedge) {
+      size_t ifrom(from_indices_[iedge]);
+      if(ifrom >= chain_begin_) {  // i.e. ifrom is ist - 1
+        chain_log_probs_[ist - chain_begin_] = from_log_probs_[iedge];
+        continue;
+      }
+      size_t ih(find(chain_heads_.begin(), chain_heads_.end(), ifrom) - chain_heads_.begin());
+      chain_head_ranges_[2*ih] = min(chain_head_ranges_[2*ih], ist);
+      chain_head_ranges_[2*ih + 1] = ist + 1;
+      chain_head_log_probs_[ih * n_chain + ist - chain_begin_] = from_log_probs_[iedge];
+    }
+    bitset<STATE_MAX> others(to_states_[ist]);
+    if(ist + 1 < chain_end_)
+      others.reset(ist + 1);
+    if(others.any())
+      chain_extra_out_states_.push_back(ist);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+bool CompiledModel::ChainLinkOk(size_t istart, size_t ist) {
+  // can <ist> be part of a chain that starts at <istart>?
+  bool has_chain_edge(false);
+  for(size_t iedge = from_offsets_[ist]; iedge < from_offsets_[ist + 1]; ++iedge) {
+    if(from_log_probs_[iedge] == -INFINITY)  // the kernels use -INFINITY to mean "no edge"
+      return false;
+    size_t ifrom(from_indices_[iedge]);
+    if(ist > istart && ifrom + 1 == ist)
+      has_chain_edge = true;
+    else if(ifrom >= istart)
+      return false;
+  }
+  return ist == istart || has_chain_edge;
+}
+
+}
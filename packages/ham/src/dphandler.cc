@@ -1,11 +1,12 @@
 #include "dphandler.h"
 namespace ham {
 // ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
-DPHandler::DPHandler(string algorithm, Args *args, GermLines &gl, HMMHolder &hmms):
+DPHandler::DPHandler(string algorithm, Args *args, GermLines &gl, HMMHolder &hmms, size_t n_threads):
   algorithm_(algorithm),
   args_(args),
   gl_(gl),
-  hmms_(hmms)
+  hmms_(hmms),
+  thread_pool_(n_threads)
 {
 }
 
@@ -20,6 +21,9 @@ void DPHandler::Clear() {
   paths_.clear();
   scores_.clear();
   per_gene_support_.clear();
+  emission_overlays_.clear();
+  composite_scores_.clear();
+  emission_bounds_.clear();
 }
 
 // ----------------------------------------------------------------------------------------
@@ -60,11 +64,17 @@ Result DPHandler::Run(vector<Sequence*> pseqvector, KBounds kbounds, vector<stri
 
 // ----------------------------------------------------------------------------------------
 Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq, bool clear_cache) {
-  clock_t run_start(clock());
-
   Sequences seqs;
   for(auto &seq : seqvector)
     seqs.AddSeq(seq);
+  return Run(seqs, kbounds, only_gene_list, overall_mute_freq, clear_cache);
+}
+
+// ----------------------------------------------------------------------------------------
+Result DPHandler::Run(Sequences seqs, KBounds kbounds, vector<string> only_gene_list, double overall_mute_freq, bool clear_cache) {
+  clock_t run_start(clock());
+  if(seqs.profile_only() && algorithm_ != "forward")  // viterbi needs the actual sequences to fill the reco events
+    throw runtime_error("DPHandler::Run() got profile-only sequences for " + seqs.name_str() + ", but they only work for the forward algorithm");
 
   // convert <only_gene_list> to a set for each region
   map<string, set<string> > only_genes;
@@ -85,10 +95,10 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
   map<KSet, double> best_scores; // best score for each kset (summed over regions)
   map<KSet, double> total_scores; // total score for each kset (summed over regions)
   map<KSet, map<string, string> > best_genes; // map from a kset to its corresponding triplet of best genes
-  if(!args_->dont_rescale_emissions()) {  // reset the emission probabilities in the hmms to reflect the frequences in this particular set of sequences
+  emission_overlays_.clear();
+  if(!args_->dont_rescale_emissions()) {  // get emission probabilities that reflect the frequences in this particular set of sequences (the hmms themselves don't change)
     assert(overall_mute_freq != -INFINITY);  // make sure the caller remembered to set it
-    // NOTE it's super important to *un*set them after you're done
-    hmms_.RescaleOverallMuteFreqs(only_genes, overall_mute_freq);
+    hmms_.RescaledEmissions(only_genes, overall_mute_freq, emission_overlays_);
   }
 
   Result result(kbounds, args_->locus());
@@ -98,6 +108,11 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
   KSet best_kset(0, 0);
   double *total_score = &result.total_score_;  // total score for all ksets
   int n_too_long(0), n_run(0), n_total(0);
+  if(args_->composite_vdj())
+    FillCompositeScores(seqs, kbounds, only_genes);
+  bool prune(args_->prune_viterbi() && algorithm_ == "viterbi" && !args_->composite_vdj());
+  if(prune)
+    CacheEmissionBounds(seqs, only_genes);
   for(size_t k_v = kbounds.vmax - 1; k_v >= kbounds.vmin; --k_v) {  // loop in reverse order to facilitate chunk caching: in principle we calculate V once the first time through, and after that can just copy over pieces of the first dp table (roughly the same for D and J)
     for(size_t k_d = kbounds.dmax - 1; k_d >= kbounds.dmin; --k_d) {
       ++n_total;
@@ -106,7 +121,15 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
         continue;
       }
       KSet kset(k_v, k_d);
-      RunKSet(seqs, kset, only_genes, &best_scores, &total_scores, &best_genes);
+      double prune_threshold(prune ? best_score - args_->prune_margin() : -INFINITY);  // skip anything that can't get above this
+      if(prune && KSetBound(kset, only_genes) < prune_threshold) {
+        ++result.n_pruned_ksets_;
+        continue;
+      }
+      if(args_->composite_vdj())
+        CompositeKSet(kbounds, kset, only_genes, &best_scores, &total_scores, &best_genes);
+      else
+        RunKSet(seqs, kbounds, kset, only_genes, &best_scores, &total_scores, &best_genes, prune_threshold, &result.n_pruned_genes_);
       ++n_run;
       *total_score = AddInLogSpace(total_scores[kset], *total_score);  // sum up the probabilities for each kset, log P_tot = log \sum_i P_k_i
       if(args_->debug() == 2 && algorithm_ == "forward") printf("            %9.2f (%.1e)  tot: %7.2f\n", total_scores[kset], exp(total_scores[kset]), *total_score);
@@ -114,11 +137,12 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
         best_score = best_scores[kset];
         best_kset = kset;
       }
-      if(algorithm_ == "viterbi" && best_scores[kset] != -INFINITY)  // add event to the vector in <result>
+      if(algorithm_ == "viterbi" && best_scores[kset] != -INFINITY && !args_->composite_vdj())  // add event to the vector in <result>
         result.PushBackRecoEvent(FillRecoEvent(seqs, kset, best_genes[kset], best_scores[kset]));
     }
   }
   if(args_->debug() && n_too_long > 0) cout << "      skipped " << n_too_long << " (of " << n_total << ") k sets 'cause they were longer than the sequence (ran " << n_run << ")" << endl;
+  if(args_->debug() && prune) cout << "      pruned " << result.n_pruned_ksets_ << " k sets and " << result.n_pruned_genes_ << " genes in other k sets" << endl;
 
   // return if no valid path
   if(best_kset.v == 0 && best_kset.d == 0) {
@@ -127,6 +151,16 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
     return result;
   }
 
+  if(algorithm_ == "viterbi" && args_->composite_vdj()) {  // we've only got scores, so do the tracebacks for the best k set (the chunk caching finds the trellises from FillCompositeScores())
+    for(auto &region : gl_.regions_) {
+      string origin;
+      Sequences suffix_seqs(GetSubSeqs(seqs, KSet(kbounds.vmin, kbounds.dmin), region));
+      vector<string> suffix_strs(GetQueryStrs(seqs, KSet(kbounds.vmin, kbounds.dmin), region));
+      FillTrellis(best_kset, GetSubSeqs(seqs, best_kset, region), GetQueryStrs(seqs, best_kset, region), best_genes[best_kset][region], origin, region == "j" ? &suffix_seqs : nullptr, region == "j" ? &suffix_strs : nullptr);
+    }
+    result.PushBackRecoEvent(FillRecoEvent(seqs, best_kset, best_genes[best_kset], best_scores[best_kset]));
+  }
+
   if(algorithm_ == "viterbi")
     result.Finalize(gl_, per_gene_support_, best_kset, kbounds);
 
@@ -160,9 +194,6 @@ Result DPHandler::Run(vector<Sequence> seqvector, KBounds kbounds, vector<string
     }
   }
 
-  if(!args_->dont_rescale_emissions())  // if we rescaled them above, re-rescale the overall mean mute freqs
-    hmms_.UnRescaleOverallMuteFreqs(only_genes);
-
   return result;
 }
 
@@ -213,41 +244,60 @@ void DPHandler::PrintCachedTrellisSize() {
 }
 
 // ----------------------------------------------------------------------------------------
-void DPHandler::FillTrellis(KSet kset, Sequences query_seqs, vector<string> query_strs, string gene, string &origin) {
+void DPHandler::FillTrellis(KSet kset, Sequences query_seqs, vector<string> query_strs, string gene, string &origin, Sequences *suffix_seqs, vector<string> *suffix_strs, double min_score) {
+  // NOTE this gets run for several genes at once (see RunKSet()), so it has to stick to <gene>'s entries in the caches, and look them up with at() rather
+  // than [] (which the standard doesn't guarantee is safe to call from more than one thread, even for a key that's already there)
+  // If <suffix_seqs> is set, we chunk cache from the end of the sequence rather than the start (see Trellis::SuffixViterbi()): when we don't find a
+  // match we fill a suffix trellis for <suffix_seqs> (the longest query we'll see for this region), and take our chunk from that.
+  // If the viterbi score (including the gene choice prob) is below <min_score>, we skip the traceback, don't store anything, and set <origin> to "pruned".
+  map<vector<string>, Trellis> &gene_cachefo(scratch_cachefo_.at(gene));
+  const EmissionOverlay *emission_overlay(emission_overlays_.count(gene) > 0 ? &emission_overlays_.at(gene) : nullptr);
 
   Trellis *cached_trellis(nullptr);
   if(!args_->no_chunk_cache()) {   // figure out if we've already got a trellis with a dp table which includes the one we're about to calculate (we should, unless this is the first kset)
     // NOTE we're no longer looking through previously chunk cached cachefo here. Which I think is ok, but possible only because we loop over ksets in decreasing order (?)
-    for(auto &kv : scratch_cachefo_[gene]) {  // kv: (query string vector, trellis)
-      vector<string> cached_query_strs(kv.first);
+    for(auto &kv : gene_cachefo) {  // kv: (query string vector, trellis)
+      const vector<string> &cached_query_strs(kv.first);
       if(cached_query_strs.size() != query_strs.size())  // have to have same number of sequences (it'd be much harder for this to happen now that I'm now reusing dphandlers)
 	continue;
+      if((suffix_seqs != nullptr) != kv.second.suffix())
+        continue;
 
       // loop over all the query strings for this trellis to see if they all match
       bool found_match(true);
       for(size_t iseq = 0; iseq < cached_query_strs.size(); ++iseq) {  // NOTE this starts to seem like it might be bottlenecking me when I'm applying it for short d sequences
-        if(cached_query_strs[iseq].find(query_strs[iseq]) != 0) {  // if <query_strs[iseq]> (the current query) doesn't appear starting at position zero in <cached_query_strs[iseq]> (a previously cached query), we'll need to recalculate
-          found_match = false;
+        const string &cached_str(cached_query_strs[iseq]), &query_str(query_strs[iseq]);
+        if(suffix_seqs)
+          found_match = cached_str.size() >= query_str.size() && cached_str.compare(cached_str.size() - query_str.size(), query_str.size(), query_str) == 0;  // does the current query appear at the end of the cached one?
+        else
+          found_match = cached_str.find(query_str) == 0;  // if <query_str> (the current query) doesn't appear starting at position zero in <cached_str> (a previously cached query), we'll need to recalculate
+        if(!found_match)
           break;
-        }
       }
 
       // if they all match, then use it
       if(found_match) {
-	cached_trellis = &scratch_cachefo_[gene][cached_query_strs];  // will copy over the required chunk of the old trellis into a new trellis for the current query
+	cached_trellis = &kv.second;  // will copy over the required chunk of the old trellis into a new trellis for the current query
         break;
       }
     }
   }
 
-  Trellis tmptrell(hmms_.Get(gene), query_seqs, cached_trellis);  // NOTE chunk cached trellisi don't get kept around -- we should be able to always just go back to the original one
+  origin = cached_trellis ? "chunk" : "scratch";
+  if(cached_trellis == nullptr && suffix_seqs) {
+    gene_cachefo[*suffix_strs] = Trellis(hmms_.Get(gene), *suffix_seqs, nullptr, &pool_, emission_overlay);
+    cached_trellis = &gene_cachefo[*suffix_strs];
+    if(algorithm_ == "viterbi")
+      cached_trellis->SuffixViterbi();
+    else
+      cached_trellis->SuffixForward();
+  }
+
+  Trellis tmptrell(hmms_.Get(gene), query_seqs, cached_trellis, &pool_, emission_overlay);  // NOTE chunk cached trellisi don't get kept around -- we should be able to always just go back to the original one
   Trellis *trell(&tmptrell);  // convenience pointer
   if(cached_trellis == nullptr) {   // if we didn't find a suitable chunk cached trellis
-    scratch_cachefo_[gene][query_strs] = Trellis(hmms_.Get(gene), query_seqs);
-    trell = &scratch_cachefo_[gene][query_strs];
-    origin = "scratch";
-  } else {
-    origin = "chunk";
+    gene_cachefo[query_strs] = Trellis(hmms_.Get(gene), query_seqs, nullptr, &pool_, emission_overlay);
+    trell = &gene_cachefo[query_strs];
   }
 
   // run the actual dp algorithms
@@ -255,19 +305,47 @@ void DPHandler::FillTrellis(KSet kset, Sequences query_seqs, vector<string> quer
   if(algorithm_ == "viterbi") {
     trell->Viterbi();
     uncorrected_score = trell->ending_viterbi_log_prob();
-    paths_[gene][kset] = TracebackPath(hmms_.Get(gene));
+    if(min_score != -INFINITY && AddWithMinusInfinities(uncorrected_score, log(hmms_.Get(gene)->overall_prob())) < min_score) {
+      origin = "pruned";
+      return;
+    }
+    map<KSet, TracebackPath> &gene_paths(paths_.at(gene));
+    gene_paths[kset] = TracebackPath(hmms_.Get(gene));
     if(uncorrected_score != -INFINITY)   // if there's a valid path
-      trell->Traceback(paths_[gene][kset]);
+      trell->Traceback(gene_paths[kset]);
   } else if(algorithm_ == "forward") {
-    trell->Forward();
+    if(args_->scaled_forward())
+      trell->ScaledForward();
+    else
+      trell->Forward();
     uncorrected_score = trell->ending_forward_log_prob();
+    if(args_->check_scaled_forward() && origin == "scratch" && !suffix_seqs)
+      CheckScaledForward(trell, query_seqs, gene);
   } else {
     assert(0);
   }
 
   // correct the score for gene choice probs
   double gene_choice_score = log(hmms_.Get(gene)->overall_prob());
-  scores_[gene][kset] = AddWithMinusInfinities(uncorrected_score, gene_choice_score);
+  scores_.at(gene)[kset] = AddWithMinusInfinities(uncorrected_score, gene_choice_score);
+}
+
+// ----------------------------------------------------------------------------------------
+void DPHandler::CheckScaledForward(Trellis *trell, Sequences &query_seqs, string gene) {
+  // rerun the forward trellis <trell> with the other method (scaled vs log space), and make sure the log probs for every length agree
+  Trellis checktrell(hmms_.Get(gene), query_seqs, nullptr, &pool_, emission_overlays_.count(gene) > 0 ? &emission_overlays_.at(gene) : nullptr);
+  if(args_->scaled_forward())
+    checktrell.Forward();
+  else
+    checktrell.ScaledForward();
+  double tolerance(1e-6);  // in log space, i.e. a relative tolerance on the probability
+  for(size_t length = 1; length <= query_seqs.GetSequenceLength(); ++length) {
+    double val(trell->ending_forward_log_prob(length)), checkval(checktrell.ending_forward_log_prob(length));
+    if(val == checkval)  // includes both -INFINITY
+      continue;
+    if(fabs(val - checkval) > tolerance * max(1., fabs(checkval)))
+      throw runtime_error("ERROR scaled and log space forward log probs differ for " + gene + " at length " + to_string(length) + ": " + to_string(val) + " vs " + to_string(checkval) + " (" + query_seqs.name_str(":") + ")");
+  }
 }
 
 // ----------------------------------------------------------------------------------------
@@ -363,7 +441,10 @@ RecoEvent DPHandler::FillRecoEvent(Sequences &seqs, KSet kset, map<string, strin
 
 // ----------------------------------------------------------------------------------------
 vector<string> DPHandler::GetQueryStrs(Sequences &seqs, KSet kset, string region) {
+  // NOTE for profile-only sequences we instead return the raw profile counts, which is all the trellis cares about (and which chunk caches the same way)
   Sequences query_seqs(GetSubSeqs(seqs, kset, region));
+  if(seqs.profile_only())
+    return vector<string>{query_seqs.full_profile().key()};
   vector<string> query_strs;
   for(size_t iseq = 0; iseq < seqs.n_seqs(); ++iseq)
     query_strs.push_back(query_seqs[iseq].undigitized());
@@ -390,6 +471,185 @@ KSet DPHandler::FindPartialCacheMatch(string region, string gene, KSet kset) {
   return KSet(0, 0);
 }
 
+// ----------------------------------------------------------------------------------------
+void DPHandler::FillCompositeScores(Sequences &seqs, KBounds &kbounds, map<string, set<string> > &only_genes) {
+  // For --composite-vdj: instead of going through the k sets one by one, fill each gene's dp tables once (v from the start of the sequence, d once for
+  // each k_v, and j from the end) and read off the gene's log prob for every boundary at which its query can end (or, for j, start). Then each k set
+  // in CompositeKSet() is just a few lookups, and the results are identical to RunKSet(), since the values come from the same trellises.
+  composite_scores_.clear();
+  if(kbounds.vmin + kbounds.dmin >= seqs.GetSequenceLength())  // no k sets fit in the sequence
+    return;
+  vector<string> genes;
+  for(auto &region : gl_.regions_) {
+    for(auto &gene : only_genes[region]) {
+      InitCache(gene);
+      hmms_.Get(gene);  // make sure it's read from disk before we go multi-threaded
+      composite_scores_[gene] = vector<double>(region == "d" ? kbounds.vmax * kbounds.dmax : seqs.GetSequenceLength(), -INFINITY);
+      genes.push_back(gene);
+    }
+  }
+  thread_pool_.ParallelFor(genes.size(), [&](size_t igene) {
+      FillCompositeScores(seqs, kbounds, genes[igene]);
+    });
+}
+
+// ----------------------------------------------------------------------------------------
+void DPHandler::FillCompositeScores(Sequences &seqs, KBounds &kbounds, string gene) {
+  // fill <gene>'s entry in <composite_scores_>, which is indexed by k_v for v, k_v * kbounds.dmax + k_d for d, and k_v + k_d for j
+  string region(gl_.GetRegion(gene));
+  vector<double> &scores(composite_scores_.at(gene));
+  double gene_choice_score(log(hmms_.Get(gene)->overall_prob()));
+  size_t seq_length(seqs.GetSequenceLength());
+  size_t max_k_v(min(kbounds.vmax - 1, seq_length - kbounds.dmin - 1));  // largest k_v of any k set that fits in the sequence
+  if(region == "v") {
+    Trellis *trell(CompositeTrellis(seqs, KSet(max_k_v, kbounds.dmin), gene));
+    for(size_t k_v = kbounds.vmin; k_v <= max_k_v; ++k_v)
+      scores[k_v] = AddWithMinusInfinities(CompositeTrellisScore(trell, k_v), gene_choice_score);
+  } else if(region == "d") {
+    for(size_t k_v = kbounds.vmin; k_v <= max_k_v; ++k_v) {
+      size_t max_k_d(min(kbounds.dmax - 1, seq_length - k_v - 1));
+      Trellis *trell(CompositeTrellis(seqs, KSet(k_v, max_k_d), gene));
+      for(size_t k_d = kbounds.dmin; k_d <= max_k_d; ++k_d)
+        scores[k_v * kbounds.dmax + k_d] = AddWithMinusInfinities(CompositeTrellisScore(trell, k_d), gene_choice_score);
+    }
+  } else if(region == "j") {
+    Trellis *trell(CompositeTrellis(seqs, KSet(kbounds.vmin, kbounds.dmin), gene));
+    for(size_t k_vd = kbounds.vmin + kbounds.dmin; k_vd < seq_length; ++k_vd)
+      scores[k_vd] = AddWithMinusInfinities(CompositeTrellisScore(trell, seq_length - k_vd), gene_choice_score);
+  } else {
+    assert(0);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+Trellis *DPHandler::CompositeTrellis(Sequences &seqs, KSet kset, string gene) {
+  // find or fill the trellis for <gene>'s query in <kset> (from the end of the sequence, for j)
+  string region(gl_.GetRegion(gene));
+  vector<string> query_strs(GetQueryStrs(seqs, kset, region));
+  map<vector<string>, Trellis> &gene_cachefo(scratch_cachefo_.at(gene));
+  if(gene_cachefo.count(query_strs) > 0 && gene_cachefo.at(query_strs).suffix() == (region == "j"))  // e.g. if we're not clearing the cache between calls
+    return &gene_cachefo.at(query_strs);
+
+  Sequences query_seqs(GetSubSeqs(seqs, kset, region));
+  gene_cachefo[query_strs] = Trellis(hmms_.Get(gene), query_seqs, nullptr, &pool_, emission_overlays_.count(gene) > 0 ? &emission_overlays_.at(gene) : nullptr);
+  Trellis *trell(&gene_cachefo[query_strs]);
+  if(algorithm_ == "viterbi") {
+    if(region == "j")
+      trell->SuffixViterbi();
+    else
+      trell->Viterbi();
+  } else if(algorithm_ == "forward") {
+    if(region == "j")
+      trell->SuffixForward();
+    else if(args_->scaled_forward())
+      trell->ScaledForward();
+    else
+      trell->Forward();
+    if(args_->check_scaled_forward() && region != "j")
+      CheckScaledForward(trell, query_seqs, gene);
+  } else {
+    assert(0);
+  }
+  return trell;
+}
+
+// ----------------------------------------------------------------------------------------
+double DPHandler::CompositeTrellisScore(Trellis *trell, size_t length) {
+  // log prob of the first (or for suffix trellises, last) <length> positions, taken the same way as FillTrellis() does (i.e. from the ending value if it's the whole query)
+  if(length == trell->seqs().GetSequenceLength())
+    return algorithm_ == "viterbi" ? trell->ending_viterbi_log_prob() : trell->ending_forward_log_prob();
+  return algorithm_ == "viterbi" ? trell->ending_viterbi_log_prob(length) : trell->ending_forward_log_prob(length);
+}
+
+// ----------------------------------------------------------------------------------------
+void DPHandler::CompositeKSet(KBounds &kbounds, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, map<string, string> > *best_genes) {
+  // same as RunKSet(), but look up the genes' scores in <composite_scores_> rather than running them
+  (*best_scores)[kset] = -INFINITY;
+  (*total_scores)[kset] = -INFINITY;
+  (*best_genes)[kset] = map<string, string>();
+  map<string, double> regional_best_scores, regional_total_scores, per_gene_support_this_kset;
+  for(auto &region : gl_.regions_) {
+    size_t ibound(region == "v" ? kset.v : (region == "d" ? kset.v * kbounds.dmax + kset.d : kset.v + kset.d));  // see FillCompositeScores()
+    regional_best_scores[region] = -INFINITY;
+    regional_total_scores[region] = -INFINITY;
+    for(auto &gene : only_genes[region]) {
+      double gene_score(composite_scores_.at(gene)[ibound]);
+      regional_total_scores[region] = AddInLogSpace(gene_score, regional_total_scores[region]);
+      if(gene_score > regional_best_scores[region]) {
+        regional_best_scores[region] = gene_score;
+        (*best_genes)[kset][region] = gene;
+      }
+      per_gene_support_this_kset[gene] = gene_score;
+    }
+    if((*best_genes)[kset].find(region) == (*best_genes)[kset].end())  // no valid path for this region
+      return;
+  }
+
+  StoreKSetResults(kset, only_genes, regional_best_scores, regional_total_scores, per_gene_support_this_kset, best_scores, total_scores);
+}
+
+// ----------------------------------------------------------------------------------------
+void DPHandler::CacheEmissionBounds(Sequences &seqs, map<string, set<string> > &only_genes) {
+  // For --prune-viterbi: no path can emit a position with a higher log prob than the gene's best emission for that position's symbols (and the
+  // transitions only make it worse), so the sum of these is an upper bound on any query's viterbi log prob. We keep it as a running sum over the
+  // sequence, so each query's bound is one subtraction.
+  emission_bounds_.clear();
+  for(auto &region : gl_.regions_) {
+    for(auto &gene : only_genes[region]) {
+      CompiledModel *cm(hmms_.Get(gene)->compiled());
+      const EmissionOverlay *emission_overlay(emission_overlays_.count(gene) > 0 ? &emission_overlays_.at(gene) : nullptr);
+      vector<double> best_logprobs(seqs.profile_width(), -INFINITY);  // best emission for each column of the profile
+      for(size_t icol = 0; icol < seqs.profile_width(); ++icol) {
+        const double *row(cm->emission_row_by_column(icol, emission_overlay));
+        for(size_t ist = 0; ist < cm->n_states(); ++ist)
+          best_logprobs[icol] = max(best_logprobs[icol], row[ist]);
+        best_logprobs[icol] = max(best_logprobs[icol], -1e6);  // a large finite penalty instead of -INFINITY, so we can subtract the running sums (it's still an upper bound)
+      }
+      vector<double> &bounds(emission_bounds_[gene]);
+      bounds.assign(seqs.GetSequenceLength() + 1, 0.);
+      for(size_t pos = 0; pos < seqs.GetSequenceLength(); ++pos) {
+        const uint32_t *counts(seqs.profile(pos));
+        double column_bound(0.);
+        for(size_t icol = 0; icol < seqs.profile_width(); ++icol)
+          column_bound += counts[icol] * best_logprobs[icol];
+        bounds[pos + 1] = bounds[pos] + column_bound;
+      }
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+double DPHandler::GeneBound(KSet kset, string region, string gene) {
+  // upper bound on <gene>'s score (including the gene choice prob) for its query in <kset>
+  vector<double> &bounds(emission_bounds_.at(gene));
+  size_t start(region == "v" ? 0 : (region == "d" ? kset.v : kset.v + kset.d));
+  size_t end(region == "v" ? kset.v : (region == "d" ? kset.v + kset.d : bounds.size() - 1));
+  return bounds[end] - bounds[start] + log(hmms_.Get(gene)->overall_prob());
+}
+
+// ----------------------------------------------------------------------------------------
+double DPHandler::KSetBound(KSet kset, map<string, set<string> > &only_genes, map<string, double> *regional_bounds) {
+  // upper bound on the best score in <kset>, i.e. the sum over regions of the best gene's bound (if <regional_bounds> is set, we also put the regions' bounds there)
+  map<string, double> tmp_bounds;
+  if(regional_bounds == nullptr)
+    regional_bounds = &tmp_bounds;
+  for(auto &region : gl_.regions_) {
+    (*regional_bounds)[region] = -INFINITY;
+    for(auto &gene : only_genes[region])
+      (*regional_bounds)[region] = max((*regional_bounds)[region], GeneBound(kset, region, gene));
+  }
+  return OptimisticScore(kset, "", "", *regional_bounds);
+}
+
+// ----------------------------------------------------------------------------------------
+double DPHandler::OptimisticScore(KSet kset, string region, string gene, map<string, double> &optimistic_scores) {
+  // best score <kset> could have if we use <gene> in <region> (or if <region> is empty, any gene), given the best possible scores for each region
+  double score(0.);
+  for(auto &tmpreg : gl_.regions_)
+    score = AddWithMinusInfinities(score, tmpreg == region ? GeneBound(kset, region, gene) : optimistic_scores.at(tmpreg));
+  return score;
+}
+
 // ----------------------------------------------------------------------------------------
 void DPHandler::InitCache(string gene) {
   if(scores_.find(gene) == scores_.end()) {
@@ -400,7 +660,8 @@ void DPHandler::InitCache(string gene) {
 }
 
 // ----------------------------------------------------------------------------------------
-void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, map<string, string> > *best_genes) {
+void DPHandler::RunKSet(Sequences &seqs, KBounds &kbounds, KSet kset, map<string, set<string> > &only_genes, map<KSet, double> *best_scores, map<KSet, double> *total_scores, map<KSet, map<string, string> > *best_genes, double prune_threshold, int *n_pruned_genes) {
+  // if <prune_threshold> is set, we skip genes (and give up on the k set) once the upper bounds from CacheEmissionBounds() say they can't get above it
   map<string, Sequences> subseqs(GetSubSeqs(seqs, kset));
   (*best_scores)[kset] = -INFINITY;
   (*total_scores)[kset] = -INFINITY;  // total log prob of this kset, i.e. log(P_v * P_d * P_j), where e.g. P_v = \sum_i P(v_i k_v)
@@ -408,6 +669,9 @@ void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &o
   map<string, double> regional_best_scores; // the best score for each region
   map<string, double> regional_total_scores; // the total score for each region, i.e. log P_v
   map<string, double> per_gene_support_this_kset;
+  map<string, double> optimistic_scores;  // for pruning: the best score each region could possibly have (the actual best, once we've run it)
+  if(prune_threshold != -INFINITY)
+    KSetBound(kset, only_genes, &optimistic_scores);
   if(args_->debug() == 2) {
     printf("         %3d%3d", (int)kset.v, (int)kset.d);
     if(algorithm_ == "forward")
@@ -430,21 +694,56 @@ void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &o
 
     regional_best_scores[region] = -INFINITY;
     regional_total_scores[region] = -INFINITY;
-    for(auto & gene : only_genes[region]) {
+    vector<string> genes(only_genes[region].begin(), only_genes[region].end());
+    vector<string> origins(genes.size());
+    vector<size_t> genes_to_fill;  // indices in <genes> of the ones we actually have to run
+    bool suffix(region == "j" && !args_->no_chunk_cache() && !args_->no_suffix_trellis());  // j queries all end at the end of the sequence, so chunk cache them from there
+    Sequences suffix_seqs;
+    vector<string> suffix_strs;
+    if(suffix) {  // the longest j query in the k bounds (we're only running k sets that fit in the sequence, so it must be shorter than that)
+      KSet longest_kset(kbounds.vmin, kbounds.dmin);
+      suffix_seqs = GetSubSeqs(seqs, longest_kset, region);
+      suffix_strs = GetQueryStrs(seqs, longest_kset, region);
+    }
+    for(size_t igene = 0; igene < genes.size(); ++igene) {
+      string gene(genes[igene]);
       InitCache(gene);
-      string origin;
+      hmms_.Get(gene);  // make sure it's read from disk before we go multi-threaded
       KSet partial_cache_match(FindPartialCacheMatch(region, gene, kset));  // "partial" in the sense that only this region's query sequence(s) need to be the same
       if(!partial_cache_match.isnull()) {  // first see if we have a match for these exact strings
 	paths_[gene][kset] = paths_[gene][partial_cache_match];
 	scores_[gene][kset] = scores_[gene][partial_cache_match];
 	// NOTE that we don't put anything about this gene/kset combo into the trellis caches. Which is fine now, since later we'll only need the path and score info
-	origin = "cached";
+	origins[igene] = "cached";
+      } else if(prune_threshold != -INFINITY && OptimisticScore(kset, region, gene, optimistic_scores) < prune_threshold) {  // can't beat what we've already got, so don't bother
+        origins[igene] = "pruned";
       } else {  // no exact cache match, so proceed to check for chunk caching (if that fails it'll actually calculate things)
-	FillTrellis(kset, subseqs[region], query_strs, gene, origin);
+	genes_to_fill.push_back(igene);
       }
+    }
 
-      double gene_score(scores_[gene][kset]);  // convenience variable
-      if(args_->debug() == 2 && algorithm_ == "viterbi")
+    double min_score(-INFINITY);  // genes with scores below this can't beat <prune_threshold>, whatever the other regions do
+    if(prune_threshold != -INFINITY) {
+      double other_regions(0.);
+      for(auto &tmpreg : gl_.regions_)
+        other_regions = tmpreg == region ? other_regions : AddWithMinusInfinities(other_regions, optimistic_scores[tmpreg]);
+      min_score = other_regions == -INFINITY ? INFINITY : prune_threshold - other_regions;
+    }
+
+    // the genes are independent, so run them in parallel (each task only touches its own gene's entries in the caches, which InitCache() has already made)
+    thread_pool_.ParallelFor(genes_to_fill.size(), [&](size_t itask) {
+	size_t igene(genes_to_fill[itask]);
+	FillTrellis(kset, subseqs.at(region), query_strs, genes[igene], origins[igene], suffix ? &suffix_seqs : nullptr, suffix ? &suffix_strs : nullptr, min_score);
+      });
+
+    // then combine the results serially, in the same order as always, so we get exactly the same answer no matter how many threads there are
+    for(size_t igene = 0; igene < genes.size(); ++igene) {
+      string gene(genes[igene]);
+      string &origin(origins[igene]);
+      if(origin == "pruned")
+        ++(*n_pruned_genes);
+      double gene_score(origin == "pruned" ? -INFINITY : scores_[gene][kset]);  // convenience variable
+      if(args_->debug() == 2 && algorithm_ == "viterbi" && origin != "pruned")
         PrintPath(kset, query_strs, gene, gene_score, origin);
 
       // add this score to the regional total score
@@ -468,8 +767,26 @@ void DPHandler::RunKSet(Sequences &seqs, KSet kset, map<string, set<string> > &o
         cout << "                  found no gene for " << region << " so skip" << endl;
       return;
     }
+
+    if(prune_threshold != -INFINITY) {  // see if the rest of the k set is still worth running
+      optimistic_scores[region] = regional_best_scores[region];
+      if(OptimisticScore(kset, "", "", optimistic_scores) < prune_threshold) {
+        bool later_region(false);
+        for(auto &tmpreg : gl_.regions_) {
+          if(later_region)
+            *n_pruned_genes += only_genes[tmpreg].size();
+          later_region = later_region || tmpreg == region;
+        }
+        return;
+      }
+    }
   }
 
+  StoreKSetResults(kset, only_genes, regional_best_scores, regional_total_scores, per_gene_support_this_kset, best_scores, total_scores);
+}
+
+// ----------------------------------------------------------------------------------------
+void DPHandler::StoreKSetResults(KSet kset, map<string, set<string> > &only_genes, map<string, double> &regional_best_scores, map<string, double> &regional_total_scores, map<string, double> &per_gene_support_this_kset, map<KSet, double> *best_scores, map<KSet, double> *total_scores) {
   // store the results
   (*best_scores)[kset] = AddWithMinusInfinities(regional_best_scores["v"], AddWithMinusInfinities(regional_best_scores["d"], regional_best_scores["j"]));  // i.e. best_prob = v_prob * d_prob * j_prob (v *and* d *and* j)
   (*total_scores)[kset] = AddWithMinusInfinities(regional_total_scores["v"], AddWithMinusInfinities(regional_total_scores["d"], regional_total_scores["j"]));
@@ -38,6 +38,30 @@ void Emission::Parse(YAML::Node config, Track *track) {
   scores_.SetLogProbs(log_probs);  // NOTE <log_probs> must already be logged
 }
 
+// ----------------------------------------------------------------------------------------
+void Emission::ParseBinary(ModelFileReader &reader, Track *track) {
+  track_ = track;
+  scores_.Init(track_);
+  size_t n_probs(reader.ReadCount());
+  if(n_probs != track_->alphabet_size())
+    throw runtime_error("ERROR binary model file has " + to_string(n_probs) + " emission probabilities, but the alphabet has size " + to_string(track_->alphabet_size()));
+  vector<double> log_probs(n_probs);
+  total_ = 0.0;
+  for(size_t ip = 0; ip < n_probs; ++ip) {
+    log_probs[ip] = reader.ReadDouble();
+    total_ += exp(log_probs[ip]);
+  }
+  scores_.SetLogProbs(log_probs);
+}
+
+// ----------------------------------------------------------------------------------------
+void Emission::WriteBinary(ModelFileWriter &writer) {
+  vector<double> log_probs(scores_.log_probs());
+  writer.Write((uint32_t)log_probs.size());
+  for(auto log_prob : log_probs)
+    writer.Write(log_prob);
+}
+
 // ----------------------------------------------------------------------------------------
 void Emission::Print() {
   cout << "    " << track_->name() << "     (normed to within at least " << EPS << ")" << endl;
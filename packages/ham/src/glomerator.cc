@@ -3,60 +3,179 @@
 namespace ham {
 
 // ----------------------------------------------------------------------------------------
-Glomerator::Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args *args, Track *track) :
+Glomerator::Glomerator(HMMHolder &hmms, GermLines &gl, vector<vector<Sequence> > &qry_seq_list, Args *args, Track *track, CacheFileStore *cache_store) :
   track_(track),
   args_(args),
   gl_(gl),
   hmms_(hmms),
+  cache_store_(cache_store),
+  thread_pool_(args->n_threads()),
+  initial_partition_(ClusterNameLess(&registry_)),
+  naive_seq_bytes_(0),
+  packed_naive_seq_bytes_(0),
+  profile_bytes_(0),
+  n_merge_steps_(0),
+  found_initial_pairs_(false),
+  found_initial_lratios_(false),
+  hfrac_candidates_(MergeCandidateOrder(&registry_)),
+  lratio_candidates_(MergeCandidateOrder(&registry_, true)),
+  small_lratio_candidates_(MergeCandidateOrder(&registry_, true)),
+  naive_seq_index_(args->hamming_fraction_bound_hi(), track->ambiguous_char()),
+  naive_seq_index_failed_(false),
+  n_indexed_pairs_(0),
   n_fwd_calculated_(0),
   n_vtb_calculated_(0),
   n_hfrac_calculated_(0),
   n_hfrac_merges_(0),
   n_lratio_merges_(0),
+  n_pruned_ksets_(0),
+  n_pruned_genes_(0),
   asym_factor_(4.),
   force_merge_(false),
   current_partition_(nullptr),
+  resumed_mid_step_(false),
   progress_file_(fopen((args_->outfile() + ".progress").c_str(), "w"))
 {
   time(&last_status_write_time_);
   ReadCacheFile();
+  if(args_->output_cachefname() != "" && args_->resume_from() == "")  // (if we're resuming, the original run's evicted entries are still in there)
+    remove(CacheJournalName(evicted_cachefname()).c_str());
 
+  for(auto &seq_vec : qry_seq_list)
+    for(auto &seq : seq_vec)
+      single_seqs_[registry_.UidIndex(seq.name())] = seq;
+
+  QueryTable &queries(args_->queries_);
   for(size_t iqry = 0; iqry < qry_seq_list.size(); iqry++) {
-    string key = SeqNameStr(qry_seq_list[iqry], ":");
-    KSet kmin(args_->integers_["k_v_min"][iqry], args_->integers_["k_d_min"][iqry]);
-    KSet kmax(args_->integers_["k_v_max"][iqry], args_->integers_["k_d_max"][iqry]);
+    ClusterId key = registry_.Intern(SeqNameStr(qry_seq_list[iqry], ":"));
+    KSet kmin(queries.k_v_min(iqry), queries.k_d_min(iqry));
+    KSet kmax(queries.k_v_max(iqry), queries.k_d_max(iqry));
+    vector<string> only_genes(queries.only_genes(iqry));
 
     initial_partition_.insert(key);
 
-    for(auto &seq_vec : qry_seq_list)
-      for(auto &seq : seq_vec)
-	single_seqs_[seq.name()] = seq;
-
-    for(auto &uid : SplitString(key)) {
-      single_seq_cachefo_[uid] = Query(uid,  // NOTE these are not necessarily the same as they would be (well, were) for the single seqs -- e.g. only_genes is now the OR for all the sequences
+    vector<unsigned> key_uids(registry_.uids(key));  // (copy, since interning can reallocate the registry's vectors)
+    for(auto iuid : key_uids) {
+      ClusterId uid = registry_.Intern(vector<unsigned>{iuid});
+      single_seq_cachefo_[iuid] = Query(uid,  // NOTE these are not necessarily the same as they would be (well, were) for the single seqs -- e.g. only_genes is now the OR for all the sequences
 				       GetSeqs(uid),
-				       !InString(args_->seed_unique_id(), uid),
-				       args_->str_lists_["only_genes"][iqry],
+				       !registry_.Contains(uid, args_->seed_unique_id()),
+				       only_genes,
 				       KBounds(kmin, kmax),
-				       args_->floats_["mut_freq"][iqry],
-				       args_->integers_["cdr3_length"][iqry]);
+				       queries.mut_freq(iqry),
+				       queries.cdr3_length(iqry));
     }
 
     cachefo_[key] = Query(key,
 			  GetSeqs(key),
-			  !InString(args_->seed_unique_id(), key),
-			  args_->str_lists_["only_genes"][iqry],
+			  !registry_.Contains(key, args_->seed_unique_id()),
+			  only_genes,
 			  KBounds(kmin, kmax),
-			  args_->floats_["mut_freq"][iqry],
-			  args_->integers_["cdr3_length"][iqry]);
+			  queries.mut_freq(iqry),
+			  queries.cdr3_length(iqry));
   }
 
+  if(args_->existing_partition() != "")
+    ReadExistingPartition();
+
   current_partition_ = &initial_partition_;
 }
 
+// ----------------------------------------------------------------------------------------
+// Replace the queries in <initial_partition_> with the clusters in the best partition from --existing-partition (the last one with the largest log
+// prob, same as ClusterPath::i_best()). Each existing cluster has to be made up of whole queries from --infile, which we combine the same way as
+// GetMergedQuery() (so they have the same name, and thus cache key, that they had in the previous run).
+void Glomerator::ReadExistingPartition() {
+  ifstream ifs(args_->existing_partition());
+  if(!ifs.is_open())
+    throw runtime_error("existing partition file " + args_->existing_partition() + " dne\n");
+  string line, best_partition_str;
+  double best_logprob(-INFINITY);
+  auto check_partition = [&](const string &partition_str, double logprob) {
+    if(best_partition_str == "" || best_logprob == -INFINITY || logprob > best_logprob) {
+      best_partition_str = partition_str;
+      best_logprob = logprob;
+    }
+  };
+  if(IsBinaryOutputFile(args_->existing_partition())) {  // from --binary-output
+    OutputFileReader reader(args_->existing_partition());
+    if(reader.kind() != "partition")
+      throw runtime_error("existing partition file " + args_->existing_partition() + " is a binary " + reader.kind() + " file, not a partition file");
+    OutputBatch batch(reader.schema());
+    while(reader.NextBatch(batch)) {
+      for(size_t ir=0; ir<batch.n_rows(); ++ir)
+	check_partition(PartitionString(batch, ir), batch.Double(0, ir));
+    }
+  } else {
+    getline(ifs, line);
+    if(line != "partition,logprob")
+      throw runtime_error("unexpected header '" + line + "' in existing partition file " + args_->existing_partition());
+    while(getline(ifs, line)) {
+      size_t icomma(line.rfind(','));
+      if(icomma == string::npos)
+	throw runtime_error("couldn't parse line '" + line + "' in existing partition file " + args_->existing_partition());
+      check_partition(line.substr(0, icomma), stod(line.substr(icomma + 1)));
+    }
+  }
+  if(best_partition_str == "")
+    throw runtime_error("no partitions in existing partition file " + args_->existing_partition());
+
+  map<unsigned, ClusterId> query_of_uid;
+  for(auto key : initial_partition_)
+    for(auto iuid : registry_.uids(key))
+      query_of_uid[iuid] = key;
+
+  for(auto &clusterstr : SplitString(best_partition_str, ";")) {
+    ClusterId cluster = registry_.Intern(clusterstr);
+    vector<ClusterId> queries;
+    size_t n_uids(0);
+    vector<unsigned> cluster_uids(registry_.uids(cluster));  // (copy, since interning can reallocate the registry's vectors)
+    for(auto iuid : cluster_uids) {
+      if(!query_of_uid.count(iuid))
+	throw runtime_error("sequence " + registry_.uid_str(iuid) + " from existing partition isn't in --infile");
+      ClusterId query(query_of_uid[iuid]);
+      if(find(queries.begin(), queries.end(), query) == queries.end()) {
+	queries.push_back(query);
+	n_uids += registry_.size(query);
+      }
+    }
+    if(n_uids != registry_.size(cluster))
+      throw runtime_error("existing cluster " + clusterstr + " only contains part of an --infile query");
+
+    existing_clusters_.insert(cluster);
+    if(queries.size() == 1)  // unchanged from the input
+      continue;
+
+    Query combined(cachefo(queries[0]));
+    for(size_t iq=1; iq<queries.size(); ++iq) {
+      Query &other(cachefo(queries[iq]));
+      if(other.cdr3_length_ != combined.cdr3_length_)
+	throw runtime_error("cdr3 lengths different within existing cluster " + clusterstr + " (" + to_string(combined.cdr3_length_) + " " + to_string(other.cdr3_length_) + ")");
+      for(auto &g : other.only_genes_) {
+	if(find(combined.only_genes_.begin(), combined.only_genes_.end(), g) == combined.only_genes_.end())
+	  combined.only_genes_.push_back(g);
+      }
+      combined.kbounds_ = combined.kbounds_.LogicalOr(other.kbounds_);
+      combined.mute_freq_ = (combined.seqs_.size()*combined.mute_freq_ + other.seqs_.size()*other.mute_freq_) / double(combined.seqs_.size() + other.seqs_.size());  // (weighted average, as in GetMergedQuery())
+      combined.seqs_.insert(combined.seqs_.end(), other.seqs_.begin(), other.seqs_.end());  // (just for the weights -- it gets reset below)
+    }
+    cachefo_[cluster] = Query(cluster, GetSeqs(cluster), !registry_.Contains(cluster, args_->seed_unique_id()), combined.only_genes_, combined.kbounds_, combined.mute_freq_, combined.cdr3_length_);
+    for(auto query : queries)
+      initial_partition_.erase(query);
+    initial_partition_.insert(cluster);
+  }
+
+  if(args_->debug())
+    printf("      starting from %zu existing clusters in %s (%zu new)\n", existing_clusters_.size(), args_->existing_partition().c_str(), initial_partition_.size() - existing_clusters_.size());
+}
+
 // ----------------------------------------------------------------------------------------
 Glomerator::~Glomerator() {
   cout << FinalString() << endl;
+  if(args_->debug() || args_->cache_memory_budget() > 0.)
+    cout << CacheMemoryString(true);
+  if(args_->debug() && args_->naive_seq_index())
+    printf("        naive seq index: proposed %zu pairs%s\n", n_indexed_pairs_, naive_seq_index_failed_ ? " (missed some pairs, so fell back to looking at every pair)" : "");
   WriteCacheFile();
   fclose(progress_file_);
   remove((args_->outfile() + ".progress").c_str());
@@ -95,13 +214,234 @@ void Glomerator::Cluster() {
     throw runtime_error("logprob ratio threshold not specified");
 
   ClusterPath cp(initial_partition_);
-  do {
+  if(args_->resume_from() != "")
+    ReadCheckpoint(cp);
+  time(&last_checkpoint_time_);
+  while(!cp.finished_) {
     Merge(&cp);
-  } while(!cp.finished_);
+    if(args_->checkpoint_file() != "" && !cp.finished_ && difftime(time(nullptr), last_checkpoint_time_) >= args_->checkpoint_interval())
+      WriteCheckpoint(cp);
+  }
 
   WritePartitions(cp);
   if(args_->annotationfile() != "")
     WriteAnnotations(cp);
+  if(args_->checkpoint_file() != "")
+    remove(args_->checkpoint_file().c_str());
+}
+
+// ----------------------------------------------------------------------------------------
+// Write everything we'd need to continue the run from the end of the current merge step (or, with <mid_step>, from the end of the pass through the
+// pairs that we just finished, see FindHfracMerge() and FindLRatioMerge()). The hmms, sequences, and other per-input info get rebuilt from the
+// arguments when we resume, but everything that depends on what we've calculated so far is in here. NOTE we don't need the rng state, since
+// ChooseSubsetOfNames() reseeds it for each subset (it's the only thing that uses it).
+void Glomerator::WriteCheckpoint(ClusterPath &cp, bool mid_step) {
+  clock_t run_start(clock());
+  CheckpointWriter ckpt(args_->checkpoint_file());
+
+  registry_.WriteCheckpoint(ckpt);
+  ckpt.Write(initial_partition_);
+  cp.WriteCheckpoint(ckpt);
+
+  ckpt.Write(naive_seq_name_translations_);
+  ckpt.Write(logprob_name_translations_);
+  ckpt.Write(logprob_asymetric_translations_);
+  ckpt.Write(name_subsets_);
+
+  for(auto *cache : {&cachefo_, &tmp_cachefo_}) {  // (the tmp one's only non-empty in the middle of a step)
+    ckpt.Write((uint64_t)cache->size());
+    for(auto &kv : *cache)
+      WriteQuery(ckpt, kv.second);
+  }
+
+  ckpt.Write(log_probs_);
+  ckpt.Write(precalculated_log_probs_);
+  ckpt.Write(naive_hfracs_);
+  ckpt.Write(lratios_);
+  ckpt.Write(naive_seqs_);
+  ckpt.Write((uint64_t)packed_naive_seqs_.size());
+  for(auto &kv : packed_naive_seqs_) {
+    ckpt.Write(kv.first);
+    ckpt.Write((uint64_t)kv.second.length_);
+    ckpt.Write((uint64_t)kv.second.n_words_);
+    ckpt.Write((uint64_t)kv.second.n_planes_);
+    ckpt.Write(kv.second.planes_);
+    ckpt.Write(kv.second.unambiguous_);
+  }
+  ckpt.Write(errors_);
+  ckpt.Write(failed_queries_);
+  ckpt.Write(initial_log_probs_);
+  ckpt.Write(initial_naive_hfracs_);
+  ckpt.Write(initial_naive_seqs_);
+
+  for(auto *stats : {&log_prob_stats_, &naive_hfrac_stats_, &lratio_stats_, &naive_seq_stats_, &name_subset_stats_}) {
+    ckpt.Write(stats->hits_);
+    ckpt.Write(stats->misses_);
+    ckpt.Write(stats->evictions_);
+  }
+  ckpt.Write((uint64_t)naive_seq_bytes_);
+  ckpt.Write((uint64_t)packed_naive_seq_bytes_);
+  ckpt.Write(n_merge_steps_);
+  ckpt.Write(last_used_);
+  ckpt.Write(merged_away_);
+
+  ckpt.Write(found_initial_pairs_);
+  ckpt.Write(found_initial_lratios_);
+  ckpt.Write(new_clusters_);
+  ckpt.Write(lratio_pairs_to_calculate_);
+  WriteCandidates(ckpt, hfrac_candidates_);
+  WriteCandidates(ckpt, lratio_candidates_);
+  WriteCandidates(ckpt, small_lratio_candidates_);
+  ckpt.Write(naive_seq_index_.members());
+  ckpt.Write(naive_seq_index_failed_);
+  ckpt.Write((uint64_t)n_indexed_pairs_);
+
+  for(auto counter : {n_fwd_calculated_, n_vtb_calculated_, n_hfrac_calculated_, n_hfrac_merges_, n_lratio_merges_, n_pruned_ksets_, n_pruned_genes_})
+    ckpt.Write(counter);
+  ckpt.Write(force_merge_);
+  ckpt.Write(mid_step);
+  ckpt.Write(hfrac_loop_failures_);
+  ckpt.Write(lratio_loop_failures_);
+
+  ckpt.Close();
+  time(&last_checkpoint_time_);
+  if(args_->debug())
+    printf("        wrote checkpoint after %zu merges%s to %s (%.1f sec)\n", cp.merges().size(), mid_step ? " and an initial pass through the pairs" : "", args_->checkpoint_file().c_str(), ((clock() - run_start) / (double)CLOCKS_PER_SEC));
+}
+
+// ----------------------------------------------------------------------------------------
+// NOTE same order as WriteCheckpoint()
+void Glomerator::ReadCheckpoint(ClusterPath &cp) {
+  CheckpointReader ckpt(args_->resume_from());
+
+  registry_.ReadCheckpoint(ckpt);
+  Partition initial_partition(initial_partition_.key_comp());
+  ckpt.Read(initial_partition);
+  if(initial_partition != initial_partition_)
+    throw runtime_error("initial partition in checkpoint " + args_->resume_from() + " doesn't match the current input");
+  cp.ReadCheckpoint(ckpt);
+  current_partition_ = &cp.CurrentPartition();
+
+  ckpt.Read(naive_seq_name_translations_);
+  ckpt.Read(logprob_name_translations_);
+  ckpt.Read(logprob_asymetric_translations_);
+  ckpt.Read(name_subsets_);
+
+  for(auto *cache : {&cachefo_, &tmp_cachefo_}) {
+    cache->clear();
+    for(size_t n=ckpt.ReadSize(); n>0; --n) {
+      Query query(ReadQuery(ckpt));
+      (*cache)[query.id_] = query;
+    }
+  }
+
+  ckpt.Read(log_probs_);
+  ckpt.Read(precalculated_log_probs_);
+  ckpt.Read(naive_hfracs_);
+  ckpt.Read(lratios_);
+  ckpt.Read(naive_seqs_);
+  packed_naive_seqs_.clear();
+  for(size_t n=ckpt.ReadSize(); n>0; --n) {
+    ClusterId key;
+    ckpt.Read(key);
+    PackedSeq &pseq(packed_naive_seqs_[key]);
+    pseq.length_ = ckpt.ReadSize();
+    pseq.n_words_ = ckpt.ReadSize();
+    pseq.n_planes_ = ckpt.ReadSize();
+    ckpt.Read(pseq.planes_);
+    ckpt.Read(pseq.unambiguous_);
+  }
+  ckpt.Read(errors_);
+  ckpt.Read(failed_queries_);
+  ckpt.Read(initial_log_probs_);
+  ckpt.Read(initial_naive_hfracs_);
+  ckpt.Read(initial_naive_seqs_);
+
+  for(auto *stats : {&log_prob_stats_, &naive_hfrac_stats_, &lratio_stats_, &naive_seq_stats_, &name_subset_stats_}) {
+    ckpt.Read(stats->hits_);
+    ckpt.Read(stats->misses_);
+    ckpt.Read(stats->evictions_);
+  }
+  naive_seq_bytes_ = ckpt.ReadSize();
+  packed_naive_seq_bytes_ = ckpt.ReadSize();
+  ckpt.Read(n_merge_steps_);
+  ckpt.Read(last_used_);
+  ckpt.Read(merged_away_);
+
+  ckpt.Read(found_initial_pairs_);
+  ckpt.Read(found_initial_lratios_);
+  ckpt.Read(new_clusters_);
+  ckpt.Read(lratio_pairs_to_calculate_);
+  ReadCandidates(ckpt, hfrac_candidates_);
+  ReadCandidates(ckpt, lratio_candidates_);
+  ReadCandidates(ckpt, small_lratio_candidates_);
+  vector<ClusterId> index_members;
+  ckpt.Read(index_members);
+  for(auto key : index_members)
+    naive_seq_index_.Add(key, cachefo(key).cdr3_length_, naive_seqs_.at(key));
+  ckpt.Read(naive_seq_index_failed_);
+  n_indexed_pairs_ = ckpt.ReadSize();
+
+  for(auto *counter : {&n_fwd_calculated_, &n_vtb_calculated_, &n_hfrac_calculated_, &n_hfrac_merges_, &n_lratio_merges_, &n_pruned_ksets_, &n_pruned_genes_})
+    ckpt.Read(*counter);
+  ckpt.Read(force_merge_);
+  ckpt.Read(resumed_mid_step_);
+  ckpt.Read(hfrac_loop_failures_);
+  ckpt.Read(lratio_loop_failures_);
+  ckpt.Close();
+
+  printf("        resumed from %s after %zu merges (%zu clusters)\n", args_->resume_from().c_str(), cp.merges().size(), cp.CurrentPartition().size());
+}
+
+// ----------------------------------------------------------------------------------------
+// (the sequence pointers get rebuilt from the cluster id)
+void Glomerator::WriteQuery(CheckpointWriter &ckpt, Query &query) {
+  ckpt.Write(query.id_);
+  ckpt.Write(query.seed_missing_);
+  ckpt.Write(query.only_genes_);
+  for(auto val : {query.kbounds_.vmin, query.kbounds_.dmin, query.kbounds_.vmax, query.kbounds_.dmax})
+    ckpt.Write((uint64_t)val);
+  ckpt.Write(query.mute_freq_);
+  ckpt.Write((uint64_t)query.cdr3_length_);
+  ckpt.Write(query.parents_);
+}
+
+// ----------------------------------------------------------------------------------------
+Query Glomerator::ReadQuery(CheckpointReader &ckpt) {
+  Query query;
+  ckpt.Read(query.id_);
+  query.seqs_ = GetSeqs(query.id_);
+  ckpt.Read(query.seed_missing_);
+  ckpt.Read(query.only_genes_);
+  for(auto *val : {&query.kbounds_.vmin, &query.kbounds_.dmin, &query.kbounds_.vmax, &query.kbounds_.dmax})
+    *val = ckpt.ReadSize();
+  ckpt.Read(query.mute_freq_);
+  query.cdr3_length_ = ckpt.ReadSize();
+  ckpt.Read(query.parents_);
+  return query;
+}
+
+// ----------------------------------------------------------------------------------------
+// (we get a copy of <candidates>, since the only way to see what's in a priority queue is to pop everything off)
+void Glomerator::WriteCandidates(CheckpointWriter &ckpt, MergeCandidateQueue candidates) {
+  ckpt.Write((uint64_t)candidates.size());
+  for( ; !candidates.empty(); candidates.pop()) {
+    ckpt.Write(candidates.top().value_);
+    ckpt.Write(candidates.top().keys_);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void Glomerator::ReadCandidates(CheckpointReader &ckpt, MergeCandidateQueue &candidates) {
+  while(!candidates.empty())
+    candidates.pop();
+  for(size_t n=ckpt.ReadSize(); n>0; --n) {
+    double value;
+    pair<ClusterId, ClusterId> keys;
+    ckpt.Read(value);
+    ckpt.Read(keys);
+    candidates.push(MergeCandidate(value, keys));
+  }
 }
 
 // // ----------------------------------------------------------------------------------------
@@ -120,70 +460,80 @@ void Glomerator::ReadCacheFile() {
   ifstream ifs(args_->input_cachefname());
   if(!ifs.is_open())
     throw runtime_error("input cache file " + args_->input_cachefname() + " dne\n");
-
-  string line;
-  // check the header is right (no cached info)
-  if(!getline(ifs, line)) {
+  if(ifs.peek() == ifstream::traits_type::eof()) {
     cout << "        empty cachefile" << endl;
     return;  // return for zero length file
   }
-  line.erase(remove(line.begin(), line.end(), '\r'), line.end());
-  vector<string> headstrs(SplitString(line, ","));
-  assert(headstrs[0].find("unique_ids") == 0);
-  assert(headstrs[1].find("logprob") == 0);
-  assert(headstrs[2].find("naive_seq") == 0);
-  assert(headstrs[3].find("naive_hfrac") == 0);
-  assert(headstrs[4].find("errors") == 0);
-
-  // NOTE there can be two lines with the same key (say if in one run we calculated the naive seq, and in a later run calculated the log prob)
-  while(getline(ifs, line)) {
-    line.erase(remove(line.begin(), line.end(), '\r'), line.end());
-    vector<string> column_list = SplitString(line, ",");
-    assert(column_list.size() == 5);
-    string query(column_list[0]);
-    string errors(column_list[4]);
-    if(errors.find("no_path") != string::npos) {
+  ifs.close();
+
+  // NOTE there can be two entries with the same key (say if in one run we calculated the naive seq, and in a later run calculated the log prob)
+  auto read_entry = [&](const CacheEntry &entry) {
+    ClusterId query = registry_.Intern(entry.name_);
+    TouchCacheEntry(query);
+    if(entry.errors_.find("no_path") != string::npos) {
       failed_queries_.insert(query);
-      continue;
+      return;
     }
 
-    string logprob_str(column_list[1]);
-    if(logprob_str.size() > 0) {  // NOTE <query> might already be in <log_probs_> (see above), but this won't replace it unless it's actually set in the file (we could also check that they're similar, but since we don't expect them to always be identical, that would be complicated)
-      log_probs_[query] = stof(logprob_str);
+    // NOTE we round log probs and naive hfracs to floats, since that's what we've always done (so results don't depend on which format the cache file's in)
+    if(entry.has_logprob_) {  // NOTE <query> might already be in <log_probs_> (see above), but this won't replace it unless it's actually set in the file (we could also check that they're similar, but since we don't expect them to always be identical, that would be complicated)
+      log_probs_[query] = float(entry.logprob_);
       initial_log_probs_.insert(query);
     }
 
-    string naive_seq(column_list[2]);
-
-    string naive_hfrac_str(column_list[3]);
-    if(naive_hfrac_str.size() > 0) {
-      naive_hfracs_[query] = stof(naive_hfrac_str);
+    if(entry.has_naive_hfrac_) {
+      naive_hfracs_[query] = float(entry.naive_hfrac_);
       initial_naive_hfracs_.insert(query);
     }
 
-    if(naive_seq.size() > 0) {
-      naive_seqs_[query] = naive_seq;
+    if(entry.naive_seq_.size() > 0) {
+      SetNaiveSeq(query, entry.naive_seq_);
       initial_naive_seqs_.insert(query);
     }
+  };
+  if(cache_store_ != nullptr) {
+    for(auto &entry : cache_store_->Entries(args_->input_cachefname()))
+      read_entry(entry);
+  } else {
+    ReadCacheEntries(args_->input_cachefname(), read_entry);
   }
   cout << "        read-cache:  logprobs " << log_probs_.size() << "   naive-seqs " << naive_seqs_.size() << endl;
 }
 
 // ----------------------------------------------------------------------------------------
-void Glomerator::WriteCacheLine(ofstream &ofs, string query) {
-  ofs << query << ",";
-  if(log_probs_.count(query))
-    ofs << log_probs_[query];
-  ofs << ",";
+CacheEntry Glomerator::GetCacheEntry(ClusterId query) {
+  CacheEntry entry;
+  entry.name_ = registry_.Name(query);
+  if(log_probs_.count(query)) {
+    entry.has_logprob_ = true;
+    entry.logprob_ = log_probs_[query];
+  }
   if(naive_seqs_.count(query))
-    ofs << naive_seqs_[query];
-  ofs << ",";
-  if(args_->cache_naive_hfracs() && naive_hfracs_.count(query))
-    ofs << naive_hfracs_[query];
-  ofs << ",";
+    entry.naive_seq_ = naive_seqs_[query];
+  if(args_->cache_naive_hfracs() && naive_hfracs_.count(query)) {
+    entry.has_naive_hfrac_ = true;
+    entry.naive_hfrac_ = naive_hfracs_[query];
+  }
   if(errors_.count(query))
-    ofs << errors_[query];
-  ofs << endl;
+    entry.errors_ = errors_[query];
+  return entry;
+}
+
+// ----------------------------------------------------------------------------------------
+bool Glomerator::OnlyCacheNewVals() {
+  return args_->only_cache_new_vals() || AppendToCacheJournal() || args_->existing_partition() != "";
+}
+
+// ----------------------------------------------------------------------------------------
+// does the output cache file need an entry for <key>?
+bool Glomerator::CacheKeyToWrite(ClusterId key, bool only_new_vals) {
+  if(log_probs_.count(key) && !(only_new_vals && initial_log_probs_.count(key)))  // don't cache it if we had it in the initial cache file (this is just an optimization)
+    return true;
+  if(naive_seqs_.count(key) && !(only_new_vals && initial_naive_seqs_.count(key)))  // note that if we had an initial log prob, but not an initial naive seq, we *do* want to write it (if we calculated the naive seq)
+    return true;
+  if(args_->cache_naive_hfracs() && naive_hfracs_.count(key) && !(only_new_vals && initial_naive_hfracs_.count(key)))
+    return true;
+  return false;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -191,36 +541,59 @@ void Glomerator::WriteCacheFile() {
   if(args_->output_cachefname() == "")
     return;
 
-  ofstream log_prob_ofs(args_->output_cachefname());
-  if(!log_prob_ofs.is_open())
-    throw runtime_error("couldn't open output cache file " + args_->output_cachefname() + "\n");
-
-  log_prob_ofs << "unique_ids,logprob,naive_seq,naive_hfrac,errors" << endl;
-  log_prob_ofs << setprecision(20);
-
-  set<string> keys_to_cache;
-  for(auto &kv : log_probs_) {
-    if(args_->only_cache_new_vals() && initial_log_probs_.count(kv.first))  // don't cache it if we had it in the initial cache file (this is just an optimization)
-      continue;
-    keys_to_cache.insert(kv.first);
-  }
-  for(auto &kv : naive_seqs_) {
-    if(args_->only_cache_new_vals() && initial_naive_seqs_.count(kv.first))  // note that if we had an initial log prob, but not an initial naive seq, we *do* want to write it (if we calculated the naive seq)
-      continue;
-    keys_to_cache.insert(kv.first);
-  }
-  if(args_->cache_naive_hfracs()) {
-    for(auto &kv : naive_hfracs_) {
-      if(args_->only_cache_new_vals() && initial_naive_hfracs_.count(kv.first))
-	continue;
+  bool only_new_vals(OnlyCacheNewVals());
+  set<ClusterId, ClusterNameLess> keys_to_cache{ClusterNameLess(&registry_)};  // (sorted by name string, so the file is in the same order as always)
+  for(auto &kv : log_probs_)
+    if(CacheKeyToWrite(kv.first, only_new_vals))
+      keys_to_cache.insert(kv.first);
+  for(auto &kv : naive_seqs_)
+    if(CacheKeyToWrite(kv.first, only_new_vals))
       keys_to_cache.insert(kv.first);
+  for(auto &kv : naive_hfracs_)
+    if(CacheKeyToWrite(kv.first, only_new_vals))
+      keys_to_cache.insert(kv.first);
+
+  // add anything that we evicted (some of which we may since have recalculated), so the file has everything it would've had without --cache-memory-budget
+  unordered_map<ClusterId, CacheEntry> evicted_entries;
+  ReadCacheJournal(evicted_cachefname(), [&](CacheEntry &entry) {
+      ClusterId key(registry_.Intern(entry.name_));
+      keys_to_cache.insert(key);
+      auto it = evicted_entries.find(key);
+      if(it == evicted_entries.end())
+	evicted_entries[key] = entry;
+      else
+	it->second.Update(entry);
+    });
+
+  vector<CacheEntry> entries;
+  for(auto &key : keys_to_cache) {
+    auto it = evicted_entries.find(key);
+    if(it == evicted_entries.end()) {
+      entries.push_back(GetCacheEntry(key));
+    } else {
+      entries.push_back(it->second);
+      if(CacheKeyToWrite(key, only_new_vals))
+	entries.back().Update(GetCacheEntry(key));
     }
   }
 
-  for(auto &key : keys_to_cache)
-    WriteCacheLine(log_prob_ofs, key);
+  if(AppendToCacheJournal())
+    CacheJournal(args_->output_cachefname()).Append(entries);
+  else if(args_->binary_cache())
+    WriteBinaryCacheFile(args_->output_cachefname(), entries);
+  else
+    WriteCsvCacheFile(args_->output_cachefname(), entries);
+  remove(CacheJournalName(evicted_cachefname()).c_str());
+}
 
-  log_prob_ofs.close();
+// ----------------------------------------------------------------------------------------
+// we only write the last --n-partitions-to-write partitions
+size_t Glomerator::FirstPartitionToWrite(ClusterPath &cp) {
+  if(args_->n_partitions_to_write() <= 0)
+    return cp.n_partitions();
+  if(cp.n_partitions() > size_t(args_->n_partitions_to_write()))
+    return cp.n_partitions() - args_->n_partitions_to_write();
+  return 0;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -228,25 +601,43 @@ void Glomerator::WritePartitions(ClusterPath &cp) {
   clock_t run_start(clock());
   if(args_->debug())
     cout << "        writing partitions" << endl;
-  ofs_.open(args_->outfile());
-  ofs_ << setprecision(20);
-  ofs_ << "partition,logprob" << endl;
-  unsigned istart(0);
-  if((int)cp.partitions().size() > args_->n_partitions_to_write())
-    istart = cp.partitions().size() - args_->n_partitions_to_write();
-  for(unsigned ipart=istart; ipart<cp.partitions().size(); ++ipart) {
-    if(args_->write_logprob_for_each_partition())  // only want to calculate this the last time through, i.e. when we're only one process NOTE this calculation can change the clustering (if we did an hfrac merge that logprob thinks we shouldn't have merged, when the python reads the partitions it'll notice this and choose the unmerged partition)
-      cp.set_logprob(ipart, LogProbOfPartition(cp.partitions()[ipart]));
-    int ic(0);
-    for(auto &cluster : cp.partitions()[ipart]) {
-      if(ic > 0)
-	ofs_ << ";";
-      ofs_ << cluster;
-      ++ic;
-    }
-    ofs_ << "," << cp.logprobs()[ipart] << endl;
+  OutputFileWriter *writer(nullptr);  // for --binary-output
+  if(args_->binary_output()) {
+    writer = new OutputFileWriter(args_->outfile(), "partition");
+  } else {
+    ofs_.open(args_->outfile());
+    ofs_ << setprecision(20);
+    ofs_ << "partition,logprob" << endl;
+  }
+  cp.ForEachPartition(FirstPartitionToWrite(cp), [&](size_t ipart, Partition &partition) {
+      if(args_->write_logprob_for_each_partition())  // only want to calculate this the last time through, i.e. when we're only one process NOTE this calculation can change the clustering (if we did an hfrac merge that logprob thinks we shouldn't have merged, when the python reads the partitions it'll notice this and choose the unmerged partition)
+	cp.set_logprob(ipart, LogProbOfPartition(partition));
+      if(writer != nullptr) {
+	OutputRow row(writer->schema());
+	row.doubles_[0] = cp.logprob(ipart);
+	for(auto &cluster : partition) {
+	  row.int_lists_[0].push_back(registry_.size(cluster));
+	  for(auto iuid : registry_.uids(cluster))
+	    row.id_lists_[0].push_back(registry_.uid_str(iuid));
+	}
+	writer->Add(row);
+	return;
+      }
+      int ic(0);
+      for(auto &cluster : partition) {
+	if(ic > 0)
+	  ofs_ << ";";
+	ofs_ << registry_.Name(cluster);
+	++ic;
+      }
+      ofs_ << "," << cp.logprob(ipart) << "\n";
+    });
+  if(writer != nullptr) {
+    writer->Close();
+    delete writer;
+  } else {
+    ofs_.close();
   }
-  ofs_.close();
   if(args_->write_logprob_for_each_partition())
     printf("        partition writing time (probably includes calculating a bunch of new logprobs) %.1f\n", ((clock() - run_start) / (double)CLOCKS_PER_SEC));
 }
@@ -256,12 +647,10 @@ void Glomerator::WriteAnnotations(ClusterPath &cp) {
   cout << "DEPRECATED" << endl;  // for somewhat technical reasons -- it still basically works (see notes in partitiondriver.py)
   clock_t run_start(clock());
   cout << "      calculating and writing annotations" << endl;
-  ofstream annotation_ofs;
-  annotation_ofs.open(args_->annotationfile());
-  StreamHeader(annotation_ofs, "viterbi");
+  AnnotationWriter writer(args_->annotationfile(), "viterbi", args_->binary_output());
 
   // NOTE we're no longer calculating the logprob for *every* partition, but in Glomerator::WritePartitions() we *do* calculate them if we're told to (i.e. the last time through), and this can make it so the last partition isn't the most likely
-  for(auto &cluster : cp.partitions()[cp.i_best()]) {
+  for(auto &cluster : cp.GetPartition(cp.i_best())) {
     if(args_->seed_unique_id() != "" && SeedMissing(cluster))
       continue;
 
@@ -269,12 +658,12 @@ void Glomerator::WriteAnnotations(ClusterPath &cp) {
     CalculateNaiveSeq(GetNaiveSeqNameToCalculate(cluster), &event);  // calculate the viterbi path from scratch to get the <event> set (should probably at some point start caching the events earlier)
 
     if(event.genes_["d"] == "") {  // shouldn't happen any more, but it is a check that could fail at some point
-      cout << "WTF " << cluster << " x" << event.naive_seq_ << "x" << endl;
+      cout << "WTF " << registry_.Name(cluster) << " x" << event.naive_seq_ << "x" << endl;
       assert(0);
     }
-    StreamViterbiOutput(annotation_ofs, event, cachefo(cluster).seqs_, "");
+    writer.Viterbi(event, cachefo(cluster).seqs_, "");
   }
-  annotation_ofs.close();
+  writer.Close();
   printf("        annotation writing time (probably includes a bunch of new vtb calculations) %.1f\n", ((clock() - run_start) / (double)CLOCKS_PER_SEC));
 }
 
@@ -287,7 +676,7 @@ double Glomerator::LogProbOfPartition(Partition &partition, bool debug) {
   for(auto &key : partition) {
     double log_prob = GetLogProb(key);  // NOTE do *not* do any translation here -- we need the actual probability of the whole partition, to compare to the other partitions, so we need each and every sequence in each cluster (i.e. if you wanted to do translation, you'd have to coordinate the ignored sequences among the different partitions)
     if(debug)
-      cout << "  " << log_prob << "  " << key << endl;
+      cout << "  " << log_prob << "  " << registry_.Name(key) << endl;
     total_log_prob = AddWithMinusInfinities(total_log_prob, log_prob);
   }
   if(debug)
@@ -300,7 +689,7 @@ void Glomerator::PrintPartition(Partition &partition, string extrastr) {
   const char *extra_cstr(extrastr.c_str());  // dammit I shouldn't need this line
   printf("    %-8.2f %s partition\n", -INFINITY/*LogProbOfPartition(partition)*/, extra_cstr);
   for(auto &key : partition)
-    cout << "          " << key << endl;
+    cout << "          " << registry_.Name(key) << endl;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -310,11 +699,70 @@ string Glomerator::CacheSizeString() {
   return string(buffer);
 }
 
+// ----------------------------------------------------------------------------------------
+// rough guess at the memory used by an unordered map: each node has the key/value pair, a next pointer, and some malloc overhead, plus there's a pointer for each bucket
+template<typename T> static size_t HashMapBytes(T &cachemap) {
+  return cachemap.size() * (sizeof(typename T::value_type) + 2 * sizeof(void*)) + cachemap.bucket_count() * sizeof(void*);
+}
+
+// ----------------------------------------------------------------------------------------
+size_t Glomerator::CacheBytes(string cachename) {
+  if(cachename == "logprob")
+    return HashMapBytes(log_probs_);
+  else if(cachename == "naive_hfrac")
+    return HashMapBytes(naive_hfracs_);
+  else if(cachename == "lratio")
+    return HashMapBytes(lratios_);
+  else if(cachename == "naive_seq")  // (including the packed versions)
+    return HashMapBytes(naive_seqs_) + naive_seq_bytes_ + HashMapBytes(packed_naive_seqs_) + packed_naive_seq_bytes_ * sizeof(uint64_t);
+  else if(cachename == "name_subset")
+    return HashMapBytes(name_subsets_);
+  else if(cachename == "profile")
+    return HashMapBytes(profiles_) + profile_bytes_;
+  else if(cachename == "last_used")  // bookkeeping for the eviction
+    return HashMapBytes(last_used_);
+  else
+    throw runtime_error("unknown cache name " + cachename + " in CacheBytes()");
+}
+
+// ----------------------------------------------------------------------------------------
+size_t Glomerator::CacheBytes() {
+  return CacheBytes("logprob") + CacheBytes("naive_hfrac") + CacheBytes("lratio") + CacheBytes("naive_seq") + CacheBytes("name_subset") + CacheBytes("profile") + CacheBytes("last_used");
+}
+
+// ----------------------------------------------------------------------------------------
+string Glomerator::CacheMemoryString(bool verbose) {
+  char buffer[2000];
+  if(!verbose) {
+    sprintf(buffer, "cache %.1f MB", CacheBytes() / 1e6);
+    return string(buffer);
+  }
+  string return_str("        caches        entries       MB       hits     misses    evicted\n");
+  vector<pair<string, size_t> > sizes{{"logprob", log_probs_.size()}, {"naive_hfrac", naive_hfracs_.size()}, {"lratio", lratios_.size()}, {"naive_seq", naive_seqs_.size()}, {"name_subset", name_subsets_.size()}, {"profile", profiles_.size()}};
+  vector<CacheStats*> stats{&log_prob_stats_, &naive_hfrac_stats_, &lratio_stats_, &naive_seq_stats_, &name_subset_stats_, &profile_stats_};
+  for(size_t ic=0; ic<sizes.size(); ++ic) {
+    sprintf(buffer, "        %-12s %8zu %8.1f %10ld %10ld %10ld\n", sizes[ic].first.c_str(), sizes[ic].second, CacheBytes(sizes[ic].first) / 1e6, stats[ic]->hits_, stats[ic]->misses_, stats[ic]->evictions_);
+    return_str += buffer;
+  }
+  sprintf(buffer, "        total                 %8.1f MB", CacheBytes() / 1e6);
+  return_str += buffer;
+  if(args_->cache_memory_budget() > 0.) {
+    sprintf(buffer, "  (budget %g MB)", args_->cache_memory_budget());
+    return_str += buffer;
+  }
+  return return_str + "\n";
+}
+
 // ----------------------------------------------------------------------------------------
 string Glomerator::FinalString(bool newline) {
     char buffer[2000];
     sprintf(buffer, "        calcd:   vtb %-4d  fwd %-4d  hfrac %-8d%s        merged:  hfrac %-4d lratio %-4d", n_vtb_calculated_, n_fwd_calculated_, n_hfrac_calculated_, newline ? "\n" : "", n_hfrac_merges_, n_lratio_merges_);
-    return string(buffer);
+    string final_str(buffer);
+    if(args_->prune_viterbi()) {
+      sprintf(buffer, "%s        pruned:  k sets %-6d  genes %-6d", newline ? "\n" : "", n_pruned_ksets_, n_pruned_genes_);
+      final_str += buffer;
+    }
+    return final_str;
 }
 
 // ----------------------------------------------------------------------------------------
@@ -325,6 +773,7 @@ string Glomerator::GetStatusStr(time_t current_time) {
   ss << "      " << timebuf;
   ss << "    " << setw(4) << current_partition_->size() << " clusters";
   ss << "    " << setw(9) << GetRss() << " / " << setw(1) << GetMemTot() << " kB = " << setw(6) << setprecision(3) << 100. * float(GetRss()) / GetMemTot() << " %";
+  ss << "   " << CacheMemoryString();
   ss << "   " << FinalString(false);
   ss << "     " << ClusterSizeString(current_partition_).c_str();
   ss << endl;
@@ -347,21 +796,14 @@ void Glomerator::WriteStatus() {
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::ParentalString(pair<string, string> *parents) {
+string Glomerator::ParentalString(pair<ClusterId, ClusterId> *parents) {
   if(CountMembers(parents->first) > 5 || CountMembers(parents->second) > 5) {
     return to_string(CountMembers(parents->first)) + " and " + to_string(CountMembers(parents->second));
   } else {
-    return parents->first + " and " + parents->second;
+    return registry_.Name(parents->first) + " and " + registry_.Name(parents->second);
   }
 }
 
-// ----------------------------------------------------------------------------------------
-// count the number of members in a cluster's colon-separated name string
-int Glomerator::CountMembers(string namestr) {
-  int n_colons = (int)count(namestr.begin(), namestr.end(), ':');
-  return n_colons + 1;
-}
-
 // ----------------------------------------------------------------------------------------
 // count the number of members in a cluster's colon-separated name string
 unsigned Glomerator::LargestClusterSize(Partition &partition) {
@@ -393,13 +835,6 @@ string Glomerator::ClusterSizeString(Partition *partition) {
   return return_str + "  (" + to_string(n_singletons) + " singletons)";
 }
 
-// ----------------------------------------------------------------------------------------
-string Glomerator::JoinNames(string name1, string name2, string delimiter) {
-  vector<string> names{name1, name2};
-  sort(names.begin(), names.end());  // NOTE this doesn't sort *within* name1 or name2 when they're already comprised of several uids. In principle this will lead to unnecessary cache misses (if we later arrive at the same combination of sequences from a different starting point). In practice, this is very unlikely (unless we're dong smc) since we've already merged the constituents of name1 and name2 and we can't unmerge them.
-  return names[0] + delimiter + names[1];
-}
-
 // ----------------------------------------------------------------------------------------
 string Glomerator::JoinNameStrings(vector<Sequence*> &strlist, string delimiter) {
   string return_str;
@@ -423,15 +858,15 @@ string Glomerator::JoinSeqStrings(vector<Sequence*> &strlist, string delimiter)
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::PrintStr(string queries) {
+string Glomerator::PrintStr(ClusterId queries) {
   if(CountMembers(queries) < 10)
-    return queries;
+    return registry_.Name(queries);
   else
     return "len(" + to_string(CountMembers(queries)) + ")";
 }
 
 // ----------------------------------------------------------------------------------------
-bool Glomerator::SeedMissing(string queries) {
+bool Glomerator::SeedMissing(ClusterId queries) {
   return cachefo(queries).seed_missing_;  // NOTE after refactoring the double loops, we probably don't really need to cache all these any more
   // set<string> queryset(SplitString(queries, delimiter));  // might be faster to look for :uid: and uid: and... hm, wait, that's kind of hard
   // return !InString(args_->seed_unique_id(), queries,  delimiter);
@@ -445,54 +880,64 @@ bool Glomerator::SeedMissing(string queries) {
 }
 
 // ----------------------------------------------------------------------------------------
-double Glomerator::CalculateHfrac(string &seq_a, string &seq_b) {
+double Glomerator::CalculateHfrac(ClusterId key_a, ClusterId key_b) {
   ++n_hfrac_calculated_;
-  if(seq_a.size() != seq_b.size())
+  PackedSeq &pseq_a(GetPackedNaiveSeq(key_a)), &pseq_b(GetPackedNaiveSeq(key_b));
+  if(pseq_a.size() != pseq_b.size()) {
+    string &seq_a(naive_seqs_[key_a]), &seq_b(naive_seqs_[key_b]);
     throw runtime_error("sequences different length in Glomerator::NaiveHfrac\n    " + to_string(seq_a.size()) + ": " + seq_a + "\n    " + to_string(seq_b.size()) + ": " + seq_b + "\n");
-  int distance(0), len_excluding_ambigs(0);
-  for(size_t ic=0; ic<seq_a.size(); ++ic) {
-    uint8_t ch_a = track_->symbol_index(seq_a.substr(ic, 1));  // kind of hackey remnant left from when naive seqs were Sequence objects
-    uint8_t ch_b = track_->symbol_index(seq_b.substr(ic, 1));
-    if(ch_a == track_->ambiguous_index() || ch_b == track_->ambiguous_index())  // skip this position if either sequence has an ambiguous character (if not set, ambig-base should be the empty string)
-      continue;
-    ++len_excluding_ambigs;
-    if(ch_a != ch_b)
-      ++distance;
   }
-
+  size_t len_excluding_ambigs(0);  // skip positions where either sequence has an ambiguous character (if not set, ambig-base should be the empty string)
+  size_t distance = PackedHammingDistance(pseq_a, pseq_b, len_excluding_ambigs);
   return distance / double(len_excluding_ambigs);
 }
 
 // ----------------------------------------------------------------------------------------
-double Glomerator::NaiveHfrac(string key_a, string key_b) {
-  string joint_key = JoinNames(key_a, key_b);  // NOTE since the cache is indexed by the joint key, this assumes we can arrive at this cluster via only one path. Which should be ok.
-  if(naive_hfracs_.count(joint_key))  // if we've already calculated this distance
-    return naive_hfracs_[joint_key];
+// packed version of the naive sequence for <key> (which has to already be in <naive_seqs_>) for calculating hfracs
+PackedSeq &Glomerator::GetPackedNaiveSeq(ClusterId key) {
+  auto it = packed_naive_seqs_.find(key);
+  if(it != packed_naive_seqs_.end())
+    return it->second;
+  PackedSeq &pseq(packed_naive_seqs_[key] = PackedSeq(naive_seqs_.at(key), track_));
+  packed_naive_seq_bytes_ += pseq.planes_.size() + pseq.unambiguous_.size();
+  return pseq;
+}
 
-  string &seq_a = GetNaiveSeq(key_a);
-  string &seq_b = GetNaiveSeq(key_b);
+// ----------------------------------------------------------------------------------------
+double Glomerator::NaiveHfrac(ClusterId key_a, ClusterId key_b) {
+  ClusterId joint_key = registry_.Join(key_a, key_b);  // NOTE since the cache is indexed by the joint key, this assumes we can arrive at this cluster via only one path. Which should be ok.
+  auto it = naive_hfracs_.find(joint_key);
+  naive_hfrac_stats_.Count(it != naive_hfracs_.end());
+  TouchCacheEntry(joint_key);
+  if(it != naive_hfracs_.end())  // if we've already calculated this distance
+    return it->second;
+
+  GetNaiveSeq(key_a);
+  GetNaiveSeq(key_b);
   double hfrac(INFINITY);
   if(failed_queries_.count(key_a) || failed_queries_.count(key_b))
     return hfrac;
-  naive_hfracs_[joint_key] = CalculateHfrac(seq_a, seq_b);
+  naive_hfracs_[joint_key] = CalculateHfrac(key_a, key_b);
 
   return naive_hfracs_[joint_key];
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::ChooseSubsetOfNames(string queries, int n_max) {
+ClusterId Glomerator::ChooseSubsetOfNames(ClusterId queries, int n_max) {
+  name_subset_stats_.Count(name_subsets_.count(queries));
+  TouchCacheEntry(queries);
   if(name_subsets_.count(queries))
     return name_subsets_[queries];
 
   // assert(seq_info_.count(queries) || tmp_cachefo_.count(queries));
-  vector<string> namevector(SplitString(queries, ":"));
+  vector<unsigned> namevector(registry_.uids(queries));
 
-  srand(hash<string>{}(queries));  // make sure we get the same subset each time we pass in the same queries (well, if there's different thresholds for naive_seqs annd logprobs they'll each get their own [very correlated] subset)
+  srand(hash<string>{}(registry_.Name(queries)));  // make sure we get the same subset each time we pass in the same queries (well, if there's different thresholds for naive_seqs annd logprobs they'll each get their own [very correlated] subset)
 
   // first decide which indices we'll choose
   set<int> ichosen;
   vector<int> ichosen_vec;  // don't really need both of these... but maybe it's faster
-  set<string> chosen_strs;  // make sure we don't choose seed unique id more than once
+  set<unsigned> chosen_strs;  // make sure we don't choose seed unique id more than once
   for(size_t iname=0; iname<unsigned(n_max); ++iname) {
     int ich(-1);
     int n_tries(0);
@@ -513,29 +958,29 @@ string Glomerator::ChooseSubsetOfNames(string queries, int n_max) {
   Query &cacheref = cachefo(queries);
 
   // and finally make the new vectors
-  vector<string> subqueryvec;
+  vector<unsigned> subqueryvec;
   for(auto &ich : ichosen_vec)
     subqueryvec.push_back(namevector[ich]);
 
-  string subqueries(JoinStrings(subqueryvec));
+  ClusterId subqueries = registry_.Intern(subqueryvec);
 
   tmp_cachefo_[subqueries] = Query(subqueries,
 				   GetSeqs(subqueries),
-				   !InString(args_->seed_unique_id(), subqueries),
+				   !registry_.Contains(subqueries, args_->seed_unique_id()),
 				   cacheref.only_genes_,
 				   cacheref.kbounds_,
 				   cacheref.mute_freq_,
 				   cacheref.cdr3_length_);
 
   if(args_->debug())
-    cout << "                chose subset  " << queries << "  -->  " << subqueries << endl;
+    cout << "                chose subset  " << registry_.Name(queries) << "  -->  " << registry_.Name(subqueries) << endl;
 
   name_subsets_[queries] = subqueries;
   return subqueries;
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::GetNaiveSeqNameToCalculate(string actual_queries) {
+ClusterId Glomerator::GetNaiveSeqNameToCalculate(ClusterId actual_queries) {
   // NOTE we don't really need to cache the names like this, since we're setting the random seed when we choose a subset. But it just seems so messy to go through the whole subset calculation every time, even though I profiled it and it's not a significant contributor
   if(naive_seq_name_translations_.count(actual_queries))
     return naive_seq_name_translations_[actual_queries];
@@ -545,20 +990,20 @@ string Glomerator::GetNaiveSeqNameToCalculate(string actual_queries) {
     return actual_queries;
 
   // but if it's bigger than this, replace it with a subset of size N
-  string subqueries = ChooseSubsetOfNames(actual_queries, args_->biggest_naive_seq_cluster_to_calculate());
+  ClusterId subqueries = ChooseSubsetOfNames(actual_queries, args_->biggest_naive_seq_cluster_to_calculate());
   if(args_->debug() > 0)
-    cout << "                translate for naive seq  " << actual_queries << "  -->  " << subqueries << endl;
+    cout << "                translate for naive seq  " << registry_.Name(actual_queries) << "  -->  " << registry_.Name(subqueries) << endl;
 
   naive_seq_name_translations_[actual_queries] = subqueries;
   return subqueries;
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::GetLogProbNameToCalculate(string queries, int n_max) {
-  string queries_to_calc(queries);
+ClusterId Glomerator::GetLogProbNameToCalculate(ClusterId queries, int n_max) {
+  ClusterId queries_to_calc(queries);
   if(logprob_asymetric_translations_.count(queries)) {
     if(args_->debug())
-      cout << "             using asymetric translation  " << queries << "  -->  " << logprob_asymetric_translations_[queries] << endl;
+      cout << "             using asymetric translation  " << registry_.Name(queries) << "  -->  " << registry_.Name(logprob_asymetric_translations_[queries]) << endl;
     queries_to_calc = logprob_asymetric_translations_[queries];
   } 
 
@@ -570,7 +1015,7 @@ string Glomerator::GetLogProbNameToCalculate(string queries, int n_max) {
 }
 
 // ----------------------------------------------------------------------------------------
-pair<string, string> Glomerator::GetLogProbPairOfNamesToCalculate(string actual_queries, pair<string, string> actual_parents) {
+pair<ClusterId, ClusterId> Glomerator::GetLogProbPairOfNamesToCalculate(ClusterId actual_queries, pair<ClusterId, ClusterId> actual_parents) {
   // NOTE we don't really need to cache the names like this, since we're setting the random seed when we choose a subset. But it just seems so messy to go through the whole subset calculation every time, even though I profiled it and it's not a significant contributor
   if(logprob_name_translations_.count(actual_queries))
     return logprob_name_translations_[actual_queries];
@@ -582,26 +1027,26 @@ pair<string, string> Glomerator::GetLogProbPairOfNamesToCalculate(string actual_
     return actual_parents;
 
   // replace either/both parents as necessary
-  pair<string, string> queries_to_calc;
+  pair<ClusterId, ClusterId> queries_to_calc;
   queries_to_calc.first = GetLogProbNameToCalculate(actual_parents.first, n_max);  // note, no factor of 1.5, "since" this is more considering the lratio as a whole, and
   queries_to_calc.second = GetLogProbNameToCalculate(actual_parents.second, n_max);
 
   if(args_->debug())
-    printf("                translate for lratio (%s)   %s  %s  -->  %s  %s\n", actual_queries.c_str(), actual_parents.first.c_str(), actual_parents.second.c_str(), queries_to_calc.first.c_str(), queries_to_calc.second.c_str());
+    printf("                translate for lratio (%s)   %s  %s  -->  %s  %s\n", registry_.Name(actual_queries).c_str(), registry_.Name(actual_parents.first).c_str(), registry_.Name(actual_parents.second).c_str(), registry_.Name(queries_to_calc.first).c_str(), registry_.Name(queries_to_calc.second).c_str());
 
   logprob_name_translations_[actual_queries] = queries_to_calc;
   return queries_to_calc;
 }
 
 // ----------------------------------------------------------------------------------------
-bool Glomerator::FirstParentMuchBigger(string queries, string queries_other, int nmax) {
+bool Glomerator::FirstParentMuchBigger(ClusterId queries, ClusterId queries_other, int nmax) {
   int nseq(CountMembers(queries));
   int nseq_other(CountMembers(queries_other));
   if(nseq > nmax && float(nseq) / nseq_other > asym_factor_ ) {  // if <nseq> is large, and if <nseq> more than twice the size of <nseq_other>, use the existing name translation (for which we should already have a logprob and a naive seq)
     if(args_->debug()) {
-      cout << "                asymetric  " << nseq << " " << nseq_other << "  use " << queries << "  instead of " << JoinNames(queries, queries_other) << endl;
+      cout << "                asymetric  " << nseq << " " << nseq_other << "  use " << registry_.Name(queries) << "  instead of " << registry_.Name(registry_.Join(queries, queries_other)) << endl;
       if(naive_seq_name_translations_.count(queries))
-	cout << "                    naive seq translates to " << naive_seq_name_translations_[queries] << endl;
+	cout << "                    naive seq translates to " << registry_.Name(naive_seq_name_translations_[queries]) << endl;
     }
     return true;
   }
@@ -609,7 +1054,7 @@ bool Glomerator::FirstParentMuchBigger(string queries, string queries_other, int
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::FindNaiveSeqNameReplace(pair<string, string> *parents) {
+ClusterId Glomerator::FindNaiveSeqNameReplace(pair<ClusterId, ClusterId> *parents) {
   assert(parents != nullptr);
 
   // if both parents have the same naive sequence, just use the first one
@@ -623,39 +1068,51 @@ string Glomerator::FindNaiveSeqNameReplace(pair<string, string> *parents) {
   if(FirstParentMuchBigger(parents->second, parents->first, nmax))
     return parents->second;
 
-  return string("");  // if we fall through, we don't want to replace the current query (but maybe we'll later decide to only use a subset of it)
+  return NO_CLUSTER;  // if we fall through, we don't want to replace the current query (but maybe we'll later decide to only use a subset of it)
 }
 
 // ----------------------------------------------------------------------------------------
-string &Glomerator::GetNaiveSeq(string queries, pair<string, string> *parents) {
-  if(naive_seqs_.count(queries))
-    return naive_seqs_[queries];
+string &Glomerator::GetNaiveSeq(ClusterId queries, pair<ClusterId, ClusterId> *parents) {
+  auto it = naive_seqs_.find(queries);
+  naive_seq_stats_.Count(it != naive_seqs_.end());
+  TouchCacheEntry(queries);
+  if(it != naive_seqs_.end())
+    return it->second;
 
   // see if we want to just straight up use the naive sequence from one of the parents
   if(parents != nullptr) {
-    string name_with_which_to_replace = FindNaiveSeqNameReplace(parents);
-    if(name_with_which_to_replace != "") {
-      naive_seqs_[queries] = GetNaiveSeq(name_with_which_to_replace);  // copy the whole sequence object  TODO this doesn't follow/do the turtle thing
-      return naive_seqs_[queries];
+    ClusterId name_with_which_to_replace = FindNaiveSeqNameReplace(parents);
+    if(name_with_which_to_replace != NO_CLUSTER) {
+      return SetNaiveSeq(queries, GetNaiveSeq(name_with_which_to_replace));  // copy the whole sequence object  TODO this doesn't follow/do the turtle thing
     }
   }
 
   // see if we want to calculate with only a subset of the queries
-  string queries_to_calc = GetNaiveSeqNameToCalculate(queries);
+  ClusterId queries_to_calc = GetNaiveSeqNameToCalculate(queries);
 
   // actually calculate the viterbi path for whatever queries we've decided on
   if(naive_seqs_.count(queries_to_calc) == 0) {
     string tmp_nseq = CalculateNaiveSeq(queries_to_calc);  // some compilers add <queries_to_calc> to <naive_seqs_> *before* calling CalculateNaiveSeq(), which causes that function's check to fail
-    naive_seqs_[queries_to_calc] = tmp_nseq;
+    SetNaiveSeq(queries_to_calc, tmp_nseq);
   }
+  TouchCacheEntry(queries_to_calc);
 
   // if we did some translation, propagate the naive sequence back to the queries we were originally interested in
   if(queries_to_calc != queries)
-    naive_seqs_[queries] = naive_seqs_[queries_to_calc];
+    SetNaiveSeq(queries, naive_seqs_[queries_to_calc]);
 
   return naive_seqs_[queries];
 }
 
+// ----------------------------------------------------------------------------------------
+string &Glomerator::SetNaiveSeq(ClusterId queries, const string &naive_seq) {
+  auto it = naive_seqs_.find(queries);
+  if(it != naive_seqs_.end())  // (only happens when reading the cache file)
+    naive_seq_bytes_ -= it->second.size();
+  naive_seq_bytes_ += naive_seq.size();
+  return naive_seqs_[queries] = naive_seq;
+}
+
 // // ----------------------------------------------------------------------------------------
 // double Glomerator::NormFactor(string name) {
 //     double nseqs(CountMembers(name));
@@ -663,9 +1120,12 @@ string &Glomerator::GetNaiveSeq(string queries, pair<string, string> *parents) {
 // }
 
 // ----------------------------------------------------------------------------------------
-double Glomerator::GetLogProb(string queries) {  // NOTE this does *no* translation, so you better have done that already before you call it if you want it done
-  if(log_probs_.count(queries))  // already did it
-    return log_probs_[queries];
+double Glomerator::GetLogProb(ClusterId queries) {  // NOTE this does *no* translation, so you better have done that already before you call it if you want it done
+  auto it = log_probs_.find(queries);
+  log_prob_stats_.Count(it != log_probs_.end());
+  TouchCacheEntry(queries);
+  if(it != log_probs_.end())  // already did it
+    return it->second;
 
   double tmplp = CalculateLogProb(queries);  // NOTE this should be the *only* place (besides cache reading) that log_probs_ gets modified
   log_probs_[queries] = tmplp;  // tmp variable is just so we can assert that queries isn't already in log_probs_
@@ -674,33 +1134,36 @@ double Glomerator::GetLogProb(string queries) {  // NOTE this does *no* translat
 }
 
 // ----------------------------------------------------------------------------------------
-double Glomerator::GetLogProbRatio(string key_a, string key_b) {
+double Glomerator::GetLogProbRatio(ClusterId key_a, ClusterId key_b) {
   // NOTE the error from using the single kbounds rather than the OR seems to be around a part in a thousand or less (it's only really important that the merged query has the OR)
   // NOTE also that the _a and _b results will be cached, but with their *individual* only_gene sets (rather than the OR)... but this seems to be ok.
   // NOTE if kbounds gets expanded in one of these three calls, we don't redo the others. Which is really ok, but could be checked again?
   // NOTE we could avoid recalculating a lot of the denominators if we didn't randomly choose a subset, and instead looked to see what we already have (but then it would be a lot harder to have a representive sample...)
 
-  string joint_name(JoinNames(key_a, key_b));
+  ClusterId joint_name(registry_.Join(key_a, key_b));
 
-  if(lratios_.count(joint_name))  // NOTE as in other places, this assumes there's only *one* way to get to a given joint name (or at least that we'll get about the same answer each different way)
-    return lratios_[joint_name];
+  auto it = lratios_.find(joint_name);
+  lratio_stats_.Count(it != lratios_.end());
+  TouchCacheEntry(joint_name);
+  if(it != lratios_.end())  // NOTE as in other places, this assumes there's only *one* way to get to a given joint name (or at least that we'll get about the same answer each different way)
+    return it->second;
 
   Query full_qmerged = GetMergedQuery(key_a, key_b);
-  pair<string, string> parents_to_calc = GetLogProbPairOfNamesToCalculate(joint_name, full_qmerged.parents_);
-  string key_a_to_calc = parents_to_calc.first;
-  string key_b_to_calc = parents_to_calc.second;
+  pair<ClusterId, ClusterId> parents_to_calc = GetLogProbPairOfNamesToCalculate(joint_name, full_qmerged.parents_);
+  ClusterId key_a_to_calc = parents_to_calc.first;
+  ClusterId key_b_to_calc = parents_to_calc.second;
   Query qmerged_to_calc = GetMergedQuery(key_a_to_calc, key_b_to_calc);
 
   double log_prob_a = GetLogProb(key_a_to_calc);
   double log_prob_b = GetLogProb(key_b_to_calc);
-  double log_prob_ab = GetLogProb(qmerged_to_calc.name_);
+  double log_prob_ab = GetLogProb(qmerged_to_calc.id_);
 
   double lratio(log_prob_ab - log_prob_a - log_prob_b);
   if(args_->debug()) {
     printf("             %8.3f =", lratio);
-    printf(" %s - %s - %s", joint_name.c_str(), key_a.c_str(), key_b.c_str());
-    if(qmerged_to_calc.name_ != joint_name || key_a_to_calc != key_a || key_b_to_calc != key_b)
-      printf(" (calcd  %s - %s - %s)", qmerged_to_calc.name_.c_str(), key_a_to_calc.c_str(), key_b_to_calc.c_str());
+    printf(" %s - %s - %s", registry_.Name(joint_name).c_str(), registry_.Name(key_a).c_str(), registry_.Name(key_b).c_str());
+    if(qmerged_to_calc.id_ != joint_name || key_a_to_calc != key_a || key_b_to_calc != key_b)
+      printf(" (calcd  %s - %s - %s)", registry_.Name(qmerged_to_calc.id_).c_str(), registry_.Name(key_a_to_calc).c_str(), registry_.Name(key_b_to_calc).c_str());
     printf("\n");
   }
 
@@ -709,7 +1172,7 @@ double Glomerator::GetLogProbRatio(string key_a, string key_b) {
 }
 
 // ----------------------------------------------------------------------------------------
-string Glomerator::CalculateNaiveSeq(string queries, RecoEvent *event) {
+string Glomerator::CalculateNaiveSeq(ClusterId queries, RecoEvent *event) {
   if(event == nullptr)  // if we're calling it with <event> set, then we know we're recalculating some things
     assert(naive_seqs_.count(queries) == 0);
 
@@ -718,9 +1181,11 @@ string Glomerator::CalculateNaiveSeq(string queries, RecoEvent *event) {
 
   ++n_vtb_calculated_;
 
-  DPHandler dph("viterbi", args_, gl_, hmms_);
+  DPHandler dph("viterbi", args_, gl_, hmms_, args_->n_threads());
   Query &cacheref = cachefo(queries);
   Result result = dph.Run(cacheref.seqs_, cacheref.kbounds_, cacheref.only_genes_, cacheref.mute_freq_);
+  n_pruned_ksets_ += result.n_pruned_ksets_;
+  n_pruned_genes_ += result.n_pruned_genes_;
   // if(FishyMultiSeqAnnotation(SplitString(queries).size(), result.best_event()))
   //   dph.HandleFishyAnnotations(result, cacheref.seqs_, cacheref.kbounds_, cacheref.only_genes_, cacheref.mute_freq_);
   if(result.no_path_) {
@@ -736,7 +1201,7 @@ string Glomerator::CalculateNaiveSeq(string queries, RecoEvent *event) {
 }
 
 // ----------------------------------------------------------------------------------------
-double Glomerator::CalculateLogProb(string queries) {  // NOTE can modify kbinfo_
+double Glomerator::CalculateLogProb(ClusterId queries) {  // NOTE can modify kbinfo_
   // NOTE do *not* call this from anywhere except GetLogProb()
   assert(log_probs_.count(queries) == 0);
 
@@ -745,30 +1210,117 @@ double Glomerator::CalculateLogProb(string queries) {  // NOTE can modify kbinfo
   
   ++n_fwd_calculated_;
 
-  DPHandler dph("forward", args_, gl_, hmms_);
-  Query &cacheref = cachefo(queries);
-  Result result = dph.Run(cacheref.seqs_, cacheref.kbounds_, cacheref.only_genes_, cacheref.mute_freq_);
-  if(result.no_path_) {
+  double total_score(-INFINITY);
+  bool no_path(false);
+  auto it = precalculated_log_probs_.find(queries);
+  if(it != precalculated_log_probs_.end()) {  // already ran it on another thread
+    total_score = it->second.first;
+    no_path = it->second.second;
+    precalculated_log_probs_.erase(it);
+  } else {
+    DPHandler dph("forward", args_, gl_, hmms_, args_->n_threads());
+    Query &cacheref = cachefo(queries);
+    Result result = dph.Run(Sequences(GetProfile(queries), registry_.Name(queries)), cacheref.kbounds_, cacheref.only_genes_, cacheref.mute_freq_);
+    total_score = result.total_score();
+    no_path = result.no_path_;
+  }
+  if(no_path) {
     AddFailedQuery(queries, "no_path");
     return -INFINITY;
   }
 
   WriteStatus();
-  return result.total_score();
+  return total_score;
+}
+
+// ----------------------------------------------------------------------------------------
+// Count profile of <key>'s sequences, which is all the forward algorithm needs. If <key> is a merge, it's the sum of its parents' profiles, which
+// for current clusters we usually have in <profiles_> (see Merge()), so merged clusters cost us their length rather than their size.
+SeqProfile Glomerator::GetProfile(ClusterId key) {
+  auto it = profiles_.find(key);
+  if(it != profiles_.end()) {
+    profile_stats_.Count(true);
+    return it->second;
+  }
+  SeqProfile profile;
+  Query &cacheref(cachefo(key));
+  if(cacheref.parents_.first != NO_CLUSTER && (profiles_.count(cacheref.parents_.first) || profiles_.count(cacheref.parents_.second))) {
+    pair<ClusterId, ClusterId> parents(cacheref.parents_);  // (copy, since GetProfile() can add to the cache maps)
+    profile = GetProfile(parents.first);
+    SeqProfile other(GetProfile(parents.second));
+    profile.Add(other);
+    if(profile.n_seqs() != cacheref.seqs_.size())
+      throw runtime_error("parents' profiles have " + to_string(profile.n_seqs()) + " sequences, but " + registry_.Name(key) + " has " + to_string(cacheref.seqs_.size()));
+  } else {
+    profile_stats_.Count(false);
+    for(auto *pseq : cacheref.seqs_)
+      profile.Add(*pseq);
+  }
+  return profile;
 }
 
 // ----------------------------------------------------------------------------------------
-void Glomerator::AddFailedQuery(string queries, string error_str) {
+// Run the forward calculations that we'll need for the lratios in <lratio_pairs_to_calculate_>, several at a time on <thread_pool_> (with one thread
+// each, rather than one thread per gene). The results wait in <precalculated_log_probs_> until CalculateLogProb() asks for them, so everything else
+// (which lratios we calculate, the caches, failed queries, and the counters) ends up the same as if we'd run them one at a time.
+// NOTE if a cluster fails partway through, we may have run some calculations that never get asked for
+void Glomerator::PrecalculateLogProbs(Partition &partition) {
+  vector<ClusterId> queries_to_calc;
+  unordered_set<ClusterId> queries_added;
+  for(auto &keys : lratio_pairs_to_calculate_) {  // this does the same translations as GetLogProbRatio(), but doesn't calculate anything
+    ClusterId key_a(keys.first), key_b(keys.second);
+    if(!partition.count(key_a) || !partition.count(key_b) || failed_queries_.count(key_a) || failed_queries_.count(key_b))
+      continue;
+    ClusterId joint_name(registry_.Join(key_a, key_b));
+    if(lratios_.count(joint_name))
+      continue;
+    Query full_qmerged = GetMergedQuery(key_a, key_b);
+    pair<ClusterId, ClusterId> parents_to_calc = GetLogProbPairOfNamesToCalculate(joint_name, full_qmerged.parents_);
+    ClusterId qmerged_to_calc = GetMergedQuery(parents_to_calc.first, parents_to_calc.second).id_;
+    for(auto query : {parents_to_calc.first, parents_to_calc.second, qmerged_to_calc}) {
+      if(log_probs_.count(query) || precalculated_log_probs_.count(query) || queries_added.count(query))
+	continue;
+      queries_to_calc.push_back(query);
+      queries_added.insert(query);
+    }
+  }
+  if(queries_to_calc.size() < 2)
+    return;
+
+  vector<Query> queries;  // copies, since the workers can't touch the cache maps
+  vector<Sequences> seqs;
+  for(auto query : queries_to_calc) {
+    queries.push_back(cachefo(query));
+    seqs.push_back(Sequences(GetProfile(query), registry_.Name(query)));
+    for(auto &gene : queries.back().only_genes_)
+      hmms_.Get(gene);  // make sure it's read from disk before we go multi-threaded
+  }
+  vector<double> total_scores(queries.size(), -INFINITY);
+  vector<char> no_paths(queries.size(), false);
+  thread_pool_.ParallelFor(queries.size(), [&](size_t iq) {
+      DPHandler dph("forward", args_, gl_, hmms_, 1);
+      Result result = dph.Run(seqs[iq], queries[iq].kbounds_, queries[iq].only_genes_, queries[iq].mute_freq_);
+      total_scores[iq] = result.total_score();
+      no_paths[iq] = result.no_path_;
+    });
+  for(size_t iq=0; iq<queries.size(); ++iq)
+    precalculated_log_probs_[queries_to_calc[iq]] = pair<double, bool>(total_scores[iq], no_paths[iq]);
+}
+
+// ----------------------------------------------------------------------------------------
+void Glomerator::AddFailedQuery(ClusterId queries, string error_str) {
     errors_[queries] = errors_[queries] + ":" + error_str;
     failed_queries_.insert(queries);
 }
 
 // ----------------------------------------------------------------------------------------
-Query &Glomerator::cachefo(string queries) {
-  if(cachefo_.find(queries) != cachefo_.end())
-    return cachefo_[queries];
-  else if(tmp_cachefo_.find(queries) != tmp_cachefo_.end())
-    return tmp_cachefo_[queries];
+Query &Glomerator::cachefo(ClusterId queries) {
+  auto it = cachefo_.find(queries);
+  if(it != cachefo_.end())
+    return it->second;
+  it = tmp_cachefo_.find(queries);
+  if(it != tmp_cachefo_.end())
+    return it->second;
   else {  // if this is happening very frequently you've fucked up
     // throw runtime_error(queries + " not found in either cache\n");
     // cout << "hackadd to tmp cache " << queries << endl;
@@ -776,7 +1328,7 @@ Query &Glomerator::cachefo(string queries) {
     KBounds kbounds;
     double mute_freq_total(0.);
     size_t cdr3_length(0);
-    vector<string> tmpvec(SplitString(queries));
+    const vector<unsigned> &tmpvec(registry_.uids(queries));
     for(size_t is=0; is<tmpvec.size(); ++is) {
       Query &scache(single_seq_cachefo_[tmpvec[is]]);
       only_gene_set.insert(scache.only_genes_.begin(), scache.only_genes_.end());
@@ -788,7 +1340,7 @@ Query &Glomerator::cachefo(string queries) {
       if(is==0)
 	cdr3_length = scache.cdr3_length_;
       if(cdr3_length != scache.cdr3_length_)
-	throw runtime_error("cdr3 length mismatch " + to_string(cdr3_length) + " " + to_string(scache.cdr3_length_) + " for single query " + tmpvec[is] + " within " + queries);
+	throw runtime_error("cdr3 length mismatch " + to_string(cdr3_length) + " " + to_string(scache.cdr3_length_) + " for single query " + registry_.uid_str(tmpvec[is]) + " within " + registry_.Name(queries));
 
       // cout << "    " << tmpvec[is] << "    " << kbounds.stringify() << "   " << scache.mute_freq_ << "   " << cdr3_length << "   ";
       // for(auto &g : only_gene_set)
@@ -799,7 +1351,7 @@ Query &Glomerator::cachefo(string queries) {
 
     tmp_cachefo_[queries] = Query(queries,
 				  GetSeqs(queries),
-				  !InString(args_->seed_unique_id(), queries),
+				  !registry_.Contains(queries, args_->seed_unique_id()),
 				  vector<string>(only_gene_set.begin(), only_gene_set.end()),
 				  kbounds,
 				  mute_freq_total / tmpvec.size(),
@@ -832,37 +1384,36 @@ bool Glomerator::SameLength(vector<Sequence*> &seqs, bool debug) {
 }  
 
 // ----------------------------------------------------------------------------------------
-vector<Sequence*> Glomerator::GetSeqs(string query) {
-  vector<string> queryvec(SplitString(query));
+vector<Sequence*> Glomerator::GetSeqs(ClusterId query) {
+  const vector<unsigned> &queryvec(registry_.uids(query));
   vector<Sequence*> seqs(queryvec.size());
   for(size_t is=0; is<queryvec.size(); ++is) {
-    if(single_seqs_.find(queryvec[is]) == single_seqs_.end())
-      throw runtime_error("couldn't find query " + query + " in single seq vector");
-    seqs[is] = &single_seqs_[queryvec[is]];
-    if(seqs[is] == nullptr)
-      throw runtime_error("null ptr to sequence for query " + query);
+    auto it = single_seqs_.find(queryvec[is]);
+    if(it == single_seqs_.end())
+      throw runtime_error("couldn't find query " + registry_.Name(query) + " in single seq vector");
+    seqs[is] = &it->second;
   }
   return seqs;
 }
 
 // ----------------------------------------------------------------------------------------
 // when we're adding <query> to the permament cache in <cachefo_>, if it's been translated we also need it's subsets in <cachefo_>
-void Glomerator::MoveSubsetsFromTmpCache(string query) {
+void Glomerator::MoveSubsetsFromTmpCache(ClusterId query) {
   if(naive_seq_name_translations_.find(query) != naive_seq_name_translations_.end()) {
-    string tquery(naive_seq_name_translations_[query]);
+    ClusterId tquery(naive_seq_name_translations_[query]);
     // cout << "naive seq nt " << tquery << endl;
     CopyToPermanentCache(tquery, query);
   }
 
   if(logprob_name_translations_.find(query) != logprob_name_translations_.end()) {
-    pair<string, string> tpair(logprob_name_translations_[query]);
+    pair<ClusterId, ClusterId> tpair(logprob_name_translations_[query]);
     // cout << "logprob nt for: " << query << "    " << tpair.first << " " << tpair.second << endl;
     CopyToPermanentCache(tpair.first, query);
     CopyToPermanentCache(tpair.second, query);
   }
 
   if(logprob_asymetric_translations_.find(query) != logprob_asymetric_translations_.end()) {
-    string tquery(logprob_asymetric_translations_[query]);
+    ClusterId tquery(logprob_asymetric_translations_[query]);
     // cout << "logprob asym t " << tquery << endl;
     CopyToPermanentCache(tquery, query);
   }
@@ -871,7 +1422,7 @@ void Glomerator::MoveSubsetsFromTmpCache(string query) {
 // ----------------------------------------------------------------------------------------
 // Copy the entry for <translated_query> from <tmp_cachefo_> to <cachefo_>, unless it isn't there, in which case we reconstruct roughly what it should have been using <superquery> (the query for which <translated_query> is a translation).
 // e.g. if <translated_query> is "is:hm" then <superquery> might be "az:fh:fi:is:fj:hm".
-void Glomerator::CopyToPermanentCache(string translated_query, string superquery) {
+void Glomerator::CopyToPermanentCache(ClusterId translated_query, ClusterId superquery) {
   if(tmp_cachefo_.find(translated_query) != tmp_cachefo_.end()) {
     cachefo_[translated_query] = tmp_cachefo_[translated_query];
   } else {  // I think that if we don't have it even in the tmp cache, that we won't ever need the query info (I think it means to we already calculated everything for it) but it makes things more consistent and safer to make sure it's in the permanenet cache
@@ -879,7 +1430,7 @@ void Glomerator::CopyToPermanentCache(string translated_query, string superquery
     // cout << "scratchy! " << superquery << " --> " << translated_query << endl;
     cachefo_[translated_query] = Query(translated_query,
 				       GetSeqs(translated_query),
-				       !InString(args_->seed_unique_id(), translated_query),
+				       !registry_.Contains(translated_query, args_->seed_unique_id()),
 				       supercache.only_genes_,
 				       supercache.kbounds_,
 				       supercache.mute_freq_,
@@ -890,13 +1441,15 @@ void Glomerator::CopyToPermanentCache(string translated_query, string superquery
 }
 
 // ----------------------------------------------------------------------------------------
-Query &Glomerator::GetMergedQuery(string name_a, string name_b) {
+Query &Glomerator::GetMergedQuery(ClusterId name_a, ClusterId name_b) {
 
-  string joint_name = JoinNames(name_a, name_b);  // sorts name_a and name_b, but *doesn't* sort within them
-  if(cachefo_.find(joint_name) != cachefo_.end())
-    return cachefo_[joint_name];
-  if(tmp_cachefo_.find(joint_name) != tmp_cachefo_.end())
-    return tmp_cachefo_[joint_name];
+  ClusterId joint_name = registry_.Join(name_a, name_b);  // sorts name_a and name_b, but *doesn't* sort within them
+  auto it = cachefo_.find(joint_name);
+  if(it != cachefo_.end())
+    return it->second;
+  it = tmp_cachefo_.find(joint_name);
+  if(it != tmp_cachefo_.end())
+    return it->second;
 
   Query &ref_a = cachefo(name_a);
   Query &ref_b = cachefo(name_b);
@@ -908,12 +1461,12 @@ Query &Glomerator::GetMergedQuery(string name_a, string name_b) {
   }
 
   if(ref_a.cdr3_length_ != ref_b.cdr3_length_)
-    throw runtime_error("cdr3 lengths different for " + name_a + " and " + name_b + " (" + to_string(ref_a.cdr3_length_) + " " + to_string(ref_b.cdr3_length_) + ")");
+    throw runtime_error("cdr3 lengths different for " + registry_.Name(name_a) + " and " + registry_.Name(name_b) + " (" + to_string(ref_a.cdr3_length_) + " " + to_string(ref_b.cdr3_length_) + ")");
 
   // NOTE now that I'm adding the merged query to the cache info here, I can maybe get rid of the qmerged entirely UPDATE I have no idea if this is still relevant
   tmp_cachefo_[joint_name] = Query(joint_name,
 				   GetSeqs(joint_name),
-				   !InString(args_->seed_unique_id(), joint_name),
+				   !registry_.Contains(joint_name, args_->seed_unique_id()),
 				   joint_only_genes,
 				   ref_a.kbounds_.LogicalOr(ref_b.kbounds_),
 				   (ref_a.seqs_.size()*ref_a.mute_freq_ + ref_b.seqs_.size()*ref_b.mute_freq_) / double(ref_a.seqs_.size() + ref_b.seqs_.size()),  // simple weighted average (doesn't account for different sequence lengths)
@@ -973,7 +1526,7 @@ bool Glomerator::LikelihoodRatioTooSmall(double lratio, int candidate_cluster_si
 
 // ----------------------------------------------------------------------------------------
 Partition Glomerator::GetSeededClusters(Partition &partition) {
-  Partition clusters;
+  Partition clusters(partition.key_comp());
   for(auto &queries : partition) {
     if(!SeedMissing(queries))
       clusters.insert(queries);
@@ -982,50 +1535,257 @@ Partition Glomerator::GetSeededClusters(Partition &partition) {
 }
 
 // ----------------------------------------------------------------------------------------
-pair<double, Query> Glomerator::FindHfracMerge(ClusterPath *path) {
-  double min_hamming_fraction(INFINITY);
-  Query min_hamming_merge;
+// order <key_a> and <key_b> as the pair loop first gets to them: for plain partitioning, the outer loop is over everything in the current partition and the inner
+// loop starts after the outer one, whereas if the seed unique id is set the outer loop is only over seeded clusters and the inner loop is over *everything*
+pair<ClusterId, ClusterId> Glomerator::LoopPair(ClusterId key_a, ClusterId key_b) {
+  if(args_->seed_unique_id() != "") {
+    bool seeded_a(!SeedMissing(key_a)), seeded_b(!SeedMissing(key_b));
+    if(seeded_a != seeded_b)
+      return seeded_a ? pair<ClusterId, ClusterId>(key_a, key_b) : pair<ClusterId, ClusterId>(key_b, key_a);
+  }
+  return registry_.NameLess(key_a, key_b) ? pair<ClusterId, ClusterId>(key_a, key_b) : pair<ClusterId, ClusterId>(key_b, key_a);
+}
 
-  Partition outer_clusters(path->CurrentPartition());  // for plain partitioning, outer loop is over everything in the current partition
-  if(args_->seed_unique_id() != "")  // whereas if seed unique id is set, outer loop is only over those clusters that contain the seed
-    outer_clusters = GetSeededClusters(path->CurrentPartition());
-  for(Partition::iterator it_a = outer_clusters.begin(); it_a != outer_clusters.end(); ++it_a) {
-    Partition::iterator it_b(it_a);  // for plain partitioning, inner loop starts at the position of the outer iterator + 1
-    ++it_b;
-    if(args_->seed_unique_id() != "")  // but if the seed's set, inner loop is over the *entire* current partition (including the seeded clusters). So we also need to skip key_a == key_b below.
-      it_b = path->CurrentPartition().begin();
-
-    for( ; true; ++it_b) {
-      if(args_->seed_unique_id() == "") {
-	if(it_b == outer_clusters.end())  // NOTE you can't replace this with path->CurrentPartition().end() because in this case <it_b> is looping over the *copy* of path->CurrentPartition()
-	  break;
-      } else {
-	if(it_b == path->CurrentPartition().end())
-	  break;
+// ----------------------------------------------------------------------------------------
+// call <fcn> for each pair involving the clusters in <new_clusters_>, in pair loop order (the first time through, this is every pair in the partition)
+void Glomerator::ForEachLoopPair(Partition &partition, function<void(pair<ClusterId, ClusterId>)> fcn) {
+  if(!found_initial_pairs_) {
+    Partition seeded_clusters(GetSeededClusters(partition));
+    Partition &outer_clusters(args_->seed_unique_id() != "" ? seeded_clusters : partition);
+    for(Partition::iterator it_a = outer_clusters.begin(); it_a != outer_clusters.end(); ++it_a) {
+      Partition::iterator it_b(it_a);  // for plain partitioning, <outer_clusters> *is* <partition>, so this is the position of the outer iterator
+      ++it_b;
+      if(args_->seed_unique_id() != "")
+	it_b = partition.begin();
+      for( ; it_b != partition.end(); ++it_b) {
+	if(*it_a == *it_b)
+	  continue;
+	pair<ClusterId, ClusterId> keys(*it_a, *it_b);
+	if(LoopPair(*it_a, *it_b) != keys)  // second time we've gotten to this pair of seeded clusters
+	  continue;
+	if(Existing(*it_a) && Existing(*it_b))  // (new clusters are never existing ones, so we only need to check this the first time through)
+	  continue;
+	fcn(keys);
       }
+    }
+  } else {
+    vector<pair<ClusterId, ClusterId> > new_pairs;
+    for(auto &newkey : new_clusters_) {
+      for(auto &key : partition) {
+	if(key == newkey)
+	  continue;
+	if(args_->seed_unique_id() != "" && SeedMissing(key) && SeedMissing(newkey))
+	  continue;
+	new_pairs.push_back(LoopPair(newkey, key));
+      }
+    }
+    sort(new_pairs.begin(), new_pairs.end(), PairLoopLess(&registry_));
+    new_pairs.erase(unique(new_pairs.begin(), new_pairs.end()), new_pairs.end());  // (in case there's more than one new cluster)
+    for(auto &keys : new_pairs)
+      fcn(keys);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void Glomerator::AddNewHfracCandidates(Partition &partition, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures) {
+  if(args_->naive_seq_index() && !naive_seq_index_failed_) {
+    vector<pair<ClusterId, ClusterId> > indexed_pairs(AddIndexedHfracCandidates(partition, loop_failures));
+    if(args_->naive_seq_index_check_every() > 0 && n_merge_steps_ % args_->naive_seq_index_check_every() == 0)
+      CheckNaiveSeqIndex(partition, indexed_pairs, loop_failures);
+  } else {
+    ForEachLoopPair(partition, [&](pair<ClusterId, ClusterId> keys) { AddHfracCandidate(keys, loop_failures); });
+  }
+  found_initial_pairs_ = true;
+  new_clusters_.clear();
+}
 
-      string key_a(*it_a), key_b(*it_b);
-      if(key_a == key_b)  // otherwise we'd loop over the seeded ones twice
+// ----------------------------------------------------------------------------------------
+// same as the full loop in ForEachLoopPair(), but only for pairs whose naive seqs share a band in <naive_seq_index_> (i.e. skipping pairs that can't be
+// under the hfrac bound). We still go through them in pair loop order, so we get the same candidates (and merges) as the full loop. Returns the pairs
+// (sorted by PairLoopLess) so CheckNaiveSeqIndex() can tell which ones we skipped.
+vector<pair<ClusterId, ClusterId> > Glomerator::AddIndexedHfracCandidates(Partition &partition, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures) {
+  bool seeded(args_->seed_unique_id() != "");
+  auto category = [&](ClusterId key) { return (seeded && !SeedMissing(key) ? 1 : 0) | (Existing(key) ? 2 : 0); };
+  auto allowed_pair = [&](int cat_a, int cat_b) { return (!seeded || (cat_a & 1) || (cat_b & 1)) && (!(cat_a & 2) || !(cat_b & 2)); };  // same pairs as the full loop: at least one seeded, and at least one new
+  vector<ClusterId> keys_to_pair;
+  if(!found_initial_pairs_) {  // the full loop only calculates naive seqs for clusters that have a possible partner with the same cdr3 length, so we do the same
+    map<size_t, vector<unsigned> > n_with_cdr3;  // number of clusters in each category for each cdr3 length
+    for(auto &key : partition) {
+      vector<unsigned> &counts(n_with_cdr3[cachefo(key).cdr3_length_]);
+      counts.resize(4, 0);
+      ++counts[category(key)];
+    }
+    for(auto &key : partition) {
+      size_t cdr3_length(cachefo(key).cdr3_length_);
+      unsigned n_partners(0);
+      for(int cat=0; cat<4; ++cat) {
+	if(allowed_pair(category(key), cat))
+	  n_partners += n_with_cdr3[cdr3_length][cat] - (cat == category(key) ? 1 : 0);
+      }
+      if(n_partners == 0)
+	continue;
+      if(failed_queries_.count(key))
 	continue;
-      if(failed_queries_.count(key_a) || failed_queries_.count(key_b))
+      string &naive_seq(GetNaiveSeq(key));
+      if(failed_queries_.count(key))
 	continue;
+      naive_seq_index_.Add(key, cdr3_length, naive_seq);
+      keys_to_pair.push_back(key);
+    }
+  } else {
+    for(auto &newkey : new_clusters_) {
+      if(failed_queries_.count(newkey))
+	continue;
+      naive_seq_index_.Add(newkey, cachefo(newkey).cdr3_length_, GetNaiveSeq(newkey));  // (already calculated in Merge())
+      keys_to_pair.push_back(newkey);
+    }
+  }
 
-      if(cachefo(key_a).cdr3_length_ != cachefo(key_b).cdr3_length_)
-      	continue;
+  vector<pair<ClusterId, ClusterId> > indexed_pairs;
+  auto add_pair = [&](ClusterId key_a, ClusterId key_b) {
+    if(!allowed_pair(category(key_a), category(key_b)))
+      return;
+    indexed_pairs.push_back(LoopPair(key_a, key_b));
+  };
+  if(!found_initial_pairs_) {
+    for(auto &keys : naive_seq_index_.AllPairs())
+      add_pair(keys.first, keys.second);
+  } else {
+    for(auto &newkey : keys_to_pair) {
+      for(auto &key : naive_seq_index_.Neighbors(newkey))
+	add_pair(newkey, key);
+    }
+  }
+  sort(indexed_pairs.begin(), indexed_pairs.end(), PairLoopLess(&registry_));
+  indexed_pairs.erase(unique(indexed_pairs.begin(), indexed_pairs.end()), indexed_pairs.end());
+  n_indexed_pairs_ += indexed_pairs.size();
 
-      double hfrac = NaiveHfrac(key_a, key_b);
-      if(hfrac > args_->hamming_fraction_bound_hi())  // if naive hamming fraction too big, don't even consider merging the pair
-	continue;
+  for(auto &keys : indexed_pairs)
+    AddHfracCandidate(keys, loop_failures);
 
-      if(args_->hamming_fraction_bound_lo() <= 0.0 || hfrac >= args_->hamming_fraction_bound_lo())
-	continue;
+  return indexed_pairs;
+}
 
-      if(hfrac < min_hamming_fraction) {
-	  min_hamming_fraction = hfrac;
-	  min_hamming_merge = GetMergedQuery(key_a, key_b);
-      }
+// ----------------------------------------------------------------------------------------
+// go through the full loop, and make sure there aren't any pairs under the hfrac bound that the index didn't give us. If there are, add them
+// (out of order, so the merges may not exactly match the full loop), and stop using the index for the rest of the run.
+void Glomerator::CheckNaiveSeqIndex(Partition &partition, vector<pair<ClusterId, ClusterId> > &indexed_pairs, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures) {
+  unsigned n_missed(0);
+  ForEachLoopPair(partition, [&](pair<ClusterId, ClusterId> keys) {
+      if(binary_search(indexed_pairs.begin(), indexed_pairs.end(), keys, PairLoopLess(&registry_)))
+	return;
+      if(failed_queries_.count(keys.first) || failed_queries_.count(keys.second))
+	return;
+      if(cachefo(keys.first).cdr3_length_ != cachefo(keys.second).cdr3_length_)
+	return;
+      if(GetNaiveSeq(keys.first).size() != GetNaiveSeq(keys.second).size())  // the index never pairs these (and they'd throw in CalculateHfrac())
+	return;
+      if(failed_queries_.count(keys.first) || failed_queries_.count(keys.second))
+	return;
+      if(NaiveHfrac(keys.first, keys.second) > args_->hamming_fraction_bound_hi())
+	return;
+      ++n_missed;
+      AddHfracCandidate(keys, loop_failures);
+    });
+  if(n_missed > 0) {
+    cout << "  warning: naive seq index missed " << n_missed << " pairs under the hfrac bound, so falling back to looking at every pair" << endl;
+    naive_seq_index_failed_ = true;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+// if calculating the pair <keys> made either of its clusters fail, remember which pair we were on (see CandidateStale())
+void Glomerator::AddLoopFailures(pair<ClusterId, ClusterId> keys, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures) {
+  for(auto key : {keys.first, keys.second}) {
+    if(failed_queries_.count(key) && !loop_failures.count(key))
+      loop_failures[key] = keys;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void Glomerator::AddHfracCandidate(pair<ClusterId, ClusterId> keys, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures) {
+  ClusterId key_a(keys.first), key_b(keys.second);
+  if(failed_queries_.count(key_a) || failed_queries_.count(key_b))
+    return;
+
+  if(cachefo(key_a).cdr3_length_ != cachefo(key_b).cdr3_length_)
+    return;
+
+  double hfrac = NaiveHfrac(key_a, key_b);
+  AddLoopFailures(keys, loop_failures);
+  if(hfrac > args_->hamming_fraction_bound_hi())  // if naive hamming fraction too big, don't even consider merging the pair
+    return;
+
+  lratio_pairs_to_calculate_.push_back(keys);
+
+  if(args_->hamming_fraction_bound_lo() > 0.0 && hfrac < args_->hamming_fraction_bound_lo())
+    hfrac_candidates_.push(MergeCandidate(hfrac, keys));
+}
+
+// ----------------------------------------------------------------------------------------
+void Glomerator::AddLRatioCandidate(pair<ClusterId, ClusterId> keys, Partition &partition, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures) {
+  ClusterId key_a(keys.first), key_b(keys.second);
+  if(!partition.count(key_a) || !partition.count(key_b))  // one of them's been merged since we found the pair
+    return;
+  if(failed_queries_.count(key_a) || failed_queries_.count(key_b))
+    return;
+
+  double lratio = GetLogProbRatio(key_a, key_b);
+  AddLoopFailures(keys, loop_failures);
+  if(!(lratio > -INFINITY))  // (also skips nans)
+    return;
+
+  // don't merge if lratio is small (less than zero, more or less), unless we're forcing merges
+  if(LikelihoodRatioTooSmall(lratio, CountMembers(key_a) + CountMembers(key_b)))
+    small_lratio_candidates_.push(MergeCandidate(lratio, keys));
+  else
+    lratio_candidates_.push(MergeCandidate(lratio, keys));
+}
+
+// ----------------------------------------------------------------------------------------
+// Can <cand> no longer be merged? Either because one of its clusters has been merged with something else, or because one of them has failed. If the
+// failure happened during the current pass through the pairs (i.e. it's in <loop_failures>), though, a full loop would still have found <cand> if it came first.
+bool Glomerator::CandidateStale(const MergeCandidate &cand, Partition &partition, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures) {
+  for(auto key : {cand.keys_.first, cand.keys_.second}) {
+    if(!partition.count(key))
+      return true;
+    if(failed_queries_.count(key)) {
+      auto it = loop_failures.find(key);
+      if(it == loop_failures.end() || !PairLoopLess(&registry_)(cand.keys_, it->second))
+	return true;
     }
   }
+  return false;
+}
+
+// ----------------------------------------------------------------------------------------
+// throw away stale candidates from the top of <candidates>, and return the best remaining one (or nullptr if there aren't any)
+const MergeCandidate *Glomerator::BestCandidate(MergeCandidateQueue &candidates, Partition &partition, map<ClusterId, pair<ClusterId, ClusterId> > &loop_failures) {
+  while(!candidates.empty() && CandidateStale(candidates.top(), partition, loop_failures))
+    candidates.pop();
+  if(candidates.empty())
+    return nullptr;
+  return &candidates.top();
+}
+
+// ----------------------------------------------------------------------------------------
+// NOTE rather than looping over every pair each time, we keep the candidates in priority queues between calls, and only calculate pairs involving the clusters that were merged since the last call.
+// We calculate the new ones in the same order as the full loop, and break ties by that order, so we get the same merges as the full loop would.
+pair<double, Query> Glomerator::FindHfracMerge(ClusterPath *path) {
+  double min_hamming_fraction(INFINITY);
+  Query min_hamming_merge;
+
+  Partition &partition(path->CurrentPartition());
+  bool initial_pass(!found_initial_pairs_);
+  AddNewHfracCandidates(partition, hfrac_loop_failures_);
+  if(initial_pass && args_->checkpoint_file() != "")  // the initial pass (with a naive seq for every cluster) is often the slowest part of the run, so don't wait for the end of the step
+    WriteCheckpoint(*path, true);
+
+  const MergeCandidate *best = BestCandidate(hfrac_candidates_, partition, hfrac_loop_failures_);
+  if(best != nullptr) {
+    min_hamming_fraction = best->value_;
+    min_hamming_merge = GetMergedQuery(best->keys_.first, best->keys_.second);
+  }
 
   if(min_hamming_fraction != INFINITY) {  // (note that this is *plus* infinity, but in the lratio fcn it's -INFINITY)
     ++n_hfrac_merges_;
@@ -1041,48 +1801,29 @@ pair<double, Query> Glomerator::FindLRatioMerge(ClusterPath *path) {
   double max_lratio(-INFINITY);
   Query chosen_qmerge;
 
-  Partition outer_clusters(path->CurrentPartition());
-  if(args_->seed_unique_id() != "")  // see comments in FindHfracMerge
-    outer_clusters = GetSeededClusters(path->CurrentPartition());
-  for(Partition::iterator it_a = outer_clusters.begin(); it_a != outer_clusters.end(); ++it_a) {
-    Partition::iterator it_b(it_a);
-    ++it_b;
-    if(args_->seed_unique_id() != "")
-      it_b = path->CurrentPartition().begin();
-
-    for( ; true; ++it_b) {
-      if(args_->seed_unique_id() == "") {
-	if(it_b == outer_clusters.end())  // NOTE you can't replace this with path->CurrentPartition().end() because in this case <it_b> is looping over the *copy* of path->CurrentPartition()
-	  break;
-      } else {
-	if(it_b == path->CurrentPartition().end())
-	  break;
-      }
-
-      string key_a(*it_a), key_b(*it_b);
-      if(key_a == key_b)  // otherwise we'd loop over the seeded ones twice
-	continue;
-      if(failed_queries_.count(key_a) || failed_queries_.count(key_b))
-	continue;
-
-      if(cachefo(key_a).cdr3_length_ != cachefo(key_b).cdr3_length_)
-      	continue;
-
-      double hfrac = NaiveHfrac(key_a, key_b);
-      if(hfrac > args_->hamming_fraction_bound_hi())  // if naive hamming fraction too big, don't even consider merging the pair
-	continue;
-
-      double lratio = GetLogProbRatio(key_a, key_b);
-
-      // don't merge if lratio is small (less than zero, more or less)
-      if(!force_merge_ && LikelihoodRatioTooSmall(lratio, CountMembers(key_a) + CountMembers(key_b)))
-	continue;
+  // NOTE FindHfracMerge() has already been through any new pairs, and left the ones within the hfrac upper bound in <lratio_pairs_to_calculate_>
+  Partition &partition(path->CurrentPartition());
+  sort(lratio_pairs_to_calculate_.begin(), lratio_pairs_to_calculate_.end(), PairLoopLess(&registry_));
+  if(thread_pool_.n_threads() > 1 && !args_->debug())  // (the dphandler debug printing would get all mixed up)
+    PrecalculateLogProbs(partition);
+  for(auto &keys : lratio_pairs_to_calculate_)
+    AddLRatioCandidate(keys, partition, lratio_loop_failures_);
+  lratio_pairs_to_calculate_.clear();
+  if(!found_initial_lratios_) {  // same for the forward calculations for the initial pairs
+    found_initial_lratios_ = true;
+    if(args_->checkpoint_file() != "")
+      WriteCheckpoint(*path, true);
+  }
 
-      if(lratio > max_lratio) {
-	max_lratio = lratio;
-	chosen_qmerge = GetMergedQuery(key_a, key_b);
-      }
-    }
+  const MergeCandidate *best = BestCandidate(lratio_candidates_, partition, lratio_loop_failures_);
+  if(force_merge_) {
+    const MergeCandidate *best_small = BestCandidate(small_lratio_candidates_, partition, lratio_loop_failures_);
+    if(best_small != nullptr && (best == nullptr || MergeCandidateOrder(&registry_, true)(*best, *best_small)))
+      best = best_small;
+  }
+  if(best != nullptr) {
+    max_lratio = best->value_;
+    chosen_qmerge = GetMergedQuery(best->keys_.first, best->keys_.second);
   }
 
   if(max_lratio != -INFINITY) {  // if we found a merge that we liked (note that this is *minus* infinity, but in the hfrac fcn it's +INFINITY)
@@ -1096,7 +1837,7 @@ pair<double, Query> Glomerator::FindLRatioMerge(ClusterPath *path) {
 
 // ----------------------------------------------------------------------------------------
 void Glomerator::UpdateLogProbTranslationsForAsymetrics(Query &qmerge) {
-  string queries("");
+  ClusterId queries(NO_CLUSTER);
 
   // see if one of the parents is much bigger than the other
   int nmax = 1.5 * args_->biggest_logprob_cluster_to_calculate();  // TODO don't hard code the factor
@@ -1105,21 +1846,21 @@ void Glomerator::UpdateLogProbTranslationsForAsymetrics(Query &qmerge) {
   else if(FirstParentMuchBigger(qmerge.parents_.second, qmerge.parents_.first, nmax))
     queries = qmerge.parents_.second;
 
-  if(queries != "") {
+  if(queries != NO_CLUSTER) {
 
     // if the large parent itself was formed by an asymetric merge, keep following the chain of translations (note that since we do this every time, the chain can't get longer than 1 [erm, I think])
-    string subqueries(queries);
+    ClusterId subqueries(queries);
     while(logprob_asymetric_translations_.count(subqueries)) {
       if(args_->debug())
-	cout << "                  turtles " << subqueries << "  -->  " << logprob_asymetric_translations_[subqueries] << endl;
+	cout << "                  turtles " << registry_.Name(subqueries) << "  -->  " << registry_.Name(logprob_asymetric_translations_[subqueries]) << endl;
       subqueries = logprob_asymetric_translations_[subqueries];
     }
 
     // if we haven't added too many new sequences since we last calculated something, we can just reuse things  TODO don't hard code this factor
     if(float(CountMembers(queries)) / CountMembers(subqueries) < 2.)  {
       if(args_->debug())
-	cout << "                logprob asymetric translation  " << qmerge.name_ << "  -->  " << subqueries << endl;
-      logprob_asymetric_translations_[qmerge.name_] = subqueries;  // note that this just says *if* we need this logprob in the future, we should instead calculate this other one -- but we may never actually need it
+	cout << "                logprob asymetric translation  " << registry_.Name(qmerge.id_) << "  -->  " << registry_.Name(subqueries) << endl;
+      logprob_asymetric_translations_[qmerge.id_] = subqueries;  // note that this just says *if* we need this logprob in the future, we should instead calculate this other one -- but we may never actually need it
     } else {
       if(args_->debug())
 	cout << "                  ratio too big for asymetric " << CountMembers(queries) << " " << CountMembers(subqueries) << endl;
@@ -1130,6 +1871,12 @@ void Glomerator::UpdateLogProbTranslationsForAsymetrics(Query &qmerge) {
 // ----------------------------------------------------------------------------------------
 // perform one merge step, i.e. find the two "nearest" clusters and merge 'em (unless we're doing doing smc, in which case we choose a random merge accordingy to their respective nearnesses)
 void Glomerator::Merge(ClusterPath *path) {
+  if(resumed_mid_step_) {  // the checkpoint has this step's loop failures up to where it left off
+    resumed_mid_step_ = false;
+  } else {
+    hfrac_loop_failures_.clear();
+    lratio_loop_failures_.clear();
+  }
   pair<double, Query> qpair = FindHfracMerge(path);
   if(qpair.first == INFINITY)  // if there wasn't a good enough hfrac merge
     qpair = FindLRatioMerge(path);
@@ -1173,28 +1920,43 @@ void Glomerator::Merge(ClusterPath *path) {
   WriteStatus();
   Query chosen_qmerge = qpair.second;
 
-  cachefo_[chosen_qmerge.name_] = chosen_qmerge;
-  GetNaiveSeq(chosen_qmerge.name_, &chosen_qmerge.parents_);  // this *needs* to happen here so it has the parental information
+  cachefo_[chosen_qmerge.id_] = chosen_qmerge;
+  GetNaiveSeq(chosen_qmerge.id_, &chosen_qmerge.parents_);  // this *needs* to happen here so it has the parental information
   UpdateLogProbTranslationsForAsymetrics(chosen_qmerge);
-  MoveSubsetsFromTmpCache(chosen_qmerge.name_);
+  MoveSubsetsFromTmpCache(chosen_qmerge.id_);
 
-  Partition new_partition(path->CurrentPartition());
-  new_partition.erase(chosen_qmerge.parents_.first);
-  new_partition.erase(chosen_qmerge.parents_.second);
-  new_partition.insert(chosen_qmerge.name_);
-  path->AddPartition(new_partition, -INFINITY, args_->n_partitions_to_write());
+  path->AddMerge(chosen_qmerge.parents_.first, chosen_qmerge.parents_.second, chosen_qmerge.id_, -INFINITY);
+  new_clusters_.push_back(chosen_qmerge.id_);
   current_partition_ = &path->CurrentPartition();
 
   if(args_->debug()) {
-    printf("       merged   %s  %s\n", chosen_qmerge.parents_.first.c_str(), chosen_qmerge.parents_.second.c_str());
+    printf("       merged   %s  %s\n", registry_.Name(chosen_qmerge.parents_.first).c_str(), registry_.Name(chosen_qmerge.parents_.second).c_str());
     cout << "          removing " << tmp_cachefo_.size() << " entries from tmp cache" << endl;
   }
 
+  if(args_->naive_seq_index()) {
+    naive_seq_index_.Remove(chosen_qmerge.parents_.first);
+    naive_seq_index_.Remove(chosen_qmerge.parents_.second);
+  }
+
+  SeqProfile &profile(profiles_[chosen_qmerge.id_] = GetProfile(chosen_qmerge.id_));  // replace the parents' profiles with the merged one
+  profile_bytes_ += profile.bytes();
+  for(auto parent : {chosen_qmerge.parents_.first, chosen_qmerge.parents_.second}) {
+    auto pit = profiles_.find(parent);
+    if(pit != profiles_.end()) {
+      profile_bytes_ -= pit->second.bytes();
+      profiles_.erase(pit);
+    }
+  }
+
   tmp_cachefo_.clear();  // NOTE I could simplify some other things if I only cleared the stuff from <tmp_cachefo_> that I thought I wouldn't later need.
-  // naive_hfracs_.clear();  // so, this can reduce memory usage a *lot* for no cpu hit in (usually, I think) later steps, but in (usually, I think) earlier steps it can be prohibitively slower (I think, when early on you're doing a ton of hfrac merges)
-  //  - bottom line, I think I'll need to buckle down and measure memory usage, decide how much I'm allowed to use, and only clear the caches that I need to
-  //  - but also, it'd probably (maybe?) be ok to clear this cache after a logprob merge, since that would mean we're probably through with all the naive hfrac merges
-  //  - or at least remove info for clusters we've merged out of existence
+  ++n_merge_steps_;
+  if(args_->cache_memory_budget() > 0.) {  // clearing naive_hfracs_ entirely can reduce memory usage a *lot*, but early on (when we're doing a ton of hfrac merges) it can be prohibitively slow, so instead we only evict things when we're over budget
+    merged_away_.insert(chosen_qmerge.parents_.first);
+    merged_away_.insert(chosen_qmerge.parents_.second);
+    if(CacheBytes() > 1e6 * args_->cache_memory_budget())
+      EvictCacheEntries(path);
+  }
 
   if((args_->n_final_clusters() > 0 && path->CurrentPartition().size() <= args_->n_final_clusters()) ||
      (args_->min_largest_cluster_size() > 0 && LargestClusterSize(path->CurrentPartition()) >= args_->min_largest_cluster_size())) {  // largest cluster is still too small
@@ -1206,6 +1968,134 @@ void Glomerator::Merge(ClusterPath *path) {
   }
 }
 
+// ----------------------------------------------------------------------------------------
+// Is there no way we'll need the cache entries for <key> again? <live_cluster_of_uid> has the current cluster for each uid (NO_CLUSTER for uids
+// we're not clustering, e.g. from other processes' cache entries).
+bool Glomerator::CacheEntryDead(ClusterId key, vector<ClusterId> &live_cluster_of_uid, unordered_set<ClusterId> &protected_keys) {
+  if(protected_keys.count(key))
+    return false;
+  if(merged_away_.count(key))
+    return true;
+  const vector<unsigned> &uids(registry_.uids(key));
+  ClusterId first_cluster(live_cluster_of_uid[uids.front()]), last_cluster(live_cluster_of_uid[uids.back()]);
+  if(first_cluster == NO_CLUSTER || last_cluster == NO_CLUSTER)
+    return true;
+  if(first_cluster == last_cluster)  // a current cluster, or a subset of one
+    return false;
+  // if it spans two current clusters, it's only any use if it's some of the first one's uids followed by some of the second one's (e.g. the two of
+  // them together, or the subsets that we calculate their lratio with), since we'll need it again if we recalculate their lratio
+  size_t iu(0);
+  while(iu < uids.size() && live_cluster_of_uid[uids[iu]] == first_cluster)
+    ++iu;
+  while(iu < uids.size() && live_cluster_of_uid[uids[iu]] == last_cluster)
+    ++iu;
+  return iu < uids.size();
+}
+
+// ----------------------------------------------------------------------------------------
+// Does <key> have anything in the caches that we'd evict if it's still alive (i.e. anything that we can recalculate exactly from what we keep)?
+bool Glomerator::HasLiveEvictableEntries(ClusterId key) {
+  return naive_hfracs_.count(key) || lratios_.count(key) || packed_naive_seqs_.count(key);
+}
+
+// ----------------------------------------------------------------------------------------
+// If <dead>, evict everything for <key>, otherwise only the things that we can recalculate exactly: naive hfracs (from the naive seqs) and lratios
+// (from the log probs and subsets). Log probs and naive seqs, on the other hand, depend on the query info that we had when we calculated them,
+// which for merged and subset queries only lasts until the end of the merge step, so if we recalculated them we'd rebuild the query info from
+// the cluster's current parents (or its single sequences) and could get a different answer than if we'd never evicted them.
+void Glomerator::EvictCacheEntry(ClusterId key, bool dead, bool only_new_vals, vector<CacheEntry> &evicted_entries) {
+  if(args_->output_cachefname() != "" && CacheKeyToWrite(key, only_new_vals))  // save anything we'd have written to the output cache file (see WriteCacheFile())
+    evicted_entries.push_back(GetCacheEntry(key));
+  if(naive_hfracs_.erase(key))
+    ++naive_hfrac_stats_.evictions_;
+  if(lratios_.erase(key))
+    ++lratio_stats_.evictions_;
+  auto pit = packed_naive_seqs_.find(key);
+  if(pit != packed_naive_seqs_.end()) {
+    packed_naive_seq_bytes_ -= pit->second.planes_.size() + pit->second.unambiguous_.size();
+    packed_naive_seqs_.erase(pit);
+  }
+  if(!dead)
+    return;
+  if(log_probs_.erase(key))
+    ++log_prob_stats_.evictions_;
+  auto it = naive_seqs_.find(key);
+  if(it != naive_seqs_.end()) {
+    naive_seq_bytes_ -= it->second.size();
+    naive_seqs_.erase(it);
+    ++naive_seq_stats_.evictions_;
+  }
+  if(name_subsets_.erase(key))
+    ++name_subset_stats_.evictions_;
+  last_used_.erase(key);
+  merged_away_.erase(key);
+}
+
+// ----------------------------------------------------------------------------------------
+// Get the caches back under --cache-memory-budget: first evict entries for clusters that have been merged out of existence (and for pairs that
+// include them), then the least recently used naive hfracs and lratios until we're comfortably under the budget (so we don't have to do this again
+// right away). We never evict the current clusters, the clusters whose log probs we use in place of theirs (see UpdateLogProbTranslationsForAsymetrics()),
+// or, if we're going to need the log prob of each partition, the clusters in the partitions we're going to write. Since we only evict things that
+// we either won't need again or can recalculate exactly, the partitions and output cache file are the same whatever the budget (although if the
+// log probs and naive seqs of live clusters alone are over budget, we stay over it).
+void Glomerator::EvictCacheEntries(ClusterPath *path) {
+  size_t bytes_before(CacheBytes());
+  unordered_set<ClusterId> protected_keys;
+  vector<ClusterId> live_cluster_of_uid(registry_.n_uids(), NO_CLUSTER);
+  for(auto key : path->CurrentPartition()) {
+    protected_keys.insert(key);
+    if(logprob_asymetric_translations_.count(key))
+      protected_keys.insert(logprob_asymetric_translations_[key]);
+    for(auto iuid : registry_.uids(key))
+      live_cluster_of_uid[iuid] = key;
+  }
+  if(args_->write_logprob_for_each_partition()) {
+    for(auto key : path->ClustersSince(FirstPartitionToWrite(*path)))
+      protected_keys.insert(key);
+  }
+
+  vector<ClusterId> dead_keys;
+  vector<pair<unsigned, ClusterId> > lru_keys;  // (merge step when last used, key)
+  for(auto &kv : last_used_) {
+    if(protected_keys.count(kv.first))
+      continue;
+    if(CacheEntryDead(kv.first, live_cluster_of_uid, protected_keys))
+      dead_keys.push_back(kv.first);
+    else if(HasLiveEvictableEntries(kv.first))
+      lru_keys.push_back(pair<unsigned, ClusterId>(kv.second, kv.first));
+  }
+  bool only_new_vals(OnlyCacheNewVals());
+  vector<CacheEntry> evicted_entries;
+  for(auto key : dead_keys)
+    EvictCacheEntry(key, true, only_new_vals, evicted_entries);
+
+  size_t n_lru(0);
+  size_t target_bytes(0.8 * 1e6 * args_->cache_memory_budget());
+  if(CacheBytes() > target_bytes) {
+    sort(lru_keys.begin(), lru_keys.end());
+    for(auto &lru_key : lru_keys) {
+      if(CacheBytes() <= target_bytes)
+	break;
+      EvictCacheEntry(lru_key.second, false, only_new_vals, evicted_entries);
+      ++n_lru;
+    }
+  }
+  if(evicted_entries.size() > 0)
+    CacheJournal(evicted_cachefname()).Append(evicted_entries);
+
+  // give back the bucket arrays, which don't shrink on their own
+  log_probs_.rehash(0);
+  naive_hfracs_.rehash(0);
+  lratios_.rehash(0);
+  naive_seqs_.rehash(0);
+  packed_naive_seqs_.rehash(0);
+  name_subsets_.rehash(0);
+  last_used_.rehash(0);
+
+  if(args_->debug())
+    printf("          evicted %zu dead and %zu least recently used cache entries (%.1f --> %.1f MB)\n", dead_keys.size(), n_lru, bytes_before / 1e6, CacheBytes() / 1e6);
+}
+
 // NOTE don't remove these (yet, at least)
 // // ----------------------------------------------------------------------------------------
 // ClusterPair Glomerator::GetClustersToMergeForNaiveSeqGlomerate(set<vector<string> > &clusters, int max_per_cluster, bool merge_whatever_you_got) {
@@ -0,0 +1,62 @@
+#include <iostream>
+
+#include "cachefile.h"
+#include "tclap/CmdLine.h"
+
+using namespace ham;
+using namespace TCLAP;
+using namespace std;
+
+// ----------------------------------------------------------------------------------------
+// convert bcrham cache files between csv and binary, compact binary ones, and look things up in them
+int main(int argc, const char *argv[]) {
+  vector<string> action_strings{"compact", "to-binary", "to-csv", "lookup"};
+  ValuesConstraint<string> action_vals(action_strings);
+  ValueArg<string> action_arg("a", "action", "compact: fold a binary cache file's journal into the main file. to-binary, to-csv: convert --infile (either format, plus its journal) to --outfile. lookup: print the entry for --key from a binary cache file (not including its journal)", true, "", &action_vals);
+  ValueArg<string> infile_arg("i", "infile", "input cache file", true, "", "string");
+  ValueArg<string> outfile_arg("o", "outfile", "output cache file (for to-binary and to-csv)", false, "", "string");
+  ValueArg<string> key_arg("k", "key", "colon-separated unique ids to look up (for lookup)", false, "", "string");
+  try {
+    CmdLine cmd("hamcache -- bcrham cache file tool", ' ', "");
+    cmd.add(action_arg);
+    cmd.add(infile_arg);
+    cmd.add(outfile_arg);
+    cmd.add(key_arg);
+    cmd.parse(argc, argv);
+  } catch(ArgException &e) {
+    cerr << "ERROR: " << e.error() << " for argument " << e.argId() << endl;
+    throw;
+  }
+
+  string action(action_arg.getValue());
+  if(action == "compact") {
+    CompactCacheFile(infile_arg.getValue());
+    return 0;
+  }
+
+  if(action == "lookup") {
+    MappedCacheFile cachefile(infile_arg.getValue());
+    CacheEntry entry;
+    if(!cachefile.Find(key_arg.getValue(), entry)) {
+      cout << "    " << key_arg.getValue() << " not found" << endl;
+      return 1;
+    }
+    cout << "    logprob: " << (entry.has_logprob_ ? to_string(entry.logprob_) : "") << endl
+	 << "    naive_seq: " << entry.naive_seq_ << endl
+	 << "    naive_hfrac: " << (entry.has_naive_hfrac_ ? to_string(entry.naive_hfrac_) : "") << endl
+	 << "    errors: " << entry.errors_ << endl;
+    return 0;
+  }
+
+  if(outfile_arg.getValue() == "")
+    throw runtime_error("--outfile is required for " + action);
+  vector<CacheEntry> entries(MergedCacheEntries(infile_arg.getValue()));
+  if(action == "to-binary") {
+    WriteBinaryCacheFile(outfile_arg.getValue(), entries);
+  } else {
+    sort(entries.begin(), entries.end(), [](const CacheEntry &a, const CacheEntry &b) { return a.name_ < b.name_; });
+    WriteCsvCacheFile(outfile_arg.getValue(), entries);
+  }
+  cout << "    wrote " << entries.size() << " entries to " << outfile_arg.getValue() << endl;
+  return 0;
+}
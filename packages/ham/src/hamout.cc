@@ -0,0 +1,57 @@
+#include <iostream>
+
+#include "outputfile.h"
+#include "tclap/CmdLine.h"
+
+using namespace ham;
+using namespace TCLAP;
+using namespace std;
+
+// ----------------------------------------------------------------------------------------
+// convert bcrham's binary output files (--binary-output) to csv, and print what's in them
+int main(int argc, const char *argv[]) {
+  vector<string> action_strings{"to-csv", "info"};
+  ValuesConstraint<string> action_vals(action_strings);
+  ValueArg<string> action_arg("a", "action", "to-csv: write the csv version of --infile (i.e. what bcrham would have written without --binary-output) to --outfile. info: print the kind of file, its columns, and how many batches and rows it has", true, "", &action_vals);
+  ValueArg<string> infile_arg("i", "infile", "input binary output file", true, "", "string");
+  ValueArg<string> outfile_arg("o", "outfile", "output csv file (for to-csv)", false, "", "string");
+  try {
+    CmdLine cmd("hamout -- bcrham binary output file tool", ' ', "");
+    cmd.add(action_arg);
+    cmd.add(infile_arg);
+    cmd.add(outfile_arg);
+    cmd.parse(argc, argv);
+  } catch(ArgException &e) {
+    cerr << "ERROR: " << e.error() << " for argument " << e.argId() << endl;
+    throw;
+  }
+
+  string action(action_arg.getValue());
+  if(action == "info") {
+    OutputFileReader reader(infile_arg.getValue());
+    OutputSchema &schema(reader.schema());
+    cout << "    kind: " << reader.kind() << endl;
+    vector<pair<string, vector<string>*> > types{{"int", &schema.ints_}, {"double", &schema.doubles_}, {"string", &schema.strings_}, {"id", &schema.ids_}, {"int list", &schema.int_lists_}, {"id list", &schema.id_lists_}};
+    for(auto &type : types) {
+      if(type.second->size() == 0)
+	continue;
+      cout << "    " << type.first << " columns:";
+      for(auto &name : *type.second)
+	cout << " " << name;
+      cout << endl;
+    }
+    OutputBatch batch(schema);
+    size_t n_batches(0), n_rows(0);
+    while(reader.NextBatch(batch)) {
+      ++n_batches;
+      n_rows += batch.n_rows();
+    }
+    cout << "    " << n_rows << " rows in " << n_batches << " batches" << endl;
+    return 0;
+  }
+
+  if(outfile_arg.getValue() == "")
+    throw runtime_error("--outfile is required for " + action);
+  ConvertOutputFileToCsv(infile_arg.getValue(), outfile_arg.getValue());
+  return 0;
+}
@@ -23,6 +23,17 @@ Model::~Model() {
   delete track_;
 }
 
+// ----------------------------------------------------------------------------------------
+size_t Model::ApproxBytes() {
+  size_t bytes(sizeof(Model) + compiled_.ApproxBytes());
+  for(auto &st : states_) {
+    bytes += sizeof(State) + st->name().size() + st->from_state_indices()->size() * sizeof(size_t);
+    bytes += st->transitions()->size() * (sizeof(Transition*) + sizeof(Transition));
+    bytes += (track_->alphabet_size() + 1) * sizeof(double);  // emissions
+  }
+  return bytes;
+}
+
 // ----------------------------------------------------------------------------------------
 void Model::Parse(string infname) {
   if(!ifstream(infname))
@@ -103,6 +114,63 @@ void Model::Parse(string infname) {
   Finalize(); // post process states and/to create an end state with only transitions-from
 }
 
+// ----------------------------------------------------------------------------------------
+void Model::ParseBinary(ModelFileReader &reader) {
+  name_ = reader.ReadString();
+  overall_prob_ = reader.ReadDouble();
+  original_overall_mute_freq_ = reader.ReadDouble();
+  ambiguous_char_ = reader.ReadString();
+
+  assert(track_ == nullptr);
+  track_ = new Track;
+  track_->set_name(reader.ReadString());
+  if(ambiguous_char_ != "")
+    track_->SetAmbiguous(ambiguous_char_);
+  size_t n_symbols(reader.ReadCount());
+  for(size_t ic = 0; ic < n_symbols; ++ic)
+    track_->AddSymbol(reader.ReadString());
+
+  size_t n_states(reader.ReadCount());
+  for(size_t ist = 0; ist < n_states; ++ist) {
+    State *state(new State);
+    state->ParseBinary(reader, track_);
+    if(states_by_name_.count(state->name()))
+      throw runtime_error("ERROR added two states with name '" + state->name() + "' from binary model file");
+    if(state->name() == "init") {
+      initial_ = state;
+    } else {
+      assert(states_.size() < STATE_MAX);
+      states_.push_back(state);
+    }
+    states_by_name_[state->name()] = state;
+  }
+  reader.Close();
+
+  Finalize();
+}
+
+// ----------------------------------------------------------------------------------------
+void Model::WriteBinary(string fname, uint64_t yaml_hash) {
+  if(!initial_)
+    throw runtime_error("ERROR tried to write binary model file for a model with no 'init' state");
+  ModelFileWriter writer(fname, yaml_hash);
+  writer.Write(name_);
+  writer.Write(overall_prob_);
+  writer.Write(original_overall_mute_freq_);
+  writer.Write(ambiguous_char_);
+
+  writer.Write(track_->name());
+  writer.Write((uint32_t)track_->alphabet_size());
+  for(size_t ic = 0; ic < track_->alphabet_size(); ++ic)
+    writer.Write(track_->symbol(ic));
+
+  writer.Write((uint32_t)(states_.size() + 1));
+  initial_->WriteBinary(writer);
+  for(auto *state : states_)
+    state->WriteBinary(writer);
+  writer.Close();
+}
+
 // ----------------------------------------------------------------------------------------
 void Model::AddState(State* state) {
   throw runtime_error("do I ever get here?");
@@ -127,6 +195,16 @@ void Model::RescaleOverallMuteFreq(double overall_mute_freq) {
     double factor = max(0.01, overall_mute_freq) / original_overall_mute_freq_;  // NOTE the 1% is kind of a hack (to protect against zero) -- but it's roughly equal to the uncertainty on our mute freq estimates, so it's reasonable
     state->RescaleOverallMuteFreq(factor);  // REMINDER still not in log space
   }
+  compiled_.CompileEmissions(states_);
+}
+
+// ----------------------------------------------------------------------------------------
+void Model::RescaledEmissions(double overall_mute_freq, EmissionOverlay &overlay) {
+  assert(overall_mute_freq != -INFINITY);
+  if(original_overall_mute_freq_ == 0.0)
+    throw runtime_error("model.cc: tried to rescale overall mut freqs with zero original_overall_mute_freq_");
+  double factor = max(0.01, overall_mute_freq) / original_overall_mute_freq_;  // NOTE same as in RescaleOverallMuteFreq()
+  compiled_.CompileRescaledEmissions(states_, factor, overlay);
 }
 
 // ----------------------------------------------------------------------------------------
@@ -134,6 +212,7 @@ void Model::UnRescaleOverallMuteFreq() {
   // cout << "  unrescaling" << endl;
   for(auto &state : states_)
     state->UnRescaleOverallMuteFreq();
+  compiled_.CompileEmissions(states_);
 }
 
 // ----------------------------------------------------------------------------------------
@@ -160,6 +239,8 @@ void Model::Finalize() {
 
   AddMaybeFasterFromStateStuff();  // TODO should really somehow be integrated into FinalizeState() (?)
 
+  compiled_.Compile(states_, initial_, track_);
+
   finalized_ = true;
 }
 
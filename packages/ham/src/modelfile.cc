@@ -0,0 +1,123 @@
+#include "modelfile.h"
+
+#include <fstream>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+uint64_t ModelFileHash(string yamlfname) {
+  ifstream ifs(yamlfname, ios::binary);
+  if(!ifs.is_open())
+    throw runtime_error("couldn't open " + yamlfname + " to hash it");
+  uint64_t hval(14695981039346656037ULL);
+  char buffer[1 << 16];
+  while(ifs) {
+    ifs.read(buffer, sizeof(buffer));
+    for(streamsize ic=0; ic<ifs.gcount(); ++ic) {
+      hval ^= (unsigned char)buffer[ic];
+      hval *= 1099511628211ULL;
+    }
+  }
+  return hval;
+}
+
+// ----------------------------------------------------------------------------------------
+string BinaryModelName(string yamlfname) {
+  string suffix(".yaml");
+  if(yamlfname.size() > suffix.size() && yamlfname.compare(yamlfname.size() - suffix.size(), suffix.size(), suffix) == 0)
+    yamlfname.resize(yamlfname.size() - suffix.size());
+  return yamlfname + ".hamb";
+}
+
+// ----------------------------------------------------------------------------------------
+ModelFileWriter::ModelFileWriter(string fname, uint64_t yaml_hash) : fname_(fname) {
+  ModelFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic_, MODEL_FILE_MAGIC, sizeof(MODEL_FILE_MAGIC));
+  header.version_ = MODEL_FILE_VERSION;
+  header.yaml_hash_ = yaml_hash;
+  buffer_.append((const char*)&header, sizeof(header));
+}
+
+// ----------------------------------------------------------------------------------------
+void ModelFileWriter::Close() {
+  buffer_.append(MODEL_FILE_MAGIC, sizeof(MODEL_FILE_MAGIC));
+  string tmpfname(fname_ + ".tmp." + to_string(getpid()));
+  ofstream ofs(tmpfname, ios::binary);
+  if(!ofs.is_open())
+    throw runtime_error("couldn't open binary model file " + tmpfname + " for writing");
+  ofs.write(buffer_.data(), buffer_.size());
+  ofs.close();
+  if(!ofs) {
+    remove(tmpfname.c_str());
+    throw runtime_error("failed writing binary model file " + tmpfname);
+  }
+  if(rename(tmpfname.c_str(), fname_.c_str()) != 0)
+    throw runtime_error("couldn't rename " + tmpfname + " to " + fname_ + " (" + strerror(errno) + ")");
+}
+
+// ----------------------------------------------------------------------------------------
+ModelFileReader::ModelFileReader(string fname) :
+  fname_(fname),
+  data_(nullptr),
+  length_(0),
+  ipos_(sizeof(ModelFileHeader))
+{
+  int fd(open(fname.c_str(), O_RDONLY));
+  if(fd < 0)
+    throw runtime_error("couldn't open binary model file " + fname + " (" + strerror(errno) + ")");
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    close(fd);
+    throw runtime_error("couldn't stat binary model file " + fname);
+  }
+  length_ = st.st_size;
+  if(length_ < sizeof(ModelFileHeader) + sizeof(MODEL_FILE_MAGIC)) {
+    close(fd);
+    throw runtime_error("binary model file " + fname + " is too short to have a header");
+  }
+  void *map(mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0));
+  close(fd);  // (the map stays valid)
+  if(map == MAP_FAILED)
+    throw runtime_error("couldn't mmap binary model file " + fname + " (" + strerror(errno) + ")");
+  data_ = (const char*)map;
+
+  const ModelFileHeader *header((const ModelFileHeader*)data_);
+  if(memcmp(header->magic_, MODEL_FILE_MAGIC, sizeof(MODEL_FILE_MAGIC)) != 0 || header->version_ != MODEL_FILE_VERSION) {
+    munmap((void*)data_, length_);
+    throw runtime_error("binary model file " + fname + " has the wrong magic number or version");
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+ModelFileReader::~ModelFileReader() {
+  if(data_ != nullptr)
+    munmap((void*)data_, length_);
+}
+
+// ----------------------------------------------------------------------------------------
+void ModelFileReader::Close() {
+  if(length_ - ipos_ != sizeof(MODEL_FILE_MAGIC) || memcmp(data_ + ipos_, MODEL_FILE_MAGIC, sizeof(MODEL_FILE_MAGIC)) != 0)
+    throw runtime_error("binary model file " + fname_ + " doesn't end where we expected (truncated, or written by a different version of bcrham?)");
+}
+
+// ----------------------------------------------------------------------------------------
+void ModelFileReader::Check(size_t n_bytes) {
+  if(n_bytes > length_ - ipos_)
+    throw runtime_error("ran off the end of binary model file " + fname_);
+}
+
+// ----------------------------------------------------------------------------------------
+void ModelFileReader::ReadBytes(void *dest, size_t n_bytes) {
+  Check(n_bytes);
+  memcpy(dest, data_ + ipos_, n_bytes);  // (no alignment guarantees in the file)
+  ipos_ += n_bytes;
+}
+
+}
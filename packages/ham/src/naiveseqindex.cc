@@ -0,0 +1,148 @@
+#include "naiveseqindex.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+static uint64_t HashBytes(uint64_t hval, const char *bytes, size_t n_bytes) {  // fnv-1a (collisions just give us extra candidates)
+  for(size_t ib=0; ib<n_bytes; ++ib) {
+    hval ^= (unsigned char)bytes[ib];
+    hval *= 1099511628211ULL;
+  }
+  return hval;
+}
+
+// ----------------------------------------------------------------------------------------
+NaiveSeqIndex::NaiveSeqIndex(double max_hfrac, string ambiguous_char, size_t max_ambiguous_bands, size_t min_band_length) :
+  max_hfrac_(max_hfrac),
+  ambiguous_char_(ambiguous_char),
+  max_ambiguous_bands_(max_ambiguous_bands),
+  min_band_length_(min_band_length)
+{
+  if(max_hfrac_ < 0.)
+    throw runtime_error("negative max hfrac in NaiveSeqIndex");
+  if(min_band_length_ == 0)
+    throw runtime_error("zero min band length in NaiveSeqIndex");
+}
+
+// ----------------------------------------------------------------------------------------
+void NaiveSeqIndex::Add(ClusterId key, int cdr3_length, const string &naive_seq) {
+  if(members_.count(key))
+    return;
+  Member member;
+  member.group_ = (uint64_t)(unsigned)cdr3_length << 32 | naive_seq.size();
+  groups_[member.group_].push_back(key);
+
+  size_t max_distance = floor(max_hfrac_ * naive_seq.size() * (1. + 1e-9));  // (the glomerator keeps pairs with hfrac *equal* to the bound, so don't let rounding knock us down by one)
+  size_t n_bands(max_distance + 1 + 2 * max_ambiguous_bands_);
+  bool wildcard(naive_seq.size() < n_bands * min_band_length_);
+
+  size_t n_ambiguous_bands(0);
+  for(size_t iband=0; iband<n_bands && !wildcard; ++iband) {
+    size_t istart(iband * naive_seq.size() / n_bands), istop((iband + 1) * naive_seq.size() / n_bands);
+    if(ambiguous_char_ != "" && naive_seq.substr(istart, istop - istart).find(ambiguous_char_) != string::npos) {  // ambiguous positions don't count toward the hamming distance, so we can't use this band
+      ++n_ambiguous_bands;
+      if(n_ambiguous_bands > max_ambiguous_bands_)
+	wildcard = true;
+      continue;
+    }
+    uint64_t hval(14695981039346656037ULL);
+    hval = HashBytes(hval, (const char*)&member.group_, sizeof(member.group_));
+    hval = HashBytes(hval, (const char*)&iband, sizeof(iband));
+    hval = HashBytes(hval, naive_seq.data() + istart, istop - istart);
+    member.bands_.push_back(hval);
+  }
+
+  if(wildcard) {
+    member.bands_.clear();
+    wildcards_[member.group_].push_back(key);
+  } else {
+    for(auto hval : member.bands_)
+      buckets_[hval].push_back(key);
+  }
+  members_[key] = member;
+}
+
+// ----------------------------------------------------------------------------------------
+void NaiveSeqIndex::RemoveFromList(vector<ClusterId> &keys, ClusterId key) {
+  auto it = find(keys.begin(), keys.end(), key);
+  if(it == keys.end())
+    throw runtime_error("couldn't find cluster in NaiveSeqIndex list");
+  *it = keys.back();
+  keys.pop_back();
+}
+
+// ----------------------------------------------------------------------------------------
+void NaiveSeqIndex::Remove(ClusterId key) {
+  auto it = members_.find(key);
+  if(it == members_.end())
+    return;
+  Member &member(it->second);
+  RemoveFromList(groups_[member.group_], key);
+  if(member.bands_.size() == 0) {
+    RemoveFromList(wildcards_[member.group_], key);
+  } else {
+    for(auto hval : member.bands_) {
+      vector<ClusterId> &bucket(buckets_[hval]);
+      RemoveFromList(bucket, key);
+      if(bucket.size() == 0)
+	buckets_.erase(hval);
+    }
+  }
+  members_.erase(it);
+}
+
+// ----------------------------------------------------------------------------------------
+vector<ClusterId> NaiveSeqIndex::Neighbors(ClusterId key) {
+  auto it = members_.find(key);
+  if(it == members_.end())
+    throw runtime_error("NaiveSeqIndex::Neighbors() called for a cluster that isn't in the index");
+  Member &member(it->second);
+  vector<ClusterId> neighbors;
+  if(member.bands_.size() == 0) {  // wildcards are paired with everybody
+    neighbors = groups_[member.group_];
+  } else {
+    for(auto hval : member.bands_) {
+      vector<ClusterId> &bucket(buckets_[hval]);
+      neighbors.insert(neighbors.end(), bucket.begin(), bucket.end());
+    }
+    vector<ClusterId> &wildcards(wildcards_[member.group_]);
+    neighbors.insert(neighbors.end(), wildcards.begin(), wildcards.end());
+  }
+  sort(neighbors.begin(), neighbors.end());
+  neighbors.erase(unique(neighbors.begin(), neighbors.end()), neighbors.end());
+  neighbors.erase(remove(neighbors.begin(), neighbors.end(), key), neighbors.end());
+  return neighbors;
+}
+
+// ----------------------------------------------------------------------------------------
+vector<pair<ClusterId, ClusterId> > NaiveSeqIndex::AllPairs() {
+  vector<pair<ClusterId, ClusterId> > pairs;
+  auto add_pair = [&](ClusterId key_a, ClusterId key_b) {
+    if(key_a != key_b)
+      pairs.push_back(key_a < key_b ? pair<ClusterId, ClusterId>(key_a, key_b) : pair<ClusterId, ClusterId>(key_b, key_a));
+  };
+  for(auto &kv : buckets_) {
+    for(size_t ia=0; ia<kv.second.size(); ++ia)
+      for(size_t ib=ia+1; ib<kv.second.size(); ++ib)
+	add_pair(kv.second[ia], kv.second[ib]);
+  }
+  for(auto &kv : wildcards_) {
+    for(auto key_a : kv.second)
+      for(auto key_b : groups_[kv.first])
+	add_pair(key_a, key_b);
+  }
+  sort(pairs.begin(), pairs.end());
+  pairs.erase(unique(pairs.begin(), pairs.end()), pairs.end());
+  return pairs;
+}
+
+// ----------------------------------------------------------------------------------------
+vector<ClusterId> NaiveSeqIndex::members() {
+  vector<ClusterId> keys;
+  for(auto &kv : members_)
+    keys.push_back(kv.first);
+  sort(keys.begin(), keys.end());
+  return keys;
+}
+
+}
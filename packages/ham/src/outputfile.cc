@@ -0,0 +1,436 @@
+#include "outputfile.h"
+
+#include <string.h>
+#include <cassert>
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+vector<string> OutputKinds() {
+  return vector<string>{"viterbi", "forward", "partition"};
+}
+
+// ----------------------------------------------------------------------------------------
+bool IsBinaryOutputFile(string fname) {
+  ifstream ifs(fname, ios::binary);
+  char magic[sizeof(OUTPUT_FILE_MAGIC)];
+  ifs.read(magic, sizeof(magic));
+  return ifs && memcmp(magic, OUTPUT_FILE_MAGIC, sizeof(magic)) == 0;
+}
+
+// ----------------------------------------------------------------------------------------
+OutputSchema::OutputSchema(string kind) {
+  // NOTE make sure to change ConvertOutputFileToCsv() (and whoever makes the rows) if you change these
+  if(kind == "viterbi") {
+    ints_ = {"has_event", "v_5p_del", "v_3p_del", "d_5p_del", "d_3p_del", "j_5p_del", "j_3p_del"};  // has_event is 0 for queries that failed (which only have unique_ids, seqs, and errors)
+    doubles_ = {"logprob"};
+    strings_ = {"unique_ids", "fv_insertion", "vd_insertion", "dj_insertion", "jf_insertion", "seqs", "v_per_gene_support", "d_per_gene_support", "j_per_gene_support", "errors"};
+    ids_ = {"v_gene", "d_gene", "j_gene"};
+  } else if(kind == "forward") {
+    ints_ = {"has_logprob"};
+    doubles_ = {"logprob"};
+    strings_ = {"unique_ids", "errors"};
+  } else if(kind == "partition") {
+    doubles_ = {"logprob"};
+    int_lists_ = {"cluster_sizes"};
+    id_lists_ = {"unique_ids"};  // every cluster's unique ids, one cluster after another
+  } else {
+    throw runtime_error("bad output file kind " + kind);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+OutputRow::OutputRow(OutputSchema &schema) :
+  ints_(schema.ints_.size(), 0),
+  doubles_(schema.doubles_.size(), 0.),
+  strings_(schema.strings_.size()),
+  ids_(schema.ids_.size()),
+  int_lists_(schema.int_lists_.size()),
+  id_lists_(schema.id_lists_.size())
+{
+}
+
+// ----------------------------------------------------------------------------------------
+OutputBatch::OutputBatch(OutputSchema &schema) :
+  n_rows_(0),
+  ints_(schema.ints_.size()),
+  doubles_(schema.doubles_.size()),
+  strings_(schema.strings_.size()),
+  ids_(schema.ids_.size()),
+  int_lists_(schema.int_lists_.size()),
+  id_lists_(schema.id_lists_.size())
+{
+}
+
+// ----------------------------------------------------------------------------------------
+void OutputBatch::Clear() {
+  n_rows_ = 0;
+  dictionary_ = StringColumn();
+  dictionary_indices_.clear();
+  for(auto &col : ints_) col.clear();
+  for(auto &col : doubles_) col.clear();
+  for(auto &col : strings_) col = StringColumn();
+  for(auto &col : ids_) col.clear();
+  for(auto &col : int_lists_) col = ListColumn<int32_t>();
+  for(auto &col : id_lists_) col = ListColumn<uint32_t>();
+}
+
+// ----------------------------------------------------------------------------------------
+uint32_t OutputBatch::IdIndex(const string &str) {
+  auto it = dictionary_indices_.find(str);
+  if(it != dictionary_indices_.end())
+    return it->second;
+  uint32_t index(dictionary_.size());
+  dictionary_.Add(str);
+  dictionary_indices_[str] = index;
+  return index;
+}
+
+// ----------------------------------------------------------------------------------------
+void OutputBatch::Add(const OutputRow &row) {
+  if(row.ints_.size() != ints_.size() || row.doubles_.size() != doubles_.size() || row.strings_.size() != strings_.size() || row.ids_.size() != ids_.size() || row.int_lists_.size() != int_lists_.size() || row.id_lists_.size() != id_lists_.size())
+    throw runtime_error("OutputRow doesn't match the batch's schema");
+  for(size_t ic=0; ic<ints_.size(); ++ic)
+    ints_[ic].push_back(row.ints_[ic]);
+  for(size_t ic=0; ic<doubles_.size(); ++ic)
+    doubles_[ic].push_back(row.doubles_[ic]);
+  for(size_t ic=0; ic<strings_.size(); ++ic)
+    strings_[ic].Add(row.strings_[ic]);
+  for(size_t ic=0; ic<ids_.size(); ++ic)
+    ids_[ic].push_back(IdIndex(row.ids_[ic]));
+  for(size_t ic=0; ic<int_lists_.size(); ++ic) {
+    int_lists_[ic].values_.insert(int_lists_[ic].values_.end(), row.int_lists_[ic].begin(), row.int_lists_[ic].end());
+    int_lists_[ic].starts_.push_back(int_lists_[ic].values_.size());
+  }
+  for(size_t ic=0; ic<id_lists_.size(); ++ic) {
+    for(auto &str : row.id_lists_[ic])
+      id_lists_[ic].values_.push_back(IdIndex(str));
+    id_lists_[ic].starts_.push_back(id_lists_[ic].values_.size());
+  }
+  ++n_rows_;
+}
+
+// ----------------------------------------------------------------------------------------
+vector<int> OutputBatch::IntList(size_t icol, size_t irow) {
+  ListColumn<int32_t> &col(int_lists_[icol]);
+  return vector<int>(col.values_.begin() + col.starts_[irow], col.values_.begin() + col.starts_[irow + 1]);
+}
+
+// ----------------------------------------------------------------------------------------
+vector<string> OutputBatch::IdList(size_t icol, size_t irow) {
+  ListColumn<uint32_t> &col(id_lists_[icol]);
+  vector<string> strs;
+  for(size_t ii=col.starts_[irow]; ii<col.starts_[irow + 1]; ++ii)
+    strs.push_back(dictionary_.Get(col.values_[ii]));
+  return strs;
+}
+
+// ----------------------------------------------------------------------------------------
+template <typename T> static void Append(string &buffer, const T *vals, size_t n_vals) {
+  buffer.append((const char*)vals, n_vals * sizeof(T));
+}
+
+// ----------------------------------------------------------------------------------------
+template <typename T> static void AppendLengths(string &buffer, const vector<T> &starts) {  // the length of each row, from the offsets
+  for(size_t ir=0; ir+1<starts.size(); ++ir) {
+    uint32_t len(starts[ir + 1] - starts[ir]);
+    Append(buffer, &len, 1);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+string OutputBatch::Serialize() {
+  string buffer;
+  uint32_t n_rows(n_rows_), n_dict(dictionary_.size());
+  Append(buffer, &n_rows, 1);
+  Append(buffer, &n_dict, 1);
+  AppendLengths(buffer, dictionary_.starts_);
+  buffer += dictionary_.chars_;
+  for(auto &col : ints_)
+    Append(buffer, col.data(), col.size());
+  for(auto &col : doubles_)
+    Append(buffer, col.data(), col.size());
+  for(auto &col : strings_) {
+    AppendLengths(buffer, col.starts_);
+    buffer += col.chars_;
+  }
+  for(auto &col : ids_)
+    Append(buffer, col.data(), col.size());
+  for(auto &col : int_lists_) {
+    AppendLengths(buffer, col.starts_);
+    Append(buffer, col.values_.data(), col.values_.size());
+  }
+  for(auto &col : id_lists_) {
+    AppendLengths(buffer, col.starts_);
+    Append(buffer, col.values_.data(), col.values_.size());
+  }
+  return buffer;
+}
+
+// ----------------------------------------------------------------------------------------
+// reads through one serialized batch (throwing if it runs off the end)
+class BatchCursor {
+public:
+  BatchCursor(const char *data, size_t length) : data_(data), length_(length), ipos_(0) {}
+  template <typename T> void Read(T *vals, size_t n_vals) {
+    if(n_vals * sizeof(T) > length_ - ipos_)
+      throw runtime_error("ran off the end of a batch in binary output file");
+    memcpy(vals, data_ + ipos_, n_vals * sizeof(T));  // (no alignment guarantees in the file)
+    ipos_ += n_vals * sizeof(T);
+  }
+  template <typename T> void ReadStarts(size_t n_rows, vector<T> &starts) {  // read <n_rows> lengths and turn them into offsets
+    vector<uint32_t> lengths(n_rows);
+    Read(lengths.data(), n_rows);
+    starts.assign(1, 0);
+    for(auto len : lengths)
+      starts.push_back(starts.back() + len);
+  }
+  bool finished() { return ipos_ == length_; }
+private:
+  const char *data_;
+  size_t length_, ipos_;
+};
+
+// ----------------------------------------------------------------------------------------
+void OutputBatch::Deserialize(const char *data, size_t length) {
+  Clear();
+  BatchCursor cursor(data, length);
+  uint32_t n_rows, n_dict;
+  cursor.Read(&n_rows, 1);
+  cursor.Read(&n_dict, 1);
+  n_rows_ = n_rows;
+  auto read_string_column = [&](StringColumn &col, size_t n_strs) {
+    cursor.ReadStarts(n_strs, col.starts_);
+    col.chars_.resize(col.starts_.back());
+    cursor.Read(&col.chars_[0], col.chars_.size());
+  };
+  read_string_column(dictionary_, n_dict);
+  for(auto &col : ints_) {
+    col.resize(n_rows);
+    cursor.Read(col.data(), n_rows);
+  }
+  for(auto &col : doubles_) {
+    col.resize(n_rows);
+    cursor.Read(col.data(), n_rows);
+  }
+  for(auto &col : strings_)
+    read_string_column(col, n_rows);
+  for(auto &col : ids_) {
+    col.resize(n_rows);
+    cursor.Read(col.data(), n_rows);
+  }
+  for(auto &col : int_lists_) {
+    cursor.ReadStarts(n_rows, col.starts_);
+    col.values_.resize(col.starts_.back());
+    cursor.Read(col.values_.data(), col.values_.size());
+  }
+  for(auto &col : id_lists_) {
+    cursor.ReadStarts(n_rows, col.starts_);
+    col.values_.resize(col.starts_.back());
+    cursor.Read(col.values_.data(), col.values_.size());
+  }
+  if(!cursor.finished())
+    throw runtime_error("batch in binary output file is longer than its columns");
+  for(auto &col : ids_)
+    for(auto index : col)
+      if(index >= n_dict) throw runtime_error("id out of range in binary output file");
+  for(auto &col : id_lists_)
+    for(auto index : col.values_)
+      if(index >= n_dict) throw runtime_error("id out of range in binary output file");
+}
+
+// ----------------------------------------------------------------------------------------
+OutputFileWriter::OutputFileWriter(string fname, string kind, size_t rows_per_batch) :
+  fname_(fname),
+  schema_(kind),
+  rows_per_batch_(rows_per_batch),
+  batch_(schema_)
+{
+  vector<string> kinds(OutputKinds());
+  ofs_.open(fname, ios::binary);
+  if(!ofs_.is_open())
+    throw runtime_error("couldn't open binary output file " + fname + " for writing");
+  OutputFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic_, OUTPUT_FILE_MAGIC, sizeof(OUTPUT_FILE_MAGIC));
+  header.version_ = OUTPUT_FILE_VERSION;
+  header.kind_ = find(kinds.begin(), kinds.end(), kind) - kinds.begin();
+  ofs_.write((const char*)&header, sizeof(header));
+}
+
+// ----------------------------------------------------------------------------------------
+OutputFileWriter::~OutputFileWriter() {
+  if(ofs_.is_open())  // didn't get to Close() (e.g. because of an exception), so leave it without the trailing magic number, so readers know it's incomplete
+    ofs_.close();
+}
+
+// ----------------------------------------------------------------------------------------
+void OutputFileWriter::Add(const OutputRow &row) {
+  batch_.Add(row);
+  if(batch_.n_rows() >= rows_per_batch_)
+    WriteBatch();
+}
+
+// ----------------------------------------------------------------------------------------
+void OutputFileWriter::WriteBatch() {
+  if(batch_.n_rows() == 0)
+    return;
+  string buffer(batch_.Serialize());
+  uint64_t length(buffer.size());
+  ofs_.write((const char*)&length, sizeof(length));
+  ofs_.write(buffer.data(), buffer.size());
+  batch_.Clear();
+}
+
+// ----------------------------------------------------------------------------------------
+void OutputFileWriter::Close() {
+  WriteBatch();
+  ofs_.write(OUTPUT_FILE_MAGIC, sizeof(OUTPUT_FILE_MAGIC));
+  ofs_.close();
+  if(!ofs_)
+    throw runtime_error("failed writing binary output file " + fname_);
+}
+
+// ----------------------------------------------------------------------------------------
+OutputFileReader::OutputFileReader(string fname) :
+  fname_(fname),
+  data_(nullptr),
+  length_(0),
+  ipos_(sizeof(OutputFileHeader)),
+  schema_("viterbi")  // (replaced below)
+{
+  int fd(open(fname.c_str(), O_RDONLY));
+  if(fd < 0)
+    throw runtime_error("couldn't open binary output file " + fname + " (" + strerror(errno) + ")");
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    close(fd);
+    throw runtime_error("couldn't stat binary output file " + fname);
+  }
+  length_ = st.st_size;
+  if(length_ < sizeof(OutputFileHeader) + sizeof(OUTPUT_FILE_MAGIC)) {
+    close(fd);
+    throw runtime_error("binary output file " + fname + " is too short to have a header");
+  }
+  void *map(mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0));
+  close(fd);  // (the map stays valid)
+  if(map == MAP_FAILED)
+    throw runtime_error("couldn't mmap binary output file " + fname + " (" + strerror(errno) + ")");
+  data_ = (const char*)map;
+
+  OutputFileHeader header;
+  memcpy(&header, data_, sizeof(header));
+  vector<string> kinds(OutputKinds());
+  if(memcmp(header.magic_, OUTPUT_FILE_MAGIC, sizeof(OUTPUT_FILE_MAGIC)) != 0 || header.version_ != OUTPUT_FILE_VERSION || header.kind_ >= kinds.size()) {
+    munmap((void*)data_, length_);  // (the destructor doesn't run if the constructor throws)
+    throw runtime_error("binary output file " + fname + " has the wrong magic number, version, or kind");
+  }
+  if(memcmp(data_ + length_ - sizeof(OUTPUT_FILE_MAGIC), OUTPUT_FILE_MAGIC, sizeof(OUTPUT_FILE_MAGIC)) != 0) {
+    munmap((void*)data_, length_);
+    throw runtime_error("binary output file " + fname + " doesn't end with the magic number (truncated, or the run didn't finish?)");
+  }
+  kind_ = kinds[header.kind_];
+  schema_ = OutputSchema(kind_);
+}
+
+// ----------------------------------------------------------------------------------------
+OutputFileReader::~OutputFileReader() {
+  if(data_ != nullptr)
+    munmap((void*)data_, length_);
+}
+
+// ----------------------------------------------------------------------------------------
+bool OutputFileReader::NextBatch(OutputBatch &batch) {
+  size_t istop(length_ - sizeof(OUTPUT_FILE_MAGIC));
+  if(ipos_ == istop)
+    return false;
+  uint64_t length;
+  if(istop - ipos_ < sizeof(length))
+    throw runtime_error("ran off the end of binary output file " + fname_);
+  memcpy(&length, data_ + ipos_, sizeof(length));
+  ipos_ += sizeof(length);
+  if(length > istop - ipos_)
+    throw runtime_error("ran off the end of binary output file " + fname_);
+  batch.Deserialize(data_ + ipos_, length);
+  ipos_ += length;
+  return true;
+}
+
+// ----------------------------------------------------------------------------------------
+string PartitionString(OutputBatch &batch, size_t irow) {
+  vector<int> cluster_sizes(batch.IntList(0, irow));
+  vector<string> uids(batch.IdList(0, irow));
+  string partition_str;
+  size_t iuid(0);
+  for(size_t ic=0; ic<cluster_sizes.size(); ++ic) {
+    if(ic > 0)
+      partition_str += ";";
+    for(int is=0; is<cluster_sizes[ic]; ++is) {
+      if(is > 0)
+	partition_str += ":";
+      partition_str += uids.at(iuid++);
+    }
+  }
+  return partition_str;
+}
+
+// ----------------------------------------------------------------------------------------
+void ConvertOutputFileToCsv(string infname, string outfname) {
+  OutputFileReader reader(infname);
+  OutputBatch batch(reader.schema());
+  ofstream ofs(outfname);
+  if(!ofs.is_open())
+    throw runtime_error("couldn't open " + outfname + " for writing");
+
+  // NOTE these have to match StreamHeader(), StreamViterbiOutput(), etc. in bcrutils.cc, and Glomerator::WritePartitions()
+  if(reader.kind() == "viterbi") {
+    ofs << "unique_ids,v_gene,d_gene,j_gene,fv_insertion,vd_insertion,dj_insertion,jf_insertion,v_5p_del,v_3p_del,d_5p_del,d_3p_del,j_5p_del,j_3p_del,logprob,seqs,v_per_gene_support,d_per_gene_support,j_per_gene_support,errors\n";
+    while(reader.NextBatch(batch)) {
+      for(size_t ir=0; ir<batch.n_rows(); ++ir) {
+	bool has_event(batch.Int(0, ir));
+	ofs << batch.String(0, ir);
+	for(size_t ig=0; ig<3; ++ig)
+	  ofs << "," << (has_event ? batch.Id(ig, ir) : "");
+	for(size_t ii=1; ii<5; ++ii)
+	  ofs << "," << (has_event ? batch.String(ii, ir) : "");
+	for(size_t id=1; id<7; ++id) {
+	  ofs << ",";
+	  if(has_event) ofs << batch.Int(id, ir);
+	}
+	ofs << ",";
+	if(has_event) ofs << (float)batch.Double(0, ir);  // (RecoEvent::score_ is a float)
+	ofs << "," << batch.String(5, ir);
+	for(size_t is=6; is<9; ++is)
+	  ofs << "," << (has_event ? batch.String(is, ir) : "");
+	ofs << "," << batch.String(9, ir) << "\n";
+      }
+    }
+  } else if(reader.kind() == "forward") {
+    ofs << "unique_ids,logprob,errors\n";
+    while(reader.NextBatch(batch)) {
+      for(size_t ir=0; ir<batch.n_rows(); ++ir) {
+	ofs << batch.String(0, ir) << ",";
+	if(batch.Int(0, ir)) ofs << batch.Double(0, ir);
+	ofs << "," << batch.String(1, ir) << "\n";
+      }
+    }
+  } else if(reader.kind() == "partition") {
+    ofs << setprecision(20);
+    ofs << "partition,logprob\n";
+    while(reader.NextBatch(batch)) {
+      for(size_t ir=0; ir<batch.n_rows(); ++ir)
+	ofs << PartitionString(batch, ir) << "," << batch.Double(0, ir) << "\n";
+    }
+  } else {
+    assert(0);
+  }
+  ofs.close();
+}
+
+}
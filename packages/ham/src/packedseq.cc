@@ -0,0 +1,120 @@
+#include "packedseq.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAM_PACKED_AVX2
+#endif
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+PackedSeq::PackedSeq(const string &seq, Track *track) :
+  length_(seq.size()),
+  n_words_((seq.size() + 63) / 64),
+  n_planes_(0)
+{
+  while(track->alphabet_size() > (size_t(1) << n_planes_))  // number of bits we need for the largest symbol index
+    ++n_planes_;
+  planes_.resize(n_planes_ * n_words_, 0);
+  unambiguous_.resize(n_words_, 0);
+
+  int indices[256];  // symbol index for each character, filled as we come to them (-1 for not yet looked up)
+  for(size_t ich=0; ich<256; ++ich)
+    indices[ich] = -1;
+  for(size_t ic=0; ic<length_; ++ic) {
+    unsigned char ch(seq[ic]);
+    if(indices[ch] < 0)
+      indices[ch] = track->symbol_index(string(1, ch));  // throws if it isn't in the alphabet
+    if(indices[ch] == track->ambiguous_index())
+      continue;
+    size_t iword(ic / 64);
+    uint64_t bit(uint64_t(1) << (ic % 64));
+    unambiguous_[iword] |= bit;
+    for(size_t ip=0; ip<n_planes_; ++ip) {
+      if(indices[ch] & (1 << ip))
+	planes_[ip*n_words_ + iword] |= bit;
+    }
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+static size_t PackedHammingDistanceScalar(PackedSeq &seq_a, PackedSeq &seq_b, size_t &n_unambiguous, size_t istart) {
+  size_t distance(0);
+  for(size_t iw=istart; iw<seq_a.n_words_; ++iw) {
+    uint64_t diffs(0);
+    for(size_t ip=0; ip<seq_a.n_planes_; ++ip)
+      diffs |= seq_a.planes_[ip*seq_a.n_words_ + iw] ^ seq_b.planes_[ip*seq_b.n_words_ + iw];
+    uint64_t unambig(seq_a.unambiguous_[iw] & seq_b.unambiguous_[iw]);
+    distance += __builtin_popcountll(diffs & unambig);
+    n_unambiguous += __builtin_popcountll(unambig);
+  }
+  return distance;
+}
+
+#ifdef HAM_PACKED_AVX2
+// ----------------------------------------------------------------------------------------
+__attribute__((target("avx2"))) static inline __m256i PopcountAvx2(__m256i vals) {  // popcount of each 64-bit lane (nibble lookup table, then sum the bytes in each lane)
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+					  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+  __m256i lo = _mm256_and_si256(vals, low_nibbles);
+  __m256i hi = _mm256_and_si256(_mm256_srli_epi16(vals, 4), low_nibbles);
+  __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+  return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+// ----------------------------------------------------------------------------------------
+__attribute__((target("avx2"))) static inline size_t HorizontalSumAvx2(__m256i vals) {
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, vals);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+// ----------------------------------------------------------------------------------------
+__attribute__((target("avx2"))) static size_t PackedHammingDistanceAvx2(PackedSeq &seq_a, PackedSeq &seq_b, size_t &n_unambiguous) {
+  __m256i distances = _mm256_setzero_si256(), unambig_counts = _mm256_setzero_si256();
+  size_t iw(0);
+  for( ; iw + 4 <= seq_a.n_words_; iw += 4) {  // four words at a time
+    __m256i diffs = _mm256_setzero_si256();
+    for(size_t ip=0; ip<seq_a.n_planes_; ++ip) {
+      __m256i plane_a = _mm256_loadu_si256((const __m256i*)&seq_a.planes_[ip*seq_a.n_words_ + iw]);
+      __m256i plane_b = _mm256_loadu_si256((const __m256i*)&seq_b.planes_[ip*seq_b.n_words_ + iw]);
+      diffs = _mm256_or_si256(diffs, _mm256_xor_si256(plane_a, plane_b));
+    }
+    __m256i unambig = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)&seq_a.unambiguous_[iw]), _mm256_loadu_si256((const __m256i*)&seq_b.unambiguous_[iw]));
+    distances = _mm256_add_epi64(distances, PopcountAvx2(_mm256_and_si256(diffs, unambig)));
+    unambig_counts = _mm256_add_epi64(unambig_counts, PopcountAvx2(unambig));
+  }
+  n_unambiguous += HorizontalSumAvx2(unambig_counts);
+  size_t distance = HorizontalSumAvx2(distances);
+  return distance + PackedHammingDistanceScalar(seq_a, seq_b, n_unambiguous, iw);  // leftover words
+}
+
+// ----------------------------------------------------------------------------------------
+static bool PackedAvx2Available() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+static bool use_packed_avx2(PackedAvx2Available());
+#else
+static bool use_packed_avx2(false);
+#endif
+
+// ----------------------------------------------------------------------------------------
+size_t PackedHammingDistance(PackedSeq &seq_a, PackedSeq &seq_b, size_t &n_unambiguous) {
+  if(seq_a.length_ != seq_b.length_ || seq_a.n_planes_ != seq_b.n_planes_)
+    throw runtime_error("packed sequences of different length (or from different tracks) in PackedHammingDistance()");
+  n_unambiguous = 0;
+#ifdef HAM_PACKED_AVX2
+  if(use_packed_avx2)
+    return PackedHammingDistanceAvx2(seq_a, seq_b, n_unambiguous);
+#endif
+  return PackedHammingDistanceScalar(seq_a, seq_b, n_unambiguous, 0);
+}
+
+// ----------------------------------------------------------------------------------------
+string PackedHammingKernelName() {
+  return use_packed_avx2 ? "avx2" : "scalar";
+}
+
+}
@@ -0,0 +1,224 @@
+#include "querytable.h"
+
+#include <string.h>
+#include <cassert>
+#include <algorithm>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+static bool IsSpace(char ch) { return ch == ' ' || ch == '\t' || ch == '\r'; }
+
+// ----------------------------------------------------------------------------------------
+void QueryTable::Rows::Clear() {
+  *this = Rows();
+}
+
+// ----------------------------------------------------------------------------------------
+void QueryTable::Rows::Append(const Rows &other) {
+  k_v_min_.insert(k_v_min_.end(), other.k_v_min_.begin(), other.k_v_min_.end());
+  k_v_max_.insert(k_v_max_.end(), other.k_v_max_.begin(), other.k_v_max_.end());
+  k_d_min_.insert(k_d_min_.end(), other.k_d_min_.begin(), other.k_d_min_.end());
+  k_d_max_.insert(k_d_max_.end(), other.k_d_max_.begin(), other.k_d_max_.end());
+  cdr3_length_.insert(cdr3_length_.end(), other.cdr3_length_.begin(), other.cdr3_length_.end());
+  mut_freq_.insert(mut_freq_.end(), other.mut_freq_.begin(), other.mut_freq_.end());
+  for(auto column : {make_pair(&names_, &other.names_), make_pair(&seqs_, &other.seqs_), make_pair(&only_genes_, &other.only_genes_)}) {
+    size_t n_before(column.first->items_.size());
+    column.first->items_.insert(column.first->items_.end(), column.second->items_.begin(), column.second->items_.end());
+    for(size_t iq=1; iq<column.second->starts_.size(); ++iq)
+      column.first->starts_.push_back(n_before + column.second->starts_[iq]);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+QueryTable::QueryTable() : data_(nullptr), length_(0), ipos_(0), n_threads_(1) {
+}
+
+// ----------------------------------------------------------------------------------------
+QueryTable::~QueryTable() {
+  if(data_ != nullptr)
+    munmap((void*)data_, length_);
+}
+
+// ----------------------------------------------------------------------------------------
+void QueryTable::Open(string fname, size_t n_threads) {
+  assert(data_ == nullptr);
+  fname_ = fname;
+  n_threads_ = n_threads;
+  int fd(open(fname.c_str(), O_RDONLY));
+  if(fd < 0)
+    throw runtime_error("querytable.cc: bcrham input file '" + fname + "' d.n.e.\n");
+  struct stat st;
+  if(fstat(fd, &st) != 0) {
+    close(fd);
+    throw runtime_error("couldn't stat bcrham input file " + fname);
+  }
+  length_ = st.st_size;
+  if(length_ == 0) {  // (can't map an empty file, but it also doesn't have any queries)
+    close(fd);
+    return;
+  }
+  void *map(mmap(nullptr, length_, PROT_READ, MAP_PRIVATE, fd, 0));
+  close(fd);  // (the map stays valid)
+  if(map == MAP_FAILED)
+    throw runtime_error("couldn't mmap bcrham input file " + fname + " (" + strerror(errno) + ")");
+  data_ = (const char*)map;
+  madvise(map, length_, MADV_SEQUENTIAL);
+
+  // header line
+  size_t iend(LineEnd(0));
+  vector<string> column_names {"names", "seqs", "only_genes", "k_v_min", "k_v_max", "k_d_min", "k_d_max", "mut_freq", "cdr3_length"};
+  vector<bool> found(N_COLUMNS, false);
+  size_t ipos(0);
+  while(ipos < iend) {
+    while(ipos < iend && IsSpace(data_[ipos]))
+      ++ipos;
+    size_t istart(ipos);
+    while(ipos < iend && !IsSpace(data_[ipos]))
+      ++ipos;
+    if(ipos == istart)
+      break;
+    string head(data_ + istart, ipos - istart);
+    auto it = find(column_names.begin(), column_names.end(), head);
+    if(it == column_names.end())
+      throw runtime_error("querytable.cc: found unexpected header " + head + "' in input file " + fname);
+    columns_.push_back(Column(it - column_names.begin()));
+    found[columns_.back()] = true;
+  }
+  for(size_t ic=0; ic<N_COLUMNS; ++ic) {
+    if(!found[ic])
+      throw runtime_error("querytable.cc: input file " + fname + " is missing column '" + column_names[ic] + "'");
+  }
+  ipos_ = iend < length_ ? iend + 1 : length_;
+}
+
+// ----------------------------------------------------------------------------------------
+size_t QueryTable::LineEnd(size_t ipos) {
+  const char *newline((const char*)memchr(data_ + ipos, '\n', length_ - ipos));
+  return newline == nullptr ? length_ : newline - data_;
+}
+
+// ----------------------------------------------------------------------------------------
+size_t QueryTable::ReadQueries(size_t max_queries) {
+  rows_.Clear();
+  if(data_ == nullptr)
+    return 0;
+
+  // find the end of this batch (i.e. skip over <max_queries> lines that are long enough to count)
+  size_t istop(ipos_);
+  if(max_queries == 0) {
+    istop = length_;
+  } else {
+    size_t n_lines(0);
+    while(istop < length_ && n_lines < max_queries) {
+      size_t iend(LineEnd(istop));
+      if(iend - istop >= 10)  // same as ParseLines()
+	++n_lines;
+      istop = iend < length_ ? iend + 1 : length_;
+    }
+  }
+
+  // cut the batch into one range of lines per thread, unless it's too small to bother
+  size_t min_bytes_per_thread(1 << 20);
+  size_t n_pieces(min(n_threads_, max((size_t)1, (istop - ipos_) / min_bytes_per_thread)));
+  vector<size_t> boundaries {ipos_};
+  for(size_t ip=1; ip<n_pieces; ++ip) {
+    size_t ipos(max(boundaries.back(), ipos_ + ip * (istop - ipos_) / n_pieces));
+    ipos = ipos < istop ? LineEnd(ipos) : istop;
+    boundaries.push_back(ipos < istop ? ipos + 1 : istop);
+  }
+  boundaries.push_back(istop);
+
+  if(n_pieces == 1) {
+    ParseLines(ipos_, istop, rows_);
+  } else {
+    vector<Rows> pieces(n_pieces);
+    ThreadPool thread_pool(n_pieces);
+    thread_pool.ParallelFor(n_pieces, [&](size_t ip) { ParseLines(boundaries[ip], boundaries[ip + 1], pieces[ip]); });
+    for(auto &piece : pieces)
+      rows_.Append(piece);
+  }
+
+  ipos_ = istop;
+  return n_queries();
+}
+
+// ----------------------------------------------------------------------------------------
+void QueryTable::ParseLines(size_t istart, size_t istop, Rows &rows) {
+  size_t iline(istart);
+  while(iline < istop) {
+    size_t iend(LineEnd(iline));
+    if(iend - iline < 10) {  // 10 is kinda arbitrary, but we just want to skip blank lines
+      iline = iend + 1;
+      continue;
+    }
+    size_t ipos(iline);
+    for(auto column : columns_) {
+      while(ipos < iend && IsSpace(data_[ipos]))
+	++ipos;
+      Span token{ipos, 0};
+      while(ipos < iend && !IsSpace(data_[ipos]))
+	++ipos;
+      token.length_ = ipos - token.offset_;
+      if(token.length_ == 0)
+	throw runtime_error("querytable.cc: not enough columns in line starting at byte " + to_string(iline) + " of " + fname_);
+
+      ListColumn *list(nullptr);
+      switch(column) {
+      case NAMES: list = &rows.names_; break;
+      case SEQS: list = &rows.seqs_; break;
+      case ONLY_GENES: list = &rows.only_genes_; break;
+      case K_V_MIN: rows.k_v_min_.push_back(int(ParseNumber(token, iline))); break;
+      case K_V_MAX: rows.k_v_max_.push_back(int(ParseNumber(token, iline))); break;
+      case K_D_MIN: rows.k_d_min_.push_back(int(ParseNumber(token, iline))); break;
+      case K_D_MAX: rows.k_d_max_.push_back(int(ParseNumber(token, iline))); break;
+      case CDR3_LENGTH: rows.cdr3_length_.push_back(int(ParseNumber(token, iline))); break;
+      case MUT_FREQ: rows.mut_freq_.push_back(ParseNumber(token, iline)); break;
+      default: assert(0);
+      }
+      if(list != nullptr) {  // colon-separated list (same as SplitString(), i.e. empty items are kept)
+	size_t iitem(token.offset_), itoken_end(token.offset_ + token.length_);
+	while(true) {
+	  const char *colon((const char*)memchr(data_ + iitem, ':', itoken_end - iitem));
+	  size_t iitem_end(colon == nullptr ? itoken_end : colon - data_);
+	  list->items_.push_back(Span{iitem, iitem_end - iitem});
+	  if(colon == nullptr)
+	    break;
+	  iitem = iitem_end + 1;
+	}
+	list->starts_.push_back(list->items_.size());
+      }
+    }
+    iline = iend + 1;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+double QueryTable::ParseNumber(Span token, size_t iline_start) {
+  char buffer[64];  // (copy it, since the map isn't null-terminated)
+  if(token.length_ >= sizeof(buffer))
+    throw runtime_error("querytable.cc: number too long in line starting at byte " + to_string(iline_start) + " of " + fname_);
+  memcpy(buffer, data_ + token.offset_, token.length_);
+  buffer[token.length_] = '\0';
+  char *end;
+  double val(strtod(buffer, &end));
+  if(end != buffer + token.length_)
+    throw runtime_error("querytable.cc: couldn't convert '" + string(buffer) + "' to a number in line starting at byte " + to_string(iline_start) + " of " + fname_);
+  return val;
+}
+
+// ----------------------------------------------------------------------------------------
+vector<string> QueryTable::List(const ListColumn &column, size_t iqry) {
+  vector<string> strs;
+  for(size_t ii=column.starts_[iqry]; ii<column.starts_[iqry + 1]; ++ii)
+    strs.push_back(string(data_ + column.items_[ii].offset_, column.items_[ii].length_));
+  return strs;
+}
+
+}
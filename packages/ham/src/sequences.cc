@@ -79,6 +79,51 @@ void Sequence::Print(string separator) {
   cout << endl;
 }
 
+// ****************************************************************************************
+// ----------------------------------------------------------------------------------------
+SeqProfile::SeqProfile(SeqProfile &rhs, size_t pos, size_t len) :
+  length_(len),
+  width_(rhs.width_),
+  n_seqs_(rhs.n_seqs_)
+{
+  if(pos + len > rhs.length_)
+    throw runtime_error("len " + to_string(len) + " at " + to_string(pos) + " too large for profile of length " + to_string(rhs.length_));
+  counts_ = vector<uint32_t>(rhs.counts_.begin() + pos * width_, rhs.counts_.begin() + (pos + len) * width_);
+}
+
+// ----------------------------------------------------------------------------------------
+void SeqProfile::Add(Sequence &seq) {
+  if(n_seqs_ == 0) {
+    assert(seq.track());
+    length_ = seq.size();
+    width_ = seq.track()->alphabet_size() + 1;
+    counts_.assign(length_ * width_, 0);
+  } else if(seq.size() != length_) {
+    throw runtime_error("SeqProfile::Add() sequence " + seq.name() + " has length " + to_string(seq.size()) + ", but profile has length " + to_string(length_));
+  }
+  uint8_t ambiguous_index(seq.track()->ambiguous_index());
+  for(size_t ipos = 0; ipos < length_; ++ipos) {
+    uint8_t ch(seq.value(ipos));
+    counts_[ipos * width_ + (ch == ambiguous_index ? width_ - 1 : ch)] += 1;
+  }
+  ++n_seqs_;
+}
+
+// ----------------------------------------------------------------------------------------
+void SeqProfile::Add(SeqProfile &rhs) {
+  if(rhs.n_seqs_ == 0)
+    return;
+  if(n_seqs_ == 0) {
+    *this = rhs;
+    return;
+  }
+  if(rhs.length_ != length_ || rhs.width_ != width_)
+    throw runtime_error("SeqProfile::Add() profile shapes differ: " + to_string(length_) + "x" + to_string(width_) + " vs " + to_string(rhs.length_) + "x" + to_string(rhs.width_));
+  for(size_t ic = 0; ic < counts_.size(); ++ic)
+    counts_[ic] += rhs.counts_[ic];
+  n_seqs_ += rhs.n_seqs_;
+}
+
 // ****************************************************************************************
 // // ----------------------------------------------------------------------------------------
 // Sequences::Sequences(const Sequences &rhs) {
@@ -110,9 +155,20 @@ Sequences Sequences::Union(Sequences &otherseqs) {
   return union_seqs;
 }
 // ----------------------------------------------------------------------------------------
-Sequences::Sequences(Sequences &seqs, size_t pos, size_t len) : sequence_length_(0) {
+Sequences::Sequences(SeqProfile profile, string names) :
+  profile_(profile),
+  names_(names)
+{
+}
+
+// ----------------------------------------------------------------------------------------
+Sequences::Sequences(Sequences &seqs, size_t pos, size_t len) :
+  names_(seqs.names_)
+{
   for(auto & seq : seqs.seqs_)
-    AddSeq(Sequence(seq, pos, len));
+    seqs_.push_back(Sequence(seq, pos, len));
+  if(seqs.profile_.n_seqs() > 0)  // no need to recount, since we can just slice the rows we want out of the parent's profile
+    profile_ = SeqProfile(seqs.profile_, pos, len);
 }
 
 // // ----------------------------------------------------------------------------------------
@@ -132,13 +188,10 @@ void Sequences::Print() {
 
 // ----------------------------------------------------------------------------------------
 void Sequences::AddSeq(Sequence sq) {
-  if(n_seqs() == 0) {  // if this is the first sequence, set <sequence_length_>
-    sequence_length_ = sq.size();
-  } else {
-    if(sq.size() != sequence_length_)  // all sequences must have the same length
-      throw runtime_error("Sequences::AddSeq() sequences must all have the same length, but got " + to_string(sq.size()) + " and " + to_string(sequence_length_));
-  }
+  if(n_seqs() > 0 && sq.size() != GetSequenceLength())  // all sequences must have the same length
+    throw runtime_error("Sequences::AddSeq() sequences must all have the same length, but got " + to_string(sq.size()) + " and " + to_string(GetSequenceLength()));
   seqs_.push_back(sq);  // NOTE we now own this sequence, i.e. we will delete it when we die
+  profile_.Add(sq);
 }
 
 }
@@ -70,17 +70,64 @@ void State::Parse(YAML::Node node, vector<string> state_names, Track *track) {
   emission_.Parse(node["emissions"], track);
 }
 
+// ----------------------------------------------------------------------------------------
+// same as Parse(), but from a binary model file (which already passed the checks in Parse() when it was written)
+void State::ParseBinary(ModelFileReader &reader, Track *track) {
+  name_ = reader.ReadString();
+  germline_nuc_ = reader.ReadString();
+  ambiguous_char_ = reader.ReadString();
+  ambiguous_emission_logprob_ = reader.ReadDouble();
+  size_t n_transitions(reader.ReadCount());
+  for(size_t it = 0; it < n_transitions; ++it) {
+    Transition *trans = new Transition(reader.ReadString(), 1.);
+    trans->set_log_prob(reader.ReadDouble());
+    if(trans->to_state_name() == "end")
+      trans_to_end_ = trans;
+    else
+      transitions_->push_back(trans);
+  }
+  if(name_ != "init")
+    emission_.ParseBinary(reader, track);
+}
+
+// ----------------------------------------------------------------------------------------
+void State::WriteBinary(ModelFileWriter &writer) {
+  writer.Write(name_);
+  writer.Write(germline_nuc_);
+  writer.Write(ambiguous_char_);
+  writer.Write(ambiguous_emission_logprob_);
+  vector<Transition*> all_transitions;
+  for(auto *trans : *transitions_)
+    if(trans != nullptr)  // (after ReorderTransitions() there's a slot for every state)
+      all_transitions.push_back(trans);
+  if(trans_to_end_ != nullptr)
+    all_transitions.push_back(trans_to_end_);
+  writer.Write((uint32_t)all_transitions.size());
+  for(auto *trans : all_transitions) {
+    writer.Write(trans->to_state_name());
+    writer.Write(trans->log_prob());
+  }
+  if(name_ != "init")
+    emission_.WriteBinary(writer);
+}
+
 // ----------------------------------------------------------------------------------------
 void State::RescaleOverallMuteFreq(double factor) {
   if(germline_nuc_ == ambiguous_char_ || germline_nuc_ == "")  // if the germline state is N, or if this state has no germline (most likely fv or jf insertion)
     return;
+  emission_.ReplaceLogProbs(RescaledEmissionLogprobs(factor));
+}
+
+// ----------------------------------------------------------------------------------------
+vector<double> State::RescaledEmissionLogprobs(double factor) {
+  vector<double> new_log_probs(emission_.log_probs());
+  if(germline_nuc_ == ambiguous_char_ || germline_nuc_ == "")  // if the germline state is N, or if this state has no germline (most likely fv or jf insertion)
+    return new_log_probs;
 
   if(factor <= 0.0 || factor > 15.)  // 15 is pretty much arbitrary, but back when I understood this code I thought it was important that the factor not be too big (which would, I think, indicate that the sequence at hand had a very, very different mutation rate to that used to build the hmm)
     cout << "very large factor in State::RescaleOverallMuteFreq: " << to_string(factor) << endl;
 
   assert(emission_.track()->symbol_index(germline_nuc_) < emission_.track()->alphabet_size());  // this'll throw an exception on the symbol_index call if the germline nuc is bad
-
-  vector<double> new_log_probs(emission_.log_probs());
   assert(new_log_probs.size() == emission_.track()->alphabet_size());
 
   // NOTE this calculation is (more or less) repeated in hmmwriter::get_emission_prob() (it's kinda wasteful to go out of and back into log space (but doesn't matter at all in actual practice)
@@ -109,7 +156,7 @@ void State::RescaleOverallMuteFreq(double factor) {
       new_log_probs[ip] = log(exp(new_log_probs[ip]) * new_mute_freq / old_mute_freq);  // don't use <factor> because of min() call above
   }
 
-  emission_.ReplaceLogProbs(new_log_probs);
+  return new_log_probs;
 }
 
 // ----------------------------------------------------------------------------------------
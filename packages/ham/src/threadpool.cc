@@ -0,0 +1,87 @@
+#include "threadpool.h"
+
+namespace ham {
+
+// ----------------------------------------------------------------------------------------
+ThreadPool::ThreadPool(size_t n_threads) : n_tasks_(0), next_task_(0), n_busy_(0), generation_(0), stop_(false) {
+  for(size_t ith = 1; ith < n_threads; ++ith)
+    workers_.push_back(thread(&ThreadPool::WorkerLoop, this));
+}
+
+// ----------------------------------------------------------------------------------------
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_cv_.notify_all();
+  for(auto &worker : workers_)
+    worker.join();
+}
+
+// ----------------------------------------------------------------------------------------
+void ThreadPool::ParallelFor(size_t n_tasks, function<void(size_t)> task) {
+  if(workers_.size() == 0 || n_tasks < 2) {  // don't bother waking anybody up
+    for(size_t itask = 0; itask < n_tasks; ++itask)
+      task(itask);
+    return;
+  }
+
+  {
+    lock_guard<mutex> lock(mutex_);
+    task_ = task;
+    n_tasks_ = n_tasks;
+    next_task_ = 0;
+    n_busy_ = workers_.size();
+    error_ = nullptr;
+    ++generation_;
+  }
+  start_cv_.notify_all();
+  RunTasks();
+
+  unique_lock<mutex> lock(mutex_);
+  done_cv_.wait(lock, [this] { return n_busy_ == 0; });
+  task_ = nullptr;
+  if(error_)
+    rethrow_exception(error_);
+}
+
+// ----------------------------------------------------------------------------------------
+void ThreadPool::WorkerLoop() {
+  size_t last_generation(0);
+  while(true) {
+    {
+      unique_lock<mutex> lock(mutex_);
+      start_cv_.wait(lock, [this, last_generation] { return stop_ || generation_ != last_generation; });
+      if(stop_)
+        return;
+      last_generation = generation_;
+    }
+    RunTasks();
+    {
+      lock_guard<mutex> lock(mutex_);
+      --n_busy_;
+    }
+    done_cv_.notify_one();
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void ThreadPool::RunTasks() {
+  // keep taking tasks until there aren't any left
+  while(true) {
+    size_t itask(next_task_++);
+    if(itask >= n_tasks_)
+      return;
+    try {
+      task_(itask);
+    } catch(...) {
+      lock_guard<mutex> lock(mutex_);
+      if(!error_)
+        error_ = current_exception();
+      next_task_ = n_tasks_;  // don't start any more
+    }
+  }
+}
+
+}
@@ -5,10 +5,10 @@ namespace ham {
 // ----------------------------------------------------------------------------------------
 double Trellis::ApproxBytesUsed() {
   double bytes(0.);
-  // NOTE doesn't include traceback table!
   bytes += sizeof(double) * viterbi_log_probs_pointer_->size();
   bytes += sizeof(double) * forward_log_probs_pointer_->size();
   bytes += sizeof(int) * viterbi_indices_.size();
+  bytes += traceback_table_.bytes();
   return bytes;
 }
 
@@ -24,29 +24,29 @@ string Trellis::SizeString() {
 }
 
 // ----------------------------------------------------------------------------------------
-Trellis::Trellis(Model* hmm, Sequence seq, Trellis *cached_trellis) :
+Trellis::Trellis(Model* hmm, Sequence seq, Trellis *cached_trellis, TrellisPool *pool, const EmissionOverlay *emission_overlay) :
   hmm_(hmm),
-  cached_trellis_(cached_trellis),
-  scoring_current_(hmm_->n_states(), -INFINITY),
-  scoring_previous_(hmm_->n_states(), -INFINITY)
+  pool_(pool),
+  emission_overlay_(emission_overlay),
+  cached_trellis_(cached_trellis)
 {
   seqs_.AddSeq(seq);
   Init();
 }
 
 // ----------------------------------------------------------------------------------------
-Trellis::Trellis(Model* hmm, Sequences seqs, Trellis *cached_trellis) :
+Trellis::Trellis(Model* hmm, Sequences seqs, Trellis *cached_trellis, TrellisPool *pool, const EmissionOverlay *emission_overlay) :
   hmm_(hmm),
   seqs_(seqs),
-  cached_trellis_(cached_trellis),
-  scoring_current_(hmm_->n_states(), -INFINITY),
-  scoring_previous_(hmm_->n_states(), -INFINITY)
+  pool_(pool),
+  emission_overlay_(emission_overlay),
+  cached_trellis_(cached_trellis)
 {
   Init();
 }
 
 // ----------------------------------------------------------------------------------------
-Trellis::Trellis() : hmm_(nullptr), cached_trellis_(nullptr)
+Trellis::Trellis() : hmm_(nullptr), pool_(nullptr), emission_overlay_(nullptr), cached_trellis_(nullptr)
 {
   Init();
 }
@@ -59,6 +59,8 @@ void Trellis::Init() {
     if(hmm_ != cached_trellis_->model())
       throw runtime_error("ERROR model in cached trellis " + cached_trellis_->model()->name() + " not the same as mine " + hmm_->name());
   }
+  if(emission_overlay_ && emission_overlay_->size() != hmm_->compiled()->emission_table_size())
+    throw runtime_error("ERROR emission overlay size " + to_string(emission_overlay_->size()) + " doesn't match " + hmm_->name());
 
   traceback_table_pointer_ = nullptr;
   viterbi_log_probs_pointer_ = nullptr;
@@ -69,10 +71,39 @@ void Trellis::Init() {
   ending_viterbi_log_prob_ = -INFINITY;
   ending_viterbi_pointer_ = -1;
   ending_forward_log_prob_ = -INFINITY;
+  scaled_forward_fell_back_ = near_underflow_ = suffix_ = false;
 }
 
 // ----------------------------------------------------------------------------------------
 Trellis::~Trellis() {
+  traceback_table_.Release(pool_);
+  if(pool_) {
+    pool_->Release(viterbi_log_probs_);
+    pool_->Release(forward_log_probs_);
+    ReleaseColumns();
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::AcquireColumns() {
+  if(pool_) {
+    pool_->Acquire(scoring_current_);
+    pool_->Acquire(scoring_previous_);
+  }
+  scoring_current_.assign(hmm_->n_states(), -INFINITY);
+  scoring_previous_.assign(hmm_->n_states(), -INFINITY);
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::ReleaseColumns() {
+  // we only need the dp columns while we're running, so don't hang on to them (there can be a *lot* of cached trellises)
+  if(pool_) {
+    pool_->Release(scoring_current_);
+    pool_->Release(scoring_previous_);
+  } else {
+    vector<double>().swap(scoring_current_);
+    vector<double>().swap(scoring_previous_);
+  }
 }
 
 // ----------------------------------------------------------------------------------------
@@ -87,56 +118,146 @@ void Trellis::Dump() {
 
 // ----------------------------------------------------------------------------------------
 void Trellis::MiddleViterbiVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position) {
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
+  CompiledModel *cm(hmm_->compiled());
+  SetEmissionRows(position);
+  if(!cm->has_chain() || !ChainKernelsOn()) {
+    MiddleViterbiRange(scoring_previous, scoring_current, current_states, next_states, position, 0, cm->n_states());
+    return;
+  }
+
+  // general code for the states before and after the chain, and the chain kernel in between (keeping this order, so ties in viterbi_indices_ come out the same)
+  MiddleViterbiRange(scoring_previous, scoring_current, current_states, next_states, position, 0, cm->chain_begin());
+  double best_end_logprob(-INFINITY);
+  int best_end_state(-1);
+  ChainViterbiColumn(cm, scoring_previous->data(), scoring_current->data(), traceback_table_pointer_, position, emission_rows_, emission_counts_, chain_lo_, chain_hi_, best_end_logprob, best_end_state);
+  if(best_end_logprob > viterbi_log_probs_[position]) {
+    viterbi_log_probs_[position] = best_end_logprob;
+    viterbi_indices_[position] = best_end_state;
+  }
+  AddChainNextStates(scoring_current, next_states);
+  MiddleViterbiRange(scoring_previous, scoring_current, current_states, next_states, position, cm->chain_end(), cm->n_states());
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::MiddleViterbiRange(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position, size_t ibegin, size_t iend) {
+  // general (any topology) viterbi step for states [ibegin, iend) NOTE assumes SetEmissionRows(position) has been called
+  CompiledModel *cm(hmm_->compiled());
+  const uint16_t *from_indices(cm->from_indices());
+  const double *from_log_probs(cm->from_log_probs());
+  for(size_t i_st_current = ibegin; i_st_current < iend; ++i_st_current) {
     if(!current_states[i_st_current])  // check if transition to this state is allowed from any state through which we passed at the previous position
       continue;
 
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
+    double emission_val = EmissionLogprob(i_st_current);
     if(emission_val == -INFINITY)
       continue;
 
-    for(auto &i_st_previous : *hmm_->state(i_st_current)->from_state_indices()) {  // list of states from which we could've arrived at <i_st_current>
+    for(uint32_t iedge = cm->from_begin(i_st_current); iedge < cm->from_end(i_st_current); ++iedge) {  // edges from states from which we could've arrived at <i_st_current>
+      size_t i_st_previous(from_indices[iedge]);
       if((*scoring_previous)[i_st_previous] == -INFINITY)  // skip if <i_st_previous> was a dead end, i.e. that row in the previous column had zero probability
 	continue;
-      double dpval = (*scoring_previous)[i_st_previous] + emission_val + hmm_->state(i_st_previous)->transition_logprob(i_st_current);
+      double dpval = (*scoring_previous)[i_st_previous] + emission_val + from_log_probs[iedge];
       if(dpval > (*scoring_current)[i_st_current]) {
 	(*scoring_current)[i_st_current] = dpval;  // save this value as the best value we've so far come across
-	(*traceback_table_pointer_)[position][i_st_current] = i_st_previous;  // and mark which state it came from for later traceback NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
+	traceback_table_pointer_->set(position, i_st_current, i_st_previous);  // and mark which state it came from for later traceback NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
       }
       CacheViterbiVals(position, dpval, i_st_current);
-      next_states |= (*hmm_->state(i_st_current)->to_states());  // NOTE we want this *inside* the <i_st_previous> loop because we only want to include previous states that are really needed
+      next_states |= (*cm->to_states(i_st_current));  // NOTE we want this *inside* the <i_st_previous> loop because we only want to include previous states that are really needed
     }
   }
 }
 
 // ----------------------------------------------------------------------------------------
 void Trellis::MiddleForwardVals(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position) {
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
+  CompiledModel *cm(hmm_->compiled());
+  SetEmissionRows(position);
+  if(!cm->has_chain() || !ChainKernelsOn()) {
+    MiddleForwardRange(scoring_previous, scoring_current, current_states, next_states, position, 0, cm->n_states());
+    return;
+  }
+
+  MiddleForwardRange(scoring_previous, scoring_current, current_states, next_states, position, 0, cm->chain_begin());
+  double chain_total = ChainForwardColumn(cm, scoring_previous->data(), scoring_current->data(), emission_rows_, emission_counts_, chain_lo_, chain_hi_);
+  if(chain_total != -INFINITY)
+    forward_log_probs_[position] = AddInLogSpace(chain_total, forward_log_probs_[position]);
+  AddChainNextStates(scoring_current, next_states);
+  MiddleForwardRange(scoring_previous, scoring_current, current_states, next_states, position, cm->chain_end(), cm->n_states());
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::MiddleForwardRange(vector<double> *scoring_previous, vector<double> *scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, size_t position, size_t ibegin, size_t iend) {
+  // general (any topology) forward step for states [ibegin, iend) NOTE assumes SetEmissionRows(position) has been called
+  CompiledModel *cm(hmm_->compiled());
+  const uint16_t *from_indices(cm->from_indices());
+  const double *from_log_probs(cm->from_log_probs());
+  for(size_t i_st_current = ibegin; i_st_current < iend; ++i_st_current) {
     if(!current_states[i_st_current])  // check if transition to this state is allowed from any state through which we passed at the previous position
       continue;
 
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
+    double emission_val = EmissionLogprob(i_st_current);
     if(emission_val == -INFINITY)
       continue;
 
-    for(auto &i_st_previous : *hmm_->state(i_st_current)->from_state_indices()) {  // list of states from which we could've arrived at <i_st_current>
+    for(uint32_t iedge = cm->from_begin(i_st_current); iedge < cm->from_end(i_st_current); ++iedge) {  // edges from states from which we could've arrived at <i_st_current>
+      size_t i_st_previous(from_indices[iedge]);
       if((*scoring_previous)[i_st_previous] == -INFINITY)  // skip if <i_st_previous> was a dead end, i.e. that row in the previous column had zero probability
 	continue;
-      double dpval = (*scoring_previous)[i_st_previous] + emission_val + hmm_->state(i_st_previous)->transition_logprob(i_st_current);
+      double dpval = (*scoring_previous)[i_st_previous] + emission_val + from_log_probs[iedge];
       (*scoring_current)[i_st_current] = AddInLogSpace(dpval, (*scoring_current)[i_st_current]);
       CacheForwardVals(position, dpval, i_st_current);
-      next_states |= (*hmm_->state(i_st_current)->to_states());  // NOTE we want this *inside* the <i_st_previous> loop because we only want to include previous states that are really needed
+      next_states |= (*cm->to_states(i_st_current));  // NOTE we want this *inside* the <i_st_previous> loop because we only want to include previous states that are really needed
     }
   }
 }
 
 // ----------------------------------------------------------------------------------------
-void Trellis::SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states) {
-  // swap <scoring_current> and <scoring_previous>, and set <scoring_current> values to -INFINITY
+void Trellis::SetChainRange(vector<double> *scoring_current) {
+  // set [chain_lo_, chain_hi_) to the range of chain states that are non-zero in <scoring_current> (after that the chain kernels keep it up to date)
+  CompiledModel *cm(hmm_->compiled());
+  chain_lo_ = chain_hi_ = cm->chain_begin();
+  for(size_t ist = cm->chain_begin(); ist < cm->chain_end(); ++ist) {
+    if((*scoring_current)[ist] == -INFINITY)
+      continue;
+    if(chain_hi_ == chain_lo_)
+      chain_lo_ = ist;
+    chain_hi_ = ist + 1;
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::AddChainNextStates(vector<double> *scoring_current, bitset<STATE_MAX> &next_states) {
+  // the chain kernels don't use <current_states> or <next_states> within the chain, so we only need to add transitions that leave it
+  CompiledModel *cm(hmm_->compiled());
+  for(auto &ist : *cm->chain_extra_out_states()) {
+    if((*scoring_current)[ist] != -INFINITY)
+      next_states |= (*cm->to_states(ist));
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::SetEmissionRows(size_t position) {
+  // point <emission_rows_> at the compiled model's emission log probs for each symbol that occurs at <position> (so the cost doesn't scale with the number of sequences)
+  CompiledModel *cm(hmm_->compiled());
+  if(seqs_.profile_width() != cm->n_symbols())
+    throw runtime_error("ERROR sequence profile width " + to_string(seqs_.profile_width()) + " doesn't match number of symbols " + to_string(cm->n_symbols()) + " in " + hmm_->name());
+  const uint32_t *counts(seqs_.profile(position));
+  emission_rows_.clear();
+  emission_counts_.clear();
+  for(size_t icol = 0; icol < seqs_.profile_width(); ++icol) {
+    if(counts[icol] == 0)  // also avoids 0 * -INFINITY
+      continue;
+    emission_rows_.push_back(cm->emission_row_by_column(icol, emission_overlay_));
+    emission_counts_.push_back(counts[icol]);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::SwapColumns(vector<double> *&scoring_previous, vector<double> *&scoring_current, bitset<STATE_MAX> &current_states, bitset<STATE_MAX> &next_states, double fill_val) {
+  // swap <scoring_current> and <scoring_previous>, and set <scoring_current> values to <fill_val> (i.e. zero probability)
   swap_ptr_ = scoring_previous;
   scoring_previous = scoring_current;
   scoring_current = swap_ptr_;
-  scoring_current->assign(hmm_->n_states(), -INFINITY);
+  scoring_current->assign(hmm_->n_states(), fill_val);
   swap_ptr_ = nullptr;
 
   // swap the <current_states> and <next_states> bitsets (ie set current_states to the states to which we can transition from *any* of the previous states)
@@ -147,7 +268,7 @@ void Trellis::SwapColumns(vector<double> *&scoring_previous, vector<double> *&sc
 
 // ----------------------------------------------------------------------------------------
 void Trellis::CacheViterbiVals(size_t position, double dpval, size_t i_st_current) {
-  double end_trans_val = hmm_->state(i_st_current)->end_transition_logprob();
+  double end_trans_val = hmm_->compiled()->end_log_prob(i_st_current);
   double logprob = dpval + end_trans_val;
   if(logprob > viterbi_log_probs_[position]) {
     viterbi_log_probs_[position] = logprob;  // since this is the log prob of *ending* at this point, we have to add on the prob of going to the end state from this state
@@ -157,7 +278,7 @@ void Trellis::CacheViterbiVals(size_t position, double dpval, size_t i_st_curren
 
 // ----------------------------------------------------------------------------------------
 void Trellis::CacheForwardVals(size_t position, double dpval, size_t i_st_current) {
-  double end_trans_val = hmm_->state(i_st_current)->end_transition_logprob();
+  double end_trans_val = hmm_->compiled()->end_log_prob(i_st_current);
   double logprob = dpval + end_trans_val;
   forward_log_probs_[position] = AddInLogSpace(logprob, forward_log_probs_[position]);
 }
@@ -173,34 +294,39 @@ void Trellis::Viterbi() {
     return;
   }
 
+  suffix_ = false;
   // initialize stored values for chunk caching
-  viterbi_log_probs_.resize(seqs_.GetSequenceLength(), -INFINITY);
-  viterbi_indices_.resize(seqs_.GetSequenceLength(), -1);
+  if(pool_ && viterbi_log_probs_.capacity() == 0)
+    pool_->Acquire(viterbi_log_probs_);
+  viterbi_log_probs_.assign(seqs_.GetSequenceLength(), -INFINITY);
+  viterbi_indices_.assign(seqs_.GetSequenceLength(), -1);
   viterbi_log_probs_pointer_ = &viterbi_log_probs_;
   viterbi_indices_pointer_ = &viterbi_indices_;
 
-  traceback_table_ = int_2D(seqs_.GetSequenceLength(), vector<int16_t>(hmm_->n_states(), -1));
+  CompiledModel *cm(hmm_->compiled());
+  traceback_table_.Init(seqs_.GetSequenceLength(), hmm_->n_states(), cm->narrow_traceback_ok(), pool_);
   traceback_table_pointer_ = &traceback_table_;
 
+  AcquireColumns();
   vector<double> *scoring_current = &scoring_current_;  // dp table values in the current column (i.e. at the current position in the query sequence)
   vector<double> *scoring_previous = &scoring_previous_;  // same, but for the previous position
-  scoring_current->assign(scoring_current->size(), -INFINITY);
-  scoring_previous->assign(scoring_previous->size(), -INFINITY);
   bitset<STATE_MAX> next_states, current_states;  // bitset of states which we need to check at the next/current position
 
   // first calculate log probs for first position in sequence
   size_t position(0);
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
+  SetEmissionRows(position);
+  for(size_t i_st_current = 0; i_st_current < cm->n_states(); ++i_st_current) {
     if(!(*hmm_->initial_to_states())[i_st_current])  // skip <i_st_current> if there's no transition to it from <init>
       continue;
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
-    double dpval = emission_val + hmm_->init_state()->transition_logprob(i_st_current);
+    double emission_val = EmissionLogprob(i_st_current);
+    double dpval = emission_val + cm->init_log_prob(i_st_current);
     if(dpval == -INFINITY)
       continue;
     (*scoring_current)[i_st_current] = dpval;
     CacheViterbiVals(position, dpval, i_st_current);
-    next_states |= (*hmm_->state(i_st_current)->to_states());  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next position (column)
+    next_states |= (*cm->to_states(i_st_current));  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next position (column)
   }
+  SetChainRange(scoring_current);
 
 
   // then loop over the rest of the sequence
@@ -218,12 +344,13 @@ void Trellis::Viterbi() {
   for(size_t st_previous = 0; st_previous < hmm_->n_states(); ++st_previous) {
     if((*scoring_previous)[st_previous] == -INFINITY)
       continue;
-    double dpval = (*scoring_previous)[st_previous] + hmm_->state(st_previous)->end_transition_logprob();
+    double dpval = (*scoring_previous)[st_previous] + cm->end_log_prob(st_previous);
     if(dpval > ending_viterbi_log_prob_) {
       ending_viterbi_log_prob_ = dpval;  // NOTE should *not* be replaced by last entry in viterbi_log_probs_, since that does not include the ending transition
       ending_viterbi_pointer_ = st_previous;
     }
   }
+  ReleaseColumns();
 }
 
 // ----------------------------------------------------------------------------------------
@@ -234,29 +361,34 @@ void Trellis::Forward() {
     return;
   }
 
+  suffix_ = false;
   // initialize stored values for chunk caching
-  forward_log_probs_.resize(seqs_.GetSequenceLength(), -INFINITY);
+  if(pool_ && forward_log_probs_.capacity() == 0)
+    pool_->Acquire(forward_log_probs_);
+  forward_log_probs_.assign(seqs_.GetSequenceLength(), -INFINITY);
   forward_log_probs_pointer_ = &forward_log_probs_;
 
+  CompiledModel *cm(hmm_->compiled());
+  AcquireColumns();
   vector<double> *scoring_current = &scoring_current_;  // dp table values in the current column (i.e. at the current position in the query sequence)
   vector<double> *scoring_previous = &scoring_previous_;  // same, but for the previous position
-  scoring_current->assign(scoring_current->size(), -INFINITY);
-  scoring_previous->assign(scoring_previous->size(), -INFINITY);
   bitset<STATE_MAX> next_states, current_states;  // bitset of states which we need to check at the next/current position
 
   // first calculate log probs for first position in sequence
   size_t position(0);
-  for(size_t i_st_current = 0; i_st_current < hmm_->n_states(); ++i_st_current) {
+  SetEmissionRows(position);
+  for(size_t i_st_current = 0; i_st_current < cm->n_states(); ++i_st_current) {
     if(!(*hmm_->initial_to_states())[i_st_current])  // skip <i_st_current> if there's no transition to it from <init>
       continue;
-    double emission_val = hmm_->state(i_st_current)->EmissionLogprob(&seqs_, position);
-    double dpval = emission_val + hmm_->init_state()->transition_logprob(i_st_current);
+    double emission_val = EmissionLogprob(i_st_current);
+    double dpval = emission_val + cm->init_log_prob(i_st_current);
     if(dpval == -INFINITY)
       continue;
     (*scoring_current)[i_st_current] = dpval;
-    next_states |= (*hmm_->state(i_st_current)->to_states());  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next column. This leaves <next_states> set to the OR of all states to which we can transition from if start from a state to which we can transition from <init>
+    next_states |= (*cm->to_states(i_st_current));  // add <i_st_current>'s outbound transitions to the list of states to check when we get to the next column. This leaves <next_states> set to the OR of all states to which we can transition from if start from a state to which we can transition from <init>
     CacheForwardVals(position, dpval, i_st_current);
   }
+  SetChainRange(scoring_current);
 
   // then loop over the rest of the sequence
   for(position = 1; position < seqs_.GetSequenceLength(); ++position) {
@@ -270,11 +402,285 @@ void Trellis::Forward() {
   for(size_t st_previous = 0; st_previous < hmm_->n_states(); ++st_previous) {
     if((*scoring_previous)[st_previous] == -INFINITY)
       continue;
-    double dpval = (*scoring_previous)[st_previous] + hmm_->state(st_previous)->end_transition_logprob();
+    double dpval = (*scoring_previous)[st_previous] + cm->end_log_prob(st_previous);
     if(dpval == -INFINITY)
       continue;
     ending_forward_log_prob_ = AddInLogSpace(ending_forward_log_prob_, dpval);
   }
+  ReleaseColumns();
+}
+
+// ----------------------------------------------------------------------------------------
+double Trellis::ScaledEmissions(bitset<STATE_MAX> &states) {
+  // set <scaled_emissions_> to exp(emission log prob - the largest one) for each state in <states>, and return the largest one NOTE assumes SetEmissionRows() has been called
+  CompiledModel *cm(hmm_->compiled());
+  double max_logprob(-INFINITY);
+  for(size_t ist = 0; ist < cm->n_states(); ++ist) {
+    if(!states[ist])
+      continue;
+    scaled_emissions_[ist] = EmissionLogprob(ist);
+    if(scaled_emissions_[ist] > max_logprob)
+      max_logprob = scaled_emissions_[ist];
+  }
+  for(size_t ist = 0; ist < cm->n_states(); ++ist) {
+    if(!states[ist])
+      continue;
+    if(scaled_emissions_[ist] - max_logprob < -600.)
+      near_underflow_ = true;
+    scaled_emissions_[ist] = max_logprob == -INFINITY ? 0. : exp(scaled_emissions_[ist] - max_logprob);
+  }
+  return max_logprob;
+}
+
+// ----------------------------------------------------------------------------------------
+double Trellis::NormalizeColumn(vector<double> *scoring_current) {
+  // divide <scoring_current> by its sum, and return the log of the sum (-INFINITY if everything's zero, in which case we leave it alone)
+  double sum(0.);
+  for(size_t ist = 0; ist < hmm_->n_states(); ++ist)
+    sum += (*scoring_current)[ist];
+  if(sum == 0.)
+    return -INFINITY;
+  double inverse(1. / sum);
+  for(size_t ist = 0; ist < hmm_->n_states(); ++ist) {
+    (*scoring_current)[ist] *= inverse;
+    if((*scoring_current)[ist] > 0. && (*scoring_current)[ist] < 1e-250)
+      near_underflow_ = true;
+  }
+  return log(sum);
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::ScaledForward() {
+  // Classic scaled forward algorithm: the columns hold probabilities (not log probs), divided by the column's sum so they don't underflow, and <log_scale> is
+  // the log of the product of all the factors we've divided by. So the log prob of a cell is log(<column value>) + <log_scale>.
+  // Emissions are also scaled by the largest emission in each column, since for lots of sequences they can be smaller than the smallest double.
+  // The catch is that paths that are more than about e^-708 smaller than the column total get rounded to zero (or lose precision on the way there), which
+  // is only ok as long as the rest of the probability doesn't later die off (e.g. if the sequence is longer than the v gene, so the only surviving paths
+  // use the very improbable left insert), and as long as we don't need the prob of ending at a position where ending is that much less likely than
+  // continuing. If either of those happens, we start over in log space (for the regression data this is a few percent of v trellises, and no d or j).
+  scaled_forward_fell_back_ = false;
+  if(cached_trellis_) {
+    ending_forward_log_prob_ = cached_trellis_->ending_forward_log_prob(seqs_.GetSequenceLength());
+    forward_log_probs_pointer_ = cached_trellis_->forward_log_probs_pointer();
+    return;
+  }
+
+  suffix_ = false;
+  // initialize stored values for chunk caching
+  if(pool_ && forward_log_probs_.capacity() == 0)
+    pool_->Acquire(forward_log_probs_);
+  forward_log_probs_.assign(seqs_.GetSequenceLength(), -INFINITY);
+  forward_log_probs_pointer_ = &forward_log_probs_;
+  ending_forward_log_prob_ = -INFINITY;
+
+  CompiledModel *cm(hmm_->compiled());
+  const uint16_t *from_indices(cm->from_indices());
+  const double *from_probs(cm->from_probs());
+  const double *end_probs(cm->end_probs());
+  AcquireColumns();
+  if(pool_)
+    pool_->Acquire(scaled_emissions_);
+  scaled_emissions_.assign(cm->n_states(), 0.);
+  vector<double> *scoring_current = &scoring_current_;
+  vector<double> *scoring_previous = &scoring_previous_;
+  scoring_current->assign(cm->n_states(), 0.);
+  scoring_previous->assign(cm->n_states(), 0.);
+  bitset<STATE_MAX> next_states, current_states;
+  near_underflow_ = false;
+
+  // first position
+  size_t position(0);
+  SetEmissionRows(position);
+  current_states = *hmm_->initial_to_states();
+  double log_scale = ScaledEmissions(current_states);
+  for(size_t i_st_current = 0; i_st_current < cm->n_states(); ++i_st_current) {
+    if(!current_states[i_st_current])
+      continue;
+    double val = cm->init_prob(i_st_current) * scaled_emissions_[i_st_current];
+    if(val == 0.)
+      continue;
+    (*scoring_current)[i_st_current] = val;
+    next_states |= (*cm->to_states(i_st_current));
+  }
+
+  for(position = 0; position < seqs_.GetSequenceLength(); ++position) {
+    if(position > 0) {
+      SwapColumns(scoring_previous, scoring_current, current_states, next_states, 0.);
+      SetEmissionRows(position);
+      log_scale += ScaledEmissions(current_states);
+      for(size_t i_st_current = 0; i_st_current < cm->n_states(); ++i_st_current) {
+	if(!current_states[i_st_current] || scaled_emissions_[i_st_current] == 0.)
+	  continue;
+	double val(0.);
+	for(uint32_t iedge = cm->from_begin(i_st_current); iedge < cm->from_end(i_st_current); ++iedge)
+	  val += (*scoring_previous)[from_indices[iedge]] * from_probs[iedge];
+	val *= scaled_emissions_[i_st_current];
+	if(val < 1e-250)  // NOTE this includes zero, since we only get here if there's an edge from a non-zero state in the previous column
+	  near_underflow_ = true;
+	if(val == 0.)
+	  continue;
+	(*scoring_current)[i_st_current] = val;
+	next_states |= (*cm->to_states(i_st_current));
+      }
+    }
+
+    double log_sum(log_scale == -INFINITY ? -INFINITY : NormalizeColumn(scoring_current));
+    if(near_underflow_ && (log_sum == -INFINITY || log_sum < -20.)) {  // most of the probability in the previous column led to dead ends (the normal range is roughly [-5, 0]), so paths that we've rounded off could now matter
+      FallBackToForward();
+      return;
+    }
+    if(log_sum == -INFINITY)  // no path with non-zero probability, so everything from here on stays at -INFINITY
+      break;
+    log_scale += log_sum;
+
+    double end_prob(0.);  // prob of ending at this position (relative to <log_scale>)
+    for(size_t ist = 0; ist < cm->n_states(); ++ist)
+      end_prob += (*scoring_current)[ist] * end_probs[ist];
+    if(near_underflow_ && end_prob < 1e-250) {  // ending here is so unlikely compared to continuing that the states that can end may have been rounded off
+      FallBackToForward();
+      return;
+    }
+    if(end_prob > 0.)
+      forward_log_probs_[position] = log(end_prob) + log_scale;
+  }
+
+  ending_forward_log_prob_ = forward_log_probs_[seqs_.GetSequenceLength() - 1];
+  ReleaseColumns();
+  if(pool_)
+    pool_->Release(scaled_emissions_);
+  else
+    vector<double>().swap(scaled_emissions_);
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::FallBackToForward() {
+  // give up on a ScaledForward() call that's partway through, and redo it in log space
+  ReleaseColumns();
+  if(pool_)
+    pool_->Release(scaled_emissions_);
+  else
+    vector<double>().swap(scaled_emissions_);
+  scaled_forward_fell_back_ = true;
+  Forward();
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::SuffixViterbi() {
+  // Run right to left, so that one table serves every k set's j query (which always ends at the end of the sequence, but starts at k_v + k_d). The column
+  // for <position> holds, for each state, the best log prob of emitting everything after <position> (and then going to end), given that we're in that
+  // state at <position>, and the traceback table entry for (<position>, state) is the state we go to at <position> + 1.
+  assert(!cached_trellis_);
+  suffix_ = true;
+  size_t length(seqs_.GetSequenceLength());
+  if(pool_ && viterbi_log_probs_.capacity() == 0)
+    pool_->Acquire(viterbi_log_probs_);
+  viterbi_log_probs_.assign(length, -INFINITY);
+  viterbi_indices_.assign(length, -1);
+  viterbi_log_probs_pointer_ = &viterbi_log_probs_;
+  viterbi_indices_pointer_ = &viterbi_indices_;
+
+  CompiledModel *cm(hmm_->compiled());
+  traceback_table_.Init(length, hmm_->n_states(), cm->narrow_traceback_ok(), pool_);
+  traceback_table_pointer_ = &traceback_table_;
+
+  AcquireColumns();
+  vector<double> &scoring_current(scoring_current_);  // dp table values at the current position
+  vector<double> &arrival_vals(scoring_previous_);  // same, plus the emission at the current position, i.e. the value of arriving in each state from position - 1
+  const uint16_t *to_indices(cm->to_indices());
+  const double *to_log_probs(cm->to_log_probs());
+  for(size_t ist = 0; ist < cm->n_states(); ++ist)
+    scoring_current[ist] = cm->end_log_prob(ist);
+
+  for(size_t position = length - 1; ; --position) {
+    SetEmissionRows(position);
+    bool any_arrivals(false);
+    for(size_t ist = 0; ist < cm->n_states(); ++ist) {
+      arrival_vals[ist] = scoring_current[ist] == -INFINITY ? -INFINITY : scoring_current[ist] + EmissionLogprob(ist);
+      if(arrival_vals[ist] == -INFINITY)
+        continue;
+      any_arrivals = true;
+      double dpval = arrival_vals[ist] + cm->init_log_prob(ist);  // start the suffix at <position> in <ist>
+      if(dpval > viterbi_log_probs_[length - position - 1]) {
+        viterbi_log_probs_[length - position - 1] = dpval;
+        viterbi_indices_[length - position - 1] = ist;
+      }
+    }
+    if(position == 0 || !any_arrivals)
+      break;
+
+    for(size_t ist = 0; ist < cm->n_states(); ++ist) {  // fill in the column for position - 1
+      double best(-INFINITY);
+      int16_t best_to(-1);
+      for(uint32_t iedge = cm->to_begin(ist); iedge < cm->to_end(ist); ++iedge) {
+        if(arrival_vals[to_indices[iedge]] == -INFINITY)
+          continue;
+        double dpval = arrival_vals[to_indices[iedge]] + to_log_probs[iedge];
+        if(dpval > best) {
+          best = dpval;
+          best_to = to_indices[iedge];
+        }
+      }
+      scoring_current[ist] = best;
+      if(best_to != -1)
+        traceback_table_.set(position - 1, ist, best_to);
+    }
+  }
+
+  ending_viterbi_log_prob_ = viterbi_log_probs_[length - 1];
+  ending_viterbi_pointer_ = viterbi_indices_[length - 1];
+  ReleaseColumns();
+}
+
+// ----------------------------------------------------------------------------------------
+void Trellis::SuffixForward() {
+  // same as SuffixViterbi(), but summing over paths rather than taking the best one
+  assert(!cached_trellis_);
+  suffix_ = true;
+  size_t length(seqs_.GetSequenceLength());
+  if(pool_ && forward_log_probs_.capacity() == 0)
+    pool_->Acquire(forward_log_probs_);
+  forward_log_probs_.assign(length, -INFINITY);
+  forward_log_probs_pointer_ = &forward_log_probs_;
+
+  CompiledModel *cm(hmm_->compiled());
+  AcquireColumns();
+  vector<double> &scoring_current(scoring_current_);
+  vector<double> &arrival_vals(scoring_previous_);
+  const uint16_t *to_indices(cm->to_indices());
+  const double *to_log_probs(cm->to_log_probs());
+  for(size_t ist = 0; ist < cm->n_states(); ++ist)
+    scoring_current[ist] = cm->end_log_prob(ist);
+
+  for(size_t position = length - 1; ; --position) {
+    SetEmissionRows(position);
+    bool any_arrivals(false);
+    for(size_t ist = 0; ist < cm->n_states(); ++ist) {
+      arrival_vals[ist] = scoring_current[ist] == -INFINITY ? -INFINITY : scoring_current[ist] + EmissionLogprob(ist);
+      if(arrival_vals[ist] == -INFINITY)
+        continue;
+      any_arrivals = true;
+      double dpval = arrival_vals[ist] + cm->init_log_prob(ist);
+      if(dpval != -INFINITY)
+        forward_log_probs_[length - position - 1] = AddInLogSpace(forward_log_probs_[length - position - 1], dpval);
+    }
+    if(position == 0 || !any_arrivals)
+      break;
+
+    for(size_t ist = 0; ist < cm->n_states(); ++ist) {
+      double total(-INFINITY);
+      for(uint32_t iedge = cm->to_begin(ist); iedge < cm->to_end(ist); ++iedge) {
+        if(arrival_vals[to_indices[iedge]] == -INFINITY)
+          continue;
+        double dpval = arrival_vals[to_indices[iedge]] + to_log_probs[iedge];
+        if(dpval != -INFINITY)
+          total = AddInLogSpace(total, dpval);
+      }
+      scoring_current[ist] = total;
+    }
+  }
+
+  ending_forward_log_prob_ = forward_log_probs_[length - 1];
+  ReleaseColumns();
 }
 
 // ----------------------------------------------------------------------------------------
@@ -284,11 +690,28 @@ void Trellis::Traceback(TracebackPath& path) {
   path.set_model(hmm_);
   if(ending_viterbi_log_prob_ == -INFINITY) return;  // no valid path through this hmm
   path.set_score(ending_viterbi_log_prob_);
+
+  if(cached_trellis_ ? cached_trellis_->suffix() : suffix_) {  // pointers go left to right, starting from the position in the (possibly larger) table at which our sequence starts
+    size_t table_length(traceback_table_pointer_->length());
+    vector<int16_t> states{ending_viterbi_pointer_};
+    for(size_t position = table_length - seqs_.GetSequenceLength(); position < table_length - 1; ++position) {
+      states.push_back(traceback_table_pointer_->get(position, states.back()));
+      if(states.back() == -1) {
+        cerr << "No valid path at Position: " << position << endl;
+        return;
+      }
+    }
+    for(auto it = states.rbegin(); it != states.rend(); ++it)  // TracebackPath wants them in reverse order
+      path.push_back(*it);
+    assert(path.size() > 0);
+    return;
+  }
+
   path.push_back(ending_viterbi_pointer_);  // push back the state that led to END state
 
   int16_t pointer(ending_viterbi_pointer_);
   for(size_t position = seqs_.GetSequenceLength() - 1; position > 0; position--) {
-    pointer = (*traceback_table_pointer_)[position][pointer];  // NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
+    pointer = traceback_table_pointer_->get(position, pointer);  // NOTE do *not* use <traceback_table_>, since we want the cached trellis's table if we have a cached trellis)
     if(pointer == -1) {
       cerr << "No valid path at Position: " << position << endl;
       return;
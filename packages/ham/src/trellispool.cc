@@ -0,0 +1,91 @@
+#include "trellispool.h"
+
+namespace ham {
+
+const int8_t TracebackTable::no_pointer_;
+
+// ----------------------------------------------------------------------------------------
+template <typename T> void TrellisPool::Acquire(vector<T> &buf, vector<vector<T> > &free_bufs) {
+  lock_guard<mutex> lock(mutex_);
+  ++n_acquired_;
+  if(free_bufs.size() == 0)
+    return;
+  buf.swap(free_bufs.back());
+  free_bufs.pop_back();
+  ++n_reused_;
+}
+
+// ----------------------------------------------------------------------------------------
+template <typename T> void TrellisPool::Release(vector<T> &buf, vector<vector<T> > &free_bufs) {
+  if(buf.capacity() == 0)
+    return;
+  lock_guard<mutex> lock(mutex_);
+  if(free_bufs.size() < max_free_) {
+    free_bufs.push_back(vector<T>());
+    free_bufs.back().swap(buf);
+    free_bufs.back().clear();  // NOTE keeps the capacity
+  } else {
+    vector<T>().swap(buf);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void TrellisPool::Acquire(vector<double> &buf) { Acquire(buf, free_doubles_); }
+void TrellisPool::Acquire(vector<int16_t> &buf) { Acquire(buf, free_int16s_); }
+void TrellisPool::Acquire(vector<int8_t> &buf) { Acquire(buf, free_int8s_); }
+void TrellisPool::Release(vector<double> &buf) { Release(buf, free_doubles_); }
+void TrellisPool::Release(vector<int16_t> &buf) { Release(buf, free_int16s_); }
+void TrellisPool::Release(vector<int8_t> &buf) { Release(buf, free_int8s_); }
+
+// ----------------------------------------------------------------------------------------
+void TrellisPool::Clear() {
+  lock_guard<mutex> lock(mutex_);
+  free_doubles_.clear();
+  free_int16s_.clear();
+  free_int8s_.clear();
+}
+
+// ----------------------------------------------------------------------------------------
+double TrellisPool::free_bytes() {
+  lock_guard<mutex> lock(mutex_);
+  double bytes(0.);
+  for(auto &buf : free_doubles_)
+    bytes += sizeof(double) * buf.capacity();
+  for(auto &buf : free_int16s_)
+    bytes += sizeof(int16_t) * buf.capacity();
+  for(auto &buf : free_int8s_)
+    bytes += sizeof(int8_t) * buf.capacity();
+  return bytes;
+}
+
+// ----------------------------------------------------------------------------------------
+void TracebackTable::Init(size_t length, size_t n_states, bool narrow, TrellisPool *pool) {
+  if(length_ > 0 || n_states_ > 0)
+    Release(pool);
+  length_ = length;
+  n_states_ = n_states;
+  narrow_ = narrow;
+  if(narrow_) {
+    if(pool)
+      pool->Acquire(narrow_buf_);
+    narrow_buf_.assign(length_ * n_states_, no_pointer_);
+  } else {
+    if(pool)
+      pool->Acquire(wide_buf_);
+    wide_buf_.assign(length_ * n_states_, -1);
+  }
+}
+
+// ----------------------------------------------------------------------------------------
+void TracebackTable::Release(TrellisPool *pool) {
+  if(pool) {
+    pool->Release(wide_buf_);
+    pool->Release(narrow_buf_);
+  } else {
+    vector<int16_t>().swap(wide_buf_);
+    vector<int8_t>().swap(narrow_buf_);
+  }
+  length_ = n_states_ = 0;
+}
+
+}